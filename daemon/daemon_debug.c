@@ -298,6 +298,8 @@ const char* opcode2string(DWORD opcode)
     case NFS41_VOLUME_QUERY: return "NFS41_VOLUME_QUERY";
     case NFS41_ACL_QUERY:   return "NFS41_ACL_QUERY";
     case NFS41_ACL_SET:     return "NFS41_ACL_SET";
+    case NFS41_FLUSH:       return "NFS41_FLUSH";
+    case NFS41_CHANGE_QUERY: return "NFS41_CHANGE_QUERY";
     default:                return "UNKNOWN";
     }
 }
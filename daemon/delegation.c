@@ -22,6 +22,8 @@
 #include "delegation.h"
 #include "nfs41_ops.h"
 #include "name_cache.h"
+#include "write_cache.h"
+#include "read_cache.h"
 #include "util.h"
 #include "daemon_debug.h"
 
@@ -82,8 +84,11 @@ void nfs41_delegation_deref(
     const LONG count = InterlockedDecrement(&state->ref_count);
     dprintf(DGLVL, "nfs41_delegation_deref(%s) count %d\n",
         state->path.path, count);
-    if (count == 0)
+    if (count == 0) {
+        if (state->write_cache)
+            nfs41_write_cache_free(state->write_cache);
         free(state);
+    }
 }
 
 #define open_entry(pos) list_container(pos, nfs41_open_state, client_entry)
@@ -111,6 +116,10 @@ static void delegation_remove(
     }
     LeaveCriticalSection(&client->state.lock);
 
+    /* drop any file data cached under the delegation */
+    nfs41_read_cache_invalidate(client_read_cache(client),
+        deleg->file.fh.fileid);
+
     /* signal threads waiting on delegreturn */
     AcquireSRWLockExclusive(&deleg->lock);
     deleg->status = DELEGATION_RETURNED;
@@ -259,6 +268,34 @@ static int delegation_flush_locks(
     return status;
 }
 
+static void delegation_stateid(
+    IN nfs41_delegation_state *deleg,
+    OUT stateid_arg *stateid)
+{
+    stateid->type = STATEID_DELEG_FILE;
+    stateid->open = NULL;
+    stateid->delegation = deleg;
+    AcquireSRWLockShared(&deleg->lock);
+    memcpy(&stateid->stateid, &deleg->state.stateid, sizeof(stateid4));
+    ReleaseSRWLockShared(&deleg->lock);
+}
+
+static int delegation_flush(
+    IN nfs41_client *client,
+    IN nfs41_delegation_state *deleg)
+{
+    stateid_arg stateid;
+    int status;
+
+    delegation_stateid(deleg, &stateid);
+    status = nfs41_write_cache_flush(deleg->write_cache,
+        client->session, &deleg->file, &stateid);
+    if (status)
+        eprintf("delegation_flush(%s) failed with %s\n",
+            deleg->path.path, nfs_error_string(status));
+    return status;
+}
+
 #pragma warning (disable : 4706) /* assignment within conditional expression */
 
 static int delegation_return(
@@ -271,6 +308,17 @@ static int delegation_return(
     nfs41_open_state *open;
     int status;
 
+    /* write back any cached data before giving up the delegation */
+    if (deleg->write_cache) {
+        if (truncate)
+            nfs41_write_cache_discard(deleg->write_cache);
+        else {
+            status = delegation_flush(client, deleg);
+            if (status)
+                goto out_keep;
+        }
+    }
+
     if (deleg->srv_open) {
         /* make an upcall to the kernel: invalide data cache */
         HANDLE pipe;
@@ -324,6 +372,16 @@ out_downcall:
     delegation_remove(client, deleg);
 out:
     return status;
+
+out_keep:
+    /* returning the delegation would lose the dirty data, so hold on
+     * to both; recovery will try the return again, or the server will
+     * revoke the delegation.  wake anyone waiting on the return */
+    AcquireSRWLockExclusive(&deleg->lock);
+    deleg->status = DELEGATION_GRANTED;
+    WakeAllConditionVariable(&deleg->cond);
+    ReleaseSRWLockExclusive(&deleg->lock);
+    goto out;
 }
 
 /* open delegation */
@@ -481,7 +539,7 @@ int nfs41_delegate_open(
     AcquireSRWLockExclusive(&deleg->lock);
     if (deleg->status != DELEGATION_GRANTED) {
         /* the delegation is being returned, wait for it to finish */
-        while (deleg->status != DELEGATION_RETURNED)
+        while (deleg->status == DELEGATION_RETURNING)
             SleepConditionVariableSRW(&deleg->cond, &deleg->lock, INFINITE, 0);
         status = NFS4ERR_BADHANDLE;
     }
@@ -657,10 +715,8 @@ int nfs41_delegation_return(
     }
     ReleaseSRWLockExclusive(&deleg->lock);
 
-    if (status == NFS4ERR_DELEG_REVOKED) {
-        delegation_return(client, deleg, truncate, TRUE);
-        status = NFS4_OK;
-    }
+    if (status == NFS4ERR_DELEG_REVOKED)
+        status = delegation_return(client, deleg, truncate, TRUE);
 
     nfs41_delegation_deref(deleg);
 out:
@@ -679,8 +735,13 @@ struct recall_thread_args {
 static unsigned int WINAPI delegation_recall_thread(void *args)
 {
     struct recall_thread_args *recall = (struct recall_thread_args*)args;
+    int status;
 
-    delegation_return(recall->client, recall->delegation, recall->truncate, TRUE);
+    status = delegation_return(recall->client, recall->delegation,
+        recall->truncate, TRUE);
+    if (status)
+        eprintf("delegation recall of %s failed with %s\n",
+            recall->delegation->path.path, nfs_error_string(status));
 
     /* clean up thread arguments */
     nfs41_delegation_deref(recall->delegation);
@@ -776,6 +837,27 @@ static int deleg_fh_cmp(const struct list_entry *entry, const void *value)
     return memcmp(lhs->fh, rhs->fh, lhs->len);
 }
 
+bool_t nfs41_delegation_held(
+    IN nfs41_client *client,
+    IN const nfs41_fh *fh)
+{
+    struct list_entry *entry;
+    nfs41_delegation_state *deleg;
+    bool_t held = FALSE;
+
+    /* unlike delegation_find(), don't count this as a use for the lru */
+    EnterCriticalSection(&client->state.lock);
+    entry = list_search(&client->state.delegations, fh, deleg_fh_cmp);
+    if (entry) {
+        deleg = deleg_entry(entry);
+        AcquireSRWLockShared(&deleg->lock);
+        held = deleg->status == DELEGATION_GRANTED;
+        ReleaseSRWLockShared(&deleg->lock);
+    }
+    LeaveCriticalSection(&client->state.lock);
+    return held;
+}
+
 int nfs41_delegation_getattr(
     IN nfs41_client *client,
     IN const nfs41_fh *fh,
@@ -812,6 +894,10 @@ int nfs41_delegation_getattr(
         status = NFS4ERR_BADHANDLE;
         goto out_deleg;
     }
+
+    /* report the size and change attribute of any cached writes */
+    if (deleg->write_cache)
+        nfs41_write_cache_getattr(deleg->write_cache, info);
 out_deleg:
     nfs41_delegation_deref(deleg);
 out:
@@ -821,6 +907,274 @@ out:
 }
 
 
+/* write-back caching */
+static nfs41_delegation_state* open_delegation_ref(
+    IN nfs41_open_state *open)
+{
+    nfs41_delegation_state *deleg;
+
+    AcquireSRWLockShared(&open->lock);
+    deleg = open->delegation.state;
+    if (deleg)
+        nfs41_delegation_ref(deleg);
+    ReleaseSRWLockShared(&open->lock);
+    return deleg;
+}
+
+/* must be called with the delegation lock held */
+static __inline bool_t delegation_cacheable(
+    IN const nfs41_delegation_state *deleg)
+{
+    return deleg->status == DELEGATION_GRANTED && !deleg->state.recalled
+        && deleg->state.type == OPEN_DELEGATE_WRITE;
+}
+
+static int delegation_cache_create(
+    IN nfs41_client *client,
+    IN nfs41_delegation_state *deleg)
+{
+    nfs41_file_info info = { 0 };
+    int status = NFS4_OK;
+
+    AcquireSRWLockExclusive(&deleg->lock);
+    if (!delegation_cacheable(deleg)) {
+        status = NFS4ERR_BADHANDLE;
+        goto out_unlock;
+    }
+    if (deleg->write_cache)
+        goto out_unlock;
+
+    /* start from the size in the attribute cache */
+    status = nfs41_attr_cache_lookup(client_name_cache(client),
+        deleg->file.fh.fileid, &info);
+    if (status) {
+        status = NFS4ERR_BADHANDLE;
+        goto out_unlock;
+    }
+    status = nfs41_write_cache_create(info.size, &deleg->write_cache);
+    if (status)
+        status = NFS4ERR_RESOURCE;
+out_unlock:
+    ReleaseSRWLockExclusive(&deleg->lock);
+    return status;
+}
+
+static void delegation_cache_update(
+    IN nfs41_client *client,
+    IN nfs41_delegation_state *deleg,
+    IN uint64_t size,
+    OUT nfs41_file_info *info)
+{
+    struct nfs41_name_cache *name_cache = client_name_cache(client);
+
+    /* update the size in the attribute cache, and return its attributes */
+    ZeroMemory(info, sizeof(nfs41_file_info));
+    info->size = size;
+    info->attrmask.count = 1;
+    info->attrmask.arr[0] = FATTR4_WORD0_SIZE;
+    nfs41_attr_cache_update(name_cache, deleg->file.fh.fileid, info);
+    nfs41_attr_cache_lookup(name_cache, deleg->file.fh.fileid, info);
+}
+
+int nfs41_delegation_write(
+    IN nfs41_open_state *open,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN const unsigned char *data,
+    OUT nfs41_file_info *info)
+{
+    nfs41_client *client = open->session->client;
+    nfs41_delegation_state *deleg;
+    uint64_t size;
+    bool_t flushed = FALSE;
+    int status;
+
+    deleg = open_delegation_ref(open);
+    if (deleg == NULL) {
+        status = NFS4ERR_BADHANDLE;
+        goto out;
+    }
+
+    status = delegation_cache_create(client, deleg);
+    if (status)
+        goto out_deleg;
+
+retry:
+    /* hold the delegation lock shared, so that delegation_return() can't
+     * start its flush until the write is in the cache */
+    AcquireSRWLockShared(&deleg->lock);
+    if (delegation_cacheable(deleg))
+        status = nfs41_write_cache_write(deleg->write_cache,
+            offset, length, data, &size);
+    else
+        status = NFS4ERR_BADHANDLE;
+    ReleaseSRWLockShared(&deleg->lock);
+
+    if (status == ERROR_NOT_ENOUGH_MEMORY && !flushed) {
+        /* over the dirty limit; write back our own data and try again */
+        flushed = TRUE;
+        if (delegation_flush(client, deleg) == NFS4_OK)
+            goto retry;
+    }
+    if (status) {
+        /* write back what we have, so the caller's synchronous
+         * WRITE can't be overwritten by older cached data */
+        delegation_flush(client, deleg);
+        status = NFS4ERR_BADHANDLE;
+        goto out_deleg;
+    }
+
+    delegation_cache_update(client, deleg, size, info);
+out_deleg:
+    nfs41_delegation_deref(deleg);
+out:
+    return status;
+}
+
+int nfs41_delegation_set_size(
+    IN nfs41_open_state *open,
+    IN uint64_t size,
+    OUT nfs41_file_info *info)
+{
+    nfs41_client *client = open->session->client;
+    nfs41_delegation_state *deleg;
+    int status;
+
+    deleg = open_delegation_ref(open);
+    if (deleg == NULL) {
+        status = NFS4ERR_BADHANDLE;
+        goto out;
+    }
+
+    status = delegation_cache_create(client, deleg);
+    if (status)
+        goto out_deleg;
+
+    AcquireSRWLockShared(&deleg->lock);
+    if (delegation_cacheable(deleg))
+        status = nfs41_write_cache_set_size(deleg->write_cache, size);
+    else
+        status = NFS4ERR_BADHANDLE;
+    ReleaseSRWLockShared(&deleg->lock);
+
+    if (status) {
+        delegation_flush(client, deleg);
+        status = NFS4ERR_BADHANDLE;
+        goto out_deleg;
+    }
+
+    delegation_cache_update(client, deleg, size, info);
+out_deleg:
+    nfs41_delegation_deref(deleg);
+out:
+    return status;
+}
+
+int nfs41_delegation_flush(
+    IN nfs41_open_state *open)
+{
+    nfs41_delegation_state *deleg;
+    int status = NFS4_OK;
+
+    deleg = open_delegation_ref(open);
+    if (deleg == NULL)
+        goto out;
+
+    if (deleg->write_cache && nfs41_write_cache_dirty(deleg->write_cache))
+        status = delegation_flush(open->session->client, deleg);
+
+    nfs41_delegation_deref(deleg);
+out:
+    return status;
+}
+
+int nfs41_delegation_flush_range(
+    IN nfs41_open_state *open,
+    IN uint64_t offset,
+    IN uint32_t length)
+{
+    nfs41_delegation_state *deleg;
+    stateid_arg stateid;
+    int status = NFS4_OK;
+
+    deleg = open_delegation_ref(open);
+    if (deleg == NULL)
+        goto out;
+
+    if (deleg->write_cache && nfs41_write_cache_dirty(deleg->write_cache)) {
+        delegation_stateid(deleg, &stateid);
+        status = nfs41_write_cache_flush_range(deleg->write_cache,
+            open->session->client->session, &deleg->file, &stateid,
+            offset, length);
+        if (status)
+            eprintf("nfs41_delegation_flush_range(%s) failed with %s\n",
+                deleg->path.path, nfs_error_string(status));
+    }
+
+    nfs41_delegation_deref(deleg);
+out:
+    return status;
+}
+
+
+/* data caching under read delegations */
+int nfs41_delegation_read(
+    IN nfs41_open_state *open,
+    IN uint64_t offset,
+    IN uint32_t length,
+    OUT unsigned char *buffer,
+    OUT uint32_t *len_out)
+{
+    nfs41_client *client = open->session->client;
+    nfs41_delegation_state *deleg;
+    int status = ERROR_FILE_NOT_FOUND;
+
+    *len_out = 0;
+
+    deleg = open_delegation_ref(open);
+    if (deleg == NULL)
+        goto out;
+
+    AcquireSRWLockShared(&deleg->lock);
+    if (deleg->status == DELEGATION_GRANTED &&
+        deleg->state.type == OPEN_DELEGATE_READ)
+        status = nfs41_read_cache_lookup(client_read_cache(client),
+            deleg->file.fh.fileid, offset, length, buffer, len_out);
+    ReleaseSRWLockShared(&deleg->lock);
+
+    nfs41_delegation_deref(deleg);
+out:
+    return status;
+}
+
+void nfs41_delegation_read_done(
+    IN nfs41_open_state *open,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN const unsigned char *data,
+    IN bool_t eof,
+    IN uint32_t generation)
+{
+    nfs41_client *client = open->session->client;
+    nfs41_delegation_state *deleg;
+
+    deleg = open_delegation_ref(open);
+    if (deleg == NULL)
+        return;
+
+    /* hold the delegation lock shared, so we can't insert pages after
+     * delegation_remove() has invalidated the file's cached data */
+    AcquireSRWLockShared(&deleg->lock);
+    if (deleg->status == DELEGATION_GRANTED &&
+        deleg->state.type == OPEN_DELEGATE_READ)
+        nfs41_read_cache_insert(client_read_cache(client),
+            deleg->file.fh.fileid, offset, length, data, eof, generation);
+    ReleaseSRWLockShared(&deleg->lock);
+
+    nfs41_delegation_deref(deleg);
+}
+
+
 void nfs41_client_delegation_free(
     IN nfs41_client *client)
 {
@@ -829,6 +1183,8 @@ void nfs41_client_delegation_free(
     EnterCriticalSection(&client->state.lock);
     list_for_each_tmp (entry, tmp, &client->state.delegations) {
         list_remove(entry);
+        nfs41_read_cache_invalidate(client_read_cache(client),
+            deleg_entry(entry)->file.fh.fileid);
         nfs41_delegation_deref(deleg_entry(entry));
     }
     LeaveCriticalSection(&client->state.lock);
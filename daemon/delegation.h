@@ -89,6 +89,11 @@ int nfs41_delegation_recall(
     IN const stateid4 *stateid,
     IN bool_t truncate);
 
+/* check for a granted delegation on the file */
+bool_t nfs41_delegation_held(
+    IN nfs41_client *client,
+    IN const nfs41_fh *fh);
+
 int nfs41_delegation_getattr(
     IN nfs41_client *client,
     IN const nfs41_fh *fh,
@@ -96,6 +101,50 @@ int nfs41_delegation_getattr(
     OUT nfs41_file_info *info);
 
 
+/* write-back caching; see write_cache.h.  nfs41_delegation_write() and
+ * nfs41_delegation_set_size() fail with NFS4ERR_BADHANDLE if the open has
+ * no write delegation or the cache is full, after writing back any cached
+ * data so the caller can fall back to a synchronous WRITE or SETATTR */
+int nfs41_delegation_write(
+    IN nfs41_open_state *open,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN const unsigned char *data,
+    OUT nfs41_file_info *info);
+
+int nfs41_delegation_set_size(
+    IN nfs41_open_state *open,
+    IN uint64_t size,
+    OUT nfs41_file_info *info);
+
+int nfs41_delegation_flush(
+    IN nfs41_open_state *open);
+
+/* write back the cached writes that a READ of this range would miss */
+int nfs41_delegation_flush_range(
+    IN nfs41_open_state *open,
+    IN uint64_t offset,
+    IN uint32_t length);
+
+/* data caching under read delegations; see read_cache.h */
+int nfs41_delegation_read(
+    IN nfs41_open_state *open,
+    IN uint64_t offset,
+    IN uint32_t length,
+    OUT unsigned char *buffer,
+    OUT uint32_t *len_out);
+
+/* cache data that was just read from the server; 'generation' is
+ * the nfs41_read_cache_generation() from before the READ was sent */
+void nfs41_delegation_read_done(
+    IN nfs41_open_state *open,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN const unsigned char *data,
+    IN bool_t eof,
+    IN uint32_t generation);
+
+
 /* after client state recovery, return any 'recalled' delegations;
  * must be called under the client's state lock */
 int nfs41_client_delegation_recovery(
@@ -0,0 +1,561 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#include <Windows.h>
+#include <process.h>
+#include <stdio.h>
+
+#include "dispatch.h"
+#include "daemon_debug.h"
+
+
+#define DPLVL 2 /* dprintf level for worker pool logging */
+
+uint32_t dispatch_min_workers = DISPATCH_DEFAULT_MIN;
+uint32_t dispatch_max_workers = DISPATCH_DEFAULT_MAX;
+
+struct dispatch_class_stats {
+    LONG                    queued;
+    LONG                    dispatched;
+    LONGLONG                total_wait; /* microseconds spent queued */
+    LONGLONG                max_wait;
+};
+
+struct dispatch_stats {
+    LONG                    queued; /* work waiting for a worker */
+    LONG                    workers;
+    LONG                    idle;
+    LONG                    blocked;
+    LONG                    peak_workers;
+    LONG                    peak_queued;
+    LONG                    dispatched;
+    LONG                    spawned;
+    LONG                    retired;
+    LONG                    deferred; /* work parked for a retry */
+    LONG                    deferrals;
+    LONGLONG                deferred_time; /* total ms of deferral */
+    struct dispatch_class_stats classes[DISPATCH_CLASS_COUNT];
+};
+
+struct dispatch_queue {
+    struct list_entry       head;
+    uint32_t                credit; /* left in this round */
+};
+
+static struct dispatch_pool {
+    HANDLE                  port; /* one wakeup per queued work item */
+    CRITICAL_SECTION        lock; /* protects the queues */
+    struct dispatch_queue   queues[DISPATCH_CLASS_COUNT];
+    LONGLONG                frequency; /* performance counter ticks/sec */
+    struct list_entry       deferred; /* sorted by due time */
+    HANDLE                  defer_event; /* new head of pool.deferred */
+    volatile struct dispatch_stats stats;
+} pool;
+
+static const uint32_t class_weight[DISPATCH_CLASS_COUNT] = {
+    DISPATCH_WEIGHT_METADATA,
+    DISPATCH_WEIGHT_DATA,
+    DISPATCH_WEIGHT_BACKGROUND
+};
+
+static const char *class_name[DISPATCH_CLASS_COUNT] = {
+    "metadata", "data", "background"
+};
+
+/* per-thread state for dispatch_block_enter/leave() */
+static __declspec(thread) bool_t is_worker = FALSE;
+static __declspec(thread) uint32_t block_depth = 0;
+static __declspec(thread) enum dispatch_class current_class = DISPATCH_METADATA;
+static __declspec(thread) struct dispatch_work *current_work = NULL;
+static __declspec(thread) uint32_t defer_delay = 0;
+
+
+static __inline void counter_max(
+    IN OUT volatile LONG *peak,
+    IN LONG value)
+{
+    LONG old = *peak;
+    while (value > old) {
+        LONG prev = InterlockedCompareExchange(peak, value, old);
+        if (prev == old)
+            break;
+        old = prev;
+    }
+}
+
+static __inline LONGLONG counter_now()
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+static void pool_get_stats(
+    OUT struct dispatch_stats *stats)
+{
+    stats->queued = pool.stats.queued;
+    stats->workers = pool.stats.workers;
+    stats->idle = pool.stats.idle;
+    stats->blocked = pool.stats.blocked;
+    stats->peak_workers = pool.stats.peak_workers;
+    stats->peak_queued = pool.stats.peak_queued;
+    stats->dispatched = pool.stats.dispatched;
+    stats->spawned = pool.stats.spawned;
+    stats->retired = pool.stats.retired;
+    stats->deferred = pool.stats.deferred;
+    stats->deferrals = pool.stats.deferrals;
+    stats->deferred_time = pool.stats.deferred_time;
+    memcpy(stats->classes, (const void*)pool.stats.classes,
+        sizeof(stats->classes));
+}
+
+static void pool_log_stats(
+    IN int level)
+{
+    struct dispatch_stats stats;
+    struct dispatch_class_stats *cs;
+    uint32_t i;
+
+    pool_get_stats(&stats);
+    dprintf(level, "worker pool: %d workers (%d idle, %d blocked, peak %d), "
+        "%d queued (peak %d), %d dispatched, %d spawned, %d retired\n",
+        stats.workers, stats.idle, stats.blocked, stats.peak_workers,
+        stats.queued, stats.peak_queued, stats.dispatched,
+        stats.spawned, stats.retired);
+    if (stats.deferrals)
+        dprintf(level, "worker pool: %d deferred now, %d deferrals totaling "
+            "%lldms\n", stats.deferred, stats.deferrals, stats.deferred_time);
+
+    for (i = 0; i < DISPATCH_CLASS_COUNT; i++) {
+        cs = &stats.classes[i];
+        if (cs->dispatched == 0)
+            continue;
+        dprintf(level, "worker pool: %s: %d queued, %d dispatched, "
+            "wait avg %lldus max %lldus\n", class_name[i], cs->queued,
+            cs->dispatched, cs->total_wait / cs->dispatched, cs->max_wait);
+    }
+}
+
+/* take the next work item by weighted round-robin: each class takes up
+ * to its weight in items per round, in order of priority */
+static struct dispatch_work* pool_next_work()
+{
+    struct dispatch_queue *queue;
+    struct list_entry *entry;
+    uint32_t i, round;
+
+    EnterCriticalSection(&pool.lock);
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < DISPATCH_CLASS_COUNT; i++) {
+            queue = &pool.queues[i];
+            if (queue->credit == 0 || list_empty(&queue->head))
+                continue;
+            queue->credit--;
+            entry = queue->head.next;
+            list_remove(entry);
+            LeaveCriticalSection(&pool.lock);
+            return list_container(entry, struct dispatch_work, entry);
+        }
+        /* every class with work has used up its share */
+        for (i = 0; i < DISPATCH_CLASS_COUNT; i++)
+            pool.queues[i].credit = class_weight[i];
+    }
+    LeaveCriticalSection(&pool.lock);
+    return NULL;
+}
+
+static void pool_account_wait(
+    IN const struct dispatch_work *work)
+{
+    struct dispatch_class_stats *cs =
+        (struct dispatch_class_stats*)&pool.stats.classes[work->type];
+    LONGLONG wait = (counter_now() - work->queued_at) * 1000000
+        / pool.frequency;
+
+    InterlockedDecrement(&cs->queued);
+    InterlockedIncrement(&cs->dispatched);
+    InterlockedExchangeAdd64(&cs->total_wait, wait);
+    while (wait > cs->max_wait) {
+        LONGLONG old = cs->max_wait;
+        if (InterlockedCompareExchange64(&cs->max_wait, wait, old) == old)
+            break;
+    }
+}
+
+static unsigned int WINAPI worker_thread(void *args);
+
+static int pool_spawn()
+{
+    HANDLE thread;
+    int status = NO_ERROR;
+
+    thread = (HANDLE)_beginthreadex(NULL, 0, worker_thread, NULL, 0, NULL);
+    if (thread == NULL) {
+        status = GetLastError();
+        eprintf("_beginthreadex failed %d\n", status);
+        goto out;
+    }
+    CloseHandle(thread);
+    InterlockedIncrement(&pool.stats.spawned);
+out:
+    return status;
+}
+
+/* add a worker if there's queued work that no idle worker can take */
+static void pool_grow()
+{
+    LONG workers;
+
+    for (;;) {
+        if (pool.stats.idle >= pool.stats.queued)
+            break;
+
+        workers = pool.stats.workers;
+        if (workers - pool.stats.blocked >= (LONG)dispatch_max_workers ||
+            workers >= DISPATCH_WORKER_LIMIT)
+            break;
+
+        if (InterlockedCompareExchange(&pool.stats.workers,
+                workers + 1, workers) != workers)
+            continue; /* raced with another grow or shrink */
+
+        if (pool_spawn()) {
+            InterlockedDecrement(&pool.stats.workers);
+            break;
+        }
+        counter_max(&pool.stats.peak_workers, workers + 1);
+        dprintf(DPLVL, "worker pool: added worker %d\n", workers + 1);
+        break;
+    }
+}
+
+/* add work to its class queue and wake a worker for it */
+static int pool_enqueue(
+    IN struct dispatch_work *work)
+{
+    const enum dispatch_class type = work->type;
+    int status = NO_ERROR;
+
+    work->queued_at = counter_now();
+
+    EnterCriticalSection(&pool.lock);
+    list_add_tail(&pool.queues[type].head, &work->entry);
+    LeaveCriticalSection(&pool.lock);
+
+    InterlockedIncrement(&pool.stats.classes[type].queued);
+    counter_max(&pool.stats.peak_queued,
+        InterlockedIncrement(&pool.stats.queued));
+
+    if (!PostQueuedCompletionStatus(pool.port, 0, 0, NULL)) {
+        status = GetLastError();
+        eprintf("PostQueuedCompletionStatus() failed with %d\n", status);
+
+        /* take it back, unless another wakeup already handed it out */
+        EnterCriticalSection(&pool.lock);
+        if (list_empty(&work->entry)) {
+            status = NO_ERROR;
+        } else {
+            list_remove(&work->entry);
+            InterlockedDecrement(&pool.stats.classes[type].queued);
+            InterlockedDecrement(&pool.stats.queued);
+        }
+        LeaveCriticalSection(&pool.lock);
+        goto out;
+    }
+    pool_grow();
+out:
+    return status;
+}
+
+/* park deferred work on pool.deferred until its delay expires */
+static void pool_defer(
+    IN struct dispatch_work *work,
+    IN uint32_t delay)
+{
+    struct list_entry *entry;
+
+    work->deferrals++;
+    work->due = GetTickCount64() + delay;
+
+    InterlockedIncrement(&pool.stats.deferred);
+    InterlockedIncrement(&pool.stats.deferrals);
+    InterlockedExchangeAdd64(&pool.stats.deferred_time, delay);
+
+    dprintf(DPLVL, "worker pool: deferring %s work for %ums (deferral %u)\n",
+        class_name[work->type], delay, work->deferrals);
+
+    EnterCriticalSection(&pool.lock);
+    list_for_each(entry, &pool.deferred)
+        if (list_container(entry, struct dispatch_work, entry)->due > work->due)
+            break;
+    /* insert before the first entry that's due later */
+    list_add(&work->entry, entry->prev, entry);
+    if (pool.deferred.next == &work->entry)
+        SetEvent(pool.defer_event);
+    LeaveCriticalSection(&pool.lock);
+}
+
+static void pool_run(
+    IN struct dispatch_work *work)
+{
+    uint32_t delay;
+
+    current_class = work->type;
+    current_work = work;
+    work->proc(work->context);
+    delay = defer_delay;
+    defer_delay = 0;
+    current_work = NULL;
+    current_class = DISPATCH_METADATA;
+
+    /* unless it was deferred, the work may already be gone */
+    if (delay)
+        pool_defer(work, delay);
+}
+
+/* requeue deferred work as its delay expires */
+static unsigned int WINAPI defer_thread(void *args)
+{
+    struct list_entry expired, *entry;
+    struct dispatch_work *work;
+    ULONGLONG now;
+    DWORD timeout;
+
+    for (;;) {
+        list_init(&expired);
+        timeout = INFINITE;
+        now = GetTickCount64();
+
+        EnterCriticalSection(&pool.lock);
+        while (!list_empty(&pool.deferred)) {
+            entry = pool.deferred.next;
+            work = list_container(entry, struct dispatch_work, entry);
+            if (work->due > now) {
+                timeout = (DWORD)(work->due - now);
+                break;
+            }
+            list_remove(entry);
+            list_add_tail(&expired, entry);
+        }
+        LeaveCriticalSection(&pool.lock);
+
+        while (!list_empty(&expired)) {
+            entry = expired.next;
+            list_remove(entry);
+            work = list_container(entry, struct dispatch_work, entry);
+            InterlockedDecrement(&pool.stats.deferred);
+            /* without a worker, run it here rather than lose it */
+            if (pool_enqueue(work))
+                pool_run(work);
+        }
+
+        WaitForSingleObject(pool.defer_event, timeout);
+    }
+    return NO_ERROR;
+}
+
+/* returns TRUE if the calling worker should exit */
+static bool_t pool_shrink()
+{
+    LONG workers;
+
+    for (;;) {
+        workers = pool.stats.workers;
+        if (workers <= (LONG)dispatch_min_workers)
+            return FALSE;
+        if (InterlockedCompareExchange(&pool.stats.workers,
+                workers - 1, workers) == workers)
+            break;
+    }
+    InterlockedIncrement(&pool.stats.retired);
+    dprintf(DPLVL, "worker pool: retiring idle worker, %d left\n",
+        workers - 1);
+    return TRUE;
+}
+
+static unsigned int WINAPI worker_thread(void *args)
+{
+    struct dispatch_work *work;
+    LPOVERLAPPED context;
+    ULONG_PTR key;
+    DWORD bytes, status;
+    BOOL success;
+
+    is_worker = TRUE;
+
+    for (;;) {
+        context = NULL;
+        InterlockedIncrement(&pool.stats.idle);
+        success = GetQueuedCompletionStatus(pool.port, &bytes, &key,
+            &context, DISPATCH_IDLE_TIMEOUT);
+        InterlockedDecrement(&pool.stats.idle);
+
+        if (!success) {
+            status = GetLastError();
+            if (status != WAIT_TIMEOUT) {
+                eprintf("GetQueuedCompletionStatus() failed with %d\n",
+                    status);
+                InterlockedDecrement(&pool.stats.workers);
+                break;
+            }
+            if (pool_shrink())
+                break;
+            pool_log_stats(DPLVL);
+            continue;
+        }
+
+        /* the wakeup isn't tied to a particular work item */
+        work = pool_next_work();
+        if (work == NULL)
+            continue;
+
+        InterlockedDecrement(&pool.stats.queued);
+        InterlockedIncrement(&pool.stats.dispatched);
+        pool_account_wait(work);
+
+        pool_run(work);
+    }
+    return NO_ERROR;
+}
+
+
+/* public worker pool interface, declared in dispatch.h */
+int dispatch_init()
+{
+    HANDLE thread;
+    uint32_t i;
+    int status = NO_ERROR;
+
+    if (dispatch_min_workers == 0)
+        dispatch_min_workers = 1;
+    if (dispatch_max_workers > DISPATCH_WORKER_LIMIT)
+        dispatch_max_workers = DISPATCH_WORKER_LIMIT;
+    if (dispatch_max_workers < dispatch_min_workers)
+        dispatch_max_workers = dispatch_min_workers;
+
+    InitializeCriticalSection(&pool.lock);
+    for (i = 0; i < DISPATCH_CLASS_COUNT; i++) {
+        list_init(&pool.queues[i].head);
+        pool.queues[i].credit = class_weight[i];
+    }
+    list_init(&pool.deferred);
+    QueryPerformanceFrequency((LARGE_INTEGER*)&pool.frequency);
+
+    /* auto-reset, so the defer thread rechecks its timeout once */
+    pool.defer_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (pool.defer_event == NULL) {
+        status = GetLastError();
+        eprintf("CreateEvent() failed with %d\n", status);
+        goto out;
+    }
+
+    /* let the port release one worker per cpu; workers blocked on the
+     * network don't count against that */
+    pool.port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (pool.port == NULL) {
+        status = GetLastError();
+        eprintf("CreateIoCompletionPort() failed with %d\n", status);
+        goto out;
+    }
+
+    for (i = 0; i < dispatch_min_workers; i++) {
+        InterlockedIncrement(&pool.stats.workers);
+        status = pool_spawn();
+        if (status) {
+            InterlockedDecrement(&pool.stats.workers);
+            if (i == 0)
+                goto out;
+            status = NO_ERROR;
+            break;
+        }
+    }
+    pool.stats.peak_workers = pool.stats.workers;
+
+    thread = (HANDLE)_beginthreadex(NULL, 0, defer_thread, NULL, 0, NULL);
+    if (thread == NULL) {
+        status = GetLastError();
+        eprintf("_beginthreadex failed %d\n", status);
+        goto out;
+    }
+    CloseHandle(thread);
+
+    dprintf(1, "worker pool started with %d workers (min %u, max %u)\n",
+        pool.stats.workers, dispatch_min_workers, dispatch_max_workers);
+out:
+    return status;
+}
+
+int dispatch_queue(
+    IN struct dispatch_work *work,
+    IN enum dispatch_class type,
+    IN bool_t deferrable,
+    IN dispatch_proc proc,
+    IN void *context)
+{
+    work->proc = proc;
+    work->context = context;
+    work->type = type;
+    work->deferrable = deferrable;
+    work->deferrals = 0;
+    return pool_enqueue(work);
+}
+
+bool_t dispatch_defer(
+    IN uint32_t delay)
+{
+    if (current_work == NULL || !current_work->deferrable)
+        return FALSE;
+    /* a later compound in the same run may ask again */
+    if (defer_delay < delay)
+        defer_delay = delay;
+    return TRUE;
+}
+
+bool_t dispatch_deferred()
+{
+    return defer_delay != 0;
+}
+
+uint32_t dispatch_deferrals()
+{
+    return current_work ? current_work->deferrals : 0;
+}
+
+enum dispatch_class dispatch_current_class()
+{
+    return current_class;
+}
+
+void dispatch_block_enter()
+{
+    if (!is_worker || block_depth++)
+        return;
+    InterlockedIncrement(&pool.stats.blocked);
+    /* make sure queued work isn't left waiting on us */
+    pool_grow();
+}
+
+void dispatch_block_leave()
+{
+    if (!is_worker || --block_depth)
+        return;
+    InterlockedDecrement(&pool.stats.blocked);
+}
@@ -0,0 +1,126 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef __NFS41_DAEMON_DISPATCH_H__
+#define __NFS41_DAEMON_DISPATCH_H__
+
+#include "nfs41_types.h"
+#include "list.h"
+
+
+/* elastic worker pool
+ *
+ *   upcalls are queued on an i/o completion port and served by a pool of
+ * worker threads that grows and shrinks between dispatch_min_workers and
+ * dispatch_max_workers.  a worker is added whenever work is queued and no
+ * worker is idle, and a worker that stays idle for DISPATCH_IDLE_TIMEOUT
+ * exits as long as the pool stays above its minimum.
+ *
+ *   workers that wait on the server (for each rpc, and for
+ * NFS4ERR_DELAY/GRACE retries, slot table and recovery waits) mark the
+ * wait with dispatch_block_enter() and dispatch_block_leave().  blocked
+ * workers don't count toward dispatch_max_workers, so queued upcalls
+ * never wait behind them; only DISPATCH_WORKER_LIMIT bounds how many
+ * can be waiting at once.
+ *
+ *   queued work is split into classes, and workers pick from them by
+ * weighted round-robin, so a burst of reads and writes can't starve
+ * interactive metadata requests.  a worker's class also limits how much
+ * of a session's slot table it can use; see nfs41_session_get_slot().
+ *
+ *   work that is safe to replay can be deferred instead of sleeping
+ * through NFS4ERR_DELAY or NFS4ERR_GRACE: the compound calls
+ * dispatch_defer() and fails, and once the work returns, the worker parks
+ * it on a timer-driven queue and moves on.  when the delay expires, the
+ * work is queued again and its proc runs from the start. */
+
+#define DISPATCH_DEFAULT_MIN 4
+#define DISPATCH_DEFAULT_MAX 128
+
+/* hard limit on workers, including blocked ones */
+#define DISPATCH_WORKER_LIMIT 512
+
+/* ms before an idle worker above the minimum exits */
+#define DISPATCH_IDLE_TIMEOUT 30000
+
+/* can be changed with --minworkers and --maxworkers */
+extern uint32_t dispatch_min_workers;
+extern uint32_t dispatch_max_workers;
+
+/* in order of priority */
+enum dispatch_class {
+    DISPATCH_METADATA,  /* opens, lookups, attributes, locks */
+    DISPATCH_DATA,      /* reads, writes and flushes */
+    DISPATCH_BACKGROUND,/* coherency polling and other work nobody waits on */
+    DISPATCH_CLASS_COUNT
+};
+
+/* number of work items each class may take per round */
+#define DISPATCH_WEIGHT_METADATA    8
+#define DISPATCH_WEIGHT_DATA        2
+#define DISPATCH_WEIGHT_BACKGROUND  1
+
+typedef void (*dispatch_proc)(void *context);
+
+/* embedded in the caller's context, which must outlive the work */
+struct dispatch_work {
+    struct list_entry       entry;
+    dispatch_proc           proc;
+    void                    *context;
+    enum dispatch_class     type;
+    LONGLONG                queued_at; /* performance counter */
+    bool_t                  deferrable;
+    uint32_t                deferrals; /* times it was deferred */
+    ULONGLONG               due; /* tick count to run again */
+};
+
+int dispatch_init();
+
+/* call 'proc' with 'context' on a worker thread; if 'deferrable' is set,
+ * proc may be called again after a dispatch_defer() */
+int dispatch_queue(
+    IN struct dispatch_work *work,
+    IN enum dispatch_class type,
+    IN bool_t deferrable,
+    IN dispatch_proc proc,
+    IN void *context);
+
+/* ask to rerun the current work after 'delay' ms.  returns FALSE if the
+ * work can't be deferred, in which case the caller must wait in place */
+bool_t dispatch_defer(
+    IN uint32_t delay);
+
+/* TRUE if the current work was deferred, and proc should return without
+ * completing it */
+bool_t dispatch_deferred();
+
+/* number of times the current work has been deferred */
+uint32_t dispatch_deferrals();
+
+/* the class of the work running on this thread; threads outside the
+ * pool are treated as DISPATCH_METADATA */
+enum dispatch_class dispatch_current_class();
+
+/* bracket a long wait on a worker thread; no-ops on any other thread */
+void dispatch_block_enter();
+void dispatch_block_leave();
+
+#endif /* !__NFS41_DAEMON_DISPATCH_H__ */
@@ -25,6 +25,7 @@
 
 #include "nfs41_ops.h"
 #include "name_cache.h"
+#include "delegation.h"
 #include "upcall.h"
 #include "daemon_debug.h"
 
@@ -182,3 +183,156 @@ const nfs41_upcall_op nfs41_op_getattr = {
     handle_getattr,
     marshall_getattr
 };
+
+
+/* NFS41_CHANGE_QUERY */
+static int parse_changeattr(unsigned char *buffer, uint32_t length, nfs41_upcall *upcall)
+{
+    int status;
+    changeattr_upcall_args *args = &upcall->args.changeattr;
+    nfs41_open_state *state;
+    uint32_t count, i;
+
+    status = safe_read(&buffer, &length, &count, sizeof(count));
+    if (status) goto out;
+    if (count > CHANGE_QUERY_MAX) {
+        eprintf("parse_changeattr: %u files exceeds the limit of %u\n",
+            count, CHANGE_QUERY_MAX);
+        status = ERROR_INVALID_PARAMETER;
+        goto out;
+    }
+    for (i = 0; i < count; i++) {
+        status = safe_read(&buffer, &length, &state, sizeof(HANDLE));
+        if (status) goto out;
+        /* released in cleanup_changeattr() */
+        nfs41_open_state_ref(state);
+        args->states[args->count++] = state;
+    }
+
+    dprintf(1, "parsing NFS41_CHANGE_QUERY: %u files\n", count);
+out:
+    return status;
+}
+
+/* fetch the change attribute of the files at the given indices, which
+ * share a session, using as few compounds as the session allows */
+static void changeattr_session(
+    IN nfs41_session *session,
+    IN OUT changeattr_upcall_args *args,
+    IN const uint32_t *index,
+    IN uint32_t count)
+{
+    nfs41_path_fh *files[GETATTR_ARRAY_MAX];
+    nfs41_file_info info[GETATTR_ARRAY_MAX];
+    bitmap4 attr_request = { 1, { FATTR4_WORD0_CHANGE } };
+    uint32_t max_files = (session->fore_chan_attrs.ca_maxoperations - 1) / 2;
+    uint32_t i, j, n, failed, compounds = 0;
+    int status;
+
+    max_files = max(1, min(max_files, GETATTR_ARRAY_MAX));
+    for (i = 0; i < count; i += n) {
+        n = min(count - i, max_files);
+        for (j = 0; j < n; j++)
+            files[j] = &args->states[index[i + j]]->file;
+
+        ZeroMemory(info, n * sizeof(nfs41_file_info));
+        status = nfs41_getattr_array(session, files, n,
+            &attr_request, info, &failed);
+        compounds++;
+
+        if (status && failed == n) {
+            /* not specific to a file, so give up on the rest */
+            eprintf("nfs41_getattr_array() failed with %s\n",
+                nfs_error_string(status));
+            status = nfs_to_windows_error(status, ERROR_BAD_NET_RESP);
+            for (j = i; j < count; j++)
+                args->status[index[j]] = status;
+            break;
+        }
+        for (j = 0; j < n && j < failed; j++)
+            args->changes[index[i + j]] = info[j].change;
+        if (status) {
+            /* start the next compound after the file that failed */
+            dprintf(1, "changeattr: '%.*s' failed with %s\n",
+                files[failed]->path->len, files[failed]->path->path,
+                nfs_error_string(status));
+            args->status[index[i + failed]] = nfs_to_windows_error(status,
+                ERROR_FILE_NOT_FOUND);
+            n = failed + 1;
+        }
+    }
+    dprintf(2, "changeattr: checked %u files with %u compounds\n",
+        count, compounds);
+}
+
+static int handle_changeattr(nfs41_upcall *upcall)
+{
+    changeattr_upcall_args *args = &upcall->args.changeattr;
+    uint32_t index[CHANGE_QUERY_MAX];
+    bool_t done[CHANGE_QUERY_MAX];
+    nfs41_session *session;
+    uint32_t i, j, count;
+
+    /* files under a delegation can't change without a recall, so there's
+     * no need to ask the server about them */
+    for (i = 0; i < args->count; i++) {
+        args->status[i] = NO_ERROR;
+        args->delegated[i] = nfs41_delegation_held(
+            args->states[i]->session->client, &args->states[i]->file.fh);
+        done[i] = args->delegated[i];
+    }
+
+    /* batch the rest by session */
+    for (i = 0; i < args->count; i++) {
+        if (done[i])
+            continue;
+        session = args->states[i]->session;
+        count = 0;
+        for (j = i; j < args->count; j++) {
+            if (done[j] || args->states[j]->session != session)
+                continue;
+            done[j] = TRUE;
+            index[count++] = j;
+        }
+        changeattr_session(session, args, index, count);
+    }
+    return NO_ERROR;
+}
+
+static int marshall_changeattr(unsigned char *buffer, uint32_t *length, nfs41_upcall *upcall)
+{
+    int status;
+    changeattr_upcall_args *args = &upcall->args.changeattr;
+    uint32_t i;
+
+    status = safe_write(&buffer, length, &args->count, sizeof(args->count));
+    if (status) goto out;
+    for (i = 0; i < args->count; i++) {
+        status = safe_write(&buffer, length, &args->status[i], sizeof(DWORD));
+        if (status) goto out;
+        status = safe_write(&buffer, length, &args->delegated[i], sizeof(BOOLEAN));
+        if (status) goto out;
+        status = safe_write(&buffer, length, &args->changes[i], sizeof(ULONGLONG));
+        if (status) goto out;
+    }
+out:
+    return status;
+}
+
+static void cleanup_changeattr(nfs41_upcall *upcall)
+{
+    changeattr_upcall_args *args = &upcall->args.changeattr;
+    uint32_t i;
+
+    for (i = 0; i < args->count; i++)
+        nfs41_open_state_deref(args->states[i]);
+}
+
+
+const nfs41_upcall_op nfs41_op_changeattr = {
+    parse_changeattr,
+    handle_changeattr,
+    marshall_changeattr,
+    NULL,
+    cleanup_changeattr
+};
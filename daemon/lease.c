@@ -0,0 +1,267 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#include <Windows.h>
+#include <process.h>
+#include <stdio.h>
+
+#include "nfs41_ops.h"
+#include "lease.h"
+#include "daemon_debug.h"
+#include "util.h"
+
+
+#define LSLVL 2 /* dprintf level for lease logging */
+
+struct lease_stats {
+    LONG                    sessions;
+    LONG                    checks; /* sessions that came due */
+    LONG                    renewals; /* SEQUENCEs sent to renew a lease */
+    LONG                    failures;
+    LONG                    skipped; /* renewals avoided by other traffic */
+    LONGLONG                min_margin; /* fewest ms left on any lease */
+};
+
+static struct lease_manager {
+    CRITICAL_SECTION        lock; /* protects the wheel and each lease */
+    CONDITION_VARIABLE      cond; /* signaled when a renewal finishes */
+    struct list_entry       wheel[LEASE_WHEEL_SIZE];
+    ULONGLONG               tick; /* next slot to expire, in wheel ticks */
+    struct lease_stats      stats;
+} leases;
+
+
+static void lease_log(
+    IN nfs41_session *session,
+    IN LONGLONG margin)
+{
+    nfs41_slot_window window;
+
+    nfs41_session_window(session, &window);
+    dprintf(LSLVL, "session %p: lease margin %lldms, cwnd %u (ssthresh %u, "
+        "peak %u, max_slots %u), %u grows, %u shrinks, %u delays, rtt "
+        "%lld/%lldus, data rtt %lld/%lldus\n", session, margin, window.cwnd,
+        window.ssthresh, window.peak, session->table.max_slots, window.grows,
+        window.shrinks, window.delays, window.rtt[0].base, window.rtt[0].srtt,
+        window.rtt[1].base, window.rtt[1].srtt);
+}
+
+static ULONGLONG lease_renewed(
+    IN nfs41_session *session)
+{
+    ULONGLONG renewed;
+
+    EnterCriticalSection(&session->table.lock);
+    renewed = session->lease.renewed;
+    LeaveCriticalSection(&session->table.lock);
+    return renewed;
+}
+
+/* the following functions expect the caller to hold leases.lock */
+static void lease_schedule(
+    IN nfs41_lease *lease,
+    IN ULONGLONG due)
+{
+    ULONGLONG tick = due / LEASE_WHEEL_TICK;
+
+    /* anything overdue goes in the next slot to expire */
+    if (tick < leases.tick)
+        tick = leases.tick;
+    lease->due = due;
+    list_add_tail(&leases.wheel[tick % LEASE_WHEEL_SIZE], &lease->entry);
+}
+
+static void lease_renew(
+    IN void *context);
+
+static void lease_expire(
+    IN nfs41_session *session,
+    IN ULONGLONG now)
+{
+    nfs41_lease *lease = &session->lease;
+    const ULONGLONG renewed = lease_renewed(session);
+    int status;
+
+    lease->margin = (LONGLONG)(renewed + session->lease_time * 1000ULL)
+        - (LONGLONG)now;
+    if (lease->margin < leases.stats.min_margin)
+        leases.stats.min_margin = lease->margin;
+    leases.stats.checks++;
+
+    /* the wheel only resolves whole ticks, so renew anything due
+     * before the next one */
+    if (renewed + lease->period > now + LEASE_WHEEL_TICK) {
+        /* other traffic renewed the lease since we last looked */
+        leases.stats.skipped++;
+        dprintf(LSLVL + 1, "lease: session %p is busy, margin %lldms\n",
+            session, lease->margin);
+        lease_schedule(lease, renewed + lease->period);
+        return;
+    }
+
+    dprintf(LSLVL, "lease: renewing idle session %p, margin %lldms\n",
+        session, lease->margin);
+    lease->queued = TRUE;
+    status = dispatch_queue(&lease->work, DISPATCH_BACKGROUND, FALSE,
+        lease_renew, session);
+    if (status) {
+        eprintf("lease: dispatch_queue() failed with %d\n", status);
+        lease->queued = FALSE;
+        lease_schedule(lease, now + LEASE_RETRY_DELAY);
+    }
+}
+
+
+/* runs on a background worker */
+static void lease_renew(
+    IN void *context)
+{
+    nfs41_session *session = (nfs41_session*)context;
+    nfs41_lease *lease = &session->lease;
+    ULONGLONG due;
+    int status;
+
+    status = nfs41_send_sequence(session);
+    if (status)
+        eprintf("lease: nfs41_send_sequence() failed with %d\n", status);
+    else
+        lease_log(session, lease->margin);
+
+    EnterCriticalSection(&leases.lock);
+    lease->queued = FALSE;
+    leases.stats.renewals++;
+    if (status) {
+        leases.stats.failures++;
+        due = GetTickCount64() + LEASE_RETRY_DELAY;
+    } else
+        due = lease_renewed(session) + lease->period;
+
+    if (lease->registered)
+        lease_schedule(lease, due);
+    dprintf(LSLVL, "lease: %d sessions, %d checks, %d renewals (%d failed), "
+        "%d skipped, min margin %lldms\n", leases.stats.sessions,
+        leases.stats.checks, leases.stats.renewals, leases.stats.failures,
+        leases.stats.skipped, leases.stats.min_margin);
+    WakeAllConditionVariable(&leases.cond);
+    LeaveCriticalSection(&leases.lock);
+}
+
+static unsigned int WINAPI lease_thread(void *args)
+{
+    struct list_entry *entry, *tmp;
+    nfs41_session *session;
+    ULONGLONG now;
+
+    for (;;) {
+        Sleep(LEASE_WHEEL_TICK);
+        now = GetTickCount64();
+
+        EnterCriticalSection(&leases.lock);
+        for (; leases.tick <= now / LEASE_WHEEL_TICK; leases.tick++) {
+            list_for_each_tmp(entry, tmp,
+                    &leases.wheel[leases.tick % LEASE_WHEEL_SIZE]) {
+                session = list_container(entry, nfs41_session, lease.entry);
+                if (session->lease.due / LEASE_WHEEL_TICK > leases.tick)
+                    continue; /* due on a later turn of the wheel */
+                list_remove(entry);
+                lease_expire(session, now);
+            }
+        }
+        LeaveCriticalSection(&leases.lock);
+    }
+    return 0;
+}
+
+
+int nfs41_lease_init()
+{
+    HANDLE thread;
+    uint32_t i;
+    int status = NO_ERROR;
+
+    InitializeCriticalSection(&leases.lock);
+    InitializeConditionVariable(&leases.cond);
+    for (i = 0; i < LEASE_WHEEL_SIZE; i++)
+        list_init(&leases.wheel[i]);
+    leases.tick = GetTickCount64() / LEASE_WHEEL_TICK;
+    leases.stats.min_margin = MAXLONGLONG;
+
+    thread = (HANDLE)_beginthreadex(NULL, 0, lease_thread, NULL, 0, NULL);
+    if (thread == NULL) {
+        status = GetLastError();
+        eprintf("_beginthreadex failed %d\n", status);
+        goto out;
+    }
+    CloseHandle(thread);
+out:
+    return status;
+}
+
+void nfs41_lease_register(
+    IN nfs41_session *session)
+{
+    nfs41_lease *lease = &session->lease;
+    ULONGLONG renewed;
+
+    EnterCriticalSection(&session->table.lock);
+    /* CREATE_SESSION counts if nothing else has renewed it yet */
+    if (lease->renewed == 0)
+        lease->renewed = GetTickCount64();
+    renewed = lease->renewed;
+    LeaveCriticalSection(&session->table.lock);
+
+    EnterCriticalSection(&leases.lock);
+    if (lease->registered) {
+        eprintf("nfs41_lease_register(): session %p is already "
+            "registered\n", session);
+        goto out;
+    }
+    lease->period = 2 * session->lease_time * 1000 / 3;
+    lease->margin = session->lease_time * 1000LL;
+    lease->registered = TRUE;
+    lease_schedule(lease, renewed + lease->period);
+    leases.stats.sessions++;
+
+    dprintf(1, "lease: session %p renews after %ums idle\n",
+        session, lease->period);
+out:
+    LeaveCriticalSection(&leases.lock);
+}
+
+void nfs41_lease_unregister(
+    IN nfs41_session *session)
+{
+    nfs41_lease *lease = &session->lease;
+
+    EnterCriticalSection(&leases.lock);
+    if (lease->registered) {
+        lease->registered = FALSE;
+        leases.stats.sessions--;
+
+        /* a queued renewal is off the wheel, and must finish before the
+         * session goes away */
+        if (!lease->queued)
+            list_remove(&lease->entry);
+        while (lease->queued)
+            SleepConditionVariableCS(&leases.cond, &leases.lock, INFINITE);
+    }
+    LeaveCriticalSection(&leases.lock);
+}
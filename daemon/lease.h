@@ -0,0 +1,59 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef __NFS41_DAEMON_LEASE_H__
+#define __NFS41_DAEMON_LEASE_H__
+
+#include "nfs41.h"
+
+
+/* lease renewal
+ *
+ *   every successful SEQUENCE renews the client's lease, so a session
+ * that's busy never needs an explicit renewal.  a single lease manager
+ * thread keeps each registered session on a timer wheel, due one renewal
+ * period (2/3 of the lease) after the last good SEQUENCE.  when a session
+ * comes due, the manager checks whether traffic renewed the lease in the
+ * meantime; if so, it just moves the session along the wheel, and only
+ * sessions that really went idle get a SEQUENCE, sent from a background
+ * worker in the dispatch pool.  the margin left on the lease at each
+ * check is logged, along with the manager's totals after each renewal. */
+
+/* ms per slot of the timer wheel */
+#define LEASE_WHEEL_TICK 1000
+
+/* slots in the timer wheel; longer timers go around more than once */
+#define LEASE_WHEEL_SIZE 128
+
+/* ms before retrying a renewal that failed */
+#define LEASE_RETRY_DELAY 5000
+
+int nfs41_lease_init();
+
+/* start renewing the session's lease, which must be set in lease_time */
+void nfs41_lease_register(
+    IN nfs41_session *session);
+
+/* stop renewing the lease, and wait for any renewal in flight */
+void nfs41_lease_unregister(
+    IN nfs41_session *session);
+
+#endif /* !__NFS41_DAEMON_LEASE_H__ */
@@ -25,6 +25,7 @@
 #include "daemon_debug.h"
 #include "delegation.h"
 #include "nfs41_ops.h"
+#include "readahead.h"
 #include "upcall.h"
 #include "util.h"
 
@@ -254,6 +255,9 @@ static int handle_lock(nfs41_upcall *upcall)
     open_lock_add(state, &stateid, lock);
     LeaveCriticalSection(&state->locks.lock);
 
+    /* data read ahead of the lock may miss writes that it protects */
+    nfs41_readahead_invalidate(state->session->client, &state->file.fh);
+
     args->acquired = TRUE; /* for cancel_lock() */
 out:
     return status;
@@ -68,6 +68,12 @@ typedef struct __nfs41_lookup_component_res {
     struct lookup_referral  *referral;
 } nfs41_lookup_component_res;
 
+/* allocated together from the compound arena */
+struct lookup_scratch {
+    nfs41_lookup_component_args args;
+    nfs41_lookup_component_res  res;
+};
+
 
 static void init_component_args(
     IN nfs41_lookup_component_args *args,
@@ -77,6 +83,13 @@ static void init_component_args(
 {
     uint32_t i;
 
+    /* the arena isn't zeroed, but only the attributes need to be; the
+     * rest is set here or by the reply */
+    ZeroMemory(&res->root, sizeof(nfs41_path_fh));
+    ZeroMemory(&res->rootinfo, sizeof(nfs41_file_info));
+    ZeroMemory(res->info, sizeof(res->info));
+    args->putfh.in_recovery = FALSE;
+
     args->attr_request.count = 2;
     args->attr_request.arr[0] = FATTR4_WORD0_TYPE
         | FATTR4_WORD0_CHANGE | FATTR4_WORD0_SIZE
@@ -119,6 +132,14 @@ static int lookup_rpc(
 
     compound_init(&compound, argops, resops, "lookup");
 
+    /* ops after a failure aren't decoded, so don't leave stale errors
+     * from the last call for server_lookup() to find */
+    res->putfh.status = res->getrootfh.status = NFS4_OK;
+    res->getrootattr.status = NFS4_OK;
+    for (i = 0; i < component_count; i++)
+        res->lookup[i].status = res->getfh[i].status =
+            res->getattr[i].status = NFS4_OK;
+
     compound_add_op(&compound, OP_SEQUENCE, &args->sequence, &res->sequence);
     nfs41_session_sequence(&args->sequence, session, 0);
 
@@ -140,8 +161,11 @@ static int lookup_rpc(
     }
 
     status = compound_encode_send_decode(session, &compound, TRUE);
-    if (status)
+    if (status) {
+        /* nothing was decoded; fail at the first op */
+        res->sequence.sr_status = status;
         goto out;
+    }
 
     compound_error(status = compound.res.status);
 out:
@@ -305,26 +329,34 @@ static int server_lookup_loop(
     OUT OPTIONAL nfs41_path_fh *target_out,
     OUT OPTIONAL nfs41_file_info *info_out)
 {
-    nfs41_lookup_component_args args = { 0 };
-    nfs41_lookup_component_res res = { 0 };
+    struct lookup_scratch *scratch;
+    nfs41_lookup_component_args *args;
+    nfs41_lookup_component_res *res;
     nfs41_path_fh *dir, *parent, *target;
     const char *path_end;
     const uint32_t max_components = max_lookup_components(session);
     uint32_t count;
     int status = NO_ERROR;
 
-    init_component_args(&args, &res, path, referral);
+    /* too big for the stack */
+    scratch = compound_arena_alloc(sizeof(struct lookup_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    args = &scratch->args;
+    res = &scratch->res;
+
+    init_component_args(args, res, path, referral);
     parent = NULL;
     target = NULL;
 
     path_end = path->path + path->len;
-    dir = parent_in ? parent_in : &res.root;
+    dir = parent_in ? parent_in : &res->root;
 
     while (get_component_array(&path_pos, path_end,
-        max_components, res.file, &count)) {
+        max_components, res->file, &count)) {
 
         status = server_lookup(session, dir, path->path, path_end, count,
-            &args, &res, &parent, &target, info_out);
+            args, res, &parent, &target, info_out);
 
         if (status == ERROR_REPARSE) {
             /* copy the component name of the symlink */
@@ -343,10 +375,10 @@ static int server_lookup_loop(
         dir = target;
     }
 
-    if (dir == &res.root && (target_out || info_out)) {
+    if (dir == &res->root && (target_out || info_out)) {
         /* didn't get any components, so we just need the root */
         status = server_lookup(session, dir, path->path, path_end,
-            0, &args, &res, &parent, &target, info_out);
+            0, args, res, &parent, &target, info_out);
         if (status)
             goto out;
     }
@@ -355,6 +387,7 @@ static int server_lookup_loop(
 out_parent:
     if (parent_out && parent) fh_copy(&parent_out->fh, &parent->fh);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
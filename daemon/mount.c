@@ -45,10 +45,13 @@ static int parse_mount(unsigned char *buffer, uint32_t length, nfs41_upcall *upc
     if (status) goto out;
     status = safe_read(&buffer, &length, &args->wsize, sizeof(DWORD));
     if (status) goto out;
+    status = safe_read(&buffer, &length, &args->nconnect, sizeof(DWORD));
+    if (status) goto out;
 
     dprintf(1, "parsing NFS14_MOUNT: srv_name=%s root=%s sec_flavor=%s "
-        "rsize=%d wsize=%d\n", args->hostname, args->path, 
-        secflavorop2name(args->sec_flavor), args->rsize, args->wsize);
+        "rsize=%d wsize=%d nconnect=%d\n", args->hostname, args->path, 
+        secflavorop2name(args->sec_flavor), args->rsize, args->wsize,
+        args->nconnect);
 out:
     return status;
 }
@@ -77,7 +80,8 @@ static int handle_mount(nfs41_upcall *upcall)
     } else {
         // create root
         status = nfs41_root_create(args->hostname, args->sec_flavor,
-            args->wsize + WRITE_OVERHEAD, args->rsize + READ_OVERHEAD, &root);
+            args->wsize + WRITE_OVERHEAD, args->rsize + READ_OVERHEAD,
+            args->nconnect, &root);
         if (status) {
             eprintf("nfs41_root_create() failed %d\n", status);
             goto out;
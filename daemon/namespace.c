@@ -39,6 +39,7 @@ int nfs41_root_create(
     IN uint32_t sec_flavor,
     IN uint32_t wsize,
     IN uint32_t rsize,
+    IN uint32_t nconnect,
     OUT nfs41_root **root_out)
 {
     int status = NO_ERROR;
@@ -55,6 +56,7 @@ int nfs41_root_create(
     list_init(&root->clients);
     root->wsize = wsize;
     root->rsize = rsize;
+    root->nconnect = min(max(nconnect, 1), NFS41_MAX_NCONNECT);
     InitializeCriticalSection(&root->lock);
     root->ref_count = 1;
     root->sec_flavor = sec_flavor;
@@ -307,6 +309,10 @@ static int root_client_create(
         goto out_err;
     }
 
+    /* spread i/o over the server's other interfaces */
+    nfs41_rpc_trunk(rpc, &root->client_owner, nfs41_exchange_id_flags(is_data),
+        exchangeid, session->session_id, root->nconnect);
+
     if (!is_data) {
         /* send RECLAIM_COMPLETE, but don't fail on ERR_NOTSUPP */
         status = nfs41_reclaim_complete(session);
@@ -356,14 +362,14 @@ int nfs41_root_mount_addrs(
 
     /* create an rpc client */
     status = nfs41_rpc_clnt_create(addrs, root->wsize, root->rsize,
-        root->uid, root->gid, root->sec_flavor, &rpc);
+        root->nconnect, root->uid, root->gid, root->sec_flavor, &rpc);
     if (status) {
         eprintf("nfs41_rpc_clnt_create() failed %d\n", status);
         goto out;
     }
 
     /* get a clientid with exchangeid */
-    status = nfs41_exchange_id(rpc, &root->client_owner,
+    status = nfs41_exchange_id(rpc, 0, &root->client_owner,
         nfs41_exchange_id_flags(is_data), &exchangeid);
     if (status) {
         eprintf("nfs41_exchange_id() failed %s\n", nfs_error_string(status));
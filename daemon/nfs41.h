@@ -24,12 +24,14 @@
 
 #include "util.h"
 #include "list.h"
+#include "dispatch.h"
 
 
 struct __nfs41_session;
 struct __nfs41_client;
 struct __rpc_client;
 struct __nfs41_root;
+struct __nfs41_read_res_ok;
 
 struct _FILE_GET_EA_INFORMATION;
 struct _FILE_FULL_EA_INFORMATION;
@@ -82,6 +84,7 @@ typedef struct __nfs41_server {
     struct server_addrs addrs;
     nfs41_superblock_list superblocks;
     struct nfs41_name_cache *name_cache;
+    struct nfs41_read_cache *read_cache;
     struct list_entry entry; /* position in global server list */
     LONG ref_count;
 } nfs41_server;
@@ -107,6 +110,8 @@ typedef struct __nfs41_delegation_state {
     bool_t revoked; /* for recovery, accessed under client.state.lock */
 
     HANDLE srv_open; /* for rdbss cache invalidation */
+
+    struct __nfs41_write_cache *write_cache; /* for write delegations */
 } nfs41_delegation_state;
 
 typedef struct __nfs41_lock_state {
@@ -162,25 +167,66 @@ typedef struct __nfs41_open_state {
     } ea;
 
     HANDLE srv_open; /* for data cache invalidation */
+
+    struct __nfs41_readahead *readahead; /* allocated on first read */
+    struct __nfs41_write_gather *write_gather; /* allocated on first write */
 } nfs41_open_state;
 
-typedef struct __nfs41_rpc_clnt {
+/* largest number of connections per rpc client (nconnect) */
+#define NFS41_MAX_NCONNECT 16
+
+/* one tcp connection of an rpc client.  the first connection creates the
+ * session and carries the backchannel; the others, to the same address or
+ * to other trunkable addresses of the server, are bound to the session's
+ * fore channel with BIND_CONN_TO_SESSION.  each one reconnects on its own,
+ * and compounds go to the connection with the fewest calls in flight */
+typedef struct __nfs41_rpc_conn {
     struct __rpc_client *rpc;
+    struct __nfs41_rpc_clnt *clnt; /* the rpc client we belong to */
+    struct __nfs41_direct_read *steered; /* see rpc_steer_hold() */
     SRWLOCK lock;
     HANDLE cond;
+    uint32_t addr_index; /* index of addr we're using */
+    uint32_t version;
+    bool_t in_recovery;
+    bool_t bound; /* usable for compounds on the session */
+    volatile LONG in_flight;
+} nfs41_rpc_conn;
+
+/* a READ reply to receive directly into the caller's buffer */
+typedef struct __nfs41_direct_read {
+    unsigned char sessionid[NFS4_SESSIONID_SIZE];
+    uint32_t sequenceid;
+    struct __nfs41_read_res_ok *res;
+    nfs41_rpc_conn *conn; /* connection receiving into res->data */
+} nfs41_direct_read;
+
+typedef struct __nfs41_rpc_clnt {
+    nfs41_rpc_conn conns[NFS41_MAX_NCONNECT];
+    uint32_t nconnect; /* number of connections in conns[] */
+    volatile LONG next_conn; /* where to start looking for the least busy */
     struct __nfs41_client *client;
     multi_addr4 addrs;
-    uint32_t addr_index; /* index of addr we're using */
     uint32_t wsize;
     uint32_t rsize;
-    uint32_t version;
     uint32_t sec_flavor;
     uint32_t uid;
     uint32_t gid;
     char server_name[NI_MAXHOST];
     bool_t is_valid_session;
-    bool_t in_recovery;
     bool_t needcb;
+
+    /* how connecting to each of addrs went, so reconnect can try the
+     * healthy ones first */
+    struct {
+        uint32_t failures; /* consecutive failed attempts */
+        ULONGLONG failed_at; /* tick count of the last failure */
+    } addr_health[NFS41_ADDRS_PER_SERVER];
+
+    /* READ replies to receive directly into the caller's buffer,
+     * indexed by slotid */
+    nfs41_direct_read direct_reads[NFS41_MAX_RPC_REQS];
+    SRWLOCK direct_lock;
 } nfs41_rpc_clnt;
 
 struct client_state {
@@ -215,14 +261,37 @@ typedef struct __nfs41_client {
     struct client_state state;
 } nfs41_client;
 
+/* round trip estimates for the congestion window, in microseconds */
+struct __nfs41_rtt {
+    LONGLONG base; /* lowest since base_reset */
+    LONGLONG srtt; /* smoothed */
+    ULONGLONG base_reset; /* tick count to forget base */
+};
+
+/* congestion window over the slot table; see nfs41_session_get_slot() */
+typedef struct __nfs41_slot_window {
+    uint32_t cwnd; /* compounds allowed in flight */
+    uint32_t ssthresh; /* grow exponentially below this */
+    uint32_t acked; /* replies since the last adjustment */
+    bool_t limited; /* someone waited on cwnd since the last adjustment */
+    struct __nfs41_rtt rtt[2]; /* indexed by is_data */
+    /* for monitoring */
+    uint32_t peak;
+    uint32_t grows;
+    uint32_t shrinks;
+    uint32_t delays; /* NFS4ERR_DELAYs from the server */
+} nfs41_slot_window;
+
 #define NFS41_MAX_NUM_SLOTS NFS41_MAX_RPC_REQS
 typedef struct __nfs41_slot_table {
-    uint32_t seq_nums[NFS41_MAX_NUM_SLOTS];
-    uint32_t used_slots[NFS41_MAX_NUM_SLOTS];
+    uint32_t *seq_nums; /* indexed by slotid */
+    uint32_t *used_slots; /* bitmap of slots in use */
+    uint32_t capacity; /* slots allocated, from ca_maxrequests */
     uint32_t max_slots;
     uint32_t highest_used;
     uint32_t num_used;
     ULONGLONG target_delay;
+    nfs41_slot_window window;
     CRITICAL_SECTION lock;
     CONDITION_VARIABLE cond;
 } nfs41_slot_table;
@@ -237,6 +306,19 @@ typedef struct __nfs41_channel_attrs {
     uint32_t                *ca_rdma_ird;
 } nfs41_channel_attrs;
 
+/* lease renewal state; see lease.h */
+typedef struct __nfs41_lease {
+    struct list_entry entry; /* in a slot of the timer wheel */
+    struct dispatch_work work;
+    ULONGLONG renewed; /* tick count when the last good SEQUENCE was sent,
+                        * protected by the slot table lock */
+    ULONGLONG due; /* tick count to check on it again */
+    uint32_t period; /* ms between renewals of an idle session */
+    LONGLONG margin; /* ms left on the lease at the last check */
+    bool_t registered;
+    bool_t queued; /* a renewal is waiting for or running on a worker */
+} nfs41_lease;
+
 struct replay_cache {
     unsigned char buffer[NFS41_MAX_SERVER_CACHE];
     uint32_t length;
@@ -259,8 +341,7 @@ typedef struct __nfs41_session {
     nfs41_channel_attrs back_chan_attrs;
     uint32_t lease_time;
     nfs41_slot_table table;
-    // array of slots
-    HANDLE renew_thread;
+    nfs41_lease lease;
     bool_t isValidState;
     uint32_t flags;
     nfs41_cb_session cb_session;
@@ -277,6 +358,7 @@ typedef struct __nfs41_root {
     struct list_entry clients;
     uint32_t wsize;
     uint32_t rsize;
+    uint32_t nconnect;
     LONG ref_count;
     uint32_t uid;
     uint32_t gid;
@@ -290,6 +372,7 @@ int nfs41_root_create(
     IN uint32_t sec_flavor,
     IN uint32_t wsize,
     IN uint32_t rsize,
+    IN uint32_t nconnect,
     OUT nfs41_root **root_out);
 
 void nfs41_root_ref(
@@ -349,7 +432,17 @@ void nfs41_session_free(
 void nfs41_session_bump_seq(
     IN nfs41_session *session,
     IN uint32_t slotid,
-    IN uint32_t target_highest_slotid);
+    IN uint32_t target_highest_slotid,
+    IN LONGLONG rtt);
+
+/* shrink the congestion window after an NFS4ERR_DELAY */
+void nfs41_session_delayed(
+    IN nfs41_session *session);
+
+/* copy the congestion window's state, for monitoring */
+void nfs41_session_window(
+    IN nfs41_session *session,
+    OUT nfs41_slot_window *window);
 
 void nfs41_session_free_slot(
     IN nfs41_session *session,
@@ -361,6 +454,12 @@ void nfs41_session_get_slot(
     OUT uint32_t *seq, 
     OUT uint32_t *highest);
 
+/* allocate slots for the fore channel's ca_maxrequests, after
+ * CREATE_SESSION */
+int nfs41_session_size_slots(
+    IN nfs41_session *session,
+    IN uint32_t max_requests);
+
 int nfs41_session_recall_slot(
     IN nfs41_session *session,
     IN OUT uint32_t target_highest_slotid);
@@ -484,6 +583,7 @@ int nfs41_rpc_clnt_create(
     IN const multi_addr4 *addrs,
     IN uint32_t wsize,
     IN uint32_t rsize,
+    IN uint32_t nconnect,
     IN uint32_t uid,
     IN uint32_t gid,
     IN uint32_t sec_flavor,
@@ -497,14 +597,55 @@ int nfs41_send_compound(
     IN char *inbuf,
     OUT char *outbuf);
 
+/* send on a specific connection, without load balancing */
+int nfs41_send_compound_conn(
+    IN nfs41_rpc_clnt *rpc,
+    IN uint32_t conn,
+    IN char *inbuf,
+    OUT char *outbuf);
+
+/* bind the extra connections to the fore channel of the given session,
+ * after it's created or renewed */
+void nfs41_rpc_bind_conns(
+    IN nfs41_rpc_clnt *rpc,
+    IN const unsigned char *sessionid);
+
+/* session trunking: open 'nconnect' connections to each of the server's
+ * other addresses that EXCHANGE_ID shows to be the same server as the one
+ * in 'exchangeid', and bind them to the session */
+struct __nfs41_exchange_id_res;
+void nfs41_rpc_trunk(
+    IN nfs41_rpc_clnt *rpc,
+    IN client_owner4 *owner,
+    IN uint32_t flags,
+    IN const struct __nfs41_exchange_id_res *exchangeid,
+    IN const unsigned char *sessionid,
+    IN uint32_t nconnect);
+
+/* arrange for the data in the reply on the given slot to be received
+ * directly into res->data; pass res=NULL to cancel.  cancel waits for
+ * any receive into the buffer to stop, so the buffer can be freed once
+ * it returns */
+void nfs41_rpc_direct_read(
+    IN nfs41_rpc_clnt *rpc,
+    IN const unsigned char *sessionid,
+    IN uint32_t slotid,
+    IN uint32_t sequenceid,
+    IN struct __nfs41_read_res_ok *res);
+
+/* enable direct reads on the connection if its credentials allow, or
+ * disable them; call with conn->lock held after changing credentials */
+void nfs41_rpc_steer_reads(
+    IN nfs41_rpc_conn *conn);
+
 static __inline netaddr4* nfs41_rpc_netaddr(
     IN nfs41_rpc_clnt *rpc)
 {
     uint32_t id;
-    AcquireSRWLockShared(&rpc->lock);
+    AcquireSRWLockShared(&rpc->conns[0].lock);
     /* only addr_index needs to be protected, as rpc->addrs is write-once */
-    id = rpc->addr_index;
-    ReleaseSRWLockShared(&rpc->lock);
+    id = rpc->conns[0].addr_index;
+    ReleaseSRWLockShared(&rpc->conns[0].lock);
 
     /* return the netaddr used to create the rpc client */
     return &rpc->addrs.arr[id];
@@ -25,6 +25,7 @@
 #include "wintirpc.h"
 #include "rpc/rpc.h"
 #include "nfs41_types.h"
+#include "pnfs.h"
 
 
 enum nfs41_callback_proc {
@@ -171,7 +171,7 @@ int nfs41_client_renew(
     nfs41_exchange_id_res exchangeid = { 0 };
     int status;
 
-    status = nfs41_exchange_id(client->rpc, &client->owner,
+    status = nfs41_exchange_id(client->rpc, 0, &client->owner,
         nfs41_exchange_id_flags(client->is_data), &exchangeid);
     if (status) {
         eprintf("nfs41_exchange_id() failed with %d\n", status);
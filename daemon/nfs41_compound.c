@@ -27,6 +27,7 @@
 #include "nfs41_ops.h"
 #include "recovery.h"
 #include "name_cache.h"
+#include "dispatch.h"
 #include "daemon_debug.h"
 #include "rpc/rpc.h"
 #include "rpc/auth_sspi.h"
@@ -51,8 +52,8 @@ void compound_init(
     compound->args.argarray_count = 0;
     compound->args.argarray = argops;
 
-    /* initialize results */
-    ZeroMemory(&compound->res, sizeof(nfs41_compound_res));
+    /* initialize results; the tag is overwritten by the reply */
+    compound->res.status = NFS4_OK;
     compound->res.tag_len = NFS4_OPAQUE_LIMIT;
     compound->res.resarray_count = 0;
     compound->res.resarray = resops;
@@ -87,6 +88,19 @@ static void set_expected_res(
         compound->res.resarray[i].op = compound->args.argarray[i].op;
 }
 
+/* microseconds since 'start', a performance counter value */
+static LONGLONG elapsed_usec(
+    IN LONGLONG start)
+{
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER now;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return (now.QuadPart - start) * 1000000 / frequency.QuadPart;
+}
+
 
 static int create_new_rpc_auth(nfs41_session *session, uint32_t op,
                                nfs41_secinfo_info *secinfo)
@@ -99,7 +113,7 @@ static int create_new_rpc_auth(nfs41_session *session, uint32_t op,
         if (!secinfo[i].sec_flavor && !secinfo[i].type)
             goto out;
         if (secinfo[i].sec_flavor == RPCSEC_GSS) {
-            auth = authsspi_create_default(session->client->rpc->rpc, 
+            auth = authsspi_create_default(session->client->rpc->conns[0].rpc, 
                         session->client->rpc->server_name, secinfo[i].type);
             if (auth == NULL) {
                 eprintf("handle_wrongsecinfo_noname: authsspi_create_default for "
@@ -123,10 +137,11 @@ static int create_new_rpc_auth(nfs41_session *session, uint32_t op,
             }
             sec_flavor = AUTH_SYS;
         }
-        AcquireSRWLockExclusive(&session->client->rpc->lock);
+        AcquireSRWLockExclusive(&session->client->rpc->conns[0].lock);
         session->client->rpc->sec_flavor = sec_flavor;
-        session->client->rpc->rpc->cl_auth = auth;
-        ReleaseSRWLockExclusive(&session->client->rpc->lock);
+        session->client->rpc->conns[0].rpc->cl_auth = auth;
+        nfs41_rpc_steer_reads(&session->client->rpc->conns[0]);
+        ReleaseSRWLockExclusive(&session->client->rpc->conns[0].lock);
         status = 0;
         break;
     }
@@ -134,6 +149,60 @@ out:
     return status;
 }
 
+/* large reads of the form SEQUENCE, PUTFH, READ can have their data
+ * received directly into the caller's buffer */
+#define DIRECT_READ_MIN 32768
+
+static nfs41_read_res_ok* compound_direct_read(
+    IN nfs41_compound *compound)
+{
+    const nfs_argop4 *argops = compound->args.argarray;
+    nfs41_read_res *res;
+
+    if (compound->args.argarray_count != 3 ||
+        argops[0].op != OP_SEQUENCE ||
+        argops[1].op != OP_PUTFH ||
+        argops[2].op != OP_READ ||
+        ((nfs41_read_args*)argops[2].arg)->count < DIRECT_READ_MIN)
+        return NULL;
+
+    res = (nfs41_read_res*)compound->res.resarray[2].res;
+    return &res->resok4;
+}
+
+/* NFS4ERR_DELAY and NFS4ERR_GRACE retries back off exponentially from
+ * 'initial' to 'maximum' ms, with jitter so that clients recovering from
+ * the same event don't retry in lockstep */
+struct retry_policy {
+    const char              *name;
+    uint32_t                initial;
+    uint32_t                maximum;
+    volatile LONG           retries;
+    volatile LONGLONG       backoff; /* total ms */
+};
+
+static struct retry_policy delay_policy = { "NFS4ERR_DELAY", 100, 5000 };
+static struct retry_policy grace_policy = { "NFS4ERR_GRACE", 1000, 15000 };
+
+static uint32_t retry_backoff(
+    IN struct retry_policy *policy,
+    IN uint32_t attempt)
+{
+    uint32_t delay = policy->initial;
+
+    while (--attempt && delay < policy->maximum)
+        delay *= 2;
+    if (delay > policy->maximum)
+        delay = policy->maximum;
+
+    /* equal jitter: wait between half and all of the delay */
+    delay = delay / 2 + rand() % (delay / 2 + 1);
+
+    InterlockedIncrement(&policy->retries);
+    InterlockedExchangeAdd64(&policy->backoff, delay);
+    return delay;
+}
+
 int compound_encode_send_decode(
     nfs41_session *session,
     nfs41_compound *compound,
@@ -144,14 +213,25 @@ int compound_encode_send_decode(
         compound->args.argarray[0].arg;
     uint32_t saved_sec_flavor;
     AUTH *saved_auth;
+    nfs41_read_res_ok *read_res;
+    struct retry_policy *policy;
+    LARGE_INTEGER sent;
     int op1 = compound->args.argarray[0].op;
 
 retry:
     /* send compound */
     retry_count++;
     set_expected_res(compound);
+    read_res = compound_direct_read(compound);
+    if (read_res)
+        nfs41_rpc_direct_read(session->client->rpc, args->sa_sessionid,
+            args->sa_slotid, args->sa_sequenceid, read_res);
+    QueryPerformanceCounter(&sent);
     status = nfs41_send_compound(session->client->rpc,
         (char *)&compound->args, (char *)&compound->res);
+    if (read_res)
+        nfs41_rpc_direct_read(session->client->rpc, args->sa_sessionid,
+            args->sa_slotid, args->sa_sequenceid, NULL);
     // bump sequence number if sequence op succeeded.
     if (compound->res.resarray_count > 0 && 
             compound->res.resarray[0].op == OP_SEQUENCE) {
@@ -180,7 +260,8 @@ retry:
                 print_sr_status_flags(1, seq->sr_resok4.sr_status_flags);
 
             nfs41_session_bump_seq(session, args->sa_slotid,
-                seq->sr_resok4.sr_target_highest_slotid);
+                seq->sr_resok4.sr_target_highest_slotid,
+                elapsed_usec(sent.QuadPart));
 
             /* check sequence status flags for state revocation */
             if (try_recovery && seq->sr_resok4.sr_status_flags)
@@ -272,14 +353,25 @@ retry:
 #endif
             if (op1 == OP_SEQUENCE)
                 nfs41_session_free_slot(session, args->sa_slotid);
-            if (compound->res.status == NFS4ERR_GRACE)
-                delayby = 5000;
-            else
-                delayby = 500*retry_count;
-            dprintf(1, "Compound returned %s: sleeping for %ums..\n", 
-                (compound->res.status==NFS4ERR_GRACE)?"NFS4ERR_GRACE":"NFS4ERR_DELAY",
-                delayby);
+            /* the server is overloaded, so send it less */
+            if (compound->res.status == NFS4ERR_DELAY)
+                nfs41_session_delayed(session);
+            policy = compound->res.status == NFS4ERR_GRACE ?
+                &grace_policy : &delay_policy;
+            delayby = retry_backoff(policy,
+                retry_count + dispatch_deferrals());
+            dprintf(1, "Compound returned %s: backing off for %ums "
+                "(%ld retries, %lldms total)\n", policy->name, delayby,
+                policy->retries, policy->backoff);
+
+            /* free the worker, and let the dispatcher replay the whole
+             * upcall when the delay expires */
+            if (dispatch_defer(delayby))
+                goto out;
+
+            dispatch_block_enter();
             Sleep(delayby);
+            dispatch_block_leave();
             dprintf(1, "Attempting to resend compound.\n");
             goto do_retry;
 #ifndef RETRY_INDEFINITELY
@@ -360,7 +452,7 @@ retry:
                     goto do_retry;
 
                 saved_sec_flavor = session->client->rpc->sec_flavor;
-                saved_auth = session->client->rpc->rpc->cl_auth;
+                saved_auth = session->client->rpc->conns[0].rpc->cl_auth;
                 if (op == OP_LOOKUP || op == OP_OPEN) {
                     const nfs41_component *name;
                     nfs41_path_fh tmp = { 0 };                   
@@ -422,10 +514,11 @@ retry:
                     // Need to retry only 
                     goto do_retry;
                 } else {
-                    AcquireSRWLockExclusive(&session->client->rpc->lock);
+                    AcquireSRWLockExclusive(&session->client->rpc->conns[0].lock);
                     session->client->rpc->sec_flavor = saved_sec_flavor;
-                    session->client->rpc->rpc->cl_auth = saved_auth;
-                    ReleaseSRWLockExclusive(&session->client->rpc->lock);
+                    session->client->rpc->conns[0].rpc->cl_auth = saved_auth;
+                    nfs41_rpc_steer_reads(&session->client->rpc->conns[0]);
+                    ReleaseSRWLockExclusive(&session->client->rpc->conns[0].lock);
                     nfs41_recovery_finish(session->client);
                 }                
                 break;
@@ -438,7 +531,7 @@ retry:
         if (seq->sr_status == NFS4_OK && session->client->rpc->needcb &&
                 (seq->sr_resok4.sr_status_flags & SEQ4_STATUS_CB_PATH_DOWN)) {
             nfs41_session_free_slot(session, args->sa_slotid);
-            nfs41_bind_conn_to_session(session->client->rpc,
+            nfs41_bind_conn_to_session(session->client->rpc, 0,
                 session->session_id, CDFC4_BACK_OR_BOTH);
             goto out;
         }
@@ -455,3 +548,87 @@ do_retry:
             &args->sa_sequenceid, &args->sa_highest_slotid);
     goto retry;
 }
+
+
+/* compound arenas */
+struct compound_arena {
+    unsigned char           *buffer; /* COMPOUND_ARENA_SIZE bytes */
+    size_t                  used;
+};
+
+/* allocations are rounded up to keep 64-bit fields aligned */
+#define ARENA_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+static DWORD arena_index = FLS_OUT_OF_INDEXES;
+static INIT_ONCE arena_once = INIT_ONCE_STATIC_INIT;
+
+/* called on thread exit, so retired workers don't leak their arenas */
+static void WINAPI arena_free(void *context)
+{
+    struct compound_arena *arena = (struct compound_arena*)context;
+    if (arena) {
+        free(arena->buffer);
+        free(arena);
+    }
+}
+
+static BOOL CALLBACK arena_init(
+    PINIT_ONCE once,
+    void *param,
+    void **context)
+{
+    arena_index = FlsAlloc(arena_free);
+    if (arena_index == FLS_OUT_OF_INDEXES)
+        eprintf("FlsAlloc() failed with %d\n", GetLastError());
+    return TRUE;
+}
+
+static struct compound_arena* arena_get()
+{
+    struct compound_arena *arena;
+
+    InitOnceExecuteOnce(&arena_once, arena_init, NULL, NULL);
+    if (arena_index == FLS_OUT_OF_INDEXES)
+        return NULL;
+
+    arena = (struct compound_arena*)FlsGetValue(arena_index);
+    if (arena == NULL) {
+        arena = calloc(1, sizeof(struct compound_arena));
+        if (arena == NULL)
+            return NULL;
+        arena->buffer = malloc(COMPOUND_ARENA_SIZE);
+        if (arena->buffer == NULL || !FlsSetValue(arena_index, arena)) {
+            arena_free(arena);
+            return NULL;
+        }
+    }
+    return arena;
+}
+
+void* compound_arena_alloc(
+    IN size_t size)
+{
+    struct compound_arena *arena = arena_get();
+    void *ptr;
+
+    size = ARENA_ALIGN(size);
+    if (arena && size <= COMPOUND_ARENA_SIZE - arena->used) {
+        ptr = arena->buffer + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+    return malloc(size);
+}
+
+void compound_arena_free(
+    IN void *ptr)
+{
+    struct compound_arena *arena = arena_get();
+    unsigned char *p = (unsigned char*)ptr;
+
+    if (arena && p >= arena->buffer &&
+        p < arena->buffer + COMPOUND_ARENA_SIZE)
+        arena->used = p - arena->buffer; /* release it and anything after */
+    else
+        free(ptr);
+}
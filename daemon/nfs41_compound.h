@@ -77,4 +77,16 @@ int compound_encode_send_decode(
     nfs41_compound *compound,
     bool_t try_recovery);
 
+/* per-thread arena for compound arguments and results that are too big
+ * for the stack.  memory is not zeroed, and must be freed in the reverse
+ * order of allocation.  allocations that don't fit in the arena fall
+ * back to malloc() */
+#define COMPOUND_ARENA_SIZE 65536
+
+void* compound_arena_alloc(
+    IN size_t size);
+
+void compound_arena_free(
+    IN void *ptr);
+
 #endif /* __NFS41_DAEMON_COMPOUND_H__ */
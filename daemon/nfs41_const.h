@@ -35,9 +35,10 @@
 #define NFS4_EANAME_SIZE        128
 
 
-#define NFS41_MAX_FILEIO_SIZE   (1024 * 1024)
+#define NFS41_MAX_FILEIO_SIZE   (16 * 1024 * 1024)
+#define NFS41_MAX_BACKCHANNEL_SIZE (1024 * 1024)
 #define NFS41_MAX_SERVER_CACHE  1024
-#define NFS41_MAX_RPC_REQS      128
+#define NFS41_MAX_RPC_REQS      1024 /* slots we ask for in CREATE_SESSION */
 
 #define UPCALL_BUF_SIZE         2048
 
@@ -304,6 +305,21 @@ enum nfs_ftype4 {
     NFS_FTYPE_MASK  = 0xF
 };
 
+/* OPEN delegation types, held in open_delegation4 */
+enum open_delegation_type4 {
+    OPEN_DELEGATE_NONE      = 0,
+    OPEN_DELEGATE_READ      = 1,
+    OPEN_DELEGATE_WRITE     = 2,
+    OPEN_DELEGATE_NONE_EXT  = 3
+};
+
+/* WRITE stability levels, held in nfs41_write_verf */
+enum stable_how4 {
+    UNSTABLE4       = 0,
+    DATA_SYNC4      = 1,
+    FILE_SYNC4      = 2
+};
+
 #define CREATE_SESSION4_FLAG_PERSIST        0x00000001
 #define CREATE_SESSION4_FLAG_CONN_BACK_CHAN 0x00000002
 #define CREATE_SESSION4_FLAG_CONN_RDMA      0x00000004
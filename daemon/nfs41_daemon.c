@@ -33,9 +33,17 @@
 #include "idmap.h"
 #include "daemon_debug.h"
 #include "upcall.h"
+#include "upcall_ring.h"
+#include "dispatch.h"
+#include "lease.h"
+#include "readahead.h"
+#include "write_gather.h"
 #include "util.h"
 
-#define MAX_NUM_THREADS 128
+/* threads waiting in IOCTL_NFS41_READ_BATCH */
+#define NUM_LISTENER_THREADS 8
+/* upcall batches read but not yet returned to the driver */
+#define MAX_BATCHES_IN_FLIGHT 64
 DWORD NFS41D_VERSION = 0;
 
 static const char FILE_NETCONFIG[] = "C:\\etc\\netconfig";
@@ -76,77 +84,380 @@ out:
     return status;
 }
 
+/* upcalls returned by a single IOCTL_NFS41_READ_BATCH.  they're handled in
+ * parallel by the worker pool, and the last worker to finish returns their
+ * downcalls with IOCTL_NFS41_WRITE_BATCH */
+struct upcall_batch;
+
+struct batch_entry {
+    nfs41_upcall            upcall;
+    struct upcall_batch     *batch;
+    struct dispatch_work    work;
+    upcall_args             saved_args; /* to replay a deferred upcall */
+};
+
+struct upcall_batch {
+    struct upcall_batch     *next; /* in batch_pool.free */
+    struct batch_entry      entries[UPCALL_BATCH_MAX];
+    uint32_t                count;
+    volatile LONG           pending;
+    HANDLE                  token; /* client's impersonation token */
+    OVERLAPPED              overlapped;
+    unsigned char           outbuf[UPCALL_BATCH_BUF_SIZE];
+    unsigned char           inbuf[UPCALL_BATCH_BUF_SIZE];
+    LONG                    results[UPCALL_BATCH_MAX]; /* from the driver */
+};
+
+/* batches are too big for the stack, and outlive the listener that reads
+ * them, so they're recycled through a free list.  the semaphore limits
+ * the number of batches in flight, so the listeners stop reading upcalls
+ * when the workers fall behind */
+static struct {
+    CRITICAL_SECTION        lock;
+    struct upcall_batch     *free;
+    HANDLE                  limit;
+} batch_pool;
+
+/* overlapped i/o isn't serialized, so every thread can share this handle */
+static HANDLE upcall_pipe = INVALID_HANDLE_VALUE;
+
+static struct upcall_batch* batch_alloc()
+{
+    struct upcall_batch *batch;
+
+    WaitForSingleObject(batch_pool.limit, INFINITE);
+
+    EnterCriticalSection(&batch_pool.lock);
+    batch = batch_pool.free;
+    if (batch)
+        batch_pool.free = batch->next;
+    LeaveCriticalSection(&batch_pool.lock);
+
+    if (batch == NULL) {
+        batch = calloc(1, sizeof(struct upcall_batch));
+        if (batch == NULL) {
+            eprintf("failed to allocate upcall batch\n");
+            goto out_release;
+        }
+        batch->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (batch->overlapped.hEvent == NULL) {
+            eprintf("CreateEvent() failed with %d\n", GetLastError());
+            free(batch);
+            batch = NULL;
+            goto out_release;
+        }
+    }
+out:
+    return batch;
+
+out_release:
+    ReleaseSemaphore(batch_pool.limit, 1, NULL);
+    goto out;
+}
+
+static void batch_free(
+    IN struct upcall_batch *batch)
+{
+    if (batch->token) {
+        CloseHandle(batch->token);
+        batch->token = NULL;
+    }
+    EnterCriticalSection(&batch_pool.lock);
+    batch->next = batch_pool.free;
+    batch_pool.free = batch;
+    LeaveCriticalSection(&batch_pool.lock);
+
+    ReleaseSemaphore(batch_pool.limit, 1, NULL);
+}
+
+static BOOL batch_ioctl(
+    IN struct upcall_batch *batch,
+    IN DWORD code,
+    IN void *inbuf,
+    IN DWORD inbuf_len,
+    OUT void *outbuf,
+    IN DWORD outbuf_len,
+    OUT DWORD *len_out)
+{
+    HANDLE event = batch->overlapped.hEvent;
+
+    ZeroMemory(&batch->overlapped, sizeof(OVERLAPPED));
+    batch->overlapped.hEvent = event;
+
+    if (DeviceIoControl(upcall_pipe, code, inbuf, inbuf_len,
+            outbuf, outbuf_len, len_out, &batch->overlapped))
+        return TRUE;
+    if (GetLastError() != ERROR_IO_PENDING)
+        return FALSE;
+    return GetOverlappedResult(upcall_pipe, &batch->overlapped, len_out, TRUE);
+}
+
+static int batch_parse(
+    IN struct upcall_batch *batch,
+    IN uint32_t length)
+{
+    unsigned char *buffer = batch->outbuf;
+    nfs41_upcall *upcall;
+    uint32_t i, len;
+    int status;
+
+    batch->count = 0;
+    status = safe_read(&buffer, &length, &batch->count, sizeof(uint32_t));
+    if (status) goto out;
+    if (batch->count == 0 || batch->count > UPCALL_BATCH_MAX) {
+        eprintf("upcall batch with %u entries\n", batch->count);
+        batch->count = 0;
+        status = ERROR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        status = safe_read(&buffer, &length, &len, sizeof(uint32_t));
+        if (status || len > length) {
+            eprintf("upcall batch truncated after %u of %u entries\n",
+                i, batch->count);
+            batch->count = i;
+            status = ERROR_INVALID_PARAMETER;
+            goto out;
+        }
+        upcall = &batch->entries[i].upcall;
+        batch->entries[i].batch = batch;
+
+        /* on failure, the downcall reports the error */
+        upcall->status = upcall_parse(buffer, len, upcall);
+        buffer += len;
+        length -= len;
+    }
+    status = NO_ERROR;
+out:
+    return status;
+}
+
+static uint32_t batch_marshall(
+    IN struct upcall_batch *batch)
+{
+    unsigned char *buffer = batch->inbuf;
+    nfs41_upcall *upcall;
+    uint32_t i, len;
+
+    memcpy(buffer, &batch->count, sizeof(uint32_t));
+    buffer += sizeof(uint32_t);
+
+    for (i = 0; i < batch->count; i++) {
+        upcall = &batch->entries[i].upcall;
+        dprintf(1, "writing downcall: xid=%lld opcode=%s status=%d "
+            "get_last_error=%d\n", upcall->xid, opcode2string(upcall->opcode),
+            upcall->status, upcall->last_error);
+
+        len = 0;
+        upcall_marshall(upcall, buffer + sizeof(uint32_t),
+            UPCALL_BATCH_ENTRY_SIZE, &len);
+        memcpy(buffer, &len, sizeof(uint32_t));
+        buffer += sizeof(uint32_t) + len;
+    }
+    return (uint32_t)(buffer - batch->inbuf);
+}
+
+/* called by whichever thread finishes the batch's last upcall */
+static void batch_complete(
+    IN struct upcall_batch *batch)
+{
+    nfs41_upcall *upcall;
+    DWORD inbuf_len, outbuf_len = 0;
+    BOOL success;
+    uint32_t i;
+
+    inbuf_len = batch_marshall(batch);
+
+    dprintf(2, "making a batch downcall: inbuf_len %ld\n\n", inbuf_len);
+    success = batch_ioctl(batch, IOCTL_NFS41_WRITE_BATCH,
+        batch->inbuf, inbuf_len, batch->results, sizeof(batch->results),
+        &outbuf_len);
+    if (!success)
+        eprintf("IOCTL_NFS41_WRITE_BATCH failed with %d\n", GetLastError());
+
+    for (i = 0; i < batch->count; i++) {
+        upcall = &batch->entries[i].upcall;
+        /* cancel any upcall that the driver failed to complete */
+        if (!success || (outbuf_len >= (i + 1) * sizeof(LONG) &&
+                batch->results[i])) {
+            eprintf("downcall failed for xid=%lld opcode=%s\n",
+                upcall->xid, opcode2string(upcall->opcode));
+            upcall_cancel(upcall);
+        }
+        if (upcall->status != NFSD_VERSION_MISMATCH)
+            upcall_cleanup(upcall);
+    }
+    batch_free(batch);
+}
+
+static void batch_worker(void *args)
+{
+    struct batch_entry *entry = (struct batch_entry*)args;
+    struct upcall_batch *batch = entry->batch;
+
+    /* a deferred upcall starts over from its original arguments */
+    if (entry->work.deferrals) {
+        entry->upcall.args = entry->saved_args;
+        entry->upcall.status = NO_ERROR;
+        entry->upcall.last_error = NO_ERROR;
+    }
+
+    /* handle the upcall in the client's security context */
+    if (batch->token && !SetThreadToken(NULL, batch->token))
+        eprintf("SetThreadToken() failed with %d\n", GetLastError());
+
+    upcall_handle(&entry->upcall);
+
+    if (batch->token)
+        RevertToSelf();
+
+    /* the dispatcher will call us again when the delay expires */
+    if (dispatch_deferred())
+        return;
+
+    if (InterlockedDecrement(&batch->pending) == 0)
+        batch_complete(batch);
+}
+
+static void batch_dispatch(
+    IN struct upcall_batch *batch)
+{
+    nfs41_upcall *upcall;
+    bool_t replayable;
+    uint32_t i;
+
+    /* hold a reference so the batch can't complete while we queue it */
+    batch->pending = 1;
+    for (i = 0; i < batch->count; i++) {
+        upcall = &batch->entries[i].upcall;
+        if (upcall->status)
+            continue;
+        InterlockedIncrement(&batch->pending);
+        replayable = upcall_replayable(upcall);
+        if (replayable)
+            batch->entries[i].saved_args = upcall->args;
+        if (dispatch_queue(&batch->entries[i].work, upcall_class(upcall),
+                replayable, batch_worker, &batch->entries[i])) {
+            InterlockedDecrement(&batch->pending);
+            upcall->status = ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+    if (InterlockedDecrement(&batch->pending) == 0)
+        batch_complete(batch);
+}
+
+/* the driver completes IOCTL_NFS41_READ_BATCH once it has upcalls for us,
+ * impersonating the client on the calling thread.  the listeners only
+ * read and queue the upcalls, so a few of them can keep any number of
+ * workers busy */
 static unsigned int WINAPI thread_main(void *args) 
 {
     nfs41_idmapper *idmapper = (nfs41_idmapper*)args;
     DWORD status = 0;
-    HANDLE pipe;
-    // buffer used to process upcall, assumed to be fixed size. 
-    // if we ever need to handle non-cached IO, need to make it dynamic
-    unsigned char outbuf[UPCALL_BUF_SIZE], inbuf[UPCALL_BUF_SIZE]; 
-    DWORD inbuf_len = UPCALL_BUF_SIZE, outbuf_len;
-    nfs41_upcall upcall;
-
-    pipe = CreateFile(NFS41_USER_DEVICE_NAME_A, GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
-        0, NULL);
-    if (pipe == INVALID_HANDLE_VALUE)
-    {
-        eprintf("Unable to open upcall pipe %d\n", GetLastError());
-        return GetLastError();
-    }
+    struct upcall_batch *batch;
+    nfs41_upcall *upcall;
+    DWORD outbuf_len;
+    uid_t uid;
+    gid_t gid;
+    uint32_t i;
 
     while(1) {
-        status = DeviceIoControl(pipe, IOCTL_NFS41_READ, NULL, 0,
-            outbuf, UPCALL_BUF_SIZE, (LPDWORD)&outbuf_len, NULL);
-        if (!status) {
-            eprintf("IOCTL_NFS41_READ failed %d\n", GetLastError());
+        batch = batch_alloc();
+        if (batch == NULL) {
+            Sleep(100);
             continue;
         }
 
-        status = upcall_parse(outbuf, (uint32_t)outbuf_len, &upcall);
-        if (status) {
-            upcall.status = status;
-            goto write_downcall;
+        outbuf_len = 0;
+        if (!batch_ioctl(batch, IOCTL_NFS41_READ_BATCH, NULL, 0,
+                batch->outbuf, UPCALL_BATCH_BUF_SIZE, &outbuf_len)) {
+            eprintf("IOCTL_NFS41_READ_BATCH failed %d\n", GetLastError());
+            batch_free(batch);
+            continue;
         }
 
-        /* map username to uid/gid */
-        status = map_user_to_ids(idmapper, &upcall.uid, &upcall.gid);
-        if (status) {
-            upcall.status = status;
-            goto write_downcall;
+        status = batch_parse(batch, (uint32_t)outbuf_len);
+        if (batch->count == 0) {
+            batch_free(batch);
+            continue;
+        }
+        dprintf(2, "received a batch of %u upcalls\n", batch->count);
+
+        /* map username to uid/gid; every upcall in the batch comes
+         * from the same client */
+        status = map_user_to_ids(idmapper, &uid, &gid);
+        for (i = 0; i < batch->count; i++) {
+            upcall = &batch->entries[i].upcall;
+            upcall->uid = uid;
+            upcall->gid = gid;
+            if (status && upcall->status == NO_ERROR)
+                upcall->status = status;
         }
 
-        if (upcall.opcode == NFS41_SHUTDOWN) {
+        upcall = &batch->entries[0].upcall;
+        if (upcall->opcode == NFS41_SHUTDOWN && upcall->status == NO_ERROR) {
             printf("Shutting down..\n");
             exit(0);
         }
 
-        status = upcall_handle(&upcall);
-
-write_downcall:
-        dprintf(1, "writing downcall: xid=%lld opcode=%s status=%d "
-            "get_last_error=%d\n", upcall.xid, opcode2string(upcall.opcode),
-            upcall.status, upcall.last_error);
-
-        upcall_marshall(&upcall, inbuf, (uint32_t)inbuf_len, (uint32_t*)&outbuf_len);
-
-        dprintf(2, "making a downcall: outbuf_len %ld\n\n", outbuf_len);
-        status = DeviceIoControl(pipe, IOCTL_NFS41_WRITE,
-            inbuf, inbuf_len, NULL, 0, (LPDWORD)&outbuf_len, NULL);
-        if (!status) {
-            eprintf("IOCTL_NFS41_WRITE failed with %d xid=%lld opcode=%s\n", 
-                GetLastError(), upcall.xid, opcode2string(upcall.opcode));
-            upcall_cancel(&upcall);
+        /* the workers take over the client's security context */
+        if (!OpenThreadToken(GetCurrentThread(), TOKEN_IMPERSONATE |
+                TOKEN_QUERY, TRUE, &batch->token)) {
+            eprintf("OpenThreadToken() failed with %d\n", GetLastError());
+            batch->token = NULL;
         }
-        if (upcall.status != NFSD_VERSION_MISMATCH)
-            upcall_cleanup(&upcall);
-    }
-    CloseHandle(pipe);
 
+        batch_dispatch(batch);
+    }
     return GetLastError();
 }
 
+static int listeners_start(
+    IN nfs41_idmapper *idmapper,
+    OUT nfs41_process_thread *tids)
+{
+    int i, status = NO_ERROR;
+
+    InitializeCriticalSection(&batch_pool.lock);
+    batch_pool.limit = CreateSemaphore(NULL, MAX_BATCHES_IN_FLIGHT,
+        MAX_BATCHES_IN_FLIGHT, NULL);
+    if (batch_pool.limit == NULL) {
+        status = GetLastError();
+        eprintf("CreateSemaphore() failed with %d\n", status);
+        goto out;
+    }
+
+    upcall_pipe = CreateFile(NFS41_USER_DEVICE_NAME_A,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if (upcall_pipe == INVALID_HANDLE_VALUE) {
+        status = GetLastError();
+        eprintf("Unable to open upcall pipe %d\n", status);
+        goto out;
+    }
+
+    status = dispatch_init();
+    if (status)
+        goto out;
+
+    status = nfs41_lease_init();
+    if (status)
+        goto out;
+
+    for (i = 0; i < NUM_LISTENER_THREADS; i++) {
+        tids[i].handle = (HANDLE)_beginthreadex(NULL, 0, thread_main, 
+                idmapper, 0, &tids[i].tid);
+        if (tids[i].handle == NULL) {
+            status = GetLastError();
+            eprintf("_beginthreadex failed %d\n", status);
+            goto out;
+        }
+    }
+out:
+    return status;
+}
+
 #ifndef STANDALONE_NFSD
 VOID ServiceStop()
 {
@@ -176,11 +487,13 @@ static bool_t check_for_files()
 static void PrintUsage()
 {
     fprintf(stderr, "Usage: nfsd.exe -d <debug_level> --noldap "
-        "--uid <non-zero value> --gid\n");
+        "--uid <non-zero value> --gid --readahead <max KB, 0 to disable> "
+        "--writegather <max ms, 0 to disable> "
+        "--minworkers <threads> --maxworkers <threads>\n");
 }
 static bool_t parse_cmdlineargs(int argc, TCHAR *argv[], nfsd_args *out)
 {
-    int i;
+    int i, kb;
 
     /* set defaults. */
     out->debug_level = 1;
@@ -228,6 +541,52 @@ static bool_t parse_cmdlineargs(int argc, TCHAR *argv[], nfsd_args *out)
                 }
                 default_gid = _ttoi(argv[i]);
             }
+            else if (_tcscmp(argv[i], TEXT("--readahead")) == 0) { /* max read-ahead window */
+                ++i;
+                if (i >= argc) {
+                    fprintf(stderr, "Missing read-ahead size\n");
+                    PrintUsage();
+                    return FALSE;
+                }
+                kb = _ttoi(argv[i]);
+                if (kb < 0) {
+                    fprintf(stderr, "Invalid read-ahead size of %d\n", kb);
+                    return FALSE;
+                }
+                if (kb > READAHEAD_LIMIT / 1024) {
+                    fprintf(stderr, "Limiting read-ahead size of %d to %d\n",
+                        kb, READAHEAD_LIMIT / 1024);
+                    kb = READAHEAD_LIMIT / 1024;
+                }
+                readahead_max_size = (uint32_t)kb * 1024;
+            }
+            else if (_tcscmp(argv[i], TEXT("--writegather")) == 0) { /* small-write gathering delay */
+                ++i;
+                if (i >= argc) {
+                    fprintf(stderr, "Missing write gather delay\n");
+                    PrintUsage();
+                    return FALSE;
+                }
+                write_gather_delay = _ttoi(argv[i]);
+            }
+            else if (_tcscmp(argv[i], TEXT("--minworkers")) == 0) { /* smallest worker pool */
+                ++i;
+                if (i >= argc) {
+                    fprintf(stderr, "Missing minimum worker count\n");
+                    PrintUsage();
+                    return FALSE;
+                }
+                dispatch_min_workers = _ttoi(argv[i]);
+            }
+            else if (_tcscmp(argv[i], TEXT("--maxworkers")) == 0) { /* largest worker pool */
+                ++i;
+                if (i >= argc) {
+                    fprintf(stderr, "Missing maximum worker count\n");
+                    PrintUsage();
+                    return FALSE;
+                }
+                dispatch_max_workers = _ttoi(argv[i]);
+            }
             else
                 fprintf(stderr, "Unrecognized option '%s', disregarding.\n", argv[i]);
         }
@@ -359,7 +718,7 @@ VOID ServiceStart(DWORD argc, LPTSTR *argv)
     DWORD status = 0, len;
     // handle to our drivers
     HANDLE pipe;
-    nfs41_process_thread tids[MAX_NUM_THREADS];
+    nfs41_process_thread tids[NUM_LISTENER_THREADS];
     nfs41_idmapper *idmapper = NULL;
     int i;
     nfsd_args cmd_args;
@@ -424,15 +783,11 @@ VOID ServiceStart(DWORD argc, LPTSTR *argv)
       goto out_pipe;
 #endif
 
-    for (i = 0; i < MAX_NUM_THREADS; i++) {
-        tids[i].handle = (HANDLE)_beginthreadex(NULL, 0, thread_main, 
-                idmapper, 0, &tids[i].tid);
-        if (tids[i].handle == INVALID_HANDLE_VALUE) {
-            status = GetLastError();
-            eprintf("_beginthreadex failed %d\n", status);
-            goto out_pipe;
-        }
-    }
+    if (listeners_start(idmapper, tids))
+        goto out_pipe;
+
+    /* without the rings, every upcall goes through the listeners above */
+    upcall_ring_start(pipe, idmapper);
 #ifndef STANDALONE_NFSD
     // report the status to the service control manager.
     if (!ReportStatusToSCMgr(SERVICE_RUNNING, NO_ERROR, 0))
@@ -441,7 +796,7 @@ VOID ServiceStart(DWORD argc, LPTSTR *argv)
 #else
     //This can be changed to waiting on an array of handles and using waitformultipleobjects
     dprintf(1, "Parent waiting for children threads\n");
-    for (i = 0; i < MAX_NUM_THREADS; i++)
+    for (i = 0; i < NUM_LISTENER_THREADS; i++)
         WaitForSingleObject(tids[i].handle, INFINITE );
 #endif
     dprintf(1, "Parent woke up!!!!\n");
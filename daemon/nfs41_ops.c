@@ -35,6 +35,7 @@
 
 int nfs41_exchange_id(
     IN nfs41_rpc_clnt *rpc,
+    IN uint32_t conn,
     IN client_owner4 *owner,
     IN uint32_t flags_in,
     OUT nfs41_exchange_id_res *res_out)
@@ -56,7 +57,7 @@ int nfs41_exchange_id(
     res_out->server_owner.so_major_id_len = NFS4_OPAQUE_LIMIT;
     res_out->server_scope_len = NFS4_OPAQUE_LIMIT;
 
-    status = nfs41_send_compound(rpc, (char *)&compound.args,
+    status = nfs41_send_compound_conn(rpc, conn, (char *)&compound.args,
         (char *)&compound.res);
     if (status)
         goto out;
@@ -88,9 +89,11 @@ static int set_back_channel_attrs(
     IN uint32_t max_req,
     OUT nfs41_channel_attrs *attrs)
 {
+    /* callbacks don't carry file data, so there's no need to ask the
+     * server for buffers as large as the fore channel's */
     attrs->ca_headerpadsize = 0;
-    attrs->ca_maxrequestsize = rpc->wsize;
-    attrs->ca_maxresponsesize = rpc->rsize;
+    attrs->ca_maxrequestsize = min(rpc->wsize, NFS41_MAX_BACKCHANNEL_SIZE);
+    attrs->ca_maxresponsesize = min(rpc->rsize, NFS41_MAX_BACKCHANNEL_SIZE);
     attrs->ca_maxresponsesize_cached = NFS41_MAX_SERVER_CACHE;
     attrs->ca_maxoperations = 0xffffffff;
     attrs->ca_maxrequests = max_req;
@@ -173,17 +176,19 @@ int nfs41_create_session(nfs41_client *clnt, nfs41_session *session, bool_t try_
         "maxoperations", session->fore_chan_attrs.ca_maxoperations,
         "maxrequests", session->fore_chan_attrs.ca_maxrequests);
     dprintf(1, "client supports %d max rpc slots, but server has %d\n", 
-        session->table.max_slots, session->fore_chan_attrs.ca_maxrequests);
-    /* use the server's ca_maxrequests unless it's bigger than our array */
-    session->table.max_slots = min(session->table.max_slots,
+        NFS41_MAX_NUM_SLOTS, session->fore_chan_attrs.ca_maxrequests);
+    /* size the slot table to the server's ca_maxrequests */
+    status = nfs41_session_size_slots(session,
         session->fore_chan_attrs.ca_maxrequests);
-    status = 0;
+    if (status)
+        eprintf("nfs41_session_size_slots() failed with %d\n", status);
 out:
     return status;
 }
 
 enum nfsstat4 nfs41_bind_conn_to_session(
     IN nfs41_rpc_clnt *rpc,
+    IN uint32_t conn,
     IN const unsigned char *sessionid,
     IN enum channel_dir_from_client4 dir)
 {
@@ -200,7 +205,7 @@ enum nfsstat4 nfs41_bind_conn_to_session(
     bind_args.sessionid = (unsigned char *)sessionid;
     bind_args.dir = dir;
 
-    status = nfs41_send_compound(rpc,
+    status = nfs41_send_compound_conn(rpc, conn,
         (char*)&compound.args, (char*)&compound.res);
     if (status)
         goto out;
@@ -363,6 +368,15 @@ retry_cache_insert:
     }
 }
 
+/* the compound's tags, and every GETATTR result's attr_vals, take 1K
+ * each.  the builders that need several of them keep their compound and
+ * results in the per-thread arena instead of on the worker's stack */
+struct open_scratch {
+    nfs41_compound          compound;
+    nfs41_getattr_res       getattr_res;
+    nfs41_getattr_res       pgetattr_res;
+};
+
 int nfs41_open(
     IN nfs41_session *session,
     IN nfs41_path_fh *parent,
@@ -380,7 +394,10 @@ int nfs41_open(
     OUT OPTIONAL nfs41_file_info *info)
 {
     int status;
-    nfs41_compound compound;
+    struct open_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
+    nfs41_getattr_res *pgetattr_res;
     nfs_argop4 argops[8];
     nfs_resop4 resops[8];
     nfs41_sequence_args sequence_args;
@@ -392,7 +409,6 @@ int nfs41_open(
     nfs41_getfh_res getfh_res;
     bitmap4 attr_request;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res, pgetattr_res;
     nfs41_savefh_res savefh_res;
     nfs41_restorefh_res restorefh_res;
     nfs41_file_info tmp_info, dir_info;
@@ -400,6 +416,13 @@ int nfs41_open(
     bool_t already_delegated = delegation->type == OPEN_DELEGATE_READ
         || delegation->type == OPEN_DELEGATE_WRITE;
 
+    scratch = compound_arena_alloc(sizeof(struct open_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
+    pgetattr_res = &scratch->pgetattr_res;
+
     /* depending on the claim type, OPEN expects CURRENT_FH set
      * to either the parent directory, or to the file itself */
     switch (claim->claim) {
@@ -429,26 +452,26 @@ int nfs41_open(
 
     attr_request.arr[0] |= FATTR4_WORD0_FSID;
 
-    compound_init(&compound, argops, resops, "open");
+    compound_init(compound, argops, resops, "open");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 1);
 
     if (current_fh_is_dir) {
         /* CURRENT_FH: directory */
-        compound_add_op(&compound, OP_PUTFH, &putfh_args[0], &putfh_res[0]);
+        compound_add_op(compound, OP_PUTFH, &putfh_args[0], &putfh_res[0]);
         putfh_args[0].file = parent;
         putfh_args[0].in_recovery = 0;
 
-        compound_add_op(&compound, OP_SAVEFH, NULL, &savefh_res);
+        compound_add_op(compound, OP_SAVEFH, NULL, &savefh_res);
     } else {
         /* CURRENT_FH: file being opened */
-        compound_add_op(&compound, OP_PUTFH, &putfh_args[0], &putfh_res[0]);
+        compound_add_op(compound, OP_PUTFH, &putfh_args[0], &putfh_res[0]);
         putfh_args[0].file = file;
         putfh_args[0].in_recovery = 0;
     }
 
-    compound_add_op(&compound, OP_OPEN, &open_args, &open_res);
+    compound_add_op(compound, OP_OPEN, &open_args, &open_res);
     open_args.seqid = 0;
 #ifdef DISABLE_FILE_DELEGATIONS
     open_args.share_access = allow | OPEN4_SHARE_ACCESS_WANT_NO_DELEG;
@@ -477,33 +500,33 @@ int nfs41_open(
     open_res.resok4.delegation = delegation;
 
     if (current_fh_is_dir) {
-        compound_add_op(&compound, OP_GETFH, NULL, &getfh_res);
+        compound_add_op(compound, OP_GETFH, NULL, &getfh_res);
         getfh_res.fh = &file->fh;
     }
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = &attr_request;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = info;
 
     if (current_fh_is_dir) {
-        compound_add_op(&compound, OP_RESTOREFH, NULL, &restorefh_res);
+        compound_add_op(compound, OP_RESTOREFH, NULL, &restorefh_res);
     } else {
-        compound_add_op(&compound, OP_PUTFH, &putfh_args[1], &putfh_res[1]);
+        compound_add_op(compound, OP_PUTFH, &putfh_args[1], &putfh_res[1]);
         putfh_args[1].file = parent;
         putfh_args[1].in_recovery = 0;
     }
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &pgetattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, pgetattr_res);
     getattr_args.attr_request = &attr_request;
-    pgetattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    pgetattr_res.info = &dir_info;
+    pgetattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    pgetattr_res->info = &dir_info;
 
-    status = compound_encode_send_decode(session, &compound, try_recovery);
+    status = compound_encode_send_decode(session, compound, try_recovery);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     if (dir_info.type == NF4ATTRDIR) {
@@ -522,11 +545,18 @@ int nfs41_open(
 
     /* update the name/attr cache with the results */
     open_update_cache(session, parent, file, try_recovery, delegation,
-        already_delegated, &open_res.resok4.cinfo, &pgetattr_res, &getattr_res);
+        already_delegated, &open_res.resok4.cinfo, pgetattr_res, getattr_res);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
+struct create_scratch {
+    nfs41_compound          compound;
+    nfs41_getattr_res       getattr_res;
+    nfs41_getattr_res       pgetattr_res;
+};
+
 int nfs41_create(
     IN nfs41_session *session,
     IN uint32_t type,
@@ -537,7 +567,10 @@ int nfs41_create(
     OUT nfs41_file_info *info)
 {
     int status;
-    nfs41_compound compound;
+    struct create_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
+    nfs41_getattr_res *pgetattr_res;
     nfs_argop4 argops[8];
     nfs_resop4 resops[8];
     nfs41_sequence_args sequence_args;
@@ -548,26 +581,32 @@ int nfs41_create(
     nfs41_create_res create_res;
     nfs41_getfh_res getfh_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res, pgetattr_res;
     bitmap4 attr_request;
     nfs41_file_info dir_info;
     nfs41_savefh_res savefh_res;
     nfs41_restorefh_res restorefh_res;
 
+    scratch = compound_arena_alloc(sizeof(struct create_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
+    pgetattr_res = &scratch->pgetattr_res;
+
     nfs41_superblock_getattr_mask(parent->fh.superblock, &attr_request);
 
-    compound_init(&compound, argops, resops, "create");
+    compound_init(compound, argops, resops, "create");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 1);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = parent;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_SAVEFH, NULL, &savefh_res);
+    compound_add_op(compound, OP_SAVEFH, NULL, &savefh_res);
 
-    compound_add_op(&compound, OP_CREATE, &create_args, &create_res);
+    compound_add_op(compound, OP_CREATE, &create_args, &create_res);
     create_args.objtype.type = type;
     if (type == NF4LNK) {
         create_args.objtype.u.lnk.linkdata = symlink;
@@ -578,26 +617,26 @@ int nfs41_create(
     nfs41_superblock_supported_attrs(
                 parent->fh.superblock, &createattrs->attrmask);
 
-    compound_add_op(&compound, OP_GETFH, NULL, &getfh_res);
+    compound_add_op(compound, OP_GETFH, NULL, &getfh_res);
     getfh_res.fh = &file->fh;
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = &attr_request;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = info;
 
-    compound_add_op(&compound, OP_RESTOREFH, NULL, &restorefh_res);
+    compound_add_op(compound, OP_RESTOREFH, NULL, &restorefh_res);
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &pgetattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, pgetattr_res);
     getattr_args.attr_request = &attr_request;
-    pgetattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    pgetattr_res.info = &dir_info;
+    pgetattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    pgetattr_res->info = &dir_info;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     /* fill in the file handle's fileid and superblock */
@@ -605,13 +644,13 @@ int nfs41_create(
     file->fh.superblock = parent->fh.superblock;
 
     /* update the attributes of the parent directory */
-    memcpy(&dir_info.attrmask, &pgetattr_res.obj_attributes.attrmask,
+    memcpy(&dir_info.attrmask, &pgetattr_res->obj_attributes.attrmask,
         sizeof(bitmap4));
     nfs41_attr_cache_update(session_name_cache(session),
         parent->fh.fileid, &dir_info);
 
     /* add the new file handle and attributes to the name cache */
-    memcpy(&info->attrmask, &getattr_res.obj_attributes.attrmask,
+    memcpy(&info->attrmask, &getattr_res->obj_attributes.attrmask,
         sizeof(bitmap4));
     AcquireSRWLockShared(&file->path->lock);
     nfs41_name_cache_insert(session_name_cache(session),
@@ -621,16 +660,25 @@ int nfs41_create(
 
     nfs41_superblock_space_changed(file->fh.superblock);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
+/* for the builders with a single GETATTR */
+struct getattr_scratch {
+    nfs41_compound          compound;
+    nfs41_getattr_res       getattr_res;
+};
+
 int nfs41_close(
     IN nfs41_session *session,
     IN nfs41_path_fh *file,
     IN stateid_arg *stateid)
 {
     int status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[4];
     nfs_resop4 resops[4];
     nfs41_sequence_args sequence_args;
@@ -640,45 +688,51 @@ int nfs41_close(
     nfs41_op_close_args close_args;
     nfs41_op_close_res close_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res;
     bitmap4 attr_request;
     nfs41_file_info info;
 
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
+
     nfs41_superblock_getattr_mask(file->fh.superblock, &attr_request);
 
-    compound_init(&compound, argops, resops, "close");
+    compound_init(compound, argops, resops, "close");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 1);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = file;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_CLOSE, &close_args, &close_res);
+    compound_add_op(compound, OP_CLOSE, &close_args, &close_res);
     close_args.stateid = stateid;
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = &attr_request;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = &info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = &info;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     if (info.type == NF4NAMEDATTR)
         goto out;
 
     /* update the attributes of the parent directory */
-    memcpy(&info.attrmask, &getattr_res.obj_attributes.attrmask,
+    memcpy(&info.attrmask, &getattr_res->obj_attributes.attrmask,
         sizeof(bitmap4));
     nfs41_attr_cache_update(session_name_cache(session),
         file->fh.fileid, &info);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -695,7 +749,9 @@ int nfs41_write(
     OUT nfs41_file_info *cinfo)
 {
     int status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[4];
     nfs_resop4 resops[4];
     nfs41_sequence_args sequence_args;
@@ -705,23 +761,28 @@ int nfs41_write(
     nfs41_write_args write_args;
     nfs41_write_res write_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res = {0};
     bitmap4 attr_request;
     nfs41_file_info info = { 0 }, *pinfo;
 
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
+
     nfs41_superblock_getattr_mask(file->fh.superblock, &attr_request);
 
-    compound_init(&compound, argops, resops,
+    compound_init(compound, argops, resops,
         stateid->stateid.seqid == 0 ? "ds write" : "write");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 0);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = file;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_WRITE, &write_args, &write_res);
+    compound_add_op(compound, OP_WRITE, &write_args, &write_res);
     write_args.stateid = stateid;
     write_args.offset = offset;
     write_args.stable = stable;
@@ -735,22 +796,22 @@ int nfs41_write(
     if (stable != UNSTABLE4) {
         /* if the write is stable, we can't rely on COMMIT to update
          * the attribute cache, so we do the GETATTR here */
-        compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+        compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
         getattr_args.attr_request = &attr_request;
-        getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-        getattr_res.info = pinfo;
+        getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+        getattr_res->info = pinfo;
     }
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     if (stable != UNSTABLE4 && pinfo->type != NF4NAMEDATTR) {
         /* update the attribute cache */
-        memcpy(&pinfo->attrmask, &getattr_res.obj_attributes.attrmask,
+        memcpy(&pinfo->attrmask, &getattr_res->obj_attributes.attrmask,
             sizeof(bitmap4));
         nfs41_attr_cache_update(session_name_cache(session),
             file->fh.fileid, pinfo);
@@ -768,6 +829,7 @@ int nfs41_write(
 
     nfs41_superblock_space_changed(file->fh.superblock);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -840,7 +902,9 @@ int nfs41_commit(
     OUT nfs41_file_info *cinfo)
 {
     int status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[4];
     nfs_resop4 resops[4];
     nfs41_sequence_args sequence_args;
@@ -850,21 +914,26 @@ int nfs41_commit(
     nfs41_commit_args commit_args;
     nfs41_commit_res commit_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res = {0};
     bitmap4 attr_request;
     nfs41_file_info info, *pinfo;
 
-    compound_init(&compound, argops, resops,
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
+
+    compound_init(compound, argops, resops,
         do_getattr ? "commit" : "ds commit");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 1);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = file;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_COMMIT, &commit_args, &commit_res);
+    compound_add_op(compound, OP_COMMIT, &commit_args, &commit_res);
     commit_args.offset = offset;
     commit_args.count = count;
     commit_res.verf = verf;
@@ -876,31 +945,37 @@ int nfs41_commit(
     if (do_getattr) {
         nfs41_superblock_getattr_mask(file->fh.superblock, &attr_request);
 
-        compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+        compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
         getattr_args.attr_request = &attr_request;
-        getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-        getattr_res.info = pinfo;
+        getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+        getattr_res->info = pinfo;
     }
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     if (do_getattr) {
         /* update the attribute cache */
-        memcpy(&pinfo->attrmask, &getattr_res.obj_attributes.attrmask,
+        memcpy(&pinfo->attrmask, &getattr_res->obj_attributes.attrmask,
             sizeof(bitmap4));
         nfs41_attr_cache_update(session_name_cache(session),
             file->fh.fileid, pinfo);
     }
     nfs41_superblock_space_changed(file->fh.superblock);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
+struct lock_scratch {
+    nfs41_compound          compound;
+    nfs41_lock_res          lock_res;
+};
+
 int nfs41_lock(
     IN nfs41_session *session,
     IN nfs41_path_fh *file,
@@ -913,7 +988,9 @@ int nfs41_lock(
     IN OUT stateid_arg *stateid)
 {
     int status;
-    nfs41_compound compound;
+    struct lock_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_lock_res *lock_res;
     nfs_argop4 argops[3];
     nfs_resop4 resops[3];
     nfs41_sequence_args sequence_args;
@@ -921,18 +998,23 @@ int nfs41_lock(
     nfs41_putfh_args putfh_args;
     nfs41_putfh_res putfh_res;
     nfs41_lock_args lock_args;
-    nfs41_lock_res lock_res;
 
-    compound_init(&compound, argops, resops, "lock");
+    scratch = compound_arena_alloc(sizeof(struct lock_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    lock_res = &scratch->lock_res;
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_init(compound, argops, resops, "lock");
+
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 0);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = file;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_LOCK, &lock_args, &lock_res);
+    compound_add_op(compound, OP_LOCK, &lock_args, lock_res);
     lock_args.locktype = type;
     lock_args.reclaim = reclaim;
     lock_args.offset = offset;
@@ -948,18 +1030,19 @@ int nfs41_lock(
         lock_args.locker.u.open_owner.lock_seqid = 0; /* ignored */
         lock_args.locker.u.open_owner.lock_owner = owner;
     }
-    lock_res.u.resok4.lock_stateid = &stateid->stateid;
-    lock_res.u.denied.owner.owner_len = NFS4_OPAQUE_LIMIT;
+    lock_res->u.resok4.lock_stateid = &stateid->stateid;
+    lock_res->u.denied.owner.owner_len = NFS4_OPAQUE_LIMIT;
 
-    status = compound_encode_send_decode(session, &compound, try_recovery);
+    status = compound_encode_send_decode(session, compound, try_recovery);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     stateid->type = STATEID_LOCK; /* returning a lock stateid */
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -1007,6 +1090,10 @@ out:
     return status;
 }
 
+struct readdir_scratch {
+    nfs41_compound          compound;
+};
+
 int nfs41_readdir(
     IN nfs41_session *session,
     IN nfs41_path_fh *file,
@@ -1017,7 +1104,8 @@ int nfs41_readdir(
     OUT bool_t *eof_out)
 {
     int status;
-    nfs41_compound compound;
+    struct readdir_scratch *scratch;
+    nfs41_compound *compound;
     nfs_argop4 argops[3];
     nfs_resop4 resops[3];
     nfs41_sequence_args sequence_args;
@@ -1027,16 +1115,21 @@ int nfs41_readdir(
     nfs41_readdir_args readdir_args;
     nfs41_readdir_res readdir_res;
 
-    compound_init(&compound, argops, resops, "readdir");
+    scratch = compound_arena_alloc(sizeof(struct readdir_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_init(compound, argops, resops, "readdir");
+
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 0);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = file;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_READDIR, &readdir_args, &readdir_res);
+    compound_add_op(compound, OP_READDIR, &readdir_args, &readdir_res);
     readdir_args.cookie.cookie = cookie->cookie;
     memcpy(readdir_args.cookie.verf, cookie->verf, NFS4_VERIFIER_SIZE);
     readdir_args.dircount = *entries_len;
@@ -1044,19 +1137,19 @@ int nfs41_readdir(
     readdir_args.attr_request = attr_request;
     readdir_res.reply.entries_len = *entries_len;
     readdir_res.reply.entries = entries;
-    ZeroMemory(entries, readdir_args.dircount);
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     *entries_len = readdir_res.reply.entries_len;
     *eof_out = readdir_res.reply.eof;
     memcpy(cookie->verf, readdir_res.cookieverf, NFS4_VERIFIER_SIZE);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -1067,7 +1160,9 @@ int nfs41_getattr(
     OUT nfs41_file_info *info)
 {
     int status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[3];
     nfs_resop4 resops[3];
     nfs41_sequence_args sequence_args;
@@ -1075,41 +1170,131 @@ int nfs41_getattr(
     nfs41_putfh_args putfh_args;
     nfs41_putfh_res putfh_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res;
 
-    compound_init(&compound, argops, resops, "getattr");
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_init(compound, argops, resops, "getattr");
+
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 0);
 
     if (file) {
-        compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+        compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
         putfh_args.file = file;
         putfh_args.in_recovery = 0;
     } else {
-        compound_add_op(&compound, OP_PUTROOTFH, NULL, &putfh_res);
+        compound_add_op(compound, OP_PUTROOTFH, NULL, &putfh_res);
     }
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = attr_request;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = info;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     if (file) {
         /* update the name cache with whatever attributes we got */
-        memcpy(&info->attrmask, &getattr_res.obj_attributes.attrmask,
+        memcpy(&info->attrmask, &getattr_res->obj_attributes.attrmask,
             sizeof(bitmap4));
         nfs41_attr_cache_update(session_name_cache(session),
             file->fh.fileid, info);
     }
 out:
+    compound_arena_free(scratch);
+    return status;
+}
+
+struct getattr_array_scratch {
+    nfs41_compound          compound;
+    nfs_argop4              argops[1+2*GETATTR_ARRAY_MAX];
+    nfs_resop4              resops[1+2*GETATTR_ARRAY_MAX];
+    nfs41_putfh_args        putfh_args[GETATTR_ARRAY_MAX];
+    nfs41_putfh_res         putfh_res[GETATTR_ARRAY_MAX];
+    nfs41_getattr_res       getattr_res[GETATTR_ARRAY_MAX];
+};
+
+int nfs41_getattr_array(
+    IN nfs41_session *session,
+    IN nfs41_path_fh **files,
+    IN uint32_t count,
+    IN bitmap4 *attr_request,
+    OUT nfs41_file_info *info,
+    OUT uint32_t *index_out)
+{
+    int status;
+    struct getattr_array_scratch *scratch;
+    nfs41_compound *compound;
+    nfs_argop4 *argops;
+    nfs_resop4 *resops;
+    nfs41_putfh_args *putfh_args;
+    nfs41_putfh_res *putfh_res;
+    nfs41_getattr_res *getattr_res;
+    nfs41_sequence_args sequence_args;
+    nfs41_sequence_res sequence_res;
+    nfs41_getattr_args getattr_args;
+    uint32_t i;
+
+    scratch = compound_arena_alloc(sizeof(struct getattr_array_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    argops = scratch->argops;
+    resops = scratch->resops;
+    putfh_args = scratch->putfh_args;
+    putfh_res = scratch->putfh_res;
+    getattr_res = scratch->getattr_res;
+
+    *index_out = count;
+
+    compound_init(compound, argops, resops, "getattr_array");
+
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    nfs41_session_sequence(&sequence_args, session, 0);
+
+    /* every GETATTR shares the same arguments */
+    getattr_args.attr_request = attr_request;
+
+    for (i = 0; i < count; i++) {
+        compound_add_op(compound, OP_PUTFH, &putfh_args[i], &putfh_res[i]);
+        putfh_args[i].file = files[i];
+        putfh_args[i].in_recovery = 0;
+
+        compound_add_op(compound, OP_GETATTR, &getattr_args, &getattr_res[i]);
+        getattr_res[i].obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+        getattr_res[i].info = &info[i];
+    }
+
+    status = compound_encode_send_decode(session, compound, TRUE);
+    if (status)
+        goto out;
+
+    if (compound_error(status = compound->res.status)) {
+        /* the compound stops at the first error; after SEQUENCE,
+         * each file has a PUTFH and GETATTR result */
+        if (compound->res.resarray_count < 2)
+            goto out;
+        *index_out = (compound->res.resarray_count - 2) / 2;
+    }
+
+    /* update the name cache with whatever attributes we got */
+    for (i = 0; i < *index_out; i++) {
+        memcpy(&info[i].attrmask, &getattr_res[i].obj_attributes.attrmask,
+            sizeof(bitmap4));
+        nfs41_attr_cache_update(session_name_cache(session),
+            files[i]->fh.fileid, &info[i]);
+    }
+out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -1121,7 +1306,9 @@ int nfs41_superblock_getattr(
     OUT bool_t *supports_named_attrs)
 {
     int status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[4];
     nfs_resop4 resops[4];
     nfs41_sequence_args sequence_args;
@@ -1129,28 +1316,33 @@ int nfs41_superblock_getattr(
     nfs41_putfh_args putfh_args;
     nfs41_putfh_res putfh_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res;
     nfs41_openattr_args openattr_args;
     nfs41_openattr_res openattr_res;
 
-    compound_init(&compound, argops, resops, "getfsattr");
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_init(compound, argops, resops, "getfsattr");
+
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 0);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = file;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = attr_request;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = info;
 
-    compound_add_op(&compound, OP_OPENATTR, &openattr_args, &openattr_res);
+    compound_add_op(compound, OP_OPENATTR, &openattr_args, &openattr_res);
     openattr_args.createdir = 0;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
@@ -1158,7 +1350,7 @@ int nfs41_superblock_getattr(
     if (status) goto out;
     status = putfh_res.status;
     if (status) goto out;
-    status = getattr_res.status;
+    status = getattr_res->status;
     if (status) goto out;
 
     switch (status = openattr_res.status) {
@@ -1174,6 +1366,7 @@ int nfs41_superblock_getattr(
         break;
     }
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -1184,7 +1377,9 @@ int nfs41_remove(
     IN uint64_t fileid)
 {
     int status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[4];
     nfs_resop4 resops[4];
     nfs41_sequence_args sequence_args;
@@ -1194,41 +1389,46 @@ int nfs41_remove(
     nfs41_remove_args remove_args;
     nfs41_remove_res remove_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res;
     bitmap4 attr_request;
     nfs41_file_info info;
 
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
+
     nfs41_superblock_getattr_mask(parent->fh.superblock, &attr_request);
 
-    compound_init(&compound, argops, resops, "remove");
+    compound_init(compound, argops, resops, "remove");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 1);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = parent;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_REMOVE, &remove_args, &remove_res);
+    compound_add_op(compound, OP_REMOVE, &remove_args, &remove_res);
     remove_args.target = target;
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = &attr_request;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = &info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = &info;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     if (info.type == NF4ATTRDIR)
         goto out;
 
     /* update the attributes of the parent directory */
-    memcpy(&info.attrmask, &getattr_res.obj_attributes.attrmask,
+    memcpy(&info.attrmask, &getattr_res->obj_attributes.attrmask,
         sizeof(bitmap4));
     nfs41_attr_cache_update(session_name_cache(session),
         parent->fh.fileid, &info);
@@ -1241,9 +1441,16 @@ int nfs41_remove(
 
     nfs41_superblock_space_changed(parent->fh.superblock);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
+struct rename_scratch {
+    nfs41_compound          compound;
+    nfs41_getattr_res       src_getattr_res;
+    nfs41_getattr_res       dst_getattr_res;
+};
+
 int nfs41_rename(
     IN nfs41_session *session,
     IN nfs41_path_fh *src_dir,
@@ -1252,7 +1459,10 @@ int nfs41_rename(
     IN const nfs41_component *dst_name)
 {
     int status;
-    nfs41_compound compound;
+    struct rename_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *src_getattr_res;
+    nfs41_getattr_res *dst_getattr_res;
     nfs_argop4 argops[8];
     nfs_resop4 resops[8];
     nfs41_sequence_args sequence_args;
@@ -1265,58 +1475,64 @@ int nfs41_rename(
     nfs41_rename_args rename_args;
     nfs41_rename_res rename_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res src_getattr_res, dst_getattr_res;
     nfs41_file_info src_info, dst_info;
     bitmap4 attr_request;
     nfs41_restorefh_res restorefh_res;
 
+    scratch = compound_arena_alloc(sizeof(struct rename_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    src_getattr_res = &scratch->src_getattr_res;
+    dst_getattr_res = &scratch->dst_getattr_res;
+
     nfs41_superblock_getattr_mask(src_dir->fh.superblock, &attr_request);
 
-    compound_init(&compound, argops, resops, "rename");
+    compound_init(compound, argops, resops, "rename");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 1);
 
-    compound_add_op(&compound, OP_PUTFH, &src_putfh_args, &src_putfh_res);
+    compound_add_op(compound, OP_PUTFH, &src_putfh_args, &src_putfh_res);
     src_putfh_args.file = src_dir;
     src_putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_SAVEFH, NULL, &savefh_res);
+    compound_add_op(compound, OP_SAVEFH, NULL, &savefh_res);
 
-    compound_add_op(&compound, OP_PUTFH, &dst_putfh_args, &dst_putfh_res);
+    compound_add_op(compound, OP_PUTFH, &dst_putfh_args, &dst_putfh_res);
     dst_putfh_args.file = dst_dir;
     dst_putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_RENAME, &rename_args, &rename_res);
+    compound_add_op(compound, OP_RENAME, &rename_args, &rename_res);
     rename_args.oldname = src_name;
     rename_args.newname = dst_name;
     
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &dst_getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, dst_getattr_res);
     getattr_args.attr_request = &attr_request;
-    dst_getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    dst_getattr_res.info = &dst_info;
+    dst_getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    dst_getattr_res->info = &dst_info;
 
-    compound_add_op(&compound, OP_RESTOREFH, NULL, &restorefh_res);
+    compound_add_op(compound, OP_RESTOREFH, NULL, &restorefh_res);
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &src_getattr_res);
-    src_getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    src_getattr_res.info = &src_info;
+    compound_add_op(compound, OP_GETATTR, &getattr_args, src_getattr_res);
+    src_getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    src_getattr_res->info = &src_info;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     /* update the attributes of the source directory */
-    memcpy(&src_info.attrmask, &src_getattr_res.obj_attributes.attrmask,
+    memcpy(&src_info.attrmask, &src_getattr_res->obj_attributes.attrmask,
         sizeof(bitmap4));
     nfs41_attr_cache_update(session_name_cache(session),
         src_dir->fh.fileid, &src_info);
 
     /* update the attributes of the destination directory */
-    memcpy(&dst_info.attrmask, &dst_getattr_res.obj_attributes.attrmask,
+    memcpy(&dst_info.attrmask, &dst_getattr_res->obj_attributes.attrmask,
         sizeof(bitmap4));
     nfs41_attr_cache_update(session_name_cache(session),
         dst_dir->fh.fileid, &dst_info);
@@ -1345,6 +1561,7 @@ int nfs41_rename(
         ReleaseSRWLockShared(&dst_dir->path->lock);
     }
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -1355,7 +1572,9 @@ int nfs41_setattr(
     IN nfs41_file_info *info)
 {
     int status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[4];
     nfs_resop4 resops[4];
     nfs41_sequence_args sequence_args;
@@ -1365,33 +1584,38 @@ int nfs41_setattr(
     nfs41_setattr_args setattr_args;
     nfs41_setattr_res setattr_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res;
     bitmap4 attr_request;
 
-    compound_init(&compound, argops, resops, "setattr");
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_init(compound, argops, resops, "setattr");
+
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 0);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = file;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_SETATTR, &setattr_args, &setattr_res);
+    compound_add_op(compound, OP_SETATTR, &setattr_args, &setattr_res);
     setattr_args.stateid = stateid;
     setattr_args.info = info;
 
     nfs41_superblock_getattr_mask(file->fh.superblock, &attr_request);
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = &attr_request;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = info;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     memcpy(&info->attrmask, &attr_request, sizeof(bitmap4));
@@ -1401,9 +1625,15 @@ int nfs41_setattr(
     if (setattr_res.attrsset.arr[0] & FATTR4_WORD0_SIZE)
         nfs41_superblock_space_changed(file->fh.superblock);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
+struct link_scratch {
+    nfs41_compound          compound;
+    nfs41_getattr_res       getattr_res[2];
+};
+
 int nfs41_link(
     IN nfs41_session *session,
     IN nfs41_path_fh *src,
@@ -1412,7 +1642,9 @@ int nfs41_link(
     OUT nfs41_file_info *cinfo)
 {
     int status;
-    nfs41_compound compound;
+    struct link_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[9];
     nfs_resop4 resops[9];
     nfs41_sequence_args sequence_args;
@@ -1426,59 +1658,64 @@ int nfs41_link(
     nfs41_lookup_res lookup_res;
     nfs41_getfh_res getfh_res;
     nfs41_getattr_args getattr_args[2];
-    nfs41_getattr_res getattr_res[2];
     nfs41_file_info info = { 0 };
     nfs41_path_fh file;
 
+    scratch = compound_arena_alloc(sizeof(struct link_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = scratch->getattr_res;
+
     nfs41_superblock_getattr_mask(src->fh.superblock, &info.attrmask);
     nfs41_superblock_getattr_mask(dst_dir->fh.superblock, &cinfo->attrmask);
     cinfo->attrmask.arr[0] |= FATTR4_WORD0_FSID;
 
-    compound_init(&compound, argops, resops, "link");
+    compound_init(compound, argops, resops, "link");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 1);
 
     /* PUTFH(src) */
-    compound_add_op(&compound, OP_PUTFH, &putfh_args[0], &putfh_res[0]);
+    compound_add_op(compound, OP_PUTFH, &putfh_args[0], &putfh_res[0]);
     putfh_args[0].file = src;
     putfh_args[0].in_recovery = 0;
 
-    compound_add_op(&compound, OP_SAVEFH, NULL, &savefh_res);
+    compound_add_op(compound, OP_SAVEFH, NULL, &savefh_res);
 
     /* PUTFH(dst_dir) */
-    compound_add_op(&compound, OP_PUTFH, &putfh_args[1], &putfh_res[1]);
+    compound_add_op(compound, OP_PUTFH, &putfh_args[1], &putfh_res[1]);
     putfh_args[1].file = dst_dir;
     putfh_args[1].in_recovery = 0;
 
-    compound_add_op(&compound, OP_LINK, &link_args, &link_res);
+    compound_add_op(compound, OP_LINK, &link_args, &link_res);
     link_args.newname = target;
 
     /* GETATTR(dst_dir) */
-    compound_add_op(&compound, OP_GETATTR, &getattr_args[0], &getattr_res[0]);
+    compound_add_op(compound, OP_GETATTR, &getattr_args[0], &getattr_res[0]);
     getattr_args[0].attr_request = &info.attrmask;
     getattr_res[0].obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
     getattr_res[0].info = &info;
 
     /* LOOKUP(target) */
-    compound_add_op(&compound, OP_LOOKUP, &lookup_args, &lookup_res);
+    compound_add_op(compound, OP_LOOKUP, &lookup_args, &lookup_res);
     lookup_args.name = target;
 
     /* GETATTR(target) */
-    compound_add_op(&compound, OP_GETATTR, &getattr_args[1], &getattr_res[1]);
+    compound_add_op(compound, OP_GETATTR, &getattr_args[1], &getattr_res[1]);
     getattr_args[1].attr_request = &cinfo->attrmask;
     getattr_res[1].obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
     getattr_res[1].info = cinfo;
 
     /* GETFH(target) */
-    compound_add_op(&compound, OP_GETFH, NULL, &getfh_res);
+    compound_add_op(compound, OP_GETFH, NULL, &getfh_res);
     getfh_res.fh = &file.fh;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     /* fill in the file handle's fileid and superblock */
@@ -1505,6 +1742,7 @@ int nfs41_link(
 
     nfs41_superblock_space_changed(dst_dir->fh.superblock);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -1741,7 +1979,9 @@ enum nfsstat4 nfs41_fs_locations(
     OUT fs_locations4 *locations)
 {
     enum nfsstat4 status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[4];
     nfs_resop4 resops[4];
     nfs41_sequence_args sequence_args;
@@ -1751,34 +1991,40 @@ enum nfsstat4 nfs41_fs_locations(
     nfs41_lookup_args lookup_args;
     nfs41_lookup_res lookup_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res;
     bitmap4 attr_request = { 1, { FATTR4_WORD0_FS_LOCATIONS } };
     nfs41_file_info info;
 
-    compound_init(&compound, argops, resops, "fs_locations");
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_init(compound, argops, resops, "fs_locations");
+
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 0);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = parent;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_LOOKUP, &lookup_args, &lookup_res);
+    compound_add_op(compound, OP_LOOKUP, &lookup_args, &lookup_res);
     lookup_args.name = name;
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = &attr_request;
     info.fs_locations = locations;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = &info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = &info;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    compound_error(status = compound.res.status);
+    compound_error(status = compound->res.status);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
@@ -2007,7 +2253,9 @@ enum nfsstat4 pnfs_rpc_layoutcommit(
     OUT nfs41_file_info *info)
 {
     enum nfsstat4 status;
-    nfs41_compound compound;
+    struct getattr_scratch *scratch;
+    nfs41_compound *compound;
+    nfs41_getattr_res *getattr_res;
     nfs_argop4 argops[4];
     nfs_resop4 resops[4];
     nfs41_sequence_args sequence_args;
@@ -2017,45 +2265,51 @@ enum nfsstat4 pnfs_rpc_layoutcommit(
     pnfs_layoutcommit_args lc_args;
     pnfs_layoutcommit_res lc_res;
     nfs41_getattr_args getattr_args;
-    nfs41_getattr_res getattr_res;
     bitmap4 attr_request;
 
+    scratch = compound_arena_alloc(sizeof(struct getattr_scratch));
+    if (scratch == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    compound = &scratch->compound;
+    getattr_res = &scratch->getattr_res;
+
     nfs41_superblock_getattr_mask(file->fh.superblock, &attr_request);
 
-    compound_init(&compound, argops, resops, "layoutcommit");
+    compound_init(compound, argops, resops, "layoutcommit");
 
-    compound_add_op(&compound, OP_SEQUENCE, &sequence_args, &sequence_res);
+    compound_add_op(compound, OP_SEQUENCE, &sequence_args, &sequence_res);
     nfs41_session_sequence(&sequence_args, session, 0);
 
-    compound_add_op(&compound, OP_PUTFH, &putfh_args, &putfh_res);
+    compound_add_op(compound, OP_PUTFH, &putfh_args, &putfh_res);
     putfh_args.file = file;
     putfh_args.in_recovery = 0;
 
-    compound_add_op(&compound, OP_LAYOUTCOMMIT, &lc_args, &lc_res);
+    compound_add_op(compound, OP_LAYOUTCOMMIT, &lc_args, &lc_res);
     lc_args.offset = offset;
     lc_args.length = length;
     lc_args.stateid = stateid;
     lc_args.new_time = new_time_modify;
     lc_args.new_offset = new_last_offset;
 
-    compound_add_op(&compound, OP_GETATTR, &getattr_args, &getattr_res);
+    compound_add_op(compound, OP_GETATTR, &getattr_args, getattr_res);
     getattr_args.attr_request = &attr_request;
-    getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
-    getattr_res.info = info;
+    getattr_res->obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    getattr_res->info = info;
 
-    status = compound_encode_send_decode(session, &compound, TRUE);
+    status = compound_encode_send_decode(session, compound, TRUE);
     if (status)
         goto out;
 
-    if (compound_error(status = compound.res.status))
+    if (compound_error(status = compound->res.status))
         goto out;
 
     /* update the attribute cache */
-    memcpy(&info->attrmask, &getattr_res.obj_attributes.attrmask,
+    memcpy(&info->attrmask, &getattr_res->obj_attributes.attrmask,
         sizeof(bitmap4));
     nfs41_attr_cache_update(session_name_cache(session),
         file->fh.fileid, info);
 out:
+    compound_arena_free(scratch);
     return status;
 }
 
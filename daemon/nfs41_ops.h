@@ -582,13 +582,6 @@ enum {
     OPEN4_SHARE_ACCESS_WANT_PUSH_DELEG_WHEN_UNCONTENDED = 0x20000
 };
 
-enum open_delegation_type4 {
-    OPEN_DELEGATE_NONE      = 0,
-    OPEN_DELEGATE_READ      = 1,
-    OPEN_DELEGATE_WRITE     = 2,
-    OPEN_DELEGATE_NONE_EXT  = 3
-};
-
 enum open_claim_type4 {
     CLAIM_NULL              = 0,
     CLAIM_PREVIOUS          = 1,
@@ -690,6 +683,7 @@ typedef struct __nfs41_read_res_ok {
     bool_t                  eof;
     uint32_t                data_len;
     unsigned char           *data; /* caller-allocated */
+    bool_t                  direct; /* data was received directly */
 } nfs41_read_res_ok;
 
 typedef struct __nfs41_read_res {
@@ -832,12 +826,6 @@ typedef struct __nfs41_test_stateid_res {
 
 
 /* OP_WRITE */
-enum stable_how4 {
-    UNSTABLE4       = 0,
-    DATA_SYNC4      = 1,
-    FILE_SYNC4      = 2
-};
-
 typedef struct __nfs41_write_args {
     stateid_arg             *stateid; /* -> nfs41_op_open_res_ok.stateid */
     uint64_t                offset;
@@ -887,7 +875,7 @@ enum secinfo_no_name_type {
 };
 
 typedef struct __nfs41_secinfo_noname_args {
-    enum secinfo_noname_type type;
+    enum secinfo_no_name_type type;
 } nfs41_secinfo_noname_args;
 
 typedef struct __nfs41_secinfo_noname_res {
@@ -995,6 +983,7 @@ typedef struct __pnfs_getdeviceinfo_res {
 /* nfs41_ops.c */
 int nfs41_exchange_id(
     IN nfs41_rpc_clnt *rpc,
+    IN uint32_t conn,
     IN client_owner4 *owner,
     IN uint32_t flags_in,
     OUT nfs41_exchange_id_res *res_out);
@@ -1006,6 +995,7 @@ int nfs41_create_session(
 
 enum nfsstat4 nfs41_bind_conn_to_session(
     IN nfs41_rpc_clnt *rpc,
+    IN uint32_t conn,
     IN const unsigned char *sessionid,
     IN enum channel_dir_from_client4 dir);
 
@@ -1129,6 +1119,21 @@ int nfs41_getattr(
     IN bitmap4 *attr_request,
     OUT nfs41_file_info *info);
 
+/* fetch attributes for several files in a single compound; 'count' can't
+ * exceed GETATTR_ARRAY_MAX or (ca_maxoperations - 1) / 2.  the compound
+ * stops at the first file that fails, whose index is returned in
+ * 'index_out' along with its error.  on any other failure, 'index_out'
+ * is set to 'count' */
+#define GETATTR_ARRAY_MAX 16
+
+int nfs41_getattr_array(
+    IN nfs41_session *session,
+    IN nfs41_path_fh **files,
+    IN uint32_t count,
+    IN bitmap4 *attr_request,
+    OUT nfs41_file_info *info,
+    OUT uint32_t *index_out);
+
 int nfs41_superblock_getattr(
     IN nfs41_session *session,
     IN nfs41_path_fh *file,
@@ -24,6 +24,9 @@
 #include "nfs41_xdr.h"
 #include "nfs41_callback.h"
 #include "nfs41_driver.h" /* for AUTH_SYS, AUTHGSS_KRB5s defines */
+#include "dispatch.h"
+
+#include <strsafe.h>
 
 #include "rpc/rpc.h"
 #define SECURITY_WIN32
@@ -80,25 +83,245 @@ out:
     return status;
 }
 
+/* parallel connection establishment
+ *
+ *   rather than walking the server's addresses one connect timeout at a
+ * time, attempts are started in order of each address's health, either
+ * RPC_CONNECT_STAGGER ms apart or as soon as the previous attempt fails,
+ * and the first one to answer a NULL ping wins (see rfc 8305, "happy
+ * eyeballs").  the losers can't be cancelled, so they finish on their own
+ * and destroy their clients.  the results are recorded in rpc->addr_health
+ * so that later reconnects try the addresses that worked first */
+
+/* ms between the start of each connection attempt */
+#define RPC_CONNECT_STAGGER 250
+
+/* ms after which an address's connection failures are forgotten */
+#define RPC_HEALTH_RESET 60000
+
+enum connect_result {
+    CONNECT_PENDING,
+    CONNECT_FAILED,
+    CONNECT_WON,
+    CONNECT_LOST
+};
+
+struct connect_race {
+    CRITICAL_SECTION        lock;
+    HANDLE                  event; /* signaled as each attempt finishes */
+    LONG                    ref_count;
+    uint32_t                wsize;
+    uint32_t                rsize;
+    nfs41_rpc_clnt          *callback;
+    bool_t                  want_name;
+    CLIENT                  *client; /* the winner */
+    uint32_t                winner;
+    char                    server_name[NI_MAXHOST];
+    netaddr4                addrs[NFS41_ADDRS_PER_SERVER];
+    enum connect_result     results[NFS41_ADDRS_PER_SERVER];
+};
+
+struct connect_attempt {
+    struct connect_race     *race;
+    uint32_t                index;
+};
+
+static void connect_race_deref(
+    IN struct connect_race *race)
+{
+    if (InterlockedDecrement(&race->ref_count) == 0) {
+        DeleteCriticalSection(&race->lock);
+        CloseHandle(race->event);
+        free(race);
+    }
+}
+
+static DWORD WINAPI connect_thread(
+    IN void *args)
+{
+    struct connect_attempt *attempt = (struct connect_attempt*)args;
+    struct connect_race *race = attempt->race;
+    const uint32_t i = attempt->index;
+    char server_name[NI_MAXHOST];
+    CLIENT *client = NULL;
+    bool_t won = FALSE;
+    int status;
+
+    free(attempt);
+
+    status = get_client_for_netaddr(&race->addrs[i], race->wsize,
+        race->rsize, race->callback, race->want_name ? server_name : NULL,
+        &client);
+    if (status == NO_ERROR && send_null(client) != RPC_SUCCESS) {
+        clnt_destroy(client);
+        status = ERROR_NETWORK_UNREACHABLE;
+    }
+
+    EnterCriticalSection(&race->lock);
+    if (status) {
+        race->results[i] = CONNECT_FAILED;
+    } else if (race->client == NULL) {
+        race->results[i] = CONNECT_WON;
+        race->client = client;
+        race->winner = i;
+        if (race->want_name)
+            StringCchCopyA(race->server_name, NI_MAXHOST, server_name);
+        won = TRUE;
+    } else {
+        race->results[i] = CONNECT_LOST;
+    }
+    LeaveCriticalSection(&race->lock);
+    SetEvent(race->event);
+
+    if (status == NO_ERROR && !won)
+        clnt_destroy(client);
+    connect_race_deref(race);
+    return 0;
+}
+
+static void connect_start(
+    IN struct connect_race *race,
+    IN uint32_t index)
+{
+    struct connect_attempt *attempt;
+
+    attempt = calloc(1, sizeof(struct connect_attempt));
+    if (attempt == NULL)
+        goto out_fail;
+    attempt->race = race;
+    attempt->index = index;
+
+    InterlockedIncrement(&race->ref_count);
+    if (!QueueUserWorkItem(connect_thread, attempt, WT_EXECUTELONGFUNCTION)) {
+        eprintf("connect_start: QueueUserWorkItem() failed with %d\n",
+            GetLastError());
+        InterlockedDecrement(&race->ref_count);
+        free(attempt);
+        goto out_fail;
+    }
+    dprintf(2, "connect_start: connecting to %s\n", race->addrs[index].uaddr);
+    return;
+
+out_fail:
+    EnterCriticalSection(&race->lock);
+    race->results[index] = CONNECT_FAILED;
+    LeaveCriticalSection(&race->lock);
+    /* the caller may be waiting on this as its last attempt */
+    SetEvent(race->event);
+}
+
+/* order addresses by their recent connection failures, and otherwise
+ * keep the order we were given */
+static void rpc_addr_order(
+    IN nfs41_rpc_clnt *rpc,
+    IN uint32_t count,
+    OUT uint32_t *order)
+{
+    const ULONGLONG now = GetTickCount64();
+    uint32_t i, j, tmp;
+
+    for (i = 0; i < count; i++) {
+        if (rpc->addr_health[i].failures &&
+                now - rpc->addr_health[i].failed_at > RPC_HEALTH_RESET)
+            rpc->addr_health[i].failures = 0;
+        order[i] = i;
+    }
+    for (i = 1; i < count; i++) {
+        for (j = i; j > 0 && rpc->addr_health[order[j-1]].failures >
+                rpc->addr_health[order[j]].failures; j--) {
+            tmp = order[j];
+            order[j] = order[j-1];
+            order[j-1] = tmp;
+        }
+    }
+}
+
 static int get_client_for_multi_addr(
+    IN nfs41_rpc_clnt *rpc,
     IN const multi_addr4 *addrs,
     IN uint32_t wsize,
     IN uint32_t rsize,
-    IN nfs41_rpc_clnt *rpc,
+    IN bool_t callbacks,
     OUT OPTIONAL char *server_name,
     OUT CLIENT **client_out,
     OUT uint32_t *addr_index)
 {
+    struct connect_race *race;
+    uint32_t order[NFS41_ADDRS_PER_SERVER];
+    uint32_t i, started = 0, finished;
     int status = ERROR_NETWORK_UNREACHABLE;
-    uint32_t i;
-    for (i = 0; i < addrs->count; i++) {
-        status = get_client_for_netaddr(&addrs->arr[i],
-            wsize, rsize, rpc, server_name, client_out);
-        if (status == NO_ERROR) {
-            *addr_index = i;
+
+    /* with nothing to start, nothing would ever set the event */
+    if (addrs->count == 0) {
+        eprintf("get_client_for_multi_addr: no addresses to connect to\n");
+        goto out;
+    }
+
+    race = calloc(1, sizeof(struct connect_race));
+    if (race == NULL) {
+        status = GetLastError();
+        goto out;
+    }
+    race->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (race->event == NULL) {
+        status = GetLastError();
+        eprintf("CreateEvent failed %d\n", status);
+        free(race);
+        goto out;
+    }
+    InitializeCriticalSection(&race->lock);
+    race->ref_count = 1;
+    race->wsize = wsize;
+    race->rsize = rsize;
+    race->callback = callbacks ? rpc : NULL;
+    race->want_name = server_name != NULL;
+    memcpy(race->addrs, addrs->arr, addrs->count * sizeof(netaddr4));
+
+    rpc_addr_order(rpc, addrs->count, order);
+
+    for (;;) {
+        if (started < addrs->count)
+            connect_start(race, order[started++]);
+
+        /* wait for an attempt to finish, or for the next one to start */
+        WaitForSingleObject(race->event,
+            started < addrs->count ? RPC_CONNECT_STAGGER : INFINITE);
+
+        EnterCriticalSection(&race->lock);
+        for (i = 0, finished = 0; i < started; i++)
+            if (race->results[order[i]] != CONNECT_PENDING)
+                finished++;
+        if (race->client) {
+            *client_out = race->client;
+            *addr_index = race->winner;
+            if (server_name)
+                StringCchCopyA(server_name, NI_MAXHOST, race->server_name);
+            status = NO_ERROR;
+        }
+        LeaveCriticalSection(&race->lock);
+
+        if (status == NO_ERROR || (started == addrs->count &&
+                finished == started))
             break;
+    }
+
+    /* remember how each address did, for the next reconnect */
+    EnterCriticalSection(&race->lock);
+    for (i = 0; i < started; i++) {
+        if (race->results[order[i]] == CONNECT_WON) {
+            rpc->addr_health[order[i]].failures = 0;
+        } else if (race->results[order[i]] == CONNECT_FAILED) {
+            rpc->addr_health[order[i]].failures++;
+            rpc->addr_health[order[i]].failed_at = GetTickCount64();
         }
     }
+    LeaveCriticalSection(&race->lock);
+
+    if (status == NO_ERROR)
+        dprintf(1, "connected to %s after %u attempt(s)\n",
+            addrs->arr[*addr_index].uaddr, started);
+    connect_race_deref(race);
+out:
     return status;
 }
 
@@ -142,10 +365,195 @@ out:
 }
 
 /* Returns a client structure and an associated lock */
+/* called by the rpc layer with the start of each large reply; if it's
+ * a READ reply that was registered with nfs41_rpc_direct_read(), steer
+ * its data directly into the caller's buffer */
+static bool_t rpc_steer_read(
+    IN void *arg,
+    IN const char *buffer,
+    IN u_int length,
+    OUT char **dest_out,
+    OUT u_int *offset_out,
+    OUT u_int *count_out)
+{
+    nfs41_rpc_conn *conn = (nfs41_rpc_conn*)arg;
+    nfs41_rpc_clnt *rpc = conn->clnt;
+    nfs41_direct_read *direct;
+    nfs41_read_res_ok *res;
+    unsigned char sessionid[NFS4_SESSIONID_SIZE];
+    uint32_t slotid, sequenceid, data_len;
+    u_int data_offset;
+    bool_t steered = FALSE;
+
+    if (!nfs_peek_read_compound(buffer, length, sessionid, &slotid,
+            &sequenceid, &data_offset, &data_len) ||
+        slotid >= NFS41_MAX_RPC_REQS)
+        goto out;
+
+    AcquireSRWLockExclusive(&rpc->direct_lock);
+    /* this is a new record, so we're done with the last one */
+    if (conn->steered) {
+        conn->steered->conn = NULL;
+        conn->steered = NULL;
+    }
+    direct = &rpc->direct_reads[slotid];
+    res = direct->res;
+    /* claim the buffer so a duplicate reply can't steer into it */
+    if (res && direct->conn == NULL && direct->sequenceid == sequenceid &&
+        memcmp(direct->sessionid, sessionid, NFS4_SESSIONID_SIZE) == 0 &&
+        data_len <= res->data_len) {
+        direct->conn = conn;
+        conn->steered = direct;
+        res->direct = TRUE;
+        *dest_out = (char*)res->data;
+        *offset_out = data_offset;
+        *count_out = data_len;
+        steered = TRUE;
+    }
+    ReleaseSRWLockExclusive(&rpc->direct_lock);
+out:
+    return steered;
+}
+
+/* called by the rpc layer around each receive into a steered buffer; the
+ * shared lock keeps nfs41_rpc_direct_read() from withdrawing the buffer
+ * until the receive is done */
+static bool_t rpc_steer_hold(
+    IN void *arg,
+    IN bool_t hold)
+{
+    nfs41_rpc_conn *conn = (nfs41_rpc_conn*)arg;
+    nfs41_rpc_clnt *rpc = conn->clnt;
+
+    if (!hold) {
+        ReleaseSRWLockShared(&rpc->direct_lock);
+        return TRUE;
+    }
+    AcquireSRWLockShared(&rpc->direct_lock);
+    if (conn->steered)
+        return TRUE;
+    ReleaseSRWLockShared(&rpc->direct_lock);
+    return FALSE;
+}
+
+void nfs41_rpc_steer_reads(
+    IN nfs41_rpc_conn *conn)
+{
+    struct clnt_steer steer = { NULL, rpc_steer_hold, conn };
+
+    /* with rpcsec_gss integrity or privacy, the results are wrapped */
+    if (conn->rpc->cl_auth &&
+        conn->rpc->cl_auth->ah_cred.oa_flavor == AUTH_SYS)
+        steer.cs_steer = rpc_steer_read;
+    clnt_control(conn->rpc, CLSET_RECV_STEER, (char*)&steer);
+}
+
+void nfs41_rpc_direct_read(
+    IN nfs41_rpc_clnt *rpc,
+    IN const unsigned char *sessionid,
+    IN uint32_t slotid,
+    IN uint32_t sequenceid,
+    IN nfs41_read_res_ok *res)
+{
+    nfs41_direct_read *direct;
+
+    if (slotid >= NFS41_MAX_RPC_REQS)
+        return;
+    direct = &rpc->direct_reads[slotid];
+
+    /* the exclusive lock waits for any receive into the old buffer to
+     * finish; after withdrawing it, the rest of that reply goes to the
+     * rpc stream instead.  see rpc_steer_hold() */
+    AcquireSRWLockExclusive(&rpc->direct_lock);
+    if (direct->conn) {
+        if (direct->conn->steered == direct)
+            direct->conn->steered = NULL;
+        direct->conn = NULL;
+    }
+    if (res) {
+        res->direct = FALSE;
+        memcpy(direct->sessionid, sessionid, NFS4_SESSIONID_SIZE);
+    }
+    direct->sequenceid = sequenceid;
+    direct->res = res;
+    ReleaseSRWLockExclusive(&rpc->direct_lock);
+}
+
+/* open an extra connection to rpc->addrs.arr[addr_index], for nconnect
+ * or trunking.  these only carry compounds on the fore channel, so they
+ * don't take callbacks */
+static int rpc_conn_create(
+    IN nfs41_rpc_clnt *rpc,
+    IN nfs41_rpc_conn *conn,
+    IN uint32_t addr_index)
+{
+    CLIENT *client;
+    char machname[MAXHOSTNAMELEN + 1];
+    gid_t gids[1];
+    int status;
+
+    conn->cond = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (conn->cond == NULL) {
+        status = GetLastError();
+        eprintf("CreateEvent failed %d\n", status);
+        goto out;
+    }
+    status = get_client_for_netaddr(&rpc->addrs.arr[addr_index],
+                rpc->wsize, rpc->rsize, NULL, NULL, &client);
+    if (status) {
+        clnt_pcreateerror("connecting failed");
+        goto out_free_cond;
+    }
+    if (send_null(client) != RPC_SUCCESS) {
+        eprintf("rpc_conn_create: send_null failed\n");
+        status = ERROR_NETWORK_UNREACHABLE;
+        goto out_err_client;
+    }
+
+    /* each connection keeps its own credentials, so that a WRONGSEC
+     * on the first connection can't free them out from under us */
+    if (gethostname(machname, sizeof(machname)) == -1) {
+        eprintf("rpc_conn_create: gethostname failed\n");
+        status = ERROR_NETWORK_UNREACHABLE;
+        goto out_err_client;
+    }
+    machname[sizeof(machname) - 1] = '\0';
+    client->cl_auth = authsys_create(machname, rpc->uid, rpc->gid, 0, gids);
+    if (client->cl_auth == NULL) {
+        eprintf("rpc_conn_create: failed to create rpc authsys\n");
+        status = ERROR_NETWORK_UNREACHABLE;
+        goto out_err_client;
+    }
+
+    InitializeSRWLock(&conn->lock);
+    conn->rpc = client;
+    conn->clnt = rpc;
+    conn->addr_index = addr_index;
+    nfs41_rpc_steer_reads(conn);
+out:
+    return status;
+out_err_client:
+    clnt_destroy(client);
+out_free_cond:
+    CloseHandle(conn->cond);
+    conn->cond = NULL;
+    goto out;
+}
+
+static void rpc_conn_free(
+    IN nfs41_rpc_conn *conn)
+{
+    auth_destroy(conn->rpc->cl_auth);
+    clnt_destroy(conn->rpc);
+    CloseHandle(conn->cond);
+    ZeroMemory(conn, sizeof(nfs41_rpc_conn));
+}
+
 int nfs41_rpc_clnt_create(
     IN const multi_addr4 *addrs,
     IN uint32_t wsize,
     IN uint32_t rsize,
+    IN uint32_t nconnect,
     IN uint32_t uid,
     IN uint32_t gid,
     IN uint32_t sec_flavor,
@@ -153,6 +561,7 @@ int nfs41_rpc_clnt_create(
 {
     CLIENT *client;
     nfs41_rpc_clnt *rpc;
+    nfs41_rpc_conn *conn;
     uint32_t addr_index;
     int status;
     char machname[MAXHOSTNAMELEN + 1];
@@ -164,29 +573,26 @@ int nfs41_rpc_clnt_create(
         status = GetLastError();
         goto out;
     }
+    conn = &rpc->conns[0];
 #ifdef NO_CB_4_KRB5P
     if (sec_flavor == RPCSEC_AUTHGSS_KRB5P)
         needcb = 0;
 #endif
     rpc->needcb = needcb;
-    rpc->cond = CreateEvent(NULL, TRUE, FALSE, NULL);
-    if (rpc->cond == NULL) {
+    conn->cond = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (conn->cond == NULL) {
         status = GetLastError();
         eprintf("CreateEvent failed %d\n", status);
         goto out_free_rpc_clnt;
     }
-    status = get_client_for_multi_addr(addrs, wsize, rsize, needcb?rpc:NULL, 
+    /* the winning connection has already answered a NULL ping */
+    status = get_client_for_multi_addr(rpc, addrs, wsize, rsize, needcb,
                 rpc->server_name, &client, &addr_index);
     if (status) {
-        clnt_pcreateerror("connecting failed");
+        eprintf("nfs41_rpc_clnt_create: failed to connect to any of "
+            "%u address(es)\n", addrs->count);
         goto out_free_rpc_cond;
     }
-    if (send_null(client) != RPC_SUCCESS) {
-        // XXX Do what here?
-        eprintf("nfs41_rpc_clnt_create: send_null failed\n");
-        status = ERROR_NETWORK_UNREACHABLE;
-        goto out_err_client;
-    }
 
     rpc->sec_flavor = sec_flavor;
     if (sec_flavor == RPCSEC_AUTH_SYS) {
@@ -212,12 +618,13 @@ int nfs41_rpc_clnt_create(
             dprintf(1, "nfs41_rpc_clnt_create: successfully created %s\n", 
                 secflavorop2name(sec_flavor));
     }
-    rpc->rpc = client;
+    conn->rpc = client;
 
     /* keep a copy of the address and buffer sizes for reconnect */
     memcpy(&rpc->addrs, addrs, sizeof(multi_addr4));
     /* save the index of the address we connected to */
-    rpc->addr_index = addr_index;
+    conn->addr_index = addr_index;
+    conn->bound = TRUE;
     rpc->wsize = wsize;
     rpc->rsize = rsize;
     rpc->is_valid_session = TRUE;
@@ -225,7 +632,27 @@ int nfs41_rpc_clnt_create(
     rpc->gid = gid;
 
     //initialize rpc client lock
-    InitializeSRWLock(&rpc->lock);
+    InitializeSRWLock(&conn->lock);
+    InitializeSRWLock(&rpc->direct_lock);
+    conn->clnt = rpc;
+    nfs41_rpc_steer_reads(conn);
+    rpc->nconnect = 1;
+
+    /* open the extra connections; they're bound to the session once it's
+     * created.  with rpcsec_gss, each connection would need its own
+     * security context, so stick to a single connection */
+    nconnect = min(max(nconnect, 1), NFS41_MAX_NCONNECT);
+    if (nconnect > 1 && sec_flavor != RPCSEC_AUTH_SYS)
+        dprintf(1, "nfs41_rpc_clnt_create: nconnect=%u ignored for %s\n",
+            nconnect, secflavorop2name(sec_flavor));
+    else while (rpc->nconnect < nconnect) {
+        if (rpc_conn_create(rpc, &rpc->conns[rpc->nconnect], addr_index)) {
+            eprintf("nfs41_rpc_clnt_create: continuing with %u of %u "
+                "connections\n", rpc->nconnect, nconnect);
+            break;
+        }
+        rpc->nconnect++;
+    }
 
     *rpc_out = rpc;
 out:
@@ -233,7 +660,7 @@ out:
 out_err_client:
     clnt_destroy(client);
 out_free_rpc_cond:
-    CloseHandle(rpc->cond);
+    CloseHandle(conn->cond);
 out_free_rpc_clnt:
     free(rpc);
     goto out;
@@ -243,57 +670,194 @@ out_free_rpc_clnt:
 void nfs41_rpc_clnt_free(
     IN nfs41_rpc_clnt *rpc)
 {
-    auth_destroy(rpc->rpc->cl_auth);
-    clnt_destroy(rpc->rpc);
-    CloseHandle(rpc->cond);
+    uint32_t i;
+
+    for (i = 0; i < rpc->nconnect; i++)
+        rpc_conn_free(&rpc->conns[i]);
     free(rpc);
 }
 
-static bool_t rpc_renew_in_progress(nfs41_rpc_clnt *rpc, int *value)
+static bool_t rpc_renew_in_progress(nfs41_rpc_conn *conn, int *value)
 {
     bool_t status = FALSE;
-    AcquireSRWLockExclusive(&rpc->lock);
+    AcquireSRWLockExclusive(&conn->lock);
     if (value) {
         dprintf(1, "nfs41_rpc_renew_in_progress: setting value %d\n", *value);
-        rpc->in_recovery = *value;
-        if (!rpc->in_recovery) 
-            SetEvent(rpc->cond);
+        conn->in_recovery = *value;
+        if (!conn->in_recovery) 
+            SetEvent(conn->cond);
     } else {
-        status = rpc->in_recovery;
+        status = conn->in_recovery;
         dprintf(1, "nfs41_rpc_renew_in_progress: returning value %d\n", status);
     }
-    ReleaseSRWLockExclusive(&rpc->lock);
+    ReleaseSRWLockExclusive(&conn->lock);
     return status;
 }
 
-static bool_t rpc_should_retry(nfs41_rpc_clnt *rpc, uint32_t version)
+static bool_t rpc_should_retry(nfs41_rpc_conn *conn, uint32_t version)
 {
     bool_t status = 0;
-    AcquireSRWLockExclusive(&rpc->lock);
-    if (rpc->version > version)
+    AcquireSRWLockExclusive(&conn->lock);
+    if (conn->version > version)
         status = 1;
-    ReleaseSRWLockExclusive(&rpc->lock);
+    ReleaseSRWLockExclusive(&conn->lock);
     return status;
 }
 
+static void rpc_bind_conn(
+    IN nfs41_rpc_clnt *rpc,
+    IN uint32_t index,
+    IN const unsigned char *sessionid)
+{
+    nfs41_rpc_conn *conn = &rpc->conns[index];
+    enum nfsstat4 status;
+
+    status = nfs41_bind_conn_to_session(rpc, index, sessionid, CDFC4_FORE);
+    if (status)
+        eprintf("nfs41_bind_conn_to_session() failed on connection %u "
+            "with %s\n", index, nfs_error_string(status));
+
+    /* compounds won't be sent on a connection until it's bound */
+    AcquireSRWLockExclusive(&conn->lock);
+    conn->bound = status == NFS4_OK;
+    ReleaseSRWLockExclusive(&conn->lock);
+}
+
+void nfs41_rpc_bind_conns(
+    IN nfs41_rpc_clnt *rpc,
+    IN const unsigned char *sessionid)
+{
+    uint32_t i;
+    for (i = 1; i < rpc->nconnect; i++)
+        rpc_bind_conn(rpc, i, sessionid);
+}
+
+/* open a connection to the given address at the end of rpc->conns,
+ * and verify with EXCHANGE_ID that it reaches the same server.  the
+ * connection isn't counted in rpc->nconnect until it's kept */
+static int rpc_trunk_probe(
+    IN nfs41_rpc_clnt *rpc,
+    IN uint32_t addr_index,
+    IN client_owner4 *owner,
+    IN uint32_t flags,
+    IN const nfs41_exchange_id_res *exchangeid)
+{
+    nfs41_exchange_id_res res = { 0 };
+    const uint32_t index = rpc->nconnect;
+    int status;
+
+    status = rpc_conn_create(rpc, &rpc->conns[index], addr_index);
+    if (status)
+        goto out;
+
+    status = nfs41_exchange_id(rpc, index, owner, flags, &res);
+    if (status) {
+        eprintf("nfs41_exchange_id() on %s failed with %s\n",
+            rpc->addrs.arr[addr_index].uaddr, nfs_error_string(status));
+        goto out_free;
+    }
+
+    /* session trunking requires matching server_owner (including the
+     * minor id), server_scope and clientid; see rfc 5661 2.10.5 */
+    if (res.server_owner.so_major_id_len !=
+            exchangeid->server_owner.so_major_id_len ||
+        memcmp(res.server_owner.so_major_id,
+            exchangeid->server_owner.so_major_id,
+            res.server_owner.so_major_id_len) ||
+        res.server_owner.so_minor_id != exchangeid->server_owner.so_minor_id ||
+        res.server_scope_len != exchangeid->server_scope_len ||
+        memcmp(res.server_scope, exchangeid->server_scope,
+            res.server_scope_len) ||
+        res.clientid != exchangeid->clientid) {
+        dprintf(1, "%s is not trunkable with %s\n",
+            rpc->addrs.arr[addr_index].uaddr,
+            nfs41_rpc_netaddr(rpc)->uaddr);
+        status = ERROR_BAD_NETPATH;
+        goto out_free;
+    }
+    rpc->nconnect++;
+out:
+    return status;
+out_free:
+    rpc_conn_free(&rpc->conns[index]);
+    goto out;
+}
+
+void nfs41_rpc_trunk(
+    IN nfs41_rpc_clnt *rpc,
+    IN client_owner4 *owner,
+    IN uint32_t flags,
+    IN const nfs41_exchange_id_res *exchangeid,
+    IN const unsigned char *sessionid,
+    IN uint32_t nconnect)
+{
+    const uint32_t primary = rpc->conns[0].addr_index;
+    uint32_t i, first, count;
+
+    /* with rpcsec_gss, each connection would need its own context */
+    if (rpc->sec_flavor != RPCSEC_AUTH_SYS)
+        return;
+
+    nconnect = min(max(nconnect, 1), NFS41_MAX_NCONNECT);
+
+    for (i = 0; i < rpc->addrs.count; i++) {
+        if (i == primary)
+            continue;
+        if (rpc->nconnect + nconnect > NFS41_MAX_NCONNECT)
+            break;
+
+        first = rpc->nconnect;
+        if (rpc_trunk_probe(rpc, i, owner, flags, exchangeid))
+            continue;
+
+        /* the address is trunkable, so give it as many connections as
+         * the primary address */
+        for (count = 1; count < nconnect; count++) {
+            if (rpc_conn_create(rpc, &rpc->conns[rpc->nconnect], i))
+                break;
+            rpc->nconnect++;
+        }
+        while (first < rpc->nconnect)
+            rpc_bind_conn(rpc, first++, sessionid);
+
+        dprintf(1, "trunked %u connection(s) to %s\n", count,
+            rpc->addrs.arr[i].uaddr);
+    }
+}
+
 static int rpc_reconnect(
-    IN nfs41_rpc_clnt *rpc)
+    IN nfs41_rpc_clnt *rpc,
+    IN uint32_t index)
 {
+    nfs41_rpc_conn *conn = &rpc->conns[index];
     CLIENT *client = NULL;
     uint32_t addr_index;
     int status;
 
-    AcquireSRWLockExclusive(&rpc->lock);
+    AcquireSRWLockExclusive(&conn->lock);
+
+    /* keep the extra connections out of rotation until they're bound */
+    if (index)
+        conn->bound = FALSE;
 
-    status = get_client_for_multi_addr(&rpc->addrs, rpc->wsize, rpc->rsize, 
-                rpc->needcb?rpc:NULL, NULL, &client, &addr_index);
+    if (index) {
+        /* extra connections stay on their own address, so that trunked
+         * connections keep their interfaces */
+        addr_index = conn->addr_index;
+        status = get_client_for_netaddr(&rpc->addrs.arr[addr_index],
+                    rpc->wsize, rpc->rsize, NULL, NULL, &client);
+    } else {
+        /* only the first connection carries the backchannel */
+        status = get_client_for_multi_addr(rpc, &rpc->addrs, rpc->wsize,
+                    rpc->rsize, rpc->needcb, NULL, &client, &addr_index);
+    }
     if (status)
         goto out_unlock;
 
-    if(rpc->sec_flavor == RPCSEC_AUTH_SYS)
-        client->cl_auth = rpc->rpc->cl_auth;
+    if (index || rpc->sec_flavor == RPCSEC_AUTH_SYS)
+        client->cl_auth = conn->rpc->cl_auth;
     else {
-        auth_destroy(rpc->rpc->cl_auth);
+        auth_destroy(conn->rpc->cl_auth);
         status = create_rpcsec_auth_client(rpc->sec_flavor, rpc->server_name, client);
         if (status) {
             eprintf("Failed to reestablish security context\n");
@@ -301,31 +865,38 @@ static int rpc_reconnect(
             goto out_err_client;
         }
     }
-    if (send_null(client) != RPC_SUCCESS) {
+    /* the first connection was pinged by get_client_for_multi_addr() */
+    if (index && send_null(client) != RPC_SUCCESS) {
         eprintf("rpc_reconnect: send_null failed\n");
         status = ERROR_NETWORK_UNREACHABLE;
         goto out_err_client;
     }
 
-    clnt_destroy(rpc->rpc);
-    rpc->rpc = client;
-    rpc->addr_index = addr_index;
-    rpc->version++;
-    dprintf(1, "nfs41_send_compound: reestablished RPC connection\n");
+    clnt_destroy(conn->rpc);
+    conn->rpc = client;
+    conn->addr_index = addr_index;
+    nfs41_rpc_steer_reads(conn);
+    conn->version++;
+    dprintf(1, "nfs41_send_compound: reestablished RPC connection %u\n",
+        index);
 
 out_unlock:
-    ReleaseSRWLockExclusive(&rpc->lock);
-
-    /* after releasing the rpc lock, send a BIND_CONN_TO_SESSION if
-     * we need to associate the connection with the backchannel */
-    if (status == NO_ERROR && rpc->needcb && 
-            rpc->client && rpc->client->session) {
-        status = nfs41_bind_conn_to_session(rpc,
-            rpc->client->session->session_id, CDFC4_BACK_OR_BOTH);
-        if (status)
-            eprintf("nfs41_bind_conn_to_session() failed with %s\n",
-                nfs_error_string(status));
-        status = NFS4_OK;
+    ReleaseSRWLockExclusive(&conn->lock);
+
+    /* after releasing the connection's lock, send a BIND_CONN_TO_SESSION
+     * if we need to associate the connection with the backchannel, or
+     * with the fore channel for the extra connections */
+    if (status == NO_ERROR && rpc->client && rpc->client->session) {
+        if (index) {
+            rpc_bind_conn(rpc, index, rpc->client->session->session_id);
+        } else if (rpc->needcb) {
+            status = nfs41_bind_conn_to_session(rpc, 0,
+                rpc->client->session->session_id, CDFC4_BACK_OR_BOTH);
+            if (status)
+                eprintf("nfs41_bind_conn_to_session() failed with %s\n",
+                    nfs_error_string(status));
+            status = NFS4_OK;
+        }
     }
     return status;
 
@@ -334,28 +905,71 @@ out_err_client:
     goto out_unlock;
 }
 
-int nfs41_send_compound(
+/* pick the connection with the fewest calls in flight, skipping any that
+ * are reconnecting or not yet bound to the session.  the reads aren't
+ * locked; a stale answer only costs us some balance */
+static uint32_t rpc_pick_conn(
+    IN nfs41_rpc_clnt *rpc)
+{
+    nfs41_rpc_conn *conn;
+    uint32_t i, index, start, best = 0;
+    LONG load, best_load = MAXLONG;
+
+    if (rpc->nconnect == 1 || rpc->sec_flavor != RPCSEC_AUTH_SYS)
+        goto out;
+
+    /* rotate the starting point, so ties are spread evenly */
+    start = (uint32_t)InterlockedIncrement(&rpc->next_conn);
+    for (i = 0; i < rpc->nconnect; i++) {
+        index = (start + i) % rpc->nconnect;
+        conn = &rpc->conns[index];
+        if (!conn->bound || conn->in_recovery)
+            continue;
+        load = conn->in_flight;
+        if (load < best_load) {
+            best_load = load;
+            best = index;
+        }
+    }
+out:
+    return best;
+}
+
+static int rpc_send_compound(
     IN nfs41_rpc_clnt *rpc,
+    IN bool_t pick,
+    IN uint32_t index,
     IN char *inbuf,
     OUT char *outbuf)
 {
     struct timeval timeout = {90, 100};
+    nfs41_rpc_conn *conn;
     enum clnt_stat rpc_status;
     int status, count = 0, one = 1, zero = 0;
     uint32_t version;
 
  try_again:
-    AcquireSRWLockShared(&rpc->lock);
-    version = rpc->version;
-    rpc_status = clnt_call(rpc->rpc, 1,
+    /* pick again on retry, in case this connection is being recovered */
+    if (pick)
+        index = rpc_pick_conn(rpc);
+    conn = &rpc->conns[index];
+
+    AcquireSRWLockShared(&conn->lock);
+    version = conn->version;
+    InterlockedIncrement(&conn->in_flight);
+    /* let another worker serve the queue while we wait on the reply */
+    dispatch_block_enter();
+    rpc_status = clnt_call(conn->rpc, 1,
                            (xdrproc_t)nfs_encode_compound, inbuf,
                            (xdrproc_t)nfs_decode_compound, outbuf,
                            timeout);
-    ReleaseSRWLockShared(&rpc->lock);
+    dispatch_block_leave();
+    InterlockedDecrement(&conn->in_flight);
+    ReleaseSRWLockShared(&conn->lock);
 
     if (rpc_status != RPC_SUCCESS) {
-        eprintf("clnt_call returned rpc_status = %s\n", 
-            rpc_error_string(rpc_status));
+        eprintf("clnt_call returned rpc_status = %s on connection %u\n", 
+            rpc_error_string(rpc_status), index);
         switch(rpc_status) {
         case RPC_CANTRECV:
         case RPC_CANTSEND:
@@ -365,35 +979,37 @@ int nfs41_send_compound(
                 status = ERROR_NETWORK_UNREACHABLE;
                 break;
             }
-            if (rpc_should_retry(rpc, version))
+            if (rpc_should_retry(conn, version))
                 goto try_again;
-            while (rpc_renew_in_progress(rpc, NULL)) {
-                status = WaitForSingleObject(rpc->cond, INFINITE);
+            while (rpc_renew_in_progress(conn, NULL)) {
+                dispatch_block_enter();
+                status = WaitForSingleObject(conn->cond, INFINITE);
+                dispatch_block_leave();
                 if (status != WAIT_OBJECT_0) {
                     dprintf(1, "rpc_renew_in_progress: WaitForSingleObject failed\n");
                     print_condwait_status(1, status);
                     status = ERROR_LOCK_VIOLATION;
                     goto out;
                 }
-                rpc_renew_in_progress(rpc, &zero);
+                rpc_renew_in_progress(conn, &zero);
                 goto try_again;
             }
-            rpc_renew_in_progress(rpc, &one);
+            rpc_renew_in_progress(conn, &one);
             if (rpc_status == RPC_AUTHERROR && rpc->sec_flavor != RPCSEC_AUTH_SYS) {
-                AcquireSRWLockExclusive(&rpc->lock);
-                auth_destroy(rpc->rpc->cl_auth);
+                AcquireSRWLockExclusive(&conn->lock);
+                auth_destroy(conn->rpc->cl_auth);
                 status = create_rpcsec_auth_client(rpc->sec_flavor, 
-                            rpc->server_name, rpc->rpc);
-                ReleaseSRWLockExclusive(&rpc->lock);
+                            rpc->server_name, conn->rpc);
+                ReleaseSRWLockExclusive(&conn->lock);
                 if (status) {
                     eprintf("Failed to reestablish security context\n");
                     status = ERROR_NETWORK_UNREACHABLE;
                     goto out;
                 }
             } else
-                if (rpc_reconnect(rpc))
+                if (rpc_reconnect(rpc, index))
                     eprintf("rpc_reconnect: Failed to reconnect!\n");
-            rpc_renew_in_progress(rpc, &zero);
+            rpc_renew_in_progress(conn, &zero);
             goto try_again;
         default:
             eprintf("UNHANDLED RPC_ERROR: %d\n", rpc_status);
@@ -407,3 +1023,20 @@ int nfs41_send_compound(
 out:
     return status;
 }
+
+int nfs41_send_compound(
+    IN nfs41_rpc_clnt *rpc,
+    IN char *inbuf,
+    OUT char *outbuf)
+{
+    return rpc_send_compound(rpc, TRUE, 0, inbuf, outbuf);
+}
+
+int nfs41_send_compound_conn(
+    IN nfs41_rpc_clnt *rpc,
+    IN uint32_t conn,
+    IN char *inbuf,
+    OUT char *outbuf)
+{
+    return rpc_send_compound(rpc, FALSE, conn, inbuf, outbuf);
+}
@@ -27,6 +27,7 @@
 #include "rpc/rpc.h"
 
 #include "name_cache.h"
+#include "read_cache.h"
 #include "daemon_debug.h"
 #include "nfs41.h"
 #include "util.h"
@@ -115,10 +116,18 @@ static int server_create(
         eprintf("nfs41_name_cache_create() failed with %d\n", status);
         goto out_free;
     }
+
+    status = nfs41_read_cache_create(&server->read_cache);
+    if (status) {
+        eprintf("nfs41_read_cache_create() failed with %d\n", status);
+        goto out_free_names;
+    }
 out:
     *server_out = server;
     return status;
 
+out_free_names:
+    nfs41_name_cache_free(&server->name_cache);
 out_free:
     free(server);
     server = NULL;
@@ -131,6 +140,7 @@ static void server_free(
     dprintf(SRVLVL, "server_free(%s)\n", server->owner);
     nfs41_superblock_list_free(&server->superblocks);
     nfs41_name_cache_free(&server->name_cache);
+    nfs41_read_cache_free(&server->read_cache);
     free(server);
 }
 
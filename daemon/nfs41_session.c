@@ -20,12 +20,14 @@
  */
 
 #include <Windows.h>
-#include <process.h>
+#include <intrin.h>
 #include <stdio.h>
 
 #include "nfs41_ops.h"
 #include "nfs41_callback.h"
 #include "util.h"
+#include "dispatch.h"
+#include "lease.h"
 #include "daemon_debug.h"
 
 
@@ -33,27 +35,137 @@
  * SEQUENCE.target_highest_slotid to catch up before updating max_slots again */
 #define MAX_SLOTS_DELAY 2000 /* in milliseconds */
 
+/* congestion window
+ *
+ *   besides the server's target_highest_slotid, the slot table limits the
+ * compounds in flight to window.cwnd.  like tcp vegas, round trips are
+ * compared to the lowest one seen recently, to estimate how many of our
+ * requests are queued at the server.  once per window of replies, cwnd
+ * grows while fewer than WINDOW_ALPHA are queued (doubling below
+ * ssthresh), and shrinks by one when more than WINDOW_BETA are.  an
+ * NFS4ERR_DELAY halves it.  reads and writes keep their own round trip
+ * estimates, since theirs include the time to transfer the data */
+#define WINDOW_INITIAL 8
+#define WINDOW_MIN 4
+#define WINDOW_ALPHA 2
+#define WINDOW_BETA 6
+#define WINDOW_BASE_PERIOD 10000 /* ms before the lowest rtt is forgotten */
+
+
+/* the number of compounds we allow in flight */
+static uint32_t slot_table_limit(
+    IN const nfs41_slot_table *table)
+{
+    return min(table->window.cwnd, table->max_slots);
+}
 
 /* predicate for nfs41_slot_table.cond */
 static int slot_table_avail(
     IN const nfs41_slot_table *table)
 {
-    return table->num_used < table->max_slots;
+    return table->num_used < slot_table_limit(table);
+}
+
+/* bulk i/o leaves a quarter of the slots to metadata requests, and
+ * background work is limited to a quarter of them, so neither can keep
+ * an interactive request waiting for a slot */
+static uint32_t slot_class_limit(
+    IN const nfs41_slot_table *table,
+    IN enum dispatch_class type)
+{
+    const uint32_t limit = slot_table_limit(table);
+
+    switch (type) {
+    case DISPATCH_DATA:
+        return limit - limit / 4;
+    case DISPATCH_BACKGROUND:
+        return max(1, limit / 4);
+    default:
+        return limit;
+    }
+}
+
+static int slot_class_avail(
+    IN const nfs41_slot_table *table,
+    IN enum dispatch_class type)
+{
+    return table->num_used < slot_class_limit(table, type);
+}
+
+/* session slot mechanism
+ *
+ *   the slot table is allocated to the size of the fore channel's
+ * ca_maxrequests by nfs41_session_size_slots(), and max_slots moves within
+ * that in response to target_highest_slotid and CB_RECALL_SLOT.  slots in
+ * use are tracked in a bitmap, so finding the lowest free slot or the
+ * highest used one takes a bit scan per 32 slots */
+#define SLOT_WORD_BITS 32
+#define SLOT_WORDS(count) (((count) + SLOT_WORD_BITS - 1) / SLOT_WORD_BITS)
+
+static __inline bool_t slot_in_use(
+    IN const nfs41_slot_table *table,
+    IN uint32_t slotid)
+{
+    return (table->used_slots[slotid / SLOT_WORD_BITS] &
+        (1u << (slotid % SLOT_WORD_BITS))) != 0;
+}
+
+/* returns the lowest slotid that's not in use, or max_slots if none */
+static uint32_t slot_find_free(
+    IN const nfs41_slot_table *table)
+{
+    const uint32_t words = SLOT_WORDS(table->max_slots);
+    unsigned long bit;
+    uint32_t w;
+
+    for (w = 0; w < words; w++) {
+        if (_BitScanForward(&bit, ~table->used_slots[w]))
+            return min(w * SLOT_WORD_BITS + bit, table->max_slots);
+    }
+    return table->max_slots;
+}
+
+/* returns the highest slotid in use at or below 'slotid', or 0 if none */
+static uint32_t slot_find_highest(
+    IN const nfs41_slot_table *table,
+    IN uint32_t slotid)
+{
+    unsigned long bit;
+    uint32_t w = slotid / SLOT_WORD_BITS;
+    uint32_t word = table->used_slots[w];
+
+    /* ignore bits above slotid in its word */
+    if (slotid % SLOT_WORD_BITS != SLOT_WORD_BITS - 1)
+        word &= (1u << (slotid % SLOT_WORD_BITS + 1)) - 1;
+
+    for (;;) {
+        if (_BitScanReverse(&bit, word))
+            return w * SLOT_WORD_BITS + bit;
+        if (w == 0)
+            return 0;
+        word = table->used_slots[--w];
+    }
 }
 
-/* session slot mechanism */
 static void init_slot_table(nfs41_slot_table *table) 
 {
     uint32_t i;
     EnterCriticalSection(&table->lock);
-    table->max_slots = NFS41_MAX_NUM_SLOTS;
-    for (i = 0; i < NFS41_MAX_NUM_SLOTS; i++) {
+    table->max_slots = table->capacity;
+    for (i = 0; i < table->capacity; i++)
         table->seq_nums[i] = 1;
+    for (i = 0; i < SLOT_WORDS(table->capacity); i++)
         table->used_slots[i] = 0;
-    }
     table->highest_used = table->num_used = 0;
     table->target_delay = 0;
 
+    /* start over with a small window, but keep the counters */
+    table->window.cwnd = WINDOW_INITIAL;
+    table->window.ssthresh = NFS41_MAX_NUM_SLOTS;
+    table->window.acked = 0;
+    table->window.limited = FALSE;
+    ZeroMemory(table->window.rtt, sizeof(table->window.rtt));
+
     /* wake any threads waiting on a slot */
     if (slot_table_avail(table))
         WakeAllConditionVariable(&table->cond);
@@ -64,8 +176,12 @@ static void resize_slot_table(
     IN nfs41_slot_table *table,
     IN uint32_t target_highest_slotid)
 {
-    if (target_highest_slotid >= NFS41_MAX_NUM_SLOTS)
-        target_highest_slotid = NFS41_MAX_NUM_SLOTS - 1;
+    if (table->capacity == 0)
+        return;
+
+    /* the server can't ask for more than it gave us in ca_maxrequests */
+    if (target_highest_slotid >= table->capacity)
+        target_highest_slotid = table->capacity - 1;
 
     if (table->max_slots != target_highest_slotid + 1) {
         dprintf(2, "updated max_slots %u to %u\n",
@@ -77,28 +193,119 @@ static void resize_slot_table(
     }
 }
 
+static void window_sample(
+    IN nfs41_slot_table *table,
+    IN bool_t is_data,
+    IN LONGLONG rtt)
+{
+    nfs41_slot_window *window = &table->window;
+    struct __nfs41_rtt *est = &window->rtt[is_data];
+    const ULONGLONG now = GetTickCount64();
+    const uint32_t limit = slot_table_limit(table);
+    uint32_t queued;
+
+    if (rtt <= 0)
+        return;
+
+    /* track the lowest rtt, but forget it now and then in case the path
+     * to the server changes */
+    if (est->base == 0 || rtt < est->base || now > est->base_reset) {
+        est->base = rtt;
+        est->base_reset = now + WINDOW_BASE_PERIOD;
+    }
+    est->srtt = est->srtt ? est->srtt + (rtt - est->srtt) / 8 : rtt;
+
+    /* adjust once per window of replies */
+    if (++window->acked < limit)
+        return;
+    window->acked = 0;
+
+    /* srtt can dip below a base that was just reset */
+    if (est->srtt <= est->base)
+        queued = 0;
+    else
+        queued = (uint32_t)(limit * (est->srtt - est->base) / est->srtt);
+    if (queued > WINDOW_BETA) {
+        if (window->cwnd > WINDOW_MIN) {
+            window->cwnd--;
+            window->shrinks++;
+        }
+        window->ssthresh = window->cwnd;
+        dprintf(2, "window: %u queued at the server, cwnd=%u\n",
+            queued, window->cwnd);
+    } else if (queued < WINDOW_ALPHA && window->limited &&
+            window->cwnd < table->max_slots) {
+        /* only grow if we're using the window we have */
+        if (window->cwnd < window->ssthresh)
+            window->cwnd = min(window->cwnd * 2, window->ssthresh);
+        else
+            window->cwnd++;
+        window->cwnd = min(window->cwnd, table->max_slots);
+        window->grows++;
+        if (window->cwnd > window->peak)
+            window->peak = window->cwnd;
+        dprintf(3, "window: grew cwnd to %u\n", window->cwnd);
+
+        if (slot_table_avail(table))
+            WakeAllConditionVariable(&table->cond);
+    }
+    window->limited = FALSE;
+}
+
 void nfs41_session_bump_seq(
     IN nfs41_session *session,
     IN uint32_t slotid,
-    IN uint32_t target_highest_slotid)
+    IN uint32_t target_highest_slotid,
+    IN LONGLONG rtt)
 {
     nfs41_slot_table *table = &session->table;
 
     AcquireSRWLockShared(&session->client->session_lock);
     EnterCriticalSection(&table->lock);
 
-    if (slotid < NFS41_MAX_NUM_SLOTS)
+    if (slotid < table->capacity)
         table->seq_nums[slotid]++;
 
+    /* a successful SEQUENCE renews the lease, as of when it was sent */
+    session->lease.renewed = GetTickCount64() - rtt / 1000;
+
     /* adjust max_slots in response to changes in target_highest_slotid,
      * but not immediately after a CB_RECALL_SLOT or NFS4ERR_BADSLOT error */
     if (table->target_delay <= GetTickCount64())
         resize_slot_table(table, target_highest_slotid);
 
+    window_sample(table, dispatch_current_class() == DISPATCH_DATA, rtt);
+
     LeaveCriticalSection(&table->lock);
     ReleaseSRWLockShared(&session->client->session_lock);
 }
 
+void nfs41_session_delayed(
+    IN nfs41_session *session)
+{
+    nfs41_slot_window *window = &session->table.window;
+
+    AcquireSRWLockShared(&session->client->session_lock);
+    EnterCriticalSection(&session->table.lock);
+    window->ssthresh = max(window->cwnd / 2, WINDOW_MIN);
+    window->cwnd = window->ssthresh;
+    window->acked = 0;
+    window->shrinks++;
+    window->delays++;
+    dprintf(2, "window: server asked us to delay, cwnd=%u\n", window->cwnd);
+    LeaveCriticalSection(&session->table.lock);
+    ReleaseSRWLockShared(&session->client->session_lock);
+}
+
+void nfs41_session_window(
+    IN nfs41_session *session,
+    OUT nfs41_slot_window *window)
+{
+    EnterCriticalSection(&session->table.lock);
+    *window = session->table.window;
+    LeaveCriticalSection(&session->table.lock);
+}
+
 void nfs41_session_free_slot(
     IN nfs41_session *session,
     IN uint32_t slotid)
@@ -109,15 +316,14 @@ void nfs41_session_free_slot(
     EnterCriticalSection(&table->lock);
 
     /* flag the slot as unused */
-    if (slotid < NFS41_MAX_NUM_SLOTS && table->used_slots[slotid]) {
-        table->used_slots[slotid] = 0;
+    if (slotid < table->capacity && slot_in_use(table, slotid)) {
+        table->used_slots[slotid / SLOT_WORD_BITS] &=
+            ~(1u << (slotid % SLOT_WORD_BITS));
         table->num_used--;
     }
     /* update highest_used if necessary */
-    if (slotid == table->highest_used) {
-        while (table->highest_used && !table->used_slots[table->highest_used])
-            table->highest_used--;
-    }
+    if (slotid == table->highest_used)
+        table->highest_used = slot_find_highest(table, slotid);
     dprintf(3, "freeing slot#=%d used=%d highest=%d\n",
         slotid, table->num_used, table->highest_used);
 
@@ -136,29 +342,34 @@ void nfs41_session_get_slot(
     OUT uint32_t *highest)
 {
     nfs41_slot_table *table = &session->table;
+    const enum dispatch_class type = dispatch_current_class();
     uint32_t i;
 
     AcquireSRWLockShared(&session->client->session_lock);
     EnterCriticalSection(&table->lock);
 
+    /* note when the window, rather than the server, keeps us waiting */
+    if (table->num_used + 1 >= table->window.cwnd)
+        table->window.limited = TRUE;
+
     /* wait for an available slot */
-    while (!slot_table_avail(table))
-        SleepConditionVariableCS(&table->cond, &table->lock, INFINITE);
-
-    for (i = 0; i < table->max_slots; i++) {
-        if (table->used_slots[i])
-            continue;
-
-        table->used_slots[i] = 1;
-        table->num_used++;
-        if (i > table->highest_used)
-            table->highest_used = i;
-
-        *slot = i;
-        *seqid = table->seq_nums[i];
-        *highest = table->highest_used;
-        break;
+    if (!slot_class_avail(table, type)) {
+        dispatch_block_enter();
+        while (!slot_class_avail(table, type))
+            SleepConditionVariableCS(&table->cond, &table->lock, INFINITE);
+        dispatch_block_leave();
     }
+
+    /* with fewer than max_slots in use, one of them must be free */
+    i = slot_find_free(table);
+    table->used_slots[i / SLOT_WORD_BITS] |= 1u << (i % SLOT_WORD_BITS);
+    table->num_used++;
+    if (i > table->highest_used)
+        table->highest_used = i;
+
+    *slot = i;
+    *seqid = table->seq_nums[i];
+    *highest = table->highest_used;
     LeaveCriticalSection(&table->lock);
     ReleaseSRWLockShared(&session->client->session_lock);
 
@@ -166,6 +377,53 @@ void nfs41_session_get_slot(
         session, *slot, *seqid, *highest);
 }
 
+int nfs41_session_size_slots(
+    IN nfs41_session *session,
+    IN uint32_t max_requests)
+{
+    nfs41_slot_table *table = &session->table;
+    uint32_t *seq_nums, *used_slots;
+    uint32_t capacity, i;
+    int status = NO_ERROR;
+
+    /* we asked for NFS41_MAX_NUM_SLOTS, but don't count on it */
+    max_requests = min(max(max_requests, 1), NFS41_MAX_NUM_SLOTS);
+    capacity = SLOT_WORDS(max_requests) * SLOT_WORD_BITS;
+
+    EnterCriticalSection(&table->lock);
+    if (capacity > table->capacity) {
+        seq_nums = realloc(table->seq_nums, capacity * sizeof(uint32_t));
+        if (seq_nums == NULL) {
+            status = ERROR_NOT_ENOUGH_MEMORY;
+            goto out_unlock;
+        }
+        table->seq_nums = seq_nums;
+
+        used_slots = realloc(table->used_slots,
+            SLOT_WORDS(capacity) * sizeof(uint32_t));
+        if (used_slots == NULL) {
+            status = ERROR_NOT_ENOUGH_MEMORY;
+            goto out_unlock;
+        }
+        table->used_slots = used_slots;
+
+        for (i = table->capacity; i < capacity; i++)
+            table->seq_nums[i] = 1;
+        for (i = SLOT_WORDS(table->capacity); i < SLOT_WORDS(capacity); i++)
+            table->used_slots[i] = 0;
+        table->capacity = capacity;
+    }
+
+    dprintf(1, "slot table holds %u slots, using %u\n",
+        table->capacity, max_requests);
+    table->max_slots = max_requests;
+    if (slot_table_avail(table))
+        WakeAllConditionVariable(&table->cond);
+out_unlock:
+    LeaveCriticalSection(&table->lock);
+    return status;
+}
+
 int nfs41_session_recall_slot(
     IN nfs41_session *session,
     IN OUT uint32_t target_highest_slotid)
@@ -223,25 +481,6 @@ void nfs41_session_sequence(
 }
 
 
-/* session renewal */
-static unsigned int WINAPI renew_session(void *args) 
-{
-    int status = NO_ERROR;
-    nfs41_session *session = (nfs41_session *)args;
-    /* sleep for 2/3 of lease_time */
-    const uint32_t sleep_time = (2 * session->lease_time*1000)/3;
-
-    dprintf(1, "Creating renew_session thread: %p\n", session->renew_thread);
-    while(1) {
-        dprintf(1, "Going to sleep for %dmsecs\n", sleep_time);
-        Sleep(sleep_time);
-        status = nfs41_send_sequence(session);
-        if (status)
-            dprintf(1, "renewal thread: nfs41_send_sequence failed %d\n", status);
-    }
-    return status;
-}
-
 /* session creation */
 static int session_alloc(
     IN nfs41_client *client,
@@ -256,7 +495,6 @@ static int session_alloc(
         goto out;
     }
     session->client = client;
-    session->renew_thread = INVALID_HANDLE_VALUE;
     session->isValidState = FALSE;
 
     InitializeCriticalSection(&session->table.lock);
@@ -305,6 +543,10 @@ int nfs41_session_create(
     client->session = session;
     session->isValidState = TRUE;
     ReleaseSRWLockExclusive(&session->client->session_lock);
+
+    /* spread compounds over any extra connections */
+    nfs41_rpc_bind_conns(client->rpc, session->session_id);
+
     *session_out = session;
 out:
     return status;
@@ -326,6 +568,10 @@ int nfs41_session_renew(
 
     status = nfs41_create_session(session->client, session, FALSE);
     ReleaseSRWLockExclusive(&session->client->session_lock);
+
+    /* the extra connections were bound to the old session */
+    if (status == NFS4_OK)
+        nfs41_rpc_bind_conns(session->client->rpc, session->session_id);
     return status;
 }
 
@@ -334,13 +580,6 @@ int nfs41_session_set_lease(
     IN uint32_t lease_time)
 {
     int status = NO_ERROR;
-    uint32_t thread_id;
-
-    if (valid_handle(session->renew_thread)) {
-        eprintf("nfs41_session_set_lease(): session "
-            "renewal thread already started!\n");
-        goto out;
-    }
 
     if (lease_time == 0) {
         eprintf("nfs41_session_set_lease(): invalid lease_time=0\n");
@@ -349,13 +588,7 @@ int nfs41_session_set_lease(
     }
 
     session->lease_time = lease_time;
-    session->renew_thread = (HANDLE)_beginthreadex(NULL,
-        0, renew_session, session, 0, &thread_id);
-    if (!valid_handle(session->renew_thread)) {
-        status = GetLastError();
-        eprintf("_beginthreadex failed %d\n", status);
-        goto out;
-    }
+    nfs41_lease_register(session);
 out:
     return status;
 }
@@ -363,13 +596,10 @@ out:
 void nfs41_session_free(
     IN nfs41_session *session)
 {
+    /* before taking session_lock, which a renewal in flight may need */
+    nfs41_lease_unregister(session);
+
     AcquireSRWLockExclusive(&session->client->session_lock);
-    if (valid_handle(session->renew_thread)) {
-        dprintf(1, "nfs41_session_free: terminating session renewal thread\n");
-        if (!TerminateThread(session->renew_thread, NO_ERROR))
-            eprintf("failed to terminate renewal thread %p\n",
-                session->renew_thread);
-    }
 
     if (session->isValidState) {
         session->client->rpc->is_valid_session = FALSE;
@@ -377,5 +607,7 @@ void nfs41_session_free(
     }
     DeleteCriticalSection(&session->table.lock);
     ReleaseSRWLockExclusive(&session->client->session_lock);
+    free(session->table.seq_nums);
+    free(session->table.used_slots);
     free(session);
 }
@@ -21,6 +21,7 @@
 
 #include <Windows.h>
 #include <strsafe.h>
+#include <intrin.h>
 
 #include "nfs41_compound.h"
 #include "nfs41_ops.h"
@@ -76,7 +77,7 @@ bool_t xdr_bitmap4(
         for (i = 0; i < bitmap->count; i++)
             if (!xdr_u_int32_t(xdr, &bitmap->arr[i]))
                 return FALSE;
-    } else 
+    } else if (xdr->x_op != XDR_FREE) /* nothing to free */
         return FALSE;
 
     return TRUE;
@@ -162,17 +163,6 @@ static bool_t xdr_fh(
     return xdr_bytes(xdr, (char **)&pfh, &fh->len, NFS4_FHSIZE);
 }
 
-/* nfs41_fsid */
-static bool_t xdr_fsid(
-    XDR *xdr,
-    nfs41_fsid *fsid)
-{
-    if (!xdr_u_hyper(xdr, &fsid->major))
-        return FALSE;
-
-    return xdr_u_hyper(xdr, &fsid->minor);
-}
-
 
 /* nfs41_component */
 static bool_t encode_component(
@@ -240,7 +230,9 @@ static bool_t xdr_layout_types(
         if (!xdr_u_int32_t(xdr, &type))
             return FALSE;
 
-        *layout_type |= 1 << (type - 1);
+        /* ignore types that don't fit in the mask */
+        if (type >= 1 && type <= 32)
+            *layout_type |= 1u << (type - 1);
     }
     return TRUE;
 }
@@ -357,7 +349,7 @@ static bool_t decode_pathname4(
     /* decode each component */
     for (i = 0; i < count; i++) {
         len = remaining;
-        if (!xdr_bytes(xdr, (char **)&pos, &len, NFS41_MAX_PATH_LEN))
+        if (!xdr_bytes(xdr, (char **)&pos, &len, remaining))
             return FALSE;
         remaining -= len;
         pos += len;
@@ -382,8 +374,10 @@ static bool_t decode_fs_location4(
     char *address;
     u_int32_t i, count, len;
 
-    /* decode the number of servers */
-    if (!xdr_u_int32_t(xdr, &count))
+    /* decode the number of servers.  each takes at least a word of the
+     * attribute values, which are no longer than NFS4_OPAQUE_LIMIT */
+    if (!xdr_u_int32_t(xdr, &count) ||
+        count > NFS4_OPAQUE_LIMIT / BYTES_PER_XDR_UNIT)
         return FALSE;
 
     /* allocate the fs_location_server array */
@@ -405,10 +399,9 @@ static bool_t decode_fs_location4(
     for (i = 0; i < count; i++) {
         len = NFS41_HOSTNAME_LEN;
         address = arr[i].address;
-        if (!xdr_bytes(xdr, &address, &len, NFS41_HOSTNAME_LEN)) {
-            free(arr);
+        /* on failure, the caller frees what was decoded so far */
+        if (!xdr_bytes(xdr, &address, &len, NFS41_HOSTNAME_LEN))
             return FALSE;
-        }
         arr[i].address[len] = '\0';
     }
 
@@ -426,7 +419,10 @@ static bool_t decode_fs_locations4(
     if (!decode_pathname4(xdr, &locations->path))
         return FALSE;
 
-    if (!xdr_u_int32_t(xdr, &count))
+    /* each location takes at least two words: its server and
+     * component counts */
+    if (!xdr_u_int32_t(xdr, &count) ||
+        count > NFS4_OPAQUE_LIMIT / (2 * BYTES_PER_XDR_UNIT))
         return FALSE;
 
     /* allocate the fs_location array */
@@ -445,12 +441,10 @@ static bool_t decode_fs_locations4(
     locations->locations = arr;
     locations->location_count = count;
 
-    for (i = 0; i < count; i++) {
-        if (!decode_fs_location4(xdr, &arr[i])) {
-            free(arr);
+    /* on failure, the caller frees what was decoded so far */
+    for (i = 0; i < count; i++)
+        if (!decode_fs_location4(xdr, &arr[i]))
             return FALSE;
-        }
-    }
     return TRUE;
 }
 
@@ -1703,174 +1697,299 @@ static bool_t encode_op_getattr(
     return xdr_bitmap4(xdr, args->attr_request);
 }
 
-static bool_t decode_file_attrs(
-    XDR *xdr,
-    fattr4 *attrs,
-    nfs41_file_info *info)
+/* fattr4 decoding
+ *
+ *   attribute values follow each other in the order of their bits, so
+ * decode_file_attrs() walks the set bits of the bitmap and looks each one
+ * up in attr_decoders[], indexed by attribute number.  fixed-size values
+ * are read straight out of the attr_vals words, and only the variable
+ * length ones go through an xdr stream.  values we don't keep are skipped
+ * if their size is fixed; after any other unknown attribute, the rest of
+ * the values can't be found and decoding fails.  so does an attribute
+ * that decodes through a pointer in nfs41_file_info that the caller left
+ * NULL, because it didn't ask for that attribute. */
+enum attr_format {
+    ATTR_NONE,      /* unknown size */
+    ATTR_SKIP,      /* fixed size, not kept */
+    ATTR_UINT32,
+    ATTR_UINT64,
+    ATTR_BOOL,
+    ATTR_TIME,      /* nfstime4 */
+    ATTR_FSID,
+    ATTR_STRING,    /* into a char* buffer of NFS4_OPAQUE_LIMIT+1 */
+    ATTR_XDR        /* variable length, decoded by 'proc' */
+};
+
+typedef bool_t (*attr_xdrproc)(XDR*, nfs41_file_info*);
+
+struct attr_decoder {
+    enum attr_format    format;
+    uint32_t            arg; /* field offset, or words to skip */
+    attr_xdrproc        proc;
+};
+
+static bool_t decode_attr_supported(XDR *xdr, nfs41_file_info *info)
 {
-    if (attrs->attrmask.count >= 1) {
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_SUPPORTED_ATTRS) {
-            if (!xdr_bitmap4(xdr, info->supported_attrs))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_TYPE) {
-            if (!xdr_u_int32_t(xdr, &info->type))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_CHANGE) {
-            if (!xdr_u_hyper(xdr, &info->change))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_SIZE) {
-            if (!xdr_u_hyper(xdr, &info->size))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_LINK_SUPPORT) {
-            if (!xdr_bool(xdr, &info->link_support))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_SYMLINK_SUPPORT) {
-            if (!xdr_bool(xdr, &info->symlink_support))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_FSID) {
-            if (!xdr_fsid(xdr, &info->fsid))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_LEASE_TIME) {
-            if (!xdr_u_int32_t(xdr, &info->lease_time))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_RDATTR_ERROR) {
-            if (!xdr_u_int32_t(xdr, &info->rdattr_error))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_ACL) {
-            nfsacl41 *acl = info->acl;
-            if (!xdr_array(xdr, (char**)&acl->aces, &acl->count,
-                32, sizeof(nfsace4), (xdrproc_t)xdr_nfsace4))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_ACLSUPPORT) {
-            if (!xdr_u_int32_t(xdr, &info->aclsupport))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_ARCHIVE) {
-            if (!xdr_bool(xdr, &info->archive))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_CANSETTIME) {
-            if (!xdr_bool(xdr, &info->cansettime))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_CASE_INSENSITIVE) {
-            if (!xdr_bool(xdr, &info->case_insensitive))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_CASE_PRESERVING) {
-            if (!xdr_bool(xdr, &info->case_preserving))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_FILEID) {
-            if (!xdr_u_hyper(xdr, &info->fileid))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_FS_LOCATIONS) {
-            if (!decode_fs_locations4(xdr, info->fs_locations))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_HIDDEN) {
-            if (!xdr_bool(xdr, &info->hidden))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_MAXREAD) {
-            if (!xdr_u_hyper(xdr, &info->maxread))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[0] & FATTR4_WORD0_MAXWRITE) {
-            if (!xdr_u_hyper(xdr, &info->maxwrite))
-                return FALSE;
-        }
-    }
-    if (attrs->attrmask.count >= 2) {
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_MODE) {
-            if (!xdr_u_int32_t(xdr, &info->mode))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_NUMLINKS) {
-            if (!xdr_u_int32_t(xdr, &info->numlinks))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_OWNER) {
-            char *ptr = &info->owner[0];
-            uint32_t owner_len;
-            if (!xdr_bytes(xdr, &ptr, &owner_len, 
-                            NFS4_OPAQUE_LIMIT))
-                return FALSE;
-            info->owner[owner_len] = '\0';
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_OWNER_GROUP) {
-            char *ptr = &info->owner_group[0];
-            uint32_t owner_group_len;
-            if (!xdr_bytes(xdr, &ptr, &owner_group_len, 
-                            NFS4_OPAQUE_LIMIT))
-                return FALSE;
-            info->owner_group[owner_group_len] = '\0';
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_SPACE_AVAIL) {
-            if (!xdr_u_hyper(xdr, &info->space_avail))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_SPACE_FREE) {
-            if (!xdr_u_hyper(xdr, &info->space_free))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_SPACE_TOTAL) {
-            if (!xdr_u_hyper(xdr, &info->space_total))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_SYSTEM) {
-            if (!xdr_bool(xdr, &info->system))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_TIME_ACCESS) {
-            if (!xdr_nfstime4(xdr, &info->time_access))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_TIME_CREATE) {
-            if (!xdr_nfstime4(xdr, &info->time_create))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_TIME_DELTA) {
-            if (!xdr_nfstime4(xdr, info->time_delta))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_TIME_MODIFY) {
-            if (!xdr_nfstime4(xdr, &info->time_modify))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_DACL) {
-            if (!xdr_nfsdacl41(xdr, info->acl))
-                return FALSE;
-        }
-        if (attrs->attrmask.arr[1] & FATTR4_WORD1_FS_LAYOUT_TYPE) {
-            if (!xdr_layout_types(xdr, &info->fs_layout_types))
-                return FALSE;
-        }
+    return info->supported_attrs &&
+        xdr_bitmap4(xdr, info->supported_attrs);
+}
+
+static bool_t decode_attr_acl(XDR *xdr, nfs41_file_info *info)
+{
+    nfsacl41 *acl = info->acl;
+    return acl && xdr_array(xdr, (char**)&acl->aces, &acl->count,
+        32, sizeof(nfsace4), (xdrproc_t)xdr_nfsace4);
+}
+
+static bool_t decode_attr_fs_locations(XDR *xdr, nfs41_file_info *info)
+{
+    return info->fs_locations &&
+        decode_fs_locations4(xdr, info->fs_locations);
+}
+
+static bool_t decode_attr_time_delta(XDR *xdr, nfs41_file_info *info)
+{
+    return info->time_delta && xdr_nfstime4(xdr, info->time_delta);
+}
+
+static bool_t decode_attr_dacl(XDR *xdr, nfs41_file_info *info)
+{
+    return info->acl && xdr_nfsdacl41(xdr, info->acl);
+}
+
+static bool_t decode_attr_layout_types(XDR *xdr, nfs41_file_info *info)
+{
+    return xdr_layout_types(xdr, &info->fs_layout_types);
+}
+
+static bool_t decode_attr_mdsthreshold(XDR *xdr, nfs41_file_info *info)
+{
+    return xdr_mdsthreshold(xdr, &info->mdsthreshold);
+}
+
+static bool_t decode_attr_exclcreat(XDR *xdr, nfs41_file_info *info)
+{
+    return info->suppattr_exclcreat &&
+        xdr_bitmap4(xdr, info->suppattr_exclcreat);
+}
+
+#define ATTR_FIELD(format, field) \
+    { format, FIELD_OFFSET(nfs41_file_info, field), NULL }
+#define ATTR_IGNORE(words) { ATTR_SKIP, words, NULL }
+#define ATTR_PROC(proc) { ATTR_XDR, 0, proc }
+#define ATTR_UNKNOWN { ATTR_NONE, 0, NULL }
+
+static const struct attr_decoder attr_decoders[] = {
+    ATTR_PROC(decode_attr_supported),           /* 0 supported_attrs */
+    ATTR_FIELD(ATTR_UINT32, type),              /* 1 type */
+    ATTR_IGNORE(1),                             /* 2 fh_expire_type */
+    ATTR_FIELD(ATTR_UINT64, change),            /* 3 change */
+    ATTR_FIELD(ATTR_UINT64, size),              /* 4 size */
+    ATTR_FIELD(ATTR_BOOL, link_support),        /* 5 link_support */
+    ATTR_FIELD(ATTR_BOOL, symlink_support),     /* 6 symlink_support */
+    ATTR_IGNORE(1),                             /* 7 named_attr */
+    ATTR_FIELD(ATTR_FSID, fsid),                /* 8 fsid */
+    ATTR_IGNORE(1),                             /* 9 unique_handles */
+    ATTR_FIELD(ATTR_UINT32, lease_time),        /* 10 lease_time */
+    ATTR_FIELD(ATTR_UINT32, rdattr_error),      /* 11 rdattr_error */
+    ATTR_PROC(decode_attr_acl),                 /* 12 acl */
+    ATTR_FIELD(ATTR_UINT32, aclsupport),        /* 13 aclsupport */
+    ATTR_FIELD(ATTR_BOOL, archive),             /* 14 archive */
+    ATTR_FIELD(ATTR_BOOL, cansettime),          /* 15 cansettime */
+    ATTR_FIELD(ATTR_BOOL, case_insensitive),    /* 16 case_insensitive */
+    ATTR_FIELD(ATTR_BOOL, case_preserving),     /* 17 case_preserving */
+    ATTR_IGNORE(1),                             /* 18 chown_restricted */
+    ATTR_UNKNOWN,                               /* 19 filehandle */
+    ATTR_FIELD(ATTR_UINT64, fileid),            /* 20 fileid */
+    ATTR_IGNORE(2),                             /* 21 files_avail */
+    ATTR_IGNORE(2),                             /* 22 files_free */
+    ATTR_IGNORE(2),                             /* 23 files_total */
+    ATTR_PROC(decode_attr_fs_locations),        /* 24 fs_locations */
+    ATTR_FIELD(ATTR_BOOL, hidden),              /* 25 hidden */
+    ATTR_IGNORE(1),                             /* 26 homogeneous */
+    ATTR_IGNORE(2),                             /* 27 maxfilesize */
+    ATTR_IGNORE(1),                             /* 28 maxlink */
+    ATTR_IGNORE(1),                             /* 29 maxname */
+    ATTR_FIELD(ATTR_UINT64, maxread),           /* 30 maxread */
+    ATTR_FIELD(ATTR_UINT64, maxwrite),          /* 31 maxwrite */
+    ATTR_UNKNOWN,                               /* 32 mimetype */
+    ATTR_FIELD(ATTR_UINT32, mode),              /* 33 mode */
+    ATTR_IGNORE(1),                             /* 34 no_trunc */
+    ATTR_FIELD(ATTR_UINT32, numlinks),          /* 35 numlinks */
+    ATTR_FIELD(ATTR_STRING, owner),             /* 36 owner */
+    ATTR_FIELD(ATTR_STRING, owner_group),       /* 37 owner_group */
+    ATTR_IGNORE(2),                             /* 38 quota_avail_hard */
+    ATTR_IGNORE(2),                             /* 39 quota_avail_soft */
+    ATTR_IGNORE(2),                             /* 40 quota_used */
+    ATTR_IGNORE(2),                             /* 41 rawdev */
+    ATTR_FIELD(ATTR_UINT64, space_avail),       /* 42 space_avail */
+    ATTR_FIELD(ATTR_UINT64, space_free),        /* 43 space_free */
+    ATTR_FIELD(ATTR_UINT64, space_total),       /* 44 space_total */
+    ATTR_IGNORE(2),                             /* 45 space_used */
+    ATTR_FIELD(ATTR_BOOL, system),              /* 46 system */
+    ATTR_FIELD(ATTR_TIME, time_access),         /* 47 time_access */
+    ATTR_UNKNOWN,                               /* 48 time_access_set */
+    ATTR_IGNORE(3),                             /* 49 time_backup */
+    ATTR_FIELD(ATTR_TIME, time_create),         /* 50 time_create */
+    ATTR_PROC(decode_attr_time_delta),          /* 51 time_delta */
+    ATTR_IGNORE(3),                             /* 52 time_metadata */
+    ATTR_FIELD(ATTR_TIME, time_modify),         /* 53 time_modify */
+    ATTR_UNKNOWN,                               /* 54 time_modify_set */
+    ATTR_IGNORE(2),                             /* 55 mounted_on_fileid */
+    ATTR_IGNORE(3),                             /* 56 dir_notif_delay */
+    ATTR_IGNORE(3),                             /* 57 dirent_notif_delay */
+    ATTR_PROC(decode_attr_dacl),                /* 58 dacl */
+    ATTR_UNKNOWN,                               /* 59 sacl */
+    ATTR_IGNORE(4),                             /* 60 change_policy */
+    ATTR_UNKNOWN,                               /* 61 fs_status */
+    ATTR_PROC(decode_attr_layout_types),        /* 62 fs_layout_type */
+    ATTR_UNKNOWN,                               /* 63 layout_hint */
+    ATTR_UNKNOWN,                               /* 64 layout_type */
+    ATTR_IGNORE(1),                             /* 65 layout_blksize */
+    ATTR_IGNORE(1),                             /* 66 layout_alignment */
+    ATTR_UNKNOWN,                               /* 67 fs_locations_info */
+    ATTR_PROC(decode_attr_mdsthreshold),        /* 68 mdsthreshold */
+    ATTR_UNKNOWN,                               /* 69 retention_get */
+    ATTR_UNKNOWN,                               /* 70 retention_set */
+    ATTR_UNKNOWN,                               /* 71 retentevt_get */
+    ATTR_UNKNOWN,                               /* 72 retentevt_set */
+    ATTR_IGNORE(2),                             /* 73 retention_hold */
+    ATTR_IGNORE(2),                             /* 74 mode_set_masked */
+    ATTR_PROC(decode_attr_exclcreat),           /* 75 suppattr_exclcreat */
+};
+#define ATTR_DECODER_COUNT (sizeof(attr_decoders) / sizeof(attr_decoders[0]))
+
+/* words needed by each fixed-size format */
+static const uint32_t attr_format_words[] = { 0, 0, 1, 2, 1, 3, 4, 0, 0 };
+
+static __inline uint64_t attr_get_hyper(
+    IN const int32_t *pos)
+{
+    return ((uint64_t)ntohl((u_int32_t)pos[0]) << 32) |
+        ntohl((u_int32_t)pos[1]);
+}
+
+static bool_t decode_attr(
+    IN const struct attr_decoder *decoder,
+    IN const int32_t **pos_inout,
+    IN const int32_t *end,
+    OUT nfs41_file_info *info)
+{
+    const int32_t *pos = *pos_inout;
+    unsigned char *field = (unsigned char*)info + decoder->arg;
+    uint32_t words = attr_format_words[decoder->format];
+    uint32_t len;
+    XDR xdr;
+
+    if (decoder->format == ATTR_SKIP)
+        words = decoder->arg;
+    if (end - pos < (ptrdiff_t)words)
+        return FALSE;
+
+    switch (decoder->format) {
+    case ATTR_SKIP:
+        pos += words;
+        break;
+    case ATTR_UINT32:
+        *(uint32_t*)field = IXDR_GET_U_INT32(pos);
+        break;
+    case ATTR_BOOL:
+        *(bool_t*)field = IXDR_GET_U_INT32(pos) ? TRUE : FALSE;
+        break;
+    case ATTR_UINT64:
+        *(uint64_t*)field = attr_get_hyper(pos);
+        pos += 2;
+        break;
+    case ATTR_TIME:
+        ((nfstime4*)field)->seconds = (int64_t)attr_get_hyper(pos);
+        pos += 2;
+        ((nfstime4*)field)->nseconds = IXDR_GET_U_INT32(pos);
+        break;
+    case ATTR_FSID:
+        ((nfs41_fsid*)field)->major = attr_get_hyper(pos);
+        ((nfs41_fsid*)field)->minor = attr_get_hyper(pos + 2);
+        pos += 4;
+        break;
+    case ATTR_STRING:
+        if (pos == end)
+            return FALSE;
+        len = IXDR_GET_U_INT32(pos);
+        if (len > NFS4_OPAQUE_LIMIT || *(char**)field == NULL ||
+            (uint32_t)(end - pos) < RNDUP(len) / BYTES_PER_XDR_UNIT)
+            return FALSE;
+        memcpy(*(char**)field, pos, len);
+        (*(char**)field)[len] = '\0';
+        pos += RNDUP(len) / BYTES_PER_XDR_UNIT;
+        break;
+    case ATTR_XDR:
+        xdrmem_create(&xdr, (char*)pos,
+            (u_int)(end - pos) * BYTES_PER_XDR_UNIT, XDR_DECODE);
+        if (!decoder->proc(&xdr, info))
+            return FALSE;
+        pos += xdr_getpos(&xdr) / BYTES_PER_XDR_UNIT;
+        break;
+    default:
+        return FALSE;
     }
-    if (attrs->attrmask.count >= 3) {
-        if (attrs->attrmask.arr[2] & FATTR4_WORD2_MDSTHRESHOLD) {
-            if (!xdr_mdsthreshold(xdr, &info->mdsthreshold))
+    *pos_inout = pos;
+    return TRUE;
+}
+
+static bool_t decode_file_attrs(
+    IN const bitmap4 *attrmask,
+    IN const unsigned char *attr_vals,
+    IN uint32_t attr_vals_len,
+    OUT nfs41_file_info *info)
+{
+    const int32_t *pos = (const int32_t*)attr_vals;
+    const int32_t *end = pos + attr_vals_len / BYTES_PER_XDR_UNIT;
+    uint32_t i, mask, attr;
+    unsigned long bit;
+
+    for (i = 0; i < attrmask->count; i++) {
+        for (mask = attrmask->arr[i]; _BitScanForward(&bit, mask);
+                mask &= mask - 1) {
+            attr = i * 32 + bit;
+            if (attr >= ATTR_DECODER_COUNT ||
+                attr_decoders[attr].format == ATTR_NONE) {
+                eprintf("decode_file_attrs: can't decode attribute %u\n",
+                    attr);
                 return FALSE;
-        }
-        if (attrs->attrmask.arr[2] & FATTR4_WORD2_SUPPATTR_EXCLCREAT) {
-            if (!xdr_bitmap4(xdr, info->suppattr_exclcreat))
+            }
+            if (!decode_attr(&attr_decoders[attr], &pos, end, info))
                 return FALSE;
         }
     }
     return TRUE;
 }
 
+/* decode a fattr4 without copying attr_vals, unless they cross the end
+ * of the receive buffer.  the values are only good until the next read
+ * from the stream */
+static bool_t decode_fattr4(
+    XDR *xdr,
+    fattr4 *attrs,
+    const unsigned char **attr_vals)
+{
+    const int32_t *buf;
+    uint32_t len;
+
+    if (!xdr_bitmap4(xdr, &attrs->attrmask))
+        return FALSE;
+
+    if (!xdr_u_int32_t(xdr, &len) || len > NFS4_OPAQUE_LIMIT)
+        return FALSE;
+    attrs->attr_vals_len = len;
+
+    buf = XDR_INLINE(xdr, RNDUP(len));
+    if (buf) {
+        *attr_vals = (const unsigned char*)buf;
+        return TRUE;
+    }
+    *attr_vals = attrs->attr_vals;
+    return xdr_opaque(xdr, (char*)attrs->attr_vals, len);
+}
+
 static bool_t decode_op_getattr(
     XDR *xdr,
     nfs_resop4 *resop)
@@ -1885,12 +2004,12 @@ static bool_t decode_op_getattr(
 
     if (res->status == NFS4_OK)
     {
-        XDR attr_xdr;
+        const unsigned char *attr_vals;
 
-        if (!xdr_fattr4(xdr, &res->obj_attributes))
+        if (!decode_fattr4(xdr, &res->obj_attributes, &attr_vals))
             return FALSE;
-        xdrmem_create(&attr_xdr, (char *)res->obj_attributes.attr_vals, res->obj_attributes.attr_vals_len, XDR_DECODE);
-        return  decode_file_attrs(&attr_xdr, &res->obj_attributes, res->info);
+        return decode_file_attrs(&res->obj_attributes.attrmask, attr_vals,
+            res->obj_attributes.attr_vals_len, res->info);
     }
     return TRUE;
 }
@@ -2219,11 +2338,23 @@ static bool_t decode_read_res_ok(
     nfs41_read_res_ok *res)
 {
     unsigned char *data = res->data;
+    const uint32_t capacity = res->data_len; /* the count we asked for */
+    char pad[BYTES_PER_XDR_UNIT];
 
     if (!xdr_bool(xdr, &res->eof))
         return FALSE;
 
-    return xdr_bytes(xdr, (char **)&data, &res->data_len, NFS41_MAX_FILEIO_SIZE);
+    if (res->direct) {
+        /* the rpc layer already received the data into res->data,
+         * leaving only the length and padding in the stream */
+        if (!xdr_u_int32_t(xdr, &res->data_len))
+            return FALSE;
+        return XDR_GETBYTES(xdr, pad, RNDUP(res->data_len) - res->data_len);
+    }
+
+    /* don't let a server that returns more than we asked for overrun
+     * the caller's buffer */
+    return xdr_bytes(xdr, (char **)&data, &res->data_len, capacity);
 }
 
 static bool_t decode_op_read(
@@ -2245,6 +2376,64 @@ static bool_t decode_op_read(
 }
 
 
+/* find the READ data in the first 'length' bytes of an rpc reply to
+ * SEQUENCE, PUTFH, READ, without copying anything out of the buffer */
+bool_t nfs_peek_read_compound(
+    IN const char *buffer,
+    IN u_int length,
+    OUT unsigned char *sessionid,
+    OUT uint32_t *slotid,
+    OUT uint32_t *sequenceid,
+    OUT u_int *data_offset,
+    OUT uint32_t *data_len)
+{
+    XDR xdr;
+    uint32_t i, value, op, status;
+    const uint32_t ops[] = { OP_SEQUENCE, OP_PUTFH, OP_READ };
+
+    xdrmem_create(&xdr, (char*)buffer, length, XDR_DECODE);
+
+    /* xid, direction, reply_stat and the verifier */
+    if (!xdr_u_int32_t(&xdr, &value) || !xdr_u_int32_t(&xdr, &value) ||
+        value != REPLY || !xdr_u_int32_t(&xdr, &value) ||
+        value != MSG_ACCEPTED || !xdr_u_int32_t(&xdr, &value) ||
+        !xdr_u_int32_t(&xdr, &value) ||
+        !xdr_setpos(&xdr, xdr_getpos(&xdr) + RNDUP(value)))
+        return FALSE;
+
+    /* accept_stat, compound status, tag and result count */
+    if (!xdr_u_int32_t(&xdr, &value) || value != SUCCESS ||
+        !xdr_u_int32_t(&xdr, &status) || status != NFS4_OK ||
+        !xdr_u_int32_t(&xdr, &value) ||
+        !xdr_setpos(&xdr, xdr_getpos(&xdr) + RNDUP(value)) ||
+        !xdr_u_int32_t(&xdr, &value) || value != ARRAYSIZE(ops))
+        return FALSE;
+
+    for (i = 0; i < ARRAYSIZE(ops); i++) {
+        if (!xdr_u_int32_t(&xdr, &op) || op != ops[i] ||
+            !xdr_u_int32_t(&xdr, &status) || status != NFS4_OK)
+            return FALSE;
+
+        if (op == OP_SEQUENCE) {
+            /* sessionid, sequenceid, slotid, highest_slotid,
+             * target_highest_slotid, status_flags */
+            if (!xdr_opaque(&xdr, (char*)sessionid, NFS4_SESSIONID_SIZE) ||
+                !xdr_u_int32_t(&xdr, sequenceid) ||
+                !xdr_u_int32_t(&xdr, slotid) ||
+                !xdr_setpos(&xdr, xdr_getpos(&xdr) + 3 * BYTES_PER_XDR_UNIT))
+                return FALSE;
+        }
+    }
+
+    /* eof, then the length of the data */
+    if (!xdr_u_int32_t(&xdr, &value) || !xdr_u_int32_t(&xdr, data_len))
+        return FALSE;
+
+    *data_offset = xdr_getpos(&xdr);
+    return TRUE;
+}
+
+
 /*
  * OP_READDIR
  */
@@ -2287,15 +2476,16 @@ static bool_t decode_readdir_entry(
     uint64_t cookie;
     unsigned char name[NFS4_OPAQUE_LIMIT];
     unsigned char *nameptr = &name[0];
+    const unsigned char *attr_vals;
     uint32_t name_len, entry_len;
     fattr4 attrs;
+    nfs41_readdir_entry *entry = NULL;
 
     /* decode into temporaries so we can determine if there's enough
-     * room in the buffer for this entry */
-    ZeroMemory(name, NFS4_OPAQUE_LIMIT);
+     * room in the buffer for this entry.  name isn't zeroed, because
+     * StringCchCopyA() stops after name_len characters */
     name_len = NFS4_OPAQUE_LIMIT;
     entry_len = (uint32_t)FIELD_OFFSET(nfs41_readdir_entry, name);
-    attrs.attr_vals_len = NFS4_OPAQUE_LIMIT;
 
     if (!xdr_u_hyper(xdr, &cookie))
         return FALSE;
@@ -2303,20 +2493,34 @@ static bool_t decode_readdir_entry(
     if (!xdr_bytes(xdr, (char **)&nameptr, &name_len, NFS4_OPAQUE_LIMIT))
         return FALSE;
 
-    if (!xdr_fattr4(xdr, &attrs))
+    if (!decode_fattr4(xdr, &attrs, &attr_vals))
         return FALSE;
 
+    /* decode the attributes straight into the entry, before the next
+     * read from the stream can move attr_vals */
+    name_len += 1; /* account for null terminator */
+    if (it->ignore_the_rest)
+        ;
+    else if (entry_len + name_len <= it->remaining_len)
+    {
+        entry = (nfs41_readdir_entry*)it->buf_pos;
+        /* attributes the server didn't return must read as zero */
+        ZeroMemory(&entry->attr_info, sizeof(nfs41_file_info));
+        if (!decode_file_attrs(&attrs.attrmask, attr_vals,
+                attrs.attr_vals_len, &entry->attr_info))
+            entry->attr_info.rdattr_error = NFS4ERR_BADXDR;
+    }
+    else if (it->last_entry_offset)
+    {
+        *(it->last_entry_offset) = 0;
+        it->ignore_the_rest = 1;
+    }
+
     if (!xdr_bool(xdr, &it->has_next_entry))
         return FALSE;
 
-    if (it->ignore_the_rest)
-        return TRUE;
-
-    name_len += 1; /* account for null terminator */
-    if (entry_len + name_len <= it->remaining_len)
+    if (entry)
     {
-        XDR fattr_xdr;
-        nfs41_readdir_entry *entry = (nfs41_readdir_entry*)it->buf_pos;
         entry->cookie = cookie;
         entry->name_len = name_len;
 
@@ -2325,21 +2529,12 @@ static bool_t decode_readdir_entry(
         else
             entry->next_entry_offset = 0;
 
-        xdrmem_create(&fattr_xdr, (char *)attrs.attr_vals, attrs.attr_vals_len, XDR_DECODE);
-        if (!(decode_file_attrs(&fattr_xdr, &attrs, &entry->attr_info)))
-            entry->attr_info.rdattr_error = NFS4ERR_BADXDR;
         StringCchCopyA(entry->name, name_len, (STRSAFE_LPCSTR)name);
 
         it->buf_pos += entry_len + name_len;
         it->remaining_len -= entry_len + name_len;
         it->last_entry_offset = &entry->next_entry_offset;
     }
-    else if (it->last_entry_offset)
-    {
-        *(it->last_entry_offset) = 0;
-        it->ignore_the_rest = 1;
-    }
-
     return TRUE;
 }
 
@@ -2827,12 +3022,25 @@ static bool_t decode_op_test_stateid(
 /*
  * OP_WRITE
  */
+static bool_t encode_write_data(
+    XDR *xdr,
+    nfs41_write_args *args)
+{
+    static const char zero[BYTES_PER_XDR_UNIT] = { 0 };
+
+    /* send the data from the caller's buffer instead of copying it
+     * into the record stream */
+    if (!xdrrec_putref(xdr, (const char*)args->data, args->data_len))
+        return FALSE;
+
+    return XDR_PUTBYTES(xdr, zero, RNDUP(args->data_len) - args->data_len);
+}
+
 static bool_t encode_op_write(
     XDR *xdr,
     nfs_argop4 *argop)
 {
     nfs41_write_args *args = (nfs41_write_args*)argop->arg;
-    unsigned char *data = args->data;
 
     if (unexpected_op(argop->op, OP_WRITE))
         return FALSE;
@@ -2846,7 +3054,13 @@ static bool_t encode_op_write(
     if (!xdr_u_int32_t(xdr, &args->stable))
         return FALSE;
 
-    return xdr_bytes(xdr, (char **)&data, &args->data_len, NFS41_MAX_FILEIO_SIZE);
+    if (args->data_len > NFS41_MAX_FILEIO_SIZE)
+        return FALSE;
+
+    if (!xdr_u_int32_t(xdr, &args->data_len))
+        return FALSE;
+
+    return encode_write_data(xdr, args);
 }
 
 static bool_t xdr_write_verf(
@@ -3581,6 +3795,140 @@ static const op_table_entry* op_table_find(uint32_t op)
 }
 
 
+/*
+ * COMPOUND fast path
+ *
+ * SEQUENCE+PUTFH followed by READ, WRITE or GETATTR makes up most of our
+ * traffic.  for those shapes, the whole compound (except WRITE's data) is
+ * sized up front, space is reserved in the record buffer with one
+ * XDR_INLINE(), and the words are stored directly instead of going
+ * through the op table and the xdr ops for every field.  anything else,
+ * or a compound that doesn't fit in what's left of the buffer, takes the
+ * generic path in nfs_encode_compound().
+ */
+#define FAST_SEQUENCE_SIZE  (4 + NFS4_SESSIONID_SIZE + 16)
+#define FAST_STATEID_SIZE   (4 + NFS4_STATEID_OTHER)
+#define FAST_READ_SIZE      (4 + FAST_STATEID_SIZE + 12)
+#define FAST_WRITE_SIZE     (4 + FAST_STATEID_SIZE + 16)
+
+static __inline int32_t* put_hyper(
+    IN int32_t *buf,
+    IN uint64_t value)
+{
+    IXDR_PUT_U_INT32(buf, (uint32_t)(value >> 32));
+    IXDR_PUT_U_INT32(buf, (uint32_t)value);
+    return buf;
+}
+
+static __inline int32_t* put_opaque(
+    IN int32_t *buf,
+    IN const void *data,
+    IN uint32_t len)
+{
+    const uint32_t padded = RNDUP(len);
+
+    memcpy(buf, data, len);
+    memset((char*)buf + len, 0, padded - len);
+    return buf + padded / BYTES_PER_XDR_UNIT;
+}
+
+static __inline int32_t* put_stateid(
+    IN int32_t *buf,
+    IN const stateid4 *stateid)
+{
+    IXDR_PUT_U_INT32(buf, stateid->seqid);
+    return put_opaque(buf, stateid->other, NFS4_STATEID_OTHER);
+}
+
+/* returns FALSE without encoding anything if the compound can't take the
+ * fast path.  for WRITE, the caller still has to encode the data */
+static bool_t encode_compound_inline(
+    XDR *xdr,
+    nfs41_compound_args *args)
+{
+    nfs_argop4 *argops = args->argarray;
+    nfs41_sequence_args *sequence;
+    nfs41_fh *fh;
+    nfs41_read_args *read = NULL;
+    nfs41_write_args *write = NULL;
+    nfs41_getattr_args *getattr = NULL;
+    uint32_t size, i;
+    int32_t *buf;
+
+    if (xdr->x_op != XDR_ENCODE || args->argarray_count != 3 ||
+        argops[0].op != OP_SEQUENCE ||
+        argops[1].op != OP_PUTFH || args->tag_len > NFS4_OPAQUE_LIMIT)
+        return FALSE;
+
+    sequence = (nfs41_sequence_args*)argops[0].arg;
+    fh = &((nfs41_putfh_args*)argops[1].arg)->file->fh;
+    if (fh->len > NFS4_FHSIZE)
+        return FALSE;
+
+    /* tag, minorversion, op count, SEQUENCE and PUTFH */
+    size = 4 + RNDUP(args->tag_len) + 8 + FAST_SEQUENCE_SIZE +
+        8 + RNDUP(fh->len);
+
+    switch (argops[2].op) {
+    case OP_READ:
+        read = (nfs41_read_args*)argops[2].arg;
+        size += FAST_READ_SIZE;
+        break;
+    case OP_WRITE:
+        write = (nfs41_write_args*)argops[2].arg;
+        if (write->data_len > NFS41_MAX_FILEIO_SIZE)
+            return FALSE;
+        size += FAST_WRITE_SIZE;
+        break;
+    case OP_GETATTR:
+        getattr = (nfs41_getattr_args*)argops[2].arg;
+        if (getattr->attr_request->count > 3)
+            return FALSE;
+        size += 8 + 4 * getattr->attr_request->count;
+        break;
+    default:
+        return FALSE;
+    }
+
+    buf = XDR_INLINE(xdr, size);
+    if (buf == NULL)
+        return FALSE;
+
+    IXDR_PUT_U_INT32(buf, args->tag_len);
+    buf = put_opaque(buf, args->tag, args->tag_len);
+    IXDR_PUT_U_INT32(buf, args->minorversion);
+    IXDR_PUT_U_INT32(buf, 3);
+
+    IXDR_PUT_U_INT32(buf, OP_SEQUENCE);
+    buf = put_opaque(buf, sequence->sa_sessionid, NFS4_SESSIONID_SIZE);
+    IXDR_PUT_U_INT32(buf, sequence->sa_sequenceid);
+    IXDR_PUT_U_INT32(buf, sequence->sa_slotid);
+    IXDR_PUT_U_INT32(buf, sequence->sa_highest_slotid);
+    IXDR_PUT_BOOL(buf, sequence->sa_cachethis);
+
+    IXDR_PUT_U_INT32(buf, OP_PUTFH);
+    IXDR_PUT_U_INT32(buf, fh->len);
+    buf = put_opaque(buf, fh->fh, fh->len);
+
+    IXDR_PUT_U_INT32(buf, argops[2].op);
+    if (read) {
+        buf = put_stateid(buf, &read->stateid->stateid);
+        buf = put_hyper(buf, read->offset);
+        IXDR_PUT_U_INT32(buf, read->count);
+    } else if (write) {
+        buf = put_stateid(buf, &write->stateid->stateid);
+        buf = put_hyper(buf, write->offset);
+        IXDR_PUT_U_INT32(buf, write->stable);
+        IXDR_PUT_U_INT32(buf, write->data_len);
+    } else {
+        IXDR_PUT_U_INT32(buf, getattr->attr_request->count);
+        for (i = 0; i < getattr->attr_request->count; i++)
+            IXDR_PUT_U_INT32(buf, getattr->attr_request->arr[i]);
+    }
+    return TRUE;
+}
+
+
 /*
  * COMPOUND
  */
@@ -3594,6 +3942,13 @@ bool_t nfs_encode_compound(
     uint32_t i;
     const op_table_entry *entry;
 
+    if (encode_compound_inline(xdr, args)) {
+        if (args->argarray[2].op == OP_WRITE)
+            return encode_write_data(xdr,
+                (nfs41_write_args*)args->argarray[2].arg);
+        return TRUE;
+    }
+
     tag = args->tag;
     if (!xdr_bytes(xdr, (char **)&tag, &args->tag_len, NFS4_OPAQUE_LIMIT))
         return FALSE;
@@ -27,6 +27,10 @@
 bool_t nfs_encode_compound(XDR *xdr, caddr_t *args);
 bool_t nfs_decode_compound(XDR *xdr, caddr_t *res);
 
+bool_t nfs_peek_read_compound(const char *buffer, u_int length,
+    unsigned char *sessionid, uint32_t *slotid, uint32_t *sequenceid,
+    u_int *data_offset, uint32_t *data_len);
+
 void nfsacl41_free(nfsacl41 *acl);
 
 #endif /* !__NFS41_NFS_XDR_H__ */
@@ -25,6 +25,8 @@
 
 #include "nfs41_ops.h"
 #include "delegation.h"
+#include "readahead.h"
+#include "write_gather.h"
 #include "from_kernel.h"
 #include "daemon_debug.h"
 #include "upcall.h"
@@ -88,6 +90,10 @@ static void open_state_free(
         nfs41_delegation_deref(state->delegation.state);
     if (state->ea.list != INVALID_HANDLE_VALUE)
         free(state->ea.list);
+    if (state->readahead)
+        nfs41_readahead_free(state->readahead);
+    if (state->write_gather)
+        nfs41_write_gather_free(state->write_gather);
     free(state);
 }
 
@@ -867,7 +873,7 @@ static int do_nfs41_close(nfs41_open_state *state)
 
 static int handle_close(nfs41_upcall *upcall)
 {
-    int status = NFS4_OK, rm_status = NFS4_OK;
+    int status = NFS4_OK, rm_status = NFS4_OK, flush_status = NFS4_OK;
     close_upcall_args *args = &upcall->args.close;
     nfs41_open_state *state = upcall->state_ref;
 
@@ -911,6 +917,16 @@ retry_delete:
                 nfs_error_string(rm_status));
             rm_status = nfs_to_windows_error(rm_status, ERROR_INTERNAL_ERROR);
         }
+    } else if (state->type == NF4REG) {
+        /* write back any cached writes for close-to-open consistency;
+         * on failure, the data stays cached under the delegation, and
+         * the error is reported once the open is closed */
+        flush_status = nfs41_delegation_flush(state);
+        if (flush_status) {
+            eprintf("handle_close: nfs41_delegation_flush() failed with %s\n",
+                nfs_error_string(flush_status));
+            flush_status = nfs_to_windows_error(flush_status, ERROR_WRITE_FAULT);
+        }
     }
 
     if (state->do_close) {
@@ -920,10 +936,12 @@ out:
     /* remove from the client's list of state for recovery */
     client_state_remove(state);
 
-    if (status || !rm_status)
+    if (status)
         return status;
-    else
+    else if (rm_status)
         return rm_status;
+    else
+        return flush_status;
 }
 
 static void cleanup_close(nfs41_upcall *upcall)
@@ -0,0 +1,309 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#include <Windows.h>
+#include <stdio.h>
+
+#include "read_cache.h"
+#include "tree.h"
+#include "daemon_debug.h"
+
+
+#define RCLVL 2 /* dprintf level for read cache logging */
+
+#define READ_CACHE_MAX_PAGES (READ_CACHE_MAX_SIZE / READ_CACHE_PAGE_SIZE)
+
+#define page_align(offset) ((offset) & ~(uint64_t)(READ_CACHE_PAGE_SIZE - 1))
+
+
+struct read_cache_page {
+    RB_ENTRY(read_cache_page) rbnode;
+    uint64_t                fileid;
+    uint64_t                offset;
+    uint32_t                length; /* < READ_CACHE_PAGE_SIZE at eof */
+    unsigned char           *data; /* points into nfs41_read_cache.arena */
+    bool_t                  in_use;
+    volatile LONG           referenced; /* for clock eviction */
+};
+
+RB_HEAD(page_tree, read_cache_page);
+
+struct nfs41_read_cache {
+    struct page_tree        head;
+    struct read_cache_page  *pages;
+    unsigned char           *arena; /* allocated on first insert */
+    uint32_t                clock_hand;
+    volatile LONG           generation; /* bumped by each invalidate */
+    SRWLOCK                 lock;
+};
+
+static int page_cmp(struct read_cache_page *lhs, struct read_cache_page *rhs)
+{
+    if (lhs->fileid != rhs->fileid)
+        return lhs->fileid < rhs->fileid ? -1 : 1;
+    return lhs->offset < rhs->offset ? -1 : lhs->offset > rhs->offset;
+}
+RB_GENERATE(page_tree, read_cache_page, rbnode, page_cmp)
+
+
+/* internal functions expect the caller to hold a lock on the cache */
+static struct read_cache_page* page_search(
+    IN struct nfs41_read_cache *cache,
+    IN uint64_t fileid,
+    IN uint64_t offset)
+{
+    struct read_cache_page tmp;
+    tmp.fileid = fileid;
+    tmp.offset = offset;
+    return RB_FIND(page_tree, &cache->head, &tmp);
+}
+
+static __inline void page_free(
+    IN struct nfs41_read_cache *cache,
+    IN struct read_cache_page *page)
+{
+    RB_REMOVE(page_tree, &cache->head, page);
+    page->in_use = FALSE;
+}
+
+/* use the clock algorithm to find an unused page, giving a second
+ * chance to any page that was referenced since the last sweep */
+static struct read_cache_page* page_evict(
+    IN struct nfs41_read_cache *cache)
+{
+    struct read_cache_page *page;
+    uint32_t i;
+
+    for (i = 0; i < 2 * READ_CACHE_MAX_PAGES; i++) {
+        page = &cache->pages[cache->clock_hand];
+        cache->clock_hand = (cache->clock_hand + 1) % READ_CACHE_MAX_PAGES;
+
+        if (!page->in_use)
+            return page;
+        if (page->referenced) {
+            page->referenced = 0;
+            continue;
+        }
+        dprintf(RCLVL, "read cache: evicting fileid=%llu offset=%llu\n",
+            page->fileid, page->offset);
+        page_free(cache, page);
+        return page;
+    }
+    return NULL;
+}
+
+static int arena_create(
+    IN struct nfs41_read_cache *cache)
+{
+    uint32_t i;
+    int status = NO_ERROR;
+
+    /* the page contents are always written before they're read */
+    cache->arena = malloc(READ_CACHE_MAX_SIZE);
+    if (cache->arena == NULL) {
+        status = GetLastError();
+        goto out;
+    }
+    for (i = 0; i < READ_CACHE_MAX_PAGES; i++)
+        cache->pages[i].data = cache->arena + i * READ_CACHE_PAGE_SIZE;
+out:
+    return status;
+}
+
+
+/* public read cache interface, declared in read_cache.h */
+int nfs41_read_cache_create(
+    OUT struct nfs41_read_cache **cache_out)
+{
+    struct nfs41_read_cache *cache;
+    int status = NO_ERROR;
+
+    dprintf(RCLVL, "nfs41_read_cache_create()\n");
+
+    cache = calloc(1, sizeof(struct nfs41_read_cache));
+    if (cache == NULL) {
+        status = GetLastError();
+        goto out;
+    }
+
+    cache->pages = calloc(READ_CACHE_MAX_PAGES, sizeof(struct read_cache_page));
+    if (cache->pages == NULL) {
+        status = GetLastError();
+        goto out_err_cache;
+    }
+
+    RB_INIT(&cache->head);
+    InitializeSRWLock(&cache->lock);
+    *cache_out = cache;
+out:
+    return status;
+
+out_err_cache:
+    free(cache);
+    goto out;
+}
+
+void nfs41_read_cache_free(
+    IN OUT struct nfs41_read_cache **cache_out)
+{
+    struct nfs41_read_cache *cache = *cache_out;
+
+    dprintf(RCLVL, "nfs41_read_cache_free()\n");
+
+    free(cache->arena);
+    free(cache->pages);
+    free(cache);
+    *cache_out = NULL;
+}
+
+int nfs41_read_cache_lookup(
+    IN struct nfs41_read_cache *cache,
+    IN uint64_t fileid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    OUT unsigned char *buffer,
+    OUT uint32_t *len_out)
+{
+    struct read_cache_page *page;
+    uint64_t position;
+    uint32_t copied = 0, page_offset, chunk;
+    int status = ERROR_FILE_NOT_FOUND;
+
+    AcquireSRWLockShared(&cache->lock);
+
+    while (copied < length) {
+        position = offset + copied;
+        page = page_search(cache, fileid, page_align(position));
+        if (page == NULL)
+            goto out_unlock;
+
+        page->referenced = 1;
+        page_offset = (uint32_t)(position - page->offset);
+        if (page_offset >= page->length) {
+            /* past the end of the file */
+            status = copied ? NO_ERROR : ERROR_HANDLE_EOF;
+            goto out_unlock;
+        }
+
+        chunk = min(length - copied, page->length - page_offset);
+        memcpy(buffer + copied, page->data + page_offset, chunk);
+        copied += chunk;
+
+        if (page->length < READ_CACHE_PAGE_SIZE)
+            break; /* reached eof */
+    }
+    status = NO_ERROR;
+
+out_unlock:
+    ReleaseSRWLockShared(&cache->lock);
+    *len_out = copied;
+
+    dprintf(RCLVL, "read cache: lookup fileid=%llu offset=%llu len=%u "
+        "found %u bytes\n", fileid, offset, length, copied);
+    return status;
+}
+
+uint32_t nfs41_read_cache_generation(
+    IN struct nfs41_read_cache *cache)
+{
+    return (uint32_t)cache->generation;
+}
+
+void nfs41_read_cache_insert(
+    IN struct nfs41_read_cache *cache,
+    IN uint64_t fileid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN const unsigned char *data,
+    IN bool_t eof,
+    IN uint32_t generation)
+{
+    struct read_cache_page *page;
+    const uint64_t end = offset + length;
+    uint64_t position;
+    uint32_t count;
+
+    /* start at the first page boundary within the range */
+    position = page_align(offset + READ_CACHE_PAGE_SIZE - 1);
+    if (position >= end)
+        return;
+
+    AcquireSRWLockExclusive(&cache->lock);
+
+    /* an invalidation raced with the READ; the data may be stale */
+    if ((uint32_t)cache->generation != generation) {
+        dprintf(RCLVL, "read cache: dropping insert for fileid=%llu "
+            "offset=%llu from generation %u\n", fileid, offset, generation);
+        goto out_unlock;
+    }
+
+    if (cache->arena == NULL && arena_create(cache))
+        goto out_unlock;
+
+    for (; position < end; position += READ_CACHE_PAGE_SIZE) {
+        count = (uint32_t)min(end - position, READ_CACHE_PAGE_SIZE);
+        if (count < READ_CACHE_PAGE_SIZE && !eof)
+            break;
+
+        if (page_search(cache, fileid, position))
+            continue;
+
+        page = page_evict(cache);
+        if (page == NULL)
+            break;
+
+        page->fileid = fileid;
+        page->offset = position;
+        page->length = count;
+        page->referenced = 0;
+        page->in_use = TRUE;
+        memcpy(page->data, data + (position - offset), count);
+        RB_INSERT(page_tree, &cache->head, page);
+    }
+out_unlock:
+    ReleaseSRWLockExclusive(&cache->lock);
+}
+
+void nfs41_read_cache_invalidate(
+    IN struct nfs41_read_cache *cache,
+    IN uint64_t fileid)
+{
+    struct read_cache_page tmp, *page, *next;
+    uint32_t count = 0;
+
+    tmp.fileid = fileid;
+    tmp.offset = 0;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    cache->generation++;
+    page = RB_NFIND(page_tree, &cache->head, &tmp);
+    while (page && page->fileid == fileid) {
+        next = RB_NEXT(page_tree, &cache->head, page);
+        page_free(cache, page);
+        page = next;
+        count++;
+    }
+    ReleaseSRWLockExclusive(&cache->lock);
+
+    if (count)
+        dprintf(RCLVL, "read cache: invalidated %u pages for fileid=%llu\n",
+            count, fileid);
+}
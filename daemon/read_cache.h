@@ -0,0 +1,89 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef __NFS41_DAEMON_READ_CACHE_H__
+#define __NFS41_DAEMON_READ_CACHE_H__
+
+#include "nfs41.h"
+
+
+/* data caching under OPEN_DELEGATE_READ
+ *
+ *   a read delegation guarantees that the file's contents can't change
+ * without a recall, so data read from the server can be shared by every
+ * open of the file until the delegation is returned.  the cache holds
+ * fixed-size pages in a single arena, indexed by (fileid, offset), and
+ * evicts with a clock algorithm so lookups only need a shared lock. */
+
+#define READ_CACHE_PAGE_SIZE 65536
+
+/* allow up to 32M of cached file data per server */
+#define READ_CACHE_MAX_SIZE 33554432
+
+
+static __inline struct nfs41_read_cache* client_read_cache(
+    IN nfs41_client *client)
+{
+    return client_server(client)->read_cache;
+}
+
+int nfs41_read_cache_create(
+    OUT struct nfs41_read_cache **cache_out);
+
+void nfs41_read_cache_free(
+    IN OUT struct nfs41_read_cache **cache_out);
+
+/* copy cached data into 'buffer', starting at 'offset'.  on return,
+ * 'len_out' holds the number of bytes copied before the first missing
+ * page.  returns NO_ERROR if the whole range (or everything up to eof)
+ * was found, ERROR_HANDLE_EOF if offset is past the cached eof, or
+ * ERROR_FILE_NOT_FOUND if a page is missing */
+int nfs41_read_cache_lookup(
+    IN struct nfs41_read_cache *cache,
+    IN uint64_t fileid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    OUT unsigned char *buffer,
+    OUT uint32_t *len_out);
+
+/* sample the invalidation generation before sending a READ, and pass it
+ * to nfs41_read_cache_insert(); any invalidation in between means the
+ * data may predate a WRITE, so the insert is dropped */
+uint32_t nfs41_read_cache_generation(
+    IN struct nfs41_read_cache *cache);
+
+/* cache the whole pages covered by the given range; if 'eof' is set,
+ * also cache the partial page at the end of the file */
+void nfs41_read_cache_insert(
+    IN struct nfs41_read_cache *cache,
+    IN uint64_t fileid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN const unsigned char *data,
+    IN bool_t eof,
+    IN uint32_t generation);
+
+/* drop all pages for the given file, and advance the generation */
+void nfs41_read_cache_invalidate(
+    IN struct nfs41_read_cache *cache,
+    IN uint64_t fileid);
+
+#endif /* !__NFS41_DAEMON_READ_CACHE_H__ */
@@ -0,0 +1,426 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#include <Windows.h>
+#include <stdio.h>
+
+#include "nfs41_ops.h"
+#include "readahead.h"
+#include "dispatch.h"
+#include "daemon_debug.h"
+#include "util.h"
+
+
+#define RALVL 2 /* dprintf level for read-ahead logging */
+
+/* number of staging buffers per open */
+#define READAHEAD_SLOTS 2
+
+/* next_offset before the first read, and after invalidation */
+#define READAHEAD_NO_OFFSET ((uint64_t)-1)
+
+/* ms before staged data is too old to serve; without a delegation,
+ * another client may have written the file since we read it */
+#define READAHEAD_MAX_AGE 1000
+
+uint32_t readahead_max_size = READAHEAD_DEFAULT_MAX;
+
+
+enum readahead_slot_state {
+    SLOT_EMPTY,
+    SLOT_PENDING,
+    SLOT_READY
+};
+
+struct readahead_slot {
+    uint64_t                offset;
+    uint32_t                length; /* requested if pending, else valid */
+    enum readahead_slot_state state;
+    int                     status;
+    bool_t                  eof;
+    bool_t                  invalid; /* discard when the read completes */
+    ULONGLONG               ready_at; /* tick count when it became ready */
+    unsigned char           *data; /* readahead_max_size bytes */
+};
+
+typedef struct __nfs41_readahead {
+    CRITICAL_SECTION        lock;
+    CONDITION_VARIABLE      cond;
+    uint64_t                next_offset; /* where a sequential read starts */
+    uint32_t                window;
+    uint32_t                capacity; /* size of each slot's buffer */
+    struct readahead_slot   slots[READAHEAD_SLOTS];
+} nfs41_readahead;
+
+struct readahead_args {
+    struct dispatch_work    work;
+    nfs41_root              *root;
+    nfs41_open_state        *state;
+    struct readahead_slot   *slot;
+};
+
+
+static nfs41_readahead* readahead_get(
+    IN nfs41_open_state *state)
+{
+    nfs41_readahead *readahead = state->readahead;
+
+    if (readahead == NULL) {
+        readahead = calloc(1, sizeof(nfs41_readahead));
+        if (readahead == NULL)
+            goto out;
+        InitializeCriticalSection(&readahead->lock);
+        InitializeConditionVariable(&readahead->cond);
+        readahead->next_offset = READAHEAD_NO_OFFSET;
+        readahead->capacity = readahead_max_size;
+
+        /* another thread may have beaten us to it */
+        if (InterlockedCompareExchangePointer((PVOID*)&state->readahead,
+                readahead, NULL) != NULL) {
+            nfs41_readahead_free(readahead);
+            readahead = state->readahead;
+        }
+    }
+out:
+    return readahead;
+}
+
+void nfs41_readahead_free(
+    IN nfs41_readahead *readahead)
+{
+    uint32_t i;
+    for (i = 0; i < READAHEAD_SLOTS; i++)
+        free(readahead->slots[i].data);
+    DeleteCriticalSection(&readahead->lock);
+    free(readahead);
+}
+
+/* the following functions expect the caller to hold readahead->lock */
+static __inline uint64_t slot_end(
+    IN const struct readahead_slot *slot)
+{
+    return slot->offset + slot->length;
+}
+
+static struct readahead_slot* slot_find(
+    IN nfs41_readahead *readahead,
+    IN uint64_t offset)
+{
+    struct readahead_slot *slot;
+    const ULONGLONG now = GetTickCount64();
+    uint32_t i;
+
+    for (i = 0; i < READAHEAD_SLOTS; i++) {
+        slot = &readahead->slots[i];
+        if (slot->state == SLOT_READY &&
+            now - slot->ready_at > READAHEAD_MAX_AGE) {
+            dprintf(RALVL, "read-ahead: dropping stale offset=%llu len=%u\n",
+                slot->offset, slot->length);
+            slot->state = SLOT_EMPTY;
+        }
+        if (slot->state == SLOT_EMPTY || slot->invalid)
+            continue;
+        if (offset < slot->offset)
+            continue;
+        /* a slot at eof also answers for offsets past its end */
+        if (offset < slot_end(slot) ||
+            (slot->state == SLOT_READY && slot->eof))
+            return slot;
+    }
+    return NULL;
+}
+
+static void slot_discard(
+    IN struct readahead_slot *slot)
+{
+    if (slot->state == SLOT_PENDING)
+        slot->invalid = TRUE;
+    else
+        slot->state = SLOT_EMPTY;
+}
+
+static void readahead_collapse(
+    IN nfs41_readahead *readahead)
+{
+    uint32_t i;
+
+    if (readahead->window)
+        dprintf(RALVL, "read-ahead: collapsing window of %u\n",
+            readahead->window);
+    readahead->window = 0;
+    for (i = 0; i < READAHEAD_SLOTS; i++)
+        slot_discard(&readahead->slots[i]);
+}
+
+
+/* asynchronous read-ahead, on a background worker */
+static void readahead_proc(
+    IN void *args)
+{
+    struct readahead_args *ra = (struct readahead_args*)args;
+    nfs41_open_state *state = ra->state;
+    nfs41_readahead *readahead = state->readahead;
+    struct readahead_slot *slot = ra->slot;
+    nfs41_session *session = state->session;
+    nfs41_path_fh *file = &state->file;
+    const uint32_t maxreadsize = max_read_size(session, &file->fh);
+    stateid_arg stateid;
+    uint32_t len = 0, bytes_read, chunk;
+    bool_t eof = FALSE;
+    int status = NFS4_OK;
+
+    nfs41_open_stateid_arg(state, &stateid);
+
+    /* the slot's buffer belongs to us until we mark it ready */
+    while (len < slot->length) {
+        chunk = min(slot->length - len, maxreadsize);
+        bytes_read = 0;
+        status = nfs41_read(session, file, &stateid, slot->offset + len,
+            chunk, slot->data + len, &bytes_read, &eof);
+        if (status)
+            break;
+        len += bytes_read;
+        if (eof || bytes_read == 0)
+            break;
+    }
+
+    dprintf(RALVL, "read-ahead: offset=%llu len=%u read %u%s status %s\n",
+        slot->offset, slot->length, len, eof ? " (eof)" : "",
+        nfs_error_string(status));
+
+    EnterCriticalSection(&readahead->lock);
+    if (slot->invalid) {
+        slot->state = SLOT_EMPTY;
+        slot->invalid = FALSE;
+    } else {
+        slot->state = SLOT_READY;
+        slot->ready_at = GetTickCount64();
+        slot->length = len;
+        slot->eof = eof;
+        slot->status = len ? NFS4_OK : status;
+    }
+    WakeAllConditionVariable(&readahead->cond);
+    LeaveCriticalSection(&readahead->lock);
+
+    nfs41_open_state_deref(state);
+    nfs41_root_deref(ra->root);
+    free(ra);
+}
+
+static void readahead_start(
+    IN nfs41_readahead *readahead,
+    IN nfs41_root *root,
+    IN nfs41_open_state *state)
+{
+    struct readahead_slot *slot;
+    struct readahead_args *args;
+    uint64_t start = readahead->next_offset;
+    const uint64_t target = readahead->next_offset + readahead->window;
+    uint32_t i;
+    int status;
+
+    /* find the end of what's already staged or in flight */
+    for (i = 0; i < READAHEAD_SLOTS; i++) {
+        slot = &readahead->slots[i];
+        if (slot->state == SLOT_EMPTY || slot->invalid)
+            continue;
+        if (slot->state == SLOT_READY && (slot->eof || slot->status))
+            return; /* don't read past eof */
+        if (slot_end(slot) > start)
+            start = slot_end(slot);
+    }
+
+    while (start < target) {
+        /* find an empty slot */
+        for (i = 0; i < READAHEAD_SLOTS; i++)
+            if (readahead->slots[i].state == SLOT_EMPTY)
+                break;
+        if (i == READAHEAD_SLOTS)
+            break;
+        slot = &readahead->slots[i];
+
+        if (slot->data == NULL) {
+            slot->data = malloc(readahead->capacity);
+            if (slot->data == NULL)
+                break;
+        }
+        args = calloc(1, sizeof(struct readahead_args));
+        if (args == NULL)
+            break;
+
+        slot->offset = start;
+        slot->length = (uint32_t)min(target - start, readahead->capacity);
+        slot->state = SLOT_PENDING;
+        slot->status = NFS4_OK;
+        slot->eof = FALSE;
+        slot->invalid = FALSE;
+
+        /* hold references until the read completes */
+        nfs41_root_ref(root);
+        nfs41_open_state_ref(state);
+        args->root = root;
+        args->state = state;
+        args->slot = slot;
+
+        status = dispatch_queue(&args->work, DISPATCH_BACKGROUND, FALSE,
+            readahead_proc, args);
+        if (status) {
+            eprintf("read-ahead: dispatch_queue() failed with %d\n", status);
+            slot->state = SLOT_EMPTY;
+            nfs41_open_state_deref(state);
+            nfs41_root_deref(root);
+            free(args);
+            break;
+        }
+        dprintf(RALVL, "read-ahead: started offset=%llu len=%u window=%u\n",
+            slot->offset, slot->length, readahead->window);
+        start = slot_end(slot);
+    }
+}
+
+
+int nfs41_readahead_read(
+    IN nfs41_root *root,
+    IN nfs41_open_state *state,
+    IN uint64_t offset,
+    IN uint32_t length,
+    OUT unsigned char *buffer,
+    OUT uint32_t *len_out)
+{
+    nfs41_readahead *readahead;
+    struct readahead_slot *slot;
+    uint64_t position;
+    uint32_t copied = 0, slot_offset, chunk, i;
+    bool_t eof = FALSE;
+    int status = ERROR_FILE_NOT_FOUND;
+
+    *len_out = 0;
+
+    if (readahead_max_size == 0 || state->type != NF4REG)
+        goto out;
+
+    readahead = readahead_get(state);
+    if (readahead == NULL)
+        goto out;
+
+    EnterCriticalSection(&readahead->lock);
+
+    /* detect the access pattern */
+    if (offset == readahead->next_offset) {
+        if (readahead->window == 0)
+            readahead->window = max(READAHEAD_MIN_WINDOW, 2 * length);
+        else
+            readahead->window *= 2;
+        readahead->window = min(readahead->window, readahead->capacity);
+    } else if (slot_find(readahead, offset) == NULL) {
+        readahead_collapse(readahead);
+    }
+
+    /* copy out whatever is staged or in flight */
+    while (copied < length) {
+        position = offset + copied;
+        slot = slot_find(readahead, position);
+        if (slot == NULL)
+            break;
+
+        if (slot->state == SLOT_PENDING) {
+            /* the read-ahead needs a worker of its own */
+            dispatch_block_enter();
+            SleepConditionVariableCS(&readahead->cond,
+                &readahead->lock, INFINITE);
+            dispatch_block_leave();
+            continue;
+        }
+        if (slot->status) {
+            /* let the caller retry the read and report the error */
+            slot->state = SLOT_EMPTY;
+            break;
+        }
+        if (position >= slot_end(slot)) {
+            eof = TRUE; /* past the end of the file */
+            break;
+        }
+
+        slot_offset = (uint32_t)(position - slot->offset);
+        chunk = min(length - copied, slot->length - slot_offset);
+        memcpy(buffer + copied, slot->data + slot_offset, chunk);
+        copied += chunk;
+        if (copied < length && slot->eof) {
+            eof = TRUE;
+            break;
+        }
+    }
+    if (copied == length || (copied && eof))
+        status = NO_ERROR;
+    else if (eof)
+        status = ERROR_HANDLE_EOF;
+
+    readahead->next_offset = offset + length;
+
+    /* recycle the slots we've read past */
+    for (i = 0; i < READAHEAD_SLOTS; i++) {
+        slot = &readahead->slots[i];
+        if (slot->state == SLOT_READY && !slot->eof &&
+            slot_end(slot) <= readahead->next_offset)
+            slot->state = SLOT_EMPTY;
+    }
+
+    if (readahead->window)
+        readahead_start(readahead, root, state);
+
+    LeaveCriticalSection(&readahead->lock);
+
+    *len_out = copied;
+    dprintf(RALVL, "read-ahead: read offset=%llu len=%u served %u bytes\n",
+        offset, length, copied);
+out:
+    return status;
+}
+
+#define open_entry(pos) list_container(pos, nfs41_open_state, client_entry)
+
+void nfs41_readahead_invalidate(
+    IN nfs41_client *client,
+    IN const nfs41_fh *fh)
+{
+    struct list_entry *entry;
+    nfs41_open_state *open;
+    nfs41_readahead *readahead;
+
+    EnterCriticalSection(&client->state.lock);
+    list_for_each(entry, &client->state.opens) {
+        open = open_entry(entry);
+        readahead = open->readahead;
+
+        /* opens that haven't read anything have nothing staged */
+        if (readahead == NULL)
+            continue;
+        if (open->file.fh.superblock != fh->superblock ||
+            open->file.fh.fileid != fh->fileid)
+            continue;
+
+        EnterCriticalSection(&readahead->lock);
+        readahead_collapse(readahead);
+        readahead->next_offset = READAHEAD_NO_OFFSET;
+        LeaveCriticalSection(&readahead->lock);
+    }
+    LeaveCriticalSection(&client->state.lock);
+}
@@ -0,0 +1,77 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef __NFS41_DAEMON_READAHEAD_H__
+#define __NFS41_DAEMON_READAHEAD_H__
+
+#include "nfs41.h"
+
+
+/* sequential read-ahead
+ *
+ *   each open state tracks the offset where its next read would start if
+ * the file is being read sequentially.  every sequential read doubles the
+ * read-ahead window, starting from READAHEAD_MIN_WINDOW, up to
+ * readahead_max_size.  read-ahead is queued on the dispatch pool's
+ * background class, into a small set of staging buffers, and later reads
+ * are served from them.  a read at any other offset that misses the
+ * staging buffers collapses the window and discards the staged data.
+ * staged data also expires after a short time, and is discarded when
+ * the file is written or locked. */
+
+#define READAHEAD_MIN_WINDOW 65536
+
+/* default for readahead_max_size; can be changed with --readahead */
+#define READAHEAD_DEFAULT_MAX 1048576
+
+/* upper bound for --readahead, in bytes */
+#define READAHEAD_LIMIT 16777216
+
+/* largest read-ahead window in bytes, or 0 to disable read-ahead */
+extern uint32_t readahead_max_size;
+
+struct __nfs41_readahead;
+
+void nfs41_readahead_free(
+    IN struct __nfs41_readahead *readahead);
+
+/* serve a read from the open's staging buffers, and start any read-ahead
+ * that the access pattern calls for.  on return, 'len_out' holds the
+ * number of bytes copied into 'buffer'.  returns NO_ERROR if the whole
+ * range (or everything up to eof) was found, ERROR_HANDLE_EOF if offset
+ * is at or past eof, or ERROR_FILE_NOT_FOUND if the rest must be read
+ * from the server */
+int nfs41_readahead_read(
+    IN nfs41_root *root,
+    IN nfs41_open_state *state,
+    IN uint64_t offset,
+    IN uint32_t length,
+    OUT unsigned char *buffer,
+    OUT uint32_t *len_out);
+
+/* discard data staged by any open of the file after a write, a size
+ * change or a lock, since the write may come through a different handle,
+ * and a lock may cover writes from other clients */
+void nfs41_readahead_invalidate(
+    IN nfs41_client *client,
+    IN const nfs41_fh *fh);
+
+#endif /* !__NFS41_DAEMON_READAHEAD_H__ */
@@ -24,6 +24,10 @@
 
 #include "nfs41_ops.h"
 #include "name_cache.h"
+#include "delegation.h"
+#include "read_cache.h"
+#include "readahead.h"
+#include "write_gather.h"
 #include "upcall.h"
 #include "daemon_debug.h"
 #include "util.h"
@@ -47,9 +51,12 @@ static int parse_rw(unsigned char *buffer, uint32_t length, nfs41_upcall *upcall
     if (status) goto out;
     status = safe_read(&buffer, &length, &args->buffer, sizeof(args->buffer));
     if (status) goto out;
+    status = safe_read(&buffer, &length, &args->write_thru, sizeof(args->write_thru));
+    if (status) goto out;
 
-    dprintf(1, "parsing %s len=%lu offset=%llu buf=%p\n", 
-            opcode2string(upcall->opcode), args->len, args->offset, args->buffer);
+    dprintf(1, "parsing %s len=%lu offset=%llu buf=%p write_thru=%d\n", 
+            opcode2string(upcall->opcode), args->len, args->offset, args->buffer,
+            args->write_thru);
 out:
     return status;
 }
@@ -57,13 +64,14 @@ out:
 /* NFS41_READ */
 static int read_from_mds(
     IN nfs41_upcall *upcall,
-    IN stateid_arg *stateid)
+    IN stateid_arg *stateid,
+    OUT bool_t *eof_out)
 {
     nfs41_session *session = upcall->state_ref->session;
     nfs41_path_fh *file = &upcall->state_ref->file;
     readwrite_upcall_args *args = &upcall->args.rw;
     int status = 0;
-    bool_t eof;
+    bool_t eof = FALSE;
     unsigned char *p = args->buffer;
     ULONG to_rcv = args->len, reloffset = 0, len = 0;
     const uint32_t maxreadsize = max_read_size(session, &file->fh);
@@ -91,7 +99,9 @@ static int read_from_mds(
         len += bytes_read;
         args->offset += bytes_read;
         if (status) {
+            /* return the partial read, but don't report eof */
             status = NO_ERROR;
+            eof = FALSE;
             break;
         }
         if (eof) {
@@ -102,6 +112,7 @@ static int read_from_mds(
     }
 out:
     args->out_len = len;
+    *eof_out = eof;
     return status;
 }
 
@@ -139,9 +150,51 @@ static int handle_read(nfs41_upcall *upcall)
 {
     readwrite_upcall_args *args = &upcall->args.rw;
     stateid_arg stateid;
-    ULONG pnfs_bytes_read = 0;
+    ULONG pnfs_bytes_read = 0, cached_bytes = 0;
+    ULONGLONG mds_offset;
+    unsigned char *mds_buffer;
+    uint32_t generation;
+    bool_t eof;
     int status = NO_ERROR;
 
+    /* write back any cached writes in this range before reading it
+     * from the server */
+    status = nfs41_delegation_flush_range(upcall->state_ref,
+        args->offset, args->len);
+    if (status) {
+        status = nfs_to_windows_error(status, ERROR_READ_FAULT);
+        goto out;
+    }
+
+    /* serve what we can from data cached under a read delegation */
+    status = nfs41_delegation_read(upcall->state_ref, args->offset,
+        args->len, args->buffer, &args->out_len);
+    if (status == NO_ERROR || status == ERROR_HANDLE_EOF)
+        goto out;
+
+    if (args->out_len) {
+        cached_bytes = args->out_len;
+        args->out_len = 0;
+
+        args->offset += cached_bytes;
+        args->buffer += cached_bytes;
+        args->len -= cached_bytes;
+    }
+
+    /* serve what we can from read-ahead, and start more if sequential */
+    status = nfs41_readahead_read(upcall->root_ref, upcall->state_ref,
+        args->offset, args->len, args->buffer, &args->out_len);
+    if (status == NO_ERROR || status == ERROR_HANDLE_EOF)
+        goto out;
+
+    if (args->out_len) {
+        cached_bytes += args->out_len;
+        args->offset += args->out_len;
+        args->buffer += args->out_len;
+        args->len -= args->out_len;
+        args->out_len = 0;
+    }
+
     nfs41_open_stateid_arg(upcall->state_ref, &stateid);
 
 #ifdef PNFS_ENABLE_READ
@@ -160,10 +213,22 @@ static int handle_read(nfs41_upcall *upcall)
     }
 #endif
 
-    status = read_from_mds(upcall, &stateid);
+    mds_offset = args->offset;
+    mds_buffer = args->buffer;
+    generation = nfs41_read_cache_generation(
+        client_read_cache(upcall->state_ref->session->client));
+    status = read_from_mds(upcall, &stateid, &eof);
+
+    /* share the data with other opens under the delegation */
+    if (status == NO_ERROR)
+        nfs41_delegation_read_done(upcall->state_ref, mds_offset,
+            args->out_len, mds_buffer, eof, generation);
 
     args->out_len += pnfs_bytes_read;
 out:
+    args->out_len += cached_bytes;
+    if (status == ERROR_HANDLE_EOF && args->out_len)
+        status = NO_ERROR;
     return status;
 }
 
@@ -186,6 +251,15 @@ static int write_to_mds(
     uint32_t retries = MAX_WRITE_RETRIES;
     nfs41_file_info info = { 0 };
 
+    /* small writes may be gathered with adjacent writes on this open */
+    if (nfs41_write_gather_eligible(args->len)) {
+        status = nfs41_write_gather(upcall->state_ref, stateid, args->offset,
+            args->len, args->buffer, &len, &info);
+        if (status == NFS4_OK)
+            args->ctime = info.change;
+        goto out;
+    }
+
 retry_write:
     p = args->buffer;
     to_send = args->len;
@@ -278,6 +352,36 @@ static int handle_write(nfs41_upcall *upcall)
     uint32_t pnfs_bytes_written = 0;
     int status;
 
+    /* discard any read-ahead that this write would make stale, on this
+     * open or any other; this includes writes absorbed by a delegation */
+    nfs41_readahead_invalidate(upcall->state_ref->session->client,
+        &upcall->state_ref->file.fh);
+
+    if (args->write_thru) {
+        /* write back any cached writes from other handles first */
+        status = nfs41_delegation_flush(upcall->state_ref);
+        if (status) {
+            status = nfs_to_windows_error(status, ERROR_NET_WRITE_FAULT);
+            goto out;
+        }
+    } else {
+        nfs41_file_info info;
+
+        /* absorb the write if we hold a write delegation */
+        status = nfs41_delegation_write(upcall->state_ref, args->offset,
+            args->len, args->buffer, &info);
+        if (status == NFS4_OK) {
+            args->out_len = args->len;
+            args->ctime = info.change;
+            goto out;
+        }
+    }
+
+    /* drop any data that other opens cached under a read delegation */
+    nfs41_read_cache_invalidate(
+        client_read_cache(upcall->state_ref->session->client),
+        upcall->state_ref->file.fh.fileid);
+
     nfs41_open_stateid_arg(upcall->state_ref, &stateid);
 
 #ifdef PNFS_ENABLE_WRITE
@@ -291,11 +395,19 @@ static int handle_write(nfs41_upcall *upcall)
         args->len -= pnfs_bytes_written;
 
         if (args->len == 0)
-            goto out;
+            goto out_invalidate;
     }
 #endif
 
     status = write_to_mds(upcall, &stateid);
+out_invalidate:
+    /* a READ that raced with the WRITE may have cached the old data in
+     * between; invalidate again, so that its insert is rejected too */
+    nfs41_read_cache_invalidate(
+        client_read_cache(upcall->state_ref->session->client),
+        upcall->state_ref->file.fh.fileid);
+    nfs41_readahead_invalidate(upcall->state_ref->session->client,
+        &upcall->state_ref->file.fh);
 out:
     args->out_len += pnfs_bytes_written;
     return status;
@@ -313,6 +425,17 @@ out:
 }
 
 
+
+/* NFS41_FLUSH */
+static int handle_flush(nfs41_upcall *upcall)
+{
+    int status;
+
+    status = nfs41_delegation_flush(upcall->state_ref);
+    return nfs_to_windows_error(status, ERROR_NET_WRITE_FAULT);
+}
+
+
 const nfs41_upcall_op nfs41_op_read = {
     parse_rw,
     handle_read,
@@ -322,4 +445,8 @@ const nfs41_upcall_op nfs41_op_write = {
     parse_rw,
     handle_write,
     marshall_rw
+};
+const nfs41_upcall_op nfs41_op_flush = {
+    NULL,
+    handle_flush
 };
\ No newline at end of file
@@ -26,6 +26,7 @@
 #include "nfs41_callback.h"
 #include "nfs41_compound.h"
 #include "nfs41_ops.h"
+#include "dispatch.h"
 #include "daemon_debug.h"
 
 
@@ -44,9 +45,11 @@ bool_t nfs41_recovery_start_or_wait(
     } else {
         status = FALSE;
         dprintf(1, "Waiting for recovery of client %llu\n", client->clnt_id);
+        dispatch_block_enter();
         while (client->recovery.in_recovery)
             SleepConditionVariableCS(&client->recovery.cond,
                 &client->recovery.lock, INFINITE);
+        dispatch_block_leave();
         dprintf(1, "Woke up after recovery of client %llu\n", client->clnt_id);
     }
 
@@ -831,9 +834,13 @@ bool_t nfs41_recover_stateid(
 
     /* if there's recovery in progress, wait for it to finish */
     EnterCriticalSection(&session->client->recovery.lock);
-    while (session->client->recovery.in_recovery)
-        SleepConditionVariableCS(&session->client->recovery.cond,
-            &session->client->recovery.lock, INFINITE);
+    if (session->client->recovery.in_recovery) {
+        dispatch_block_enter();
+        while (session->client->recovery.in_recovery)
+            SleepConditionVariableCS(&session->client->recovery.cond,
+                &session->client->recovery.lock, INFINITE);
+        dispatch_block_leave();
+    }
     LeaveCriticalSection(&session->client->recovery.lock);
 
     switch (stateid->type) {
@@ -27,6 +27,7 @@
 #include "nfs41_ops.h"
 #include "delegation.h"
 #include "name_cache.h"
+#include "readahead.h"
 #include "upcall.h"
 #include "util.h"
 #include "daemon_debug.h"
@@ -351,6 +352,14 @@ static int handle_nfs41_set_size(setattr_upcall_args *args)
     nfs41_open_state *state = args->state;
     int status;
 
+    /* staged read-ahead may extend past the new size */
+    nfs41_readahead_invalidate(state->session->client, &state->file.fh);
+
+    /* absorb the size change if we hold a write delegation */
+    status = nfs41_delegation_set_size(state, size->QuadPart, &info);
+    if (status == NFS4_OK)
+        goto out_update;
+
     /* break read delegations before SETATTR */
     nfs41_delegation_return(state->session, &state->file,
         OPEN_DELEGATE_READ, FALSE);
@@ -369,6 +378,7 @@ static int handle_nfs41_set_size(setattr_upcall_args *args)
         goto out;
     }
 
+out_update:
     /* update the last offset for LAYOUTCOMMIT */
     AcquireSRWLockExclusive(&state->lock);
     state->pnfs_last_offset = info.size ? info.size - 1 : 0;
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <time.h>
 
+#include "nfs41_driver.h" /* for upcall opcodes */
 #include "upcall.h"
 #include "daemon_debug.h"
 #include "util.h"
@@ -44,6 +45,8 @@ extern const nfs41_upcall_op nfs41_op_symlink;
 extern const nfs41_upcall_op nfs41_op_volume;
 extern const nfs41_upcall_op nfs41_op_getacl;
 extern const nfs41_upcall_op nfs41_op_setacl;
+extern const nfs41_upcall_op nfs41_op_flush;
+extern const nfs41_upcall_op nfs41_op_changeattr;
 
 static const nfs41_upcall_op *g_upcall_op_table[] = {
     &nfs41_op_mount,
@@ -63,11 +66,48 @@ static const nfs41_upcall_op *g_upcall_op_table[] = {
     &nfs41_op_volume,
     &nfs41_op_getacl,
     &nfs41_op_setacl,
+    &nfs41_op_flush,
+    &nfs41_op_changeattr,
     NULL,
     NULL
 };
 static const uint32_t g_upcall_op_table_size = ARRAYSIZE(g_upcall_op_table);
 
+/* scheduling class of each upcall in g_upcall_op_table; see dispatch.h */
+enum dispatch_class upcall_class(
+    IN const nfs41_upcall *upcall)
+{
+    switch (upcall->opcode) {
+    case NFS41_READ:
+    case NFS41_WRITE:
+    case NFS41_FLUSH:
+        return DISPATCH_DATA;
+    case NFS41_CHANGE_QUERY:
+    case NFS41_UNMOUNT:
+        return DISPATCH_BACKGROUND;
+    default:
+        return DISPATCH_METADATA;
+    }
+}
+
+/* upcalls whose handlers only read from the server, and can safely run
+ * again from the start after a deferred NFS4ERR_DELAY or NFS4ERR_GRACE.
+ * writes are left out, because a gathered write fails every writer that
+ * shares the gather */
+bool_t upcall_replayable(
+    IN const nfs41_upcall *upcall)
+{
+    switch (upcall->opcode) {
+    case NFS41_READ:
+    case NFS41_FILE_QUERY:
+    case NFS41_VOLUME_QUERY:
+    case NFS41_CHANGE_QUERY:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
 
 int upcall_parse(
     IN unsigned char *buffer,
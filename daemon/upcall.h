@@ -24,6 +24,7 @@
 
 #include "nfs41_ops.h"
 #include "from_kernel.h"
+#include "dispatch.h"
 
 #define NFSD_VERSION_MISMATCH 116
 
@@ -34,6 +35,7 @@ typedef struct __mount_upcall_args {
     DWORD       sec_flavor;
     DWORD       rsize;
     DWORD       wsize;
+    DWORD       nconnect;
     DWORD       lease_time;
     FILE_FS_ATTRIBUTE_INFORMATION FsAttrs;
 } mount_upcall_args;
@@ -71,6 +73,7 @@ typedef struct __readwrite_upcall_args {
     ULONG len;
     ULONG out_len;
     ULONGLONG ctime;
+    BOOLEAN write_thru;
 } readwrite_upcall_args;
 
 typedef struct __lock_upcall_args {
@@ -99,6 +102,17 @@ typedef struct __getattr_upcall_args {
     ULONGLONG ctime;
 } getattr_upcall_args;
 
+/* matches NFS41_CHANGE_QUERY_MAX in nfs41_driver.h */
+#define CHANGE_QUERY_MAX 64
+
+typedef struct __changeattr_upcall_args {
+    nfs41_open_state *states[CHANGE_QUERY_MAX];
+    ULONGLONG changes[CHANGE_QUERY_MAX];
+    DWORD status[CHANGE_QUERY_MAX];
+    BOOLEAN delegated[CHANGE_QUERY_MAX];
+    uint32_t count;
+} changeattr_upcall_args;
+
 typedef struct __setattr_upcall_args {
     const char *path;
     nfs41_root *root;
@@ -180,6 +194,7 @@ typedef union __upcall_args {
     lock_upcall_args        lock;
     unlock_upcall_args      unlock;
     getattr_upcall_args     getattr;
+    changeattr_upcall_args  changeattr;
     getexattr_upcall_args   getexattr;
     setattr_upcall_args     setattr;
     setexattr_upcall_args   setexattr;
@@ -245,4 +260,10 @@ void upcall_cancel(
 void upcall_cleanup(
     IN nfs41_upcall *upcall);
 
+enum dispatch_class upcall_class(
+    IN const nfs41_upcall *upcall);
+
+bool_t upcall_replayable(
+    IN const nfs41_upcall *upcall);
+
 #endif /* !__NFS41_DAEMON_UPCALL_H__ */
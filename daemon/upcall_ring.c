@@ -0,0 +1,463 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#include <Windows.h>
+#include <process.h>
+#include <ntsecapi.h> /* for LsaGetLogonSessionData() */
+#include <lmcons.h> /* for UNLEN */
+#include <stdio.h>
+
+#include <devioctl.h>
+#include "nfs41_driver.h"
+#include "nfs41_ring.h"
+#include "upcall_ring.h"
+#include "upcall.h"
+#include "daemon_debug.h"
+#include "util.h"
+
+
+#define RINGLVL 2 /* dprintf level for upcall ring logging */
+
+/* number of logon sessions whose user names we remember */
+#define LUID_CACHE_SIZE 64
+
+/* limits the ring upcalls waiting on the worker pool; once they're all
+ * taken, the submission ring fills and the driver falls back on
+ * IOCTL_NFS41_READ_BATCH */
+#define RING_UPCALLS_IN_FLIGHT 128
+
+extern int default_uid;
+extern int default_gid;
+
+enum ring_state {
+    RING_STARTING,
+    RING_RUNNING,
+    RING_FAILED
+};
+
+struct luid_name {
+    LUID                    luid;
+    char                    username[UNLEN + 1];
+};
+
+/* an upcall copied out of the submission ring.  its arguments may point
+ * into the buffer, so it stays with the upcall until the downcall */
+struct ring_upcall {
+    struct ring_upcall      *next; /* in upcall_ring.free */
+    nfs41_upcall            upcall;
+    struct dispatch_work    work;
+    upcall_args             saved_args; /* to replay a deferred upcall */
+    LUID                    luid;
+    OVERLAPPED              overlapped;
+    uint32_t                length;
+    unsigned char           buffer[NFS41_RING_DATA_SIZE];
+};
+
+static struct upcall_ring {
+    nfs41_ring_pair         *rings;
+    HANDLE                  doorbell; /* submission ring went from empty */
+    volatile enum ring_state state;
+    nfs41_idmapper          *idmapper;
+    /* overlapped i/o isn't serialized, so every worker can share it */
+    HANDLE                  pipe;
+
+    /* ring upcalls are recycled like the listeners' batches */
+    CRITICAL_SECTION        lock;
+    struct ring_upcall      *free;
+    HANDLE                  limit;
+
+    /* a logon session's user never changes, so cache the names */
+    SRWLOCK                 luid_lock;
+    struct luid_name        luid_cache[LUID_CACHE_SIZE];
+    uint32_t                luid_count;
+    uint32_t                luid_next;
+} upcall_ring;
+
+
+static int luid_to_name(
+    IN const LUID *luid,
+    OUT char *username)
+{
+    PSECURITY_LOGON_SESSION_DATA data;
+    struct luid_name *entry;
+    NTSTATUS nt_status;
+    uint32_t i;
+    int len, status = NO_ERROR;
+
+    AcquireSRWLockShared(&upcall_ring.luid_lock);
+    for (i = 0; i < upcall_ring.luid_count; i++) {
+        entry = &upcall_ring.luid_cache[i];
+        if (entry->luid.LowPart == luid->LowPart &&
+            entry->luid.HighPart == luid->HighPart) {
+            strcpy(username, entry->username);
+            ReleaseSRWLockShared(&upcall_ring.luid_lock);
+            goto out;
+        }
+    }
+    ReleaseSRWLockShared(&upcall_ring.luid_lock);
+
+    nt_status = LsaGetLogonSessionData((PLUID)luid, &data);
+    if (nt_status) {
+        status = LsaNtStatusToWinError(nt_status);
+        eprintf("LsaGetLogonSessionData() failed with %d\n", status);
+        goto out;
+    }
+    len = WideCharToMultiByte(CP_ACP, 0, data->UserName.Buffer,
+        data->UserName.Length / sizeof(WCHAR), username, UNLEN, NULL, NULL);
+    if (len == 0)
+        status = GetLastError();
+    username[len] = '\0';
+    LsaFreeReturnBuffer(data);
+    if (status) {
+        eprintf("WideCharToMultiByte() failed with %d\n", status);
+        goto out;
+    }
+
+    AcquireSRWLockExclusive(&upcall_ring.luid_lock);
+    entry = &upcall_ring.luid_cache[upcall_ring.luid_next];
+    upcall_ring.luid_next = (upcall_ring.luid_next + 1) % LUID_CACHE_SIZE;
+    if (upcall_ring.luid_count < LUID_CACHE_SIZE)
+        upcall_ring.luid_count++;
+    entry->luid = *luid;
+    strcpy(entry->username, username);
+    ReleaseSRWLockExclusive(&upcall_ring.luid_lock);
+out:
+    return status;
+}
+
+static int map_luid_to_ids(
+    IN const LUID *luid,
+    OUT uid_t *uid,
+    OUT gid_t *gid)
+{
+    char username[UNLEN + 1];
+    int status;
+
+    status = luid_to_name(luid, username);
+    if (status)
+        goto out;
+    dprintf(RINGLVL, "map_luid_to_ids: mapping user %s\n", username);
+
+    if (nfs41_idmap_name_to_ids(upcall_ring.idmapper, username, uid, gid)) {
+        /* instead of failing for auth_sys, fall back to 'nobody' uid/gid */
+        *uid = default_uid;
+        *gid = default_gid;
+    }
+out:
+    return status;
+}
+
+static struct ring_upcall* ring_upcall_alloc()
+{
+    struct ring_upcall *ru;
+
+    WaitForSingleObject(upcall_ring.limit, INFINITE);
+
+    EnterCriticalSection(&upcall_ring.lock);
+    ru = upcall_ring.free;
+    if (ru)
+        upcall_ring.free = ru->next;
+    LeaveCriticalSection(&upcall_ring.lock);
+
+    if (ru == NULL) {
+        ru = calloc(1, sizeof(struct ring_upcall));
+        if (ru == NULL) {
+            eprintf("failed to allocate ring upcall\n");
+            goto out_release;
+        }
+        ru->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (ru->overlapped.hEvent == NULL) {
+            eprintf("CreateEvent() failed with %d\n", GetLastError());
+            free(ru);
+            ru = NULL;
+            goto out_release;
+        }
+    }
+out:
+    return ru;
+
+out_release:
+    ReleaseSemaphore(upcall_ring.limit, 1, NULL);
+    goto out;
+}
+
+static void ring_upcall_free(
+    IN struct ring_upcall *ru)
+{
+    EnterCriticalSection(&upcall_ring.lock);
+    ru->next = upcall_ring.free;
+    upcall_ring.free = ru;
+    LeaveCriticalSection(&upcall_ring.lock);
+
+    ReleaseSemaphore(upcall_ring.limit, 1, NULL);
+}
+
+static BOOL ring_ioctl(
+    IN struct ring_upcall *ru,
+    IN DWORD code,
+    IN void *inbuf,
+    IN DWORD inbuf_len)
+{
+    HANDLE event = ru->overlapped.hEvent;
+    DWORD ignored;
+
+    ZeroMemory(&ru->overlapped, sizeof(OVERLAPPED));
+    ru->overlapped.hEvent = event;
+
+    if (DeviceIoControl(upcall_ring.pipe, code, inbuf, inbuf_len,
+            NULL, 0, &ignored, &ru->overlapped))
+        return TRUE;
+    if (GetLastError() != ERROR_IO_PENDING)
+        return FALSE;
+    return GetOverlappedResult(upcall_ring.pipe, &ru->overlapped,
+        &ignored, TRUE);
+}
+
+/* return the downcall through the completion ring, and recycle the
+ * ring upcall */
+static void ring_complete(
+    IN struct ring_upcall *ru)
+{
+    nfs41_upcall *upcall = &ru->upcall;
+    nfs41_ring *cq = &upcall_ring.rings->cq;
+    nfs41_ring_entry *entry;
+    unsigned char buffer[UPCALL_BUF_SIZE];
+    uint32_t length = 0;
+    ULONG pos;
+
+    dprintf(RINGLVL, "completing upcall: xid=%lld opcode=%s status=%d "
+        "get_last_error=%d\n", upcall->xid, opcode2string(upcall->opcode),
+        upcall->status, upcall->last_error);
+
+    entry = nfs41_ring_reserve(cq, &pos);
+    if (entry == NULL) {
+        /* the completion ring is full, so make a normal downcall */
+        upcall_marshall(upcall, buffer, UPCALL_BUF_SIZE, &length);
+        if (!ring_ioctl(ru, IOCTL_NFS41_WRITE, buffer, length))
+            eprintf("IOCTL_NFS41_WRITE failed with %d xid=%lld opcode=%s\n",
+                GetLastError(), upcall->xid, opcode2string(upcall->opcode));
+        goto out;
+    }
+
+    upcall_marshall(upcall, entry->data, NFS41_RING_DATA_SIZE, &length);
+    entry->len = length;
+    if (nfs41_ring_publish(cq, entry, pos) &&
+        !ring_ioctl(ru, IOCTL_NFS41_RING_ENTER, NULL, 0))
+        eprintf("IOCTL_NFS41_RING_ENTER failed with %d\n", GetLastError());
+out:
+    if (upcall->status != NFSD_VERSION_MISMATCH)
+        upcall_cleanup(upcall);
+    ring_upcall_free(ru);
+}
+
+static void ring_worker(void *args)
+{
+    struct ring_upcall *ru = (struct ring_upcall*)args;
+    nfs41_upcall *upcall = &ru->upcall;
+    int status;
+
+    if (ru->work.deferrals) {
+        /* a deferred upcall starts over from its original arguments */
+        upcall->args = ru->saved_args;
+        upcall->status = NO_ERROR;
+        upcall->last_error = NO_ERROR;
+    } else {
+        /* the mapping can block on the idmapper, so it happens here
+         * rather than on the ring threads */
+        status = map_luid_to_ids(&ru->luid, &upcall->uid, &upcall->gid);
+        if (status) {
+            upcall->status = status;
+            goto out_complete;
+        }
+    }
+
+    upcall_handle(upcall);
+
+    /* the dispatcher will call us again when the delay expires */
+    if (dispatch_deferred())
+        return;
+out_complete:
+    ring_complete(ru);
+}
+
+/* parse the upcall and hand it to the worker pool */
+static void ring_dispatch(
+    IN struct ring_upcall *ru)
+{
+    nfs41_upcall *upcall = &ru->upcall;
+    bool_t replayable;
+    int status;
+
+    status = upcall_parse(ru->buffer, ru->length, upcall);
+    if (status) {
+        upcall->status = status;
+        goto out_complete;
+    }
+
+    replayable = upcall_replayable(upcall);
+    if (replayable)
+        ru->saved_args = upcall->args;
+    if (dispatch_queue(&ru->work, upcall_class(upcall), replayable,
+            ring_worker, ru)) {
+        upcall->status = ERROR_NOT_ENOUGH_MEMORY;
+        goto out_complete;
+    }
+    return;
+
+out_complete:
+    ring_complete(ru);
+}
+
+/* the ring threads only copy upcalls out of the submission ring and
+ * queue them, like the listeners in nfs41_daemon.c */
+static unsigned int WINAPI ring_thread(void *args)
+{
+    nfs41_ring *sq;
+    nfs41_ring_entry *entry;
+    struct ring_upcall *ru = NULL;
+    ULONG pos;
+
+    for (;;) {
+        WaitForSingleObject(upcall_ring.doorbell, INFINITE);
+        if (upcall_ring.state == RING_STARTING)
+            continue; /* upcall_ring_start() rings again when it's ready */
+        if (upcall_ring.state == RING_FAILED) {
+            SetEvent(upcall_ring.doorbell); /* pass it on to the next thread */
+            break;
+        }
+
+        sq = &upcall_ring.rings->sq;
+        for (;;) {
+            /* take an upcall before claiming an entry, so we never hold
+             * an entry while we wait for one */
+            if (ru == NULL) {
+                ru = ring_upcall_alloc();
+                if (ru == NULL) {
+                    Sleep(100);
+                    continue;
+                }
+            }
+
+            entry = nfs41_ring_consume(sq, &pos);
+            if (entry == NULL)
+                break;
+            ru->length = min(entry->len, NFS41_RING_DATA_SIZE);
+            memcpy(ru->buffer, entry->data, ru->length);
+            ru->luid.LowPart = entry->luid_low;
+            ru->luid.HighPart = entry->luid_high;
+            nfs41_ring_release(entry, pos);
+
+            /* wake another thread for the rest */
+            if (nfs41_ring_ready(sq))
+                SetEvent(upcall_ring.doorbell);
+
+            /* an empty entry means the driver failed to marshal it,
+             * and has already failed the upcall */
+            if (ru->length == 0)
+                continue;
+
+            ring_dispatch(ru);
+            ru = NULL;
+        }
+    }
+    if (ru)
+        ring_upcall_free(ru);
+    return NO_ERROR;
+}
+
+
+int upcall_ring_start(
+    IN HANDLE pipe,
+    IN nfs41_idmapper *idmapper)
+{
+    nfs41_ring_pair *rings = NULL;
+    HANDLE thread;
+    DWORD len;
+    uint32_t i;
+    int status = NO_ERROR;
+
+    InitializeSRWLock(&upcall_ring.luid_lock);
+    InitializeCriticalSection(&upcall_ring.lock);
+    upcall_ring.idmapper = idmapper;
+    upcall_ring.state = RING_STARTING;
+
+    upcall_ring.limit = CreateSemaphore(NULL, RING_UPCALLS_IN_FLIGHT,
+        RING_UPCALLS_IN_FLIGHT, NULL);
+    if (upcall_ring.limit == NULL) {
+        status = GetLastError();
+        eprintf("CreateSemaphore() failed with %d\n", status);
+        goto out;
+    }
+
+    upcall_ring.pipe = CreateFile(NFS41_USER_DEVICE_NAME_A,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if (upcall_ring.pipe == INVALID_HANDLE_VALUE) {
+        status = GetLastError();
+        eprintf("Unable to open upcall pipe %d\n", status);
+        goto out;
+    }
+
+    /* auto-reset, so each doorbell wakes a single thread */
+    upcall_ring.doorbell = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (upcall_ring.doorbell == NULL) {
+        status = GetLastError();
+        eprintf("CreateEvent() failed with %d\n", status);
+        goto out;
+    }
+
+    /* start the threads first, so the rings are never without them */
+    for (i = 0; i < UPCALL_RING_THREADS; i++) {
+        thread = (HANDLE)_beginthreadex(NULL, 0, ring_thread, NULL, 0, NULL);
+        if (thread == NULL) {
+            status = GetLastError();
+            eprintf("_beginthreadex failed %d\n", status);
+            if (i == 0)
+                goto out_fail;
+            break;
+        }
+        CloseHandle(thread);
+    }
+
+    if (!DeviceIoControl(pipe, IOCTL_NFS41_RING_SETUP,
+            &upcall_ring.doorbell, sizeof(HANDLE),
+            &rings, sizeof(rings), &len, NULL) || rings == NULL) {
+        status = GetLastError();
+        eprintf("IOCTL_NFS41_RING_SETUP failed with %d; every upcall will "
+            "use IOCTL_NFS41_READ_BATCH\n", status);
+        goto out_fail;
+    }
+    upcall_ring.rings = rings;
+    upcall_ring.state = RING_RUNNING;
+    /* the driver may have rung before we were ready */
+    SetEvent(upcall_ring.doorbell);
+
+    dprintf(1, "upcall rings mapped at %p with %u threads\n", rings, i);
+    status = NO_ERROR;
+out:
+    return status;
+
+out_fail:
+    /* the threads exit when they see the failure */
+    upcall_ring.state = RING_FAILED;
+    SetEvent(upcall_ring.doorbell);
+    goto out;
+}
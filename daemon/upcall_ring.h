@@ -0,0 +1,46 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef __NFS41_DAEMON_UPCALL_RING_H__
+#define __NFS41_DAEMON_UPCALL_RING_H__
+
+#include "idmap.h"
+
+
+/* shared-memory upcall transport
+ *
+ *   the driver delivers most upcalls through a submission ring that it
+ * maps into the daemon, and we return their downcalls through a matching
+ * completion ring; see sys/nfs41_ring.h.  the ring threads only copy
+ * upcalls out of the ring and queue them on the worker pool, like the
+ * listeners do.  the workers can't impersonate the client, so the driver
+ * sends its logon session with each upcall.  mounts, opens, locks and
+ * shutdown still go through IOCTL_NFS41_READ_BATCH. */
+
+#define UPCALL_RING_THREADS 4
+
+/* map the rings on the given device handle, which must stay open while
+ * the daemon runs, and start the threads that serve them */
+int upcall_ring_start(
+    IN HANDLE pipe,
+    IN nfs41_idmapper *idmapper);
+
+#endif /* !__NFS41_DAEMON_UPCALL_RING_H__ */
@@ -0,0 +1,529 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#include <Windows.h>
+#include <stdio.h>
+
+#include "nfs41_ops.h"
+#include "write_cache.h"
+#include "daemon_debug.h"
+#include "util.h"
+
+
+#define WCLVL 2 /* dprintf level for write cache logging */
+
+/* number of times to retry on write/commit verifier mismatch */
+#define MAX_FLUSH_RETRIES 6
+
+
+/* dirty extents are kept sorted by offset, and never overlap or touch;
+ * any write that overlaps or is adjacent to an existing extent is merged
+ * into it, so sequential writes grow a single extent */
+struct write_extent {
+    struct list_entry       entry; /* position in nfs41_write_cache.extents */
+    uint64_t                offset;
+    uint32_t                length;
+    uint32_t                capacity;
+    unsigned char           *data;
+};
+#define extent_entry(pos) list_container(pos, struct write_extent, entry)
+
+typedef struct __nfs41_write_cache {
+    struct list_entry       extents;
+    uint64_t                size; /* file size, including dirty data */
+    uint64_t                server_size; /* file size on the server */
+    uint64_t                truncate_size; /* smallest size since last flush */
+    uint32_t                dirty; /* bytes held in extents */
+    bool_t                  truncated;
+    bool_t                  size_changed;
+    CRITICAL_SECTION        lock;
+} nfs41_write_cache;
+
+/* total bytes of dirty data across all caches */
+static volatile LONG g_dirty_bytes = 0;
+
+
+static __inline uint64_t extent_end(
+    IN const struct write_extent *extent)
+{
+    return extent->offset + extent->length;
+}
+
+static int extent_create(
+    IN uint64_t offset,
+    IN uint32_t capacity,
+    OUT struct write_extent **extent_out)
+{
+    struct write_extent *extent;
+    int status = NO_ERROR;
+
+    extent = calloc(1, sizeof(struct write_extent));
+    if (extent == NULL) {
+        status = GetLastError();
+        goto out;
+    }
+    extent->data = malloc(capacity);
+    if (extent->data == NULL) {
+        status = GetLastError();
+        free(extent);
+        goto out;
+    }
+    extent->offset = offset;
+    extent->capacity = capacity;
+    list_init(&extent->entry);
+    *extent_out = extent;
+out:
+    return status;
+}
+
+static void extent_free(
+    IN struct write_extent *extent)
+{
+    list_remove(&extent->entry);
+    free(extent->data);
+    free(extent);
+}
+
+static void dirty_add(
+    IN nfs41_write_cache *cache,
+    IN LONG bytes)
+{
+    cache->dirty += bytes;
+    InterlockedExchangeAdd(&g_dirty_bytes, bytes);
+}
+
+static void cache_clear(
+    IN nfs41_write_cache *cache)
+{
+    struct list_entry *entry, *tmp;
+
+    list_for_each_tmp(entry, tmp, &cache->extents)
+        extent_free(extent_entry(entry));
+
+    InterlockedExchangeAdd(&g_dirty_bytes, -(LONG)cache->dirty);
+    cache->dirty = 0;
+    cache->truncated = FALSE;
+    cache->size_changed = FALSE;
+}
+
+
+int nfs41_write_cache_create(
+    IN uint64_t size,
+    OUT nfs41_write_cache **cache_out)
+{
+    nfs41_write_cache *cache;
+    int status = NO_ERROR;
+
+    cache = calloc(1, sizeof(nfs41_write_cache));
+    if (cache == NULL) {
+        status = GetLastError();
+        goto out;
+    }
+    list_init(&cache->extents);
+    cache->size = cache->server_size = size;
+    InitializeCriticalSection(&cache->lock);
+    *cache_out = cache;
+out:
+    return status;
+}
+
+void nfs41_write_cache_free(
+    IN nfs41_write_cache *cache)
+{
+    if (cache->dirty || cache->size_changed)
+        eprintf("nfs41_write_cache_free: discarding %u dirty bytes\n",
+            cache->dirty);
+    cache_clear(cache);
+    DeleteCriticalSection(&cache->lock);
+    free(cache);
+}
+
+int nfs41_write_cache_write(
+    IN nfs41_write_cache *cache,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN const unsigned char *data,
+    OUT uint64_t *size_out)
+{
+    struct list_entry *entry, *tmp;
+    struct write_extent *first = NULL, *extent;
+    uint64_t start = offset, end = offset + length;
+    uint32_t merged = 0, capacity;
+    LONG added;
+    int status = NO_ERROR;
+
+    EnterCriticalSection(&cache->lock);
+
+    /* find the range of extents that overlap or touch this write */
+    list_for_each(entry, &cache->extents) {
+        extent = extent_entry(entry);
+        if (extent->offset > end)
+            break;
+        if (extent_end(extent) < offset)
+            continue;
+        if (first == NULL)
+            first = extent;
+        start = min(start, extent->offset);
+        end = max(end, extent_end(extent));
+        merged += extent->length;
+    }
+
+    if (end - start > ULONG_MAX) {
+        status = ERROR_NOT_ENOUGH_MEMORY;
+        goto out_unlock;
+    }
+    added = (LONG)(end - start - merged);
+    if (added > 0 && g_dirty_bytes + added > WRITE_CACHE_MAX_DIRTY) {
+        dprintf(WCLVL, "write cache full: %ld dirty bytes\n", g_dirty_bytes);
+        status = ERROR_NOT_ENOUGH_MEMORY;
+        goto out_unlock;
+    }
+
+    if (first && first->offset == start && first->capacity >= end - start) {
+        /* the write fits in the first extent's buffer */
+        extent = first;
+    } else if (first && first->offset == start) {
+        /* grow the first extent's buffer geometrically for appends */
+        unsigned char *buffer;
+        capacity = (uint32_t)min(max(end - start,
+            (uint64_t)first->capacity * 2), ULONG_MAX);
+        buffer = realloc(first->data, capacity);
+        if (buffer == NULL) {
+            status = ERROR_NOT_ENOUGH_MEMORY;
+            goto out_unlock;
+        }
+        first->data = buffer;
+        first->capacity = capacity;
+        extent = first;
+    } else {
+        /* allocate a new extent, and copy the old ones into it */
+        status = extent_create(start, (uint32_t)(end - start), &extent);
+        if (status)
+            goto out_unlock;
+        if (first) {
+            list_add(&extent->entry, first->entry.prev, &first->entry);
+        } else {
+            /* insert before the first extent that starts past this one */
+            list_for_each(entry, &cache->extents)
+                if (extent_entry(entry)->offset > start)
+                    break;
+            list_add(&extent->entry, entry->prev, entry);
+        }
+    }
+
+    /* merge the data from any following extents we overlap */
+    list_for_each_tmp(entry, tmp, &cache->extents) {
+        struct write_extent *next = extent_entry(entry);
+        if (next == extent || next->offset < start)
+            continue;
+        if (next->offset > end)
+            break;
+        memcpy(extent->data + (next->offset - start), next->data, next->length);
+        extent_free(next);
+    }
+
+    /* copy in the new data last, so it overwrites anything older */
+    memcpy(extent->data + (offset - start), data, length);
+    extent->length = (uint32_t)(end - start);
+    dirty_add(cache, added);
+
+    if (cache->size < offset + length)
+        cache->size = offset + length;
+    *size_out = cache->size;
+
+    dprintf(WCLVL, "write cache: absorbed offset=%llu len=%u; extent "
+        "[%llu, %llu) dirty=%u size=%llu\n", offset, length, start, end,
+        cache->dirty, cache->size);
+out_unlock:
+    LeaveCriticalSection(&cache->lock);
+    return status;
+}
+
+int nfs41_write_cache_set_size(
+    IN nfs41_write_cache *cache,
+    IN uint64_t size)
+{
+    struct list_entry *entry, *tmp;
+    struct write_extent *extent;
+
+    EnterCriticalSection(&cache->lock);
+
+    /* trim any dirty data past the new size */
+    list_for_each_tmp(entry, tmp, &cache->extents) {
+        extent = extent_entry(entry);
+        if (extent->offset >= size) {
+            dirty_add(cache, -(LONG)extent->length);
+            extent_free(extent);
+        } else if (extent_end(extent) > size) {
+            dirty_add(cache, -(LONG)(extent_end(extent) - size));
+            extent->length = (uint32_t)(size - extent->offset);
+        }
+    }
+
+    if (size < cache->size) {
+        /* remember the smallest size, so the flush can discard any
+         * data on the server that was truncated, then extended again */
+        if (!cache->truncated || size < cache->truncate_size)
+            cache->truncate_size = size;
+        cache->truncated = TRUE;
+    }
+    cache->size = size;
+    cache->size_changed = TRUE;
+
+    dprintf(WCLVL, "write cache: set size=%llu dirty=%u\n", size, cache->dirty);
+    LeaveCriticalSection(&cache->lock);
+    return NO_ERROR;
+}
+
+bool_t nfs41_write_cache_getattr(
+    IN nfs41_write_cache *cache,
+    IN OUT nfs41_file_info *info)
+{
+    bool_t dirty;
+
+    EnterCriticalSection(&cache->lock);
+    dirty = cache->dirty || cache->size_changed;
+    if (dirty) {
+        /* 10.4.3. Handling of CB_GETATTR: report a change attribute
+         * greater than the server's to show the file was modified */
+        info->size = cache->size;
+        info->change++;
+    }
+    LeaveCriticalSection(&cache->lock);
+    return dirty;
+}
+
+bool_t nfs41_write_cache_dirty(
+    IN nfs41_write_cache *cache)
+{
+    /* unlocked read; callers use this only as a hint */
+    return cache->dirty || cache->size_changed;
+}
+
+static int cache_set_size(
+    IN nfs41_session *session,
+    IN nfs41_path_fh *file,
+    IN stateid_arg *stateid,
+    IN uint64_t size)
+{
+    nfs41_file_info info = { 0 };
+    int status;
+
+    info.size = size;
+    info.attrmask.count = 1;
+    info.attrmask.arr[0] = FATTR4_WORD0_SIZE;
+
+    status = nfs41_setattr(session, file, stateid, &info);
+    if (status)
+        eprintf("write cache: setattr(size=%llu) failed with %s\n",
+            size, nfs_error_string(status));
+    return status;
+}
+
+/* writes back the extents that overlap [start, end) */
+static int cache_write_extents(
+    IN nfs41_write_cache *cache,
+    IN nfs41_session *session,
+    IN nfs41_path_fh *file,
+    IN stateid_arg *stateid,
+    IN uint64_t start,
+    IN uint64_t end)
+{
+    struct list_entry *entry;
+    struct write_extent *extent;
+    nfs41_write_verf verf;
+    enum stable_how4 committed = FILE_SYNC4;
+    const uint32_t maxwritesize = max_write_size(session, &file->fh);
+    uint64_t first = 0, last = 0;
+    uint32_t retries = MAX_FLUSH_RETRIES;
+    bool_t found;
+    int status = NFS4_OK;
+
+retry_write:
+    found = FALSE;
+    list_for_each(entry, &cache->extents) {
+        uint32_t sent = 0;
+        extent = extent_entry(entry);
+
+        if (extent_end(extent) <= start)
+            continue;
+        if (extent->offset >= end)
+            break;
+        if (!found)
+            first = extent->offset;
+        found = TRUE;
+        last = extent_end(extent);
+
+        /* send the extent in full-wsize UNSTABLE4 chunks */
+        while (sent < extent->length) {
+            uint32_t bytes_written = 0;
+            uint32_t chunk = min(extent->length - sent, maxwritesize);
+
+            status = nfs41_write(session, file, stateid, extent->data + sent,
+                chunk, extent->offset + sent, UNSTABLE4, &bytes_written,
+                &verf, NULL);
+            if (status)
+                goto out;
+            if (bytes_written == 0) {
+                /* a short write that makes no progress would loop forever */
+                eprintf("write cache: WRITE at offset %llu wrote 0 bytes\n",
+                    extent->offset + sent);
+                status = NFS4ERR_IO;
+                goto out;
+            }
+            sent += bytes_written;
+
+            if (!verify_write(&verf, &committed)) {
+                if (retries--) goto retry_write;
+                goto out_verify_failed;
+            }
+        }
+    }
+
+    if (found && committed != FILE_SYNC4) {
+        /* COMMIT count=0 means 'to the end of the file' */
+        const uint32_t count = last - first > ULONG_MAX ?
+            0 : (uint32_t)(last - first);
+
+        dprintf(WCLVL, "write cache: COMMIT offset=%llu count=%u\n",
+            first, count);
+        status = nfs41_commit(session, file, first, count, 1, &verf, NULL);
+        if (status)
+            goto out;
+
+        if (!verify_commit(&verf)) {
+            if (retries--) goto retry_write;
+            goto out_verify_failed;
+        }
+    }
+out:
+    return status;
+
+out_verify_failed:
+    eprintf("write cache: write verifier changed %u times, giving up\n",
+        MAX_FLUSH_RETRIES);
+    status = NFS4ERR_IO;
+    goto out;
+}
+
+int nfs41_write_cache_flush(
+    IN nfs41_write_cache *cache,
+    IN nfs41_session *session,
+    IN nfs41_path_fh *file,
+    IN stateid_arg *stateid)
+{
+    int status = NFS4_OK;
+
+    /* hold the lock across the flush, so that writers and readers of
+     * this file wait for the data to reach the server */
+    EnterCriticalSection(&cache->lock);
+    if (!cache->dirty && !cache->size_changed)
+        goto out_unlock;
+
+    dprintf(1, "--> nfs41_write_cache_flush(%s) dirty=%u size=%llu\n",
+        file->path->path, cache->dirty, cache->size);
+
+    /* apply any truncation before writing data past it */
+    if (cache->truncated) {
+        status = cache_set_size(session, file, stateid, cache->truncate_size);
+        if (status)
+            goto out_unlock;
+        cache->truncated = FALSE;
+    }
+
+    if (!list_empty(&cache->extents)) {
+        status = cache_write_extents(cache, session, file, stateid,
+            0, NFS4_UINT64_MAX);
+        if (status)
+            goto out_unlock;
+    }
+
+    /* the writes may leave the file short of a size set by SETATTR */
+    if (cache->size_changed) {
+        status = cache_set_size(session, file, stateid, cache->size);
+        if (status)
+            goto out_unlock;
+    }
+
+    cache_clear(cache);
+    cache->server_size = cache->size;
+out_unlock:
+    LeaveCriticalSection(&cache->lock);
+    dprintf(WCLVL, "<-- nfs41_write_cache_flush() returning %s\n",
+        nfs_error_string(status));
+    return status;
+}
+
+int nfs41_write_cache_flush_range(
+    IN nfs41_write_cache *cache,
+    IN nfs41_session *session,
+    IN nfs41_path_fh *file,
+    IN stateid_arg *stateid,
+    IN uint64_t offset,
+    IN uint32_t length)
+{
+    struct list_entry *entry, *tmp;
+    struct write_extent *extent;
+    const uint64_t end = offset + length;
+    int status = NFS4_OK;
+
+    EnterCriticalSection(&cache->lock);
+    if (cache->truncated || cache->size_changed || end > cache->server_size) {
+        /* the server's size is stale, so a READ in this range could
+         * see the wrong data or end of file; write back everything */
+        LeaveCriticalSection(&cache->lock);
+        return nfs41_write_cache_flush(cache, session, file, stateid);
+    }
+
+    dprintf(WCLVL, "--> nfs41_write_cache_flush_range(%s, %llu, %u)\n",
+        file->path->path, offset, length);
+
+    status = cache_write_extents(cache, session, file, stateid, offset, end);
+    if (status)
+        goto out_unlock;
+
+    /* drop the extents that reached the server */
+    list_for_each_tmp(entry, tmp, &cache->extents) {
+        extent = extent_entry(entry);
+        if (extent_end(extent) <= offset)
+            continue;
+        if (extent->offset >= end)
+            break;
+        if (cache->server_size < extent_end(extent))
+            cache->server_size = extent_end(extent);
+        dirty_add(cache, -(LONG)extent->length);
+        extent_free(extent);
+    }
+out_unlock:
+    LeaveCriticalSection(&cache->lock);
+    dprintf(WCLVL, "<-- nfs41_write_cache_flush_range() returning %s\n",
+        nfs_error_string(status));
+    return status;
+}
+
+void nfs41_write_cache_discard(
+    IN nfs41_write_cache *cache)
+{
+    EnterCriticalSection(&cache->lock);
+    dprintf(WCLVL, "write cache: discarding %u dirty bytes\n", cache->dirty);
+    cache_clear(cache);
+    LeaveCriticalSection(&cache->lock);
+}
@@ -0,0 +1,99 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef __NFS41_DAEMON_WRITE_CACHE_H__
+#define __NFS41_DAEMON_WRITE_CACHE_H__
+
+#include "nfs41.h"
+
+
+/* write-back caching under OPEN_DELEGATE_WRITE
+ *
+ *   a write delegation guarantees that no other client can read or modify
+ * the file without first recalling the delegation.  this lets us absorb
+ * WRITEs and size changes in the daemon, and push them to the server later
+ * as full-wsize UNSTABLE4 WRITEs followed by a single COMMIT.  dirty data
+ * is flushed on CLOSE, on NFS41_FLUSH (FlushFileBuffers), before the
+ * delegation is returned, and whenever the total amount of dirty data
+ * exceeds WRITE_CACHE_MAX_DIRTY.  a READ that goes to the server flushes
+ * only the dirty data in its range.
+ *   write-through handles bypass the cache entirely, and any write that
+ * the cache can't absorb falls back to the synchronous path. */
+
+/* allow up to 32M of dirty data across all delegations */
+#define WRITE_CACHE_MAX_DIRTY 33554432
+
+struct __nfs41_write_cache;
+
+int nfs41_write_cache_create(
+    IN uint64_t size,
+    OUT struct __nfs41_write_cache **cache_out);
+
+void nfs41_write_cache_free(
+    IN struct __nfs41_write_cache *cache);
+
+/* absorb a write; fails with ERROR_NOT_ENOUGH_MEMORY if the write would
+ * exceed WRITE_CACHE_MAX_DIRTY, in which case the caller should flush and
+ * retry or fall back to a synchronous WRITE */
+int nfs41_write_cache_write(
+    IN struct __nfs41_write_cache *cache,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN const unsigned char *data,
+    OUT uint64_t *size_out);
+
+/* absorb a SETATTR(size), trimming any dirty data past the new size */
+int nfs41_write_cache_set_size(
+    IN struct __nfs41_write_cache *cache,
+    IN uint64_t size);
+
+/* overwrite size and change attributes in 'info' with the dirty state;
+ * returns FALSE if the cache holds no dirty data */
+bool_t nfs41_write_cache_getattr(
+    IN struct __nfs41_write_cache *cache,
+    IN OUT nfs41_file_info *info);
+
+bool_t nfs41_write_cache_dirty(
+    IN struct __nfs41_write_cache *cache);
+
+/* write back all dirty data and size changes using the given stateid */
+int nfs41_write_cache_flush(
+    IN struct __nfs41_write_cache *cache,
+    IN nfs41_session *session,
+    IN nfs41_path_fh *file,
+    IN struct __stateid_arg *stateid);
+
+/* write back only the dirty data in [offset, offset+length), for a READ
+ * of that range.  flushes everything if a size change is pending, or if
+ * the range reaches past the file's size on the server */
+int nfs41_write_cache_flush_range(
+    IN struct __nfs41_write_cache *cache,
+    IN nfs41_session *session,
+    IN nfs41_path_fh *file,
+    IN struct __stateid_arg *stateid,
+    IN uint64_t offset,
+    IN uint32_t length);
+
+/* drop all dirty data without writing it back, for REMOVE */
+void nfs41_write_cache_discard(
+    IN struct __nfs41_write_cache *cache);
+
+#endif /* !__NFS41_DAEMON_WRITE_CACHE_H__ */
@@ -0,0 +1,331 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#include <Windows.h>
+#include <stdio.h>
+
+#include "nfs41_ops.h"
+#include "write_gather.h"
+#include "daemon_debug.h"
+#include "util.h"
+
+
+#define WGLVL 2 /* dprintf level for write gather logging */
+
+/* number of times to retry on write/commit verifier mismatch */
+#define MAX_GATHER_RETRIES 6
+
+uint32_t write_gather_delay = WRITE_GATHER_DEFAULT_DELAY;
+
+
+struct gather_batch {
+    uint64_t                offset;
+    uint32_t                length;
+    uint32_t                capacity; /* limited by max_write_size() */
+    uint32_t                writers; /* callers waiting on the batch */
+    uint32_t                written; /* bytes on stable storage */
+    uint64_t                change;
+    int                     status;
+    bool_t                  done;
+    unsigned char           data[WRITE_GATHER_MAX_SIZE];
+};
+
+typedef struct __nfs41_write_gather {
+    CRITICAL_SECTION        lock;
+    CONDITION_VARIABLE      cond;
+    struct gather_batch     *batch; /* open batch, accepting writes */
+    uint32_t                inflight; /* writes sent but not completed */
+} nfs41_gather_state;
+
+
+static nfs41_gather_state* write_gather_get(
+    IN nfs41_open_state *state)
+{
+    nfs41_gather_state *gather = state->write_gather;
+
+    if (gather == NULL) {
+        gather = calloc(1, sizeof(nfs41_gather_state));
+        if (gather == NULL)
+            goto out;
+        InitializeCriticalSection(&gather->lock);
+        InitializeConditionVariable(&gather->cond);
+
+        /* another thread may have beaten us to it */
+        if (InterlockedCompareExchangePointer((PVOID*)&state->write_gather,
+                gather, NULL) != NULL) {
+            nfs41_write_gather_free(gather);
+            gather = state->write_gather;
+        }
+    }
+out:
+    return gather;
+}
+
+void nfs41_write_gather_free(
+    IN nfs41_gather_state *gather)
+{
+    DeleteCriticalSection(&gather->lock);
+    free(gather);
+}
+
+
+/* write the range with the given stability, looping on short writes,
+ * and send a COMMIT if the server didn't write it to stable storage */
+static int write_commit(
+    IN nfs41_open_state *state,
+    IN stateid_arg *stateid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN unsigned char *data,
+    IN enum stable_how4 stable,
+    OUT uint32_t *len_out,
+    OUT nfs41_file_info *info)
+{
+    nfs41_write_verf verf;
+    enum stable_how4 committed;
+    uint32_t len, bytes_written;
+    /* on write verifier mismatch, retry N times before failing */
+    uint32_t retries = MAX_GATHER_RETRIES;
+    int status;
+
+retry_write:
+    len = 0;
+    committed = FILE_SYNC4;
+    status = NFS4_OK;
+
+    while (len < length) {
+        bytes_written = 0;
+        status = nfs41_write(state->session, &state->file, stateid,
+            data + len, length - len, offset + len, stable,
+            &bytes_written, &verf, info);
+        if (status && !len)
+            goto out;
+        len += bytes_written;
+        if (status || bytes_written == 0) {
+            status = NFS4_OK;
+            break;
+        }
+        if (!verify_write(&verf, &committed)) {
+            if (retries--) goto retry_write;
+            goto out_verify_failed;
+        }
+    }
+
+    if (committed != FILE_SYNC4) {
+        status = nfs41_commit(state->session, &state->file,
+            offset, len, 1, &verf, info);
+        if (status) {
+            len = 0;
+            goto out;
+        }
+        if (!verify_commit(&verf)) {
+            if (retries--) goto retry_write;
+            goto out_verify_failed;
+        }
+    }
+out:
+    *len_out = len;
+    return status;
+
+out_verify_failed:
+    len = 0;
+    status = NFS4ERR_IO;
+    goto out;
+}
+
+static void batch_result(
+    IN struct gather_batch *batch,
+    IN uint64_t offset,
+    IN uint32_t length,
+    OUT uint32_t *len_out,
+    OUT nfs41_file_info *info,
+    OUT int *status_out)
+{
+    const uint32_t relative = (uint32_t)(offset - batch->offset);
+
+    *len_out = batch->written > relative ?
+        min(batch->written - relative, length) : 0;
+    info->change = batch->change;
+    *status_out = *len_out ? NFS4_OK : batch->status;
+    if (*status_out == NFS4_OK && *len_out == 0)
+        *status_out = NFS4ERR_IO;
+}
+
+
+/* the following functions expect the caller to hold gather->lock, and
+ * return with it held */
+static int write_direct(
+    IN nfs41_gather_state *gather,
+    IN nfs41_open_state *state,
+    IN stateid_arg *stateid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN unsigned char *data,
+    OUT uint32_t *len_out,
+    OUT nfs41_file_info *info)
+{
+    int status;
+
+    gather->inflight++;
+    LeaveCriticalSection(&gather->lock);
+
+    status = write_commit(state, stateid, offset, length, data,
+        FILE_SYNC4, len_out, info);
+
+    EnterCriticalSection(&gather->lock);
+    gather->inflight--;
+    /* wake a batch that's waiting for us to finish */
+    WakeAllConditionVariable(&gather->cond);
+    return status;
+}
+
+static int write_join(
+    IN nfs41_gather_state *gather,
+    IN struct gather_batch *batch,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN unsigned char *data,
+    OUT uint32_t *len_out,
+    OUT nfs41_file_info *info)
+{
+    int status;
+
+    memcpy(batch->data + batch->length, data, length);
+    batch->length += length;
+    batch->writers++;
+    if (batch->length == batch->capacity)
+        WakeAllConditionVariable(&gather->cond);
+
+    while (!batch->done)
+        SleepConditionVariableCS(&gather->cond, &gather->lock, INFINITE);
+
+    batch_result(batch, offset, length, len_out, info, &status);
+    if (--batch->writers == 0)
+        free(batch);
+    return status;
+}
+
+static int write_lead(
+    IN nfs41_gather_state *gather,
+    IN nfs41_open_state *state,
+    IN stateid_arg *stateid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN unsigned char *data,
+    OUT uint32_t *len_out,
+    OUT nfs41_file_info *info)
+{
+    struct gather_batch *batch;
+    const DWORD start = GetTickCount();
+    DWORD elapsed;
+    int status;
+
+    batch = malloc(sizeof(struct gather_batch));
+    if (batch == NULL)
+        return write_direct(gather, state, stateid,
+            offset, length, data, len_out, info);
+
+    batch->offset = offset;
+    batch->length = length;
+    batch->capacity = min(WRITE_GATHER_MAX_SIZE,
+        max_write_size(state->session, &state->file.fh));
+    batch->writers = 1;
+    batch->written = 0;
+    batch->status = NFS4_OK;
+    batch->done = FALSE;
+    memcpy(batch->data, data, length);
+    gather->batch = batch;
+
+    /* collect adjacent writes until the previous write completes, the
+     * batch fills up, or the delay expires */
+    while (gather->inflight && batch->length < batch->capacity) {
+        elapsed = GetTickCount() - start;
+        if (elapsed >= write_gather_delay)
+            break;
+        if (!SleepConditionVariableCS(&gather->cond, &gather->lock,
+                write_gather_delay - elapsed))
+            break;
+    }
+    gather->batch = NULL;
+    gather->inflight++;
+    LeaveCriticalSection(&gather->lock);
+
+    /* gathered writes are only stable once they're committed */
+    dprintf(WGLVL, "write gather: sending offset=%llu len=%u from %u writes\n",
+        batch->offset, batch->length, batch->writers);
+    status = write_commit(state, stateid, batch->offset, batch->length,
+        batch->data, batch->writers > 1 ? UNSTABLE4 : FILE_SYNC4,
+        &batch->written, info);
+
+    EnterCriticalSection(&gather->lock);
+    gather->inflight--;
+    batch->status = status;
+    batch->change = info->change;
+    batch->done = TRUE;
+    WakeAllConditionVariable(&gather->cond);
+
+    batch_result(batch, offset, length, len_out, info, &status);
+    if (--batch->writers == 0)
+        free(batch);
+    return status;
+}
+
+
+int nfs41_write_gather(
+    IN nfs41_open_state *state,
+    IN stateid_arg *stateid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN unsigned char *data,
+    OUT uint32_t *len_out,
+    OUT nfs41_file_info *info)
+{
+    nfs41_gather_state *gather;
+    struct gather_batch *batch;
+    int status;
+
+    *len_out = 0;
+
+    gather = write_gather_get(state);
+    if (gather == NULL)
+        return write_commit(state, stateid, offset, length, data,
+            FILE_SYNC4, len_out, info);
+
+    EnterCriticalSection(&gather->lock);
+    batch = gather->batch;
+    if (batch) {
+        if (offset == batch->offset + batch->length &&
+            length <= batch->capacity - batch->length)
+            status = write_join(gather, batch, offset, length,
+                data, len_out, info);
+        else
+            status = write_direct(gather, state, stateid, offset,
+                length, data, len_out, info);
+    } else if (gather->inflight) {
+        status = write_lead(gather, state, stateid, offset, length,
+            data, len_out, info);
+    } else {
+        status = write_direct(gather, state, stateid, offset, length,
+            data, len_out, info);
+    }
+    LeaveCriticalSection(&gather->lock);
+    return status;
+}
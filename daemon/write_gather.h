@@ -0,0 +1,75 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef __NFS41_DAEMON_WRITE_GATHER_H__
+#define __NFS41_DAEMON_WRITE_GATHER_H__
+
+#include "nfs41_ops.h"
+
+
+/* small-write gathering
+ *
+ *   small writes that go straight to the server are normally sent one at
+ * a time as FILE_SYNC4.  when a write arrives while another write on the
+ * same open is still in flight, it opens a batch instead, and waits up to
+ * write_gather_delay milliseconds for the in-flight write to finish.  any
+ * adjacent writes that arrive in the meantime are appended to the batch,
+ * which is then sent as a single UNSTABLE4 WRITE followed by a COMMIT.
+ * every caller waits for the COMMIT before returning, so a write is on
+ * stable storage when it completes, just as it would be with FILE_SYNC4. */
+
+/* writes larger than this are never gathered */
+#define WRITE_GATHER_MAX_WRITE 4096
+
+/* largest batch, in bytes */
+#define WRITE_GATHER_MAX_SIZE 65536
+
+/* default for write_gather_delay; can be changed with --writegather */
+#define WRITE_GATHER_DEFAULT_DELAY 2
+
+/* longest time in milliseconds that a batch stays open, or 0 to disable
+ * write gathering */
+extern uint32_t write_gather_delay;
+
+struct __nfs41_write_gather;
+
+static __inline bool_t nfs41_write_gather_eligible(
+    IN uint32_t length)
+{
+    return write_gather_delay && length <= WRITE_GATHER_MAX_WRITE;
+}
+
+void nfs41_write_gather_free(
+    IN struct __nfs41_write_gather *gather);
+
+/* write the given range to stable storage, possibly as part of a larger
+ * batch.  on return, 'len_out' holds the number of bytes written and
+ * 'info' holds the change attribute after the write */
+int nfs41_write_gather(
+    IN nfs41_open_state *state,
+    IN stateid_arg *stateid,
+    IN uint64_t offset,
+    IN uint32_t length,
+    IN unsigned char *data,
+    OUT uint32_t *len_out,
+    OUT nfs41_file_info *info);
+
+#endif /* !__NFS41_DAEMON_WRITE_GATHER_H__ */
@@ -128,6 +128,7 @@ static struct clnt_ops *clnt_vc_ops(void);
 static bool_t time_not_ok(struct timeval *);
 static int read_vc(void *, void *, int);
 static int write_vc(void *, void *, int);
+static int writev_vc(void *, WSABUF *, int);
 
 struct ct_data {
 	int		ct_fd;		/* connection's fd */
@@ -475,6 +476,7 @@ clnt_vc_create(fd, raddr, prog, vers, sendsz, recvsz, cb_xdr, cb_fn, cb_args)
 	recvsz = __rpc_get_t_size(si.si_af, si.si_proto, (int)recvsz);
 	xdrrec_create(&(ct->ct_xdrs), sendsz, recvsz,
 	    cl->cl_private, read_vc, write_vc);
+	__xdrrec_setwritev(&(ct->ct_xdrs), writev_vc);
 
     if (cb_xdr && cb_fn && cb_args) {
         cl->cb_xdr = cb_xdr;
@@ -883,6 +885,13 @@ clnt_vc_control(cl, request, info)
 		    htonl(*(u_int32_t *)info);
 		break;
 
+	case CLSET_RECV_STEER:
+		__xdrrec_setsteer(&ct->ct_xdrs,
+		    ((struct clnt_steer *)info)->cs_steer,
+		    ((struct clnt_steer *)info)->cs_hold,
+		    ((struct clnt_steer *)info)->cs_arg);
+		break;
+
 	default:
 		release_fd_lock(ct->ct_fd, mask);
 		return (FALSE);
@@ -1009,6 +1018,44 @@ read_vc(ctp, buf, len)
 	return (len);
 }
 
+/*
+ * Like write_vc, but gathers the data from an array of buffers.  The
+ * array may be modified.
+ */
+static int
+writev_vc(ctp, iov, cnt)
+	void *ctp;
+	WSABUF *iov;
+	int cnt;
+{
+	struct ct_data *ct = (struct ct_data *)ctp;
+	DWORD sent;
+	int len = 0, i;
+
+	for (i = 0; i < cnt; i++)
+		len += iov[i].len;
+
+	while (cnt > 0) {
+		if (WSASend(ct->ct_fd, iov, cnt, &sent, 0, NULL, NULL)
+		    == SOCKET_ERROR) {
+			ct->ct_error.re_errno = WSAGetLastError();
+			ct->ct_error.re_status = RPC_CANTSEND;
+			return (-1);
+		}
+		/* skip past whatever was sent */
+		while (cnt > 0 && sent >= iov->len) {
+			sent -= iov->len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->buf += sent;
+			iov->len -= sent;
+		}
+	}
+	return (len);
+}
+
 static int
 write_vc(ctp, buf, len)
 	void *ctp;
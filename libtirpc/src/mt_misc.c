@@ -102,6 +102,9 @@ mutex_t serialize_pkey;
 /* netconfig serialization */
 mutex_t nc_lock;
 
+/* pool of large record buffers (xdr_rec.c) */
+mutex_t xdrrec_pool_lock;
+
 #ifdef _WIN32
 /*
  * Initialize all the mutexes (CriticalSections)
@@ -129,6 +132,7 @@ void multithread_init(void)
 	InitializeCriticalSection(&xprtlist_lock);
 	InitializeCriticalSection(&serialize_pkey);
 	InitializeCriticalSection(&nc_lock);
+	InitializeCriticalSection(&xdrrec_pool_lock);
 }
 #endif
 
@@ -89,6 +89,8 @@ bool_t __svc_clean_idle(fd_set *, int, bool_t);
 bool_t __xdrrec_setnonblock(XDR *, int);
 bool_t __xdrrec_setblock(XDR *);
 bool_t __xdrrec_getrec(XDR *, enum xprt_stat *, bool_t);
+bool_t __xdrrec_setsteer(XDR *, xdrrec_steer_t, xdrrec_hold_t, void *);
+bool_t __xdrrec_setwritev(XDR *, int (*)(void *, WSABUF *, int));
 void __xprt_unregister_unlocked(SVCXPRT *);
 void __xprt_set_raddr(SVCXPRT *, const struct sockaddr_storage *);
 
@@ -85,6 +85,7 @@
 #include <rpc/svc.h>
 #include <rpc/clnt.h>
 #include <stddef.h>
+#include <reentrant.h>
 #include "rpc_com.h"
 //#include <unistd.h>
 static bool_t	xdrrec_getlong(XDR *, long *);
@@ -123,6 +124,37 @@ static const struct  xdr_ops xdrrec_ops = {
 
 #define LAST_FRAG ((u_int32_t)(1 << 31))
 
+/*
+ * Most references the output buffer can hold before it's flushed, and
+ * the smallest number of bytes worth putting by reference.
+ */
+#define MAX_OUT_REFS 8
+#define MIN_OUT_REF_SIZE 1024
+
+/*
+ * Buffers start out no larger than this, and grow on demand up to
+ * sendsize and recvsize.
+ */
+#define INITIAL_BUF_SIZE 65536
+
+/*
+ * Buffers grown past INITIAL_BUF_SIZE are taken from a pool shared by all
+ * streams, and given back once the record that needed them is done, so a
+ * connection only holds a large buffer while it's sending or receiving a
+ * large record.  The pool keeps at most XDRREC_POOL_MAX idle buffers,
+ * adding up to no more than XDRREC_POOL_BYTES.
+ */
+#define XDRREC_POOL_MAX 8
+#define XDRREC_POOL_BYTES (32 * 1024 * 1024)
+
+static struct {
+	char *buf;
+	u_int size;
+} xdrrec_pool[XDRREC_POOL_MAX];
+static u_int xdrrec_pool_count;
+static u_int xdrrec_pool_bytes;
+extern mutex_t xdrrec_pool_lock;
+
 typedef struct rec_strm {
 	char *tcp_handle;
 	/*
@@ -134,18 +166,35 @@ typedef struct rec_strm {
 	char *out_boundry;	/* data cannot up to this address */
 	u_int32_t *frag_header;	/* beginning of curren fragment */
 	bool_t frag_sent;	/* true if buffer sent in middle of record */
+	/*
+	 * bytes put by reference, sent with a gather write at their
+	 * position in the output buffer when it's flushed
+	 */
+	int (*writevit)(void *, WSABUF *, int);
+	struct {
+		char *pos;
+		const char *data;
+		u_int len;
+	} out_refs[MAX_OUT_REFS];
+	u_int out_nrefs;
+	u_int out_reflen;	/* total bytes in out_refs */
 	/*
 	 * in-coming bits
 	 */
 	int (*readit)(void *, void *, int);
-	u_long in_size;	/* fixed size of the input buffer */
+	u_long in_size;	/* current size of the input buffer */
 	char *in_base;
 	char *in_finger;	/* location of next byte to be had */
 	char *in_boundry;	/* can read up to this location */
 	u_int fbtbc;		/* fragment bytes to be consumed */
 	bool_t last_frag;
-	u_int sendsize;
-	u_int recvsize;
+	u_int sendsize;		/* largest size of the output buffer */
+	u_int recvsize;		/* largest size of the input buffer */
+	u_int out_size;		/* current size of the output buffer */
+	u_int out_alloc;	/* size of a pooled out_base, 0 if out_own */
+	u_int in_alloc;		/* size of a pooled in_base, 0 if in_own */
+	char *out_own;		/* buffers allocated with the stream */
+	char *in_own;
 
 	bool_t nonblock;
 	bool_t in_haveheader;
@@ -155,8 +204,26 @@ typedef struct rec_strm {
 	u_int in_reclen;
 	u_int in_received;
 	u_int in_maxrec;
+
+	/*
+	 * receive steering, see xdrrec_steer_t
+	 */
+	xdrrec_steer_t steer;
+	xdrrec_hold_t steer_hold;
+	void *steer_arg;
+	bool_t in_steered;	/* steer already called for this record */
+	char *in_dest;		/* destination of the steered range */
+	u_int in_dest_off;	/* record offset of the steered range */
+	u_int in_dest_len;
+	u_int in_diverted;	/* bytes received into in_dest so far */
 } RECSTREAM;
 
+/*
+ * Bytes of a record to receive before calling the steer function; records
+ * no larger than this are never steered.
+ */
+#define STEER_PEEK_SIZE 512
+
 static u_int	fix_buf_size(u_int);
 static bool_t	flush_out(RECSTREAM *, bool_t);
 static bool_t	fill_input_buf(RECSTREAM *);
@@ -164,6 +231,13 @@ static bool_t	get_input_bytes(RECSTREAM *, char *, u_int);
 static bool_t	set_input_fragment(RECSTREAM *);
 static bool_t	skip_input_bytes(RECSTREAM *, u_int);
 static bool_t	realloc_stream(RECSTREAM *, u_int);
+static bool_t	grow_output(RECSTREAM *);
+static char	*pool_get(u_int, u_int *);
+static void	pool_put(char *, u_int);
+static void	release_output(RECSTREAM *);
+static void	release_input(RECSTREAM *);
+static void	steer_record(RECSTREAM *);
+static bool_t	flush_refs(RECSTREAM *, u_int32_t);
 
 
 /*
@@ -196,14 +270,16 @@ xdrrec_create(xdrs, sendsize, recvsize, tcp_handle, readit, writeit)
 		 */
 		return;
 	}
-	rstrm->sendsize = sendsize = fix_buf_size(sendsize);
-	rstrm->out_base = mem_alloc(rstrm->sendsize);
+	rstrm->sendsize = fix_buf_size(sendsize);
+	sendsize = min(rstrm->sendsize, INITIAL_BUF_SIZE);
+	rstrm->out_base = mem_alloc(sendsize);
 	if (rstrm->out_base == NULL) {
 		//warnx("xdrrec_create: out of memory");
 		mem_free(rstrm, sizeof(RECSTREAM));
 		return;
 	}
-	rstrm->recvsize = recvsize = fix_buf_size(recvsize);
+	rstrm->recvsize = fix_buf_size(recvsize);
+	recvsize = min(rstrm->recvsize, INITIAL_BUF_SIZE);
 	rstrm->in_base = mem_alloc(recvsize);
 	if (rstrm->in_base == NULL) {
 		//warnx("xdrrec_create: out of memory");
@@ -223,8 +299,16 @@ xdrrec_create(xdrs, sendsize, recvsize, tcp_handle, readit, writeit)
 	rstrm->frag_header = (u_int32_t *)(void *)rstrm->out_base;
 	rstrm->out_finger += sizeof(u_int32_t);
 	rstrm->out_boundry += sendsize;
+	rstrm->out_size = sendsize;
+	rstrm->out_own = rstrm->out_base;
+	rstrm->out_alloc = 0;
 	rstrm->frag_sent = FALSE;
+	rstrm->writevit = NULL;
+	rstrm->out_nrefs = 0;
+	rstrm->out_reflen = 0;
 	rstrm->in_size = recvsize;
+	rstrm->in_own = rstrm->in_base;
+	rstrm->in_alloc = 0;
 	rstrm->in_boundry = rstrm->in_base;
 	rstrm->in_finger = (rstrm->in_boundry += recvsize);
 	rstrm->fbtbc = 0;
@@ -235,6 +319,12 @@ xdrrec_create(xdrs, sendsize, recvsize, tcp_handle, readit, writeit)
 	rstrm->nonblock = FALSE;
 	rstrm->in_reclen = 0;
 	rstrm->in_received = 0;
+	rstrm->steer = NULL;
+	rstrm->steer_hold = NULL;
+	rstrm->steer_arg = NULL;
+	rstrm->in_steered = FALSE;
+	rstrm->in_dest = NULL;
+	rstrm->in_diverted = 0;
 }
 
 
@@ -281,9 +371,11 @@ xdrrec_putlong(xdrs, lp)
 		 * inefficient
 		 */
 		rstrm->out_finger -= sizeof(int32_t);
-		rstrm->frag_sent = TRUE;
-		if (! flush_out(rstrm, FALSE))
-			return (FALSE);
+		if (! grow_output(rstrm)) {
+			rstrm->frag_sent = TRUE;
+			if (! flush_out(rstrm, FALSE))
+				return (FALSE);
+		}
 		dest_lp = ((int32_t *)(void *)(rstrm->out_finger));
 		rstrm->out_finger += sizeof(int32_t);
 	}
@@ -336,7 +428,8 @@ xdrrec_putbytes(xdrs, addr, len)
 		rstrm->out_finger += current;
 		addr += current;
 		len -= current;
-		if (rstrm->out_finger == rstrm->out_boundry) {
+		if (rstrm->out_finger == rstrm->out_boundry &&
+		    ! grow_output(rstrm)) {
 			rstrm->frag_sent = TRUE;
 			if (! flush_out(rstrm, FALSE))
 				return (FALSE);
@@ -359,6 +452,7 @@ xdrrec_getpos(xdrs)
 
 		case XDR_ENCODE:
 			pos += PtrToLong(rstrm->out_finger) - PtrToLong(rstrm->out_base);
+			pos += rstrm->out_reflen;
 			break;
 
 		case XDR_DECODE:
@@ -471,8 +565,10 @@ xdrrec_destroy(xdrs)
 {
 	RECSTREAM *rstrm = (RECSTREAM *)xdrs->x_private;
 
-	mem_free(rstrm->out_base, rstrm->sendsize);
-	mem_free(rstrm->in_base, rstrm->recvsize);
+	release_output(rstrm);
+	release_input(rstrm);
+	mem_free(rstrm->out_base, rstrm->out_size);
+	mem_free(rstrm->in_base, rstrm->in_size);
 	mem_free(rstrm, sizeof(RECSTREAM));
 }
 
@@ -559,7 +655,7 @@ xdrrec_endofrecord(xdrs, sendnow)
 	RECSTREAM *rstrm = (RECSTREAM *)(xdrs->x_private);
 	u_long len;  /* fragment length */
 
-	if (sendnow || rstrm->frag_sent ||
+	if (sendnow || rstrm->frag_sent || rstrm->out_nrefs ||
 		(PtrToUlong(rstrm->out_finger) + sizeof(u_int32_t) >=
 		PtrToUlong(rstrm->out_boundry))) {
 		rstrm->frag_sent = FALSE;
@@ -585,7 +681,15 @@ __xdrrec_getrec(xdrs, statp, expectdata)
 {
 	RECSTREAM *rstrm = (RECSTREAM *)(xdrs->x_private);
 	int n;
-	u_int fraglen;
+	u_int fraglen, len;
+	char *where;
+	bool_t held = FALSE;
+
+	/* the last record has been consumed; give back its buffer before
+	 * starting on the next one */
+	if (!rstrm->in_haveheader && rstrm->in_hdrlen == 0 &&
+	    rstrm->in_received == 0 && rstrm->in_finger == rstrm->in_boundry)
+		release_input(rstrm);
 
 	if (!rstrm->in_haveheader) {
 		n = rstrm->readit(rstrm->tcp_handle, rstrm->in_hdrp,
@@ -613,8 +717,6 @@ __xdrrec_getrec(xdrs, statp, expectdata)
 		}
         rstrm->fbtbc = rstrm->in_header & (~LAST_FRAG);
 		rstrm->in_reclen += fraglen;
-		if (rstrm->in_reclen > rstrm->recvsize)
-			realloc_stream(rstrm, rstrm->in_reclen);
 		if (rstrm->in_header & LAST_FRAG) {
 			rstrm->in_header &= ~LAST_FRAG;
 			rstrm->last_frag = TRUE;
@@ -622,9 +724,51 @@ __xdrrec_getrec(xdrs, statp, expectdata)
 	}
 
     do {
-	    n =  rstrm->readit(rstrm->tcp_handle,
-	        rstrm->in_base + rstrm->in_received,
-	        (rstrm->in_reclen - rstrm->in_received));
+	    if (rstrm->steer && !rstrm->in_steered && rstrm->last_frag &&
+	        rstrm->in_reclen == rstrm->fbtbc &&
+	        rstrm->in_reclen > STEER_PEEK_SIZE) {
+		    /* receive the start of the record before deciding
+		     * where the rest of it goes */
+		    if (rstrm->in_received == STEER_PEEK_SIZE) {
+			    steer_record(rstrm);
+			    continue;
+		    }
+		    where = rstrm->in_base + rstrm->in_received;
+		    len = STEER_PEEK_SIZE - rstrm->in_received;
+	    } else if (rstrm->in_dest &&
+	        rstrm->in_received >= rstrm->in_dest_off &&
+	        rstrm->in_received < rstrm->in_dest_off + rstrm->in_dest_len) {
+		    if (! (*(rstrm->steer_hold))(rstrm->steer_arg, TRUE)) {
+			    /* withdrawn; receive the rest into the stream */
+			    rstrm->in_dest = NULL;
+			    continue;
+		    }
+		    held = TRUE;
+		    where = rstrm->in_dest +
+			(rstrm->in_received - rstrm->in_dest_off);
+		    len = rstrm->in_dest_off + rstrm->in_dest_len -
+			rstrm->in_received;
+	    } else {
+		    len = rstrm->in_reclen - rstrm->in_received;
+		    /* stop at the start of the steered range */
+		    if (rstrm->in_dest &&
+			rstrm->in_received < rstrm->in_dest_off)
+			    len = rstrm->in_dest_off - rstrm->in_received;
+		    /* grow the buffer for what's left of the record,
+		     * less anything that's been steered elsewhere */
+		    if (! realloc_stream(rstrm, rstrm->in_received -
+			rstrm->in_diverted + len)) {
+			    *statp = XPRT_DIED;
+			    return FALSE;
+		    }
+		    where = rstrm->in_base +
+			(rstrm->in_received - rstrm->in_diverted);
+	    }
+	    n =  rstrm->readit(rstrm->tcp_handle, where, len);
+	    if (held) {
+		    (void)(*(rstrm->steer_hold))(rstrm->steer_arg, FALSE);
+		    held = FALSE;
+	    }
 
         /* this case is needed for non-block as socket returns TIMEDOUT and -1
          * -2 is an error case and covered by the next if() statement */
@@ -641,14 +785,23 @@ __xdrrec_getrec(xdrs, statp, expectdata)
 	    }
 
 	    rstrm->in_received += n;
+	    if (rstrm->in_dest && where >= rstrm->in_dest &&
+		where < rstrm->in_dest + rstrm->in_dest_len)
+		    rstrm->in_diverted += n;
 	    if (rstrm->in_received == rstrm->in_reclen) {
 		    rstrm->in_haveheader = FALSE;
 		    rstrm->in_hdrp = (char *)(void *)&rstrm->in_header;
 		    rstrm->in_hdrlen = 0;
 		    if (rstrm->last_frag) {
-			    rstrm->in_boundry = rstrm->in_base + rstrm->in_reclen;
+			    /* steered bytes are missing from the stream */
+			    rstrm->in_boundry = rstrm->in_base +
+				(rstrm->in_reclen - rstrm->in_diverted);
+			    rstrm->fbtbc -= rstrm->in_diverted;
 			    rstrm->in_finger = rstrm->in_base;
 			    rstrm->in_reclen = rstrm->in_received = 0;
+			    rstrm->in_steered = FALSE;
+			    rstrm->in_dest = NULL;
+			    rstrm->in_diverted = 0;
 			    *statp = XPRT_MOREREQS;
 			    return TRUE;
 		    }
@@ -673,6 +826,65 @@ __xdrrec_setnonblock(xdrs, maxrec)
 	return TRUE;
 }
 
+bool_t
+xdrrec_putref(xdrs, addr, len)
+	XDR *xdrs;
+	const char *addr;
+	u_int len;
+{
+	RECSTREAM *rstrm;
+
+	if (xdrs->x_ops != &xdrrec_ops)
+		return (XDR_PUTBYTES(xdrs, addr, len));
+
+	rstrm = (RECSTREAM *)(xdrs->x_private);
+	if (rstrm->writevit == NULL || len < MIN_OUT_REF_SIZE)
+		return (xdrrec_putbytes(xdrs, addr, len));
+
+	if (rstrm->out_nrefs == MAX_OUT_REFS) {
+		rstrm->frag_sent = TRUE;
+		if (! flush_out(rstrm, FALSE))
+			return (FALSE);
+	}
+	rstrm->out_refs[rstrm->out_nrefs].pos = rstrm->out_finger;
+	rstrm->out_refs[rstrm->out_nrefs].data = addr;
+	rstrm->out_refs[rstrm->out_nrefs].len = len;
+	rstrm->out_nrefs++;
+	rstrm->out_reflen += len;
+	return (TRUE);
+}
+
+bool_t
+__xdrrec_setwritev(xdrs, writevit)
+	XDR *xdrs;
+	int (*writevit)(void *, WSABUF *, int);
+{
+	RECSTREAM *rstrm = (RECSTREAM *)(xdrs->x_private);
+
+	rstrm->writevit = writevit;
+	return TRUE;
+}
+
+bool_t
+__xdrrec_setsteer(xdrs, steer, hold, arg)
+	XDR *xdrs;
+	xdrrec_steer_t steer;
+	xdrrec_hold_t hold;
+	void *arg;
+{
+	RECSTREAM *rstrm = (RECSTREAM *)(xdrs->x_private);
+
+	/*
+	 * the caller holds the fd lock, so nothing is being received; drop
+	 * any destination given out under the old steer function
+	 */
+	rstrm->in_dest = NULL;
+	rstrm->steer = steer;
+	rstrm->steer_hold = hold;
+	rstrm->steer_arg = arg;
+	return TRUE;
+}
+
 bool_t
 __xdrrec_setblock(xdrs)
 	XDR *xdrs;
@@ -694,12 +906,18 @@ flush_out(rstrm, eor)
 	u_int32_t len = (u_int32_t)(PtrToUlong(rstrm->out_finger) - 
 		PtrToUlong(rstrm->frag_header) - sizeof(u_int32_t));
 
+	len += rstrm->out_reflen;
 	*(rstrm->frag_header) = htonl(len | eormask);
 	len = (u_int32_t)(PtrToUlong(rstrm->out_finger) - 
 	    PtrToUlong(rstrm->out_base));
-	if ((*(rstrm->writeit))(rstrm->tcp_handle, rstrm->out_base, (int)len)
-		!= (int)len)
+	if (rstrm->out_nrefs) {
+		if (! flush_refs(rstrm, len))
+			return (FALSE);
+	} else if ((*(rstrm->writeit))(rstrm->tcp_handle, rstrm->out_base,
+	    (int)len) != (int)len)
 		return (FALSE);
+	if (eor)
+		release_output(rstrm);
 	rstrm->frag_header = (u_int32_t *)(void *)rstrm->out_base;
 	rstrm->out_finger = (char *)rstrm->out_base + sizeof(u_int32_t);
 	return (TRUE);
@@ -809,6 +1027,80 @@ skip_input_bytes(rstrm, cnt)
 	return (TRUE);
 }
 
+/*
+ * Send the output buffer, with the bytes put by reference at their
+ * positions, in a single gather write.
+ */
+static bool_t
+flush_refs(rstrm, len)
+	RECSTREAM *rstrm;
+	u_int32_t len;
+{
+	WSABUF iov[2 * MAX_OUT_REFS + 1];
+	char *start = rstrm->out_base;
+	u_int i;
+	int cnt = 0;
+
+	for (i = 0; i < rstrm->out_nrefs; i++) {
+		if (rstrm->out_refs[i].pos > start) {
+			iov[cnt].buf = start;
+			iov[cnt].len = (u_long)(rstrm->out_refs[i].pos - start);
+			cnt++;
+		}
+		iov[cnt].buf = (char *)rstrm->out_refs[i].data;
+		iov[cnt].len = rstrm->out_refs[i].len;
+		cnt++;
+		start = rstrm->out_refs[i].pos;
+	}
+	if (rstrm->out_finger > start) {
+		iov[cnt].buf = start;
+		iov[cnt].len = (u_long)(rstrm->out_finger - start);
+		cnt++;
+	}
+
+	len += rstrm->out_reflen;
+	rstrm->out_nrefs = 0;
+	rstrm->out_reflen = 0;
+	return ((*(rstrm->writevit))(rstrm->tcp_handle, iov, cnt) == (int)len);
+}
+
+/*
+ * Ask the steer function where the rest of the current record should go,
+ * given the first in_received bytes.  Any part of the steered range that
+ * was already received is moved to the destination.
+ */
+static void
+steer_record(rstrm)
+	RECSTREAM *rstrm;
+{
+	char *dest;
+	u_int offset, count, copied;
+
+	rstrm->in_steered = TRUE;
+	if (! (*(rstrm->steer))(rstrm->steer_arg, rstrm->in_base,
+	    rstrm->in_received, &dest, &offset, &count))
+		return;
+	if (offset > rstrm->in_reclen || count > rstrm->in_reclen - offset)
+		return;
+
+	if (offset < rstrm->in_received) {
+		/* the destination may be withdrawn as soon as it's returned */
+		if (! (*(rstrm->steer_hold))(rstrm->steer_arg, TRUE))
+			return;
+		copied = rstrm->in_received - offset;
+		if (copied > count)
+			copied = count;
+		memcpy(dest, rstrm->in_base + offset, copied);
+		(void)(*(rstrm->steer_hold))(rstrm->steer_arg, FALSE);
+		memmove(rstrm->in_base + offset, rstrm->in_base + offset + copied,
+		    rstrm->in_received - offset - copied);
+		rstrm->in_diverted = copied;
+	}
+	rstrm->in_dest = dest;
+	rstrm->in_dest_off = offset;
+	rstrm->in_dest_len = count;
+}
+
 static u_int
 fix_buf_size(s)
 	u_int s;
@@ -820,27 +1112,158 @@ fix_buf_size(s)
 }
 
 /*
- * Reallocate the input buffer for a non-block stream.
+ * Grow the input buffer for a non-block stream to hold at least size
+ * bytes, at least doubling it to limit the number of reallocations.
  */
 static bool_t
 realloc_stream(rstrm, size)
 	RECSTREAM *rstrm;
 	u_int size;
 {
-	ptrdiff_t diff;
 	char *buf;
+	u_int alloc;
 
-	if (size > rstrm->recvsize) {
-		buf = realloc(rstrm->in_base, (size_t)size);
+	if (size > rstrm->in_size) {
+		if (size < rstrm->in_size * 2)
+			size = min(rstrm->in_size * 2,
+			    max(rstrm->recvsize, size));
+		buf = pool_get(size, &alloc);
 		if (buf == NULL)
 			return FALSE;
-		diff = buf - rstrm->in_base;
-		rstrm->in_finger += diff;
+		memcpy(buf, rstrm->in_base, rstrm->in_size);
+		rstrm->in_finger = buf + (rstrm->in_finger - rstrm->in_base);
+		if (rstrm->in_alloc)
+			pool_put(rstrm->in_base, rstrm->in_alloc);
 		rstrm->in_base = buf;
+		rstrm->in_alloc = alloc;
 		rstrm->in_boundry = buf + size;
-		rstrm->recvsize = size;
 		rstrm->in_size = size;
 	}
 
 	return TRUE;
 }
+
+/*
+ * Double the output buffer, up to sendsize.  Returns FALSE if the buffer
+ * can't grow, in which case the caller flushes it as a fragment.
+ */
+static bool_t
+grow_output(rstrm)
+	RECSTREAM *rstrm;
+{
+	char *buf;
+	u_int size, alloc, i;
+
+	if (rstrm->out_size >= rstrm->sendsize)
+		return FALSE;
+
+	size = min(rstrm->out_size * 2, rstrm->sendsize);
+	buf = pool_get(size, &alloc);
+	if (buf == NULL)
+		return FALSE;
+
+	memcpy(buf, rstrm->out_base, rstrm->out_finger - rstrm->out_base);
+	rstrm->out_finger = buf + (rstrm->out_finger - rstrm->out_base);
+	rstrm->frag_header = (u_int32_t *)(void *)
+	    (buf + ((char *)rstrm->frag_header - rstrm->out_base));
+	for (i = 0; i < rstrm->out_nrefs; i++)
+		rstrm->out_refs[i].pos = buf +
+		    (rstrm->out_refs[i].pos - rstrm->out_base);
+	if (rstrm->out_alloc)
+		pool_put(rstrm->out_base, rstrm->out_alloc);
+	rstrm->out_base = buf;
+	rstrm->out_alloc = alloc;
+	rstrm->out_boundry = buf + size;
+	rstrm->out_size = size;
+	return TRUE;
+}
+
+/*
+ * Take the smallest pooled buffer that holds size bytes, or allocate one.
+ * The buffer's actual size is returned in allocp, for pool_put().
+ */
+static char *
+pool_get(size, allocp)
+	u_int size;
+	u_int *allocp;
+{
+	char *buf = NULL;
+	u_int i, best = XDRREC_POOL_MAX;
+
+	mutex_lock(&xdrrec_pool_lock);
+	for (i = 0; i < xdrrec_pool_count; i++) {
+		if (xdrrec_pool[i].size >= size && (best == XDRREC_POOL_MAX ||
+		    xdrrec_pool[i].size < xdrrec_pool[best].size))
+			best = i;
+	}
+	if (best != XDRREC_POOL_MAX) {
+		buf = xdrrec_pool[best].buf;
+		*allocp = xdrrec_pool[best].size;
+		xdrrec_pool_bytes -= xdrrec_pool[best].size;
+		xdrrec_pool[best] = xdrrec_pool[--xdrrec_pool_count];
+	}
+	mutex_unlock(&xdrrec_pool_lock);
+
+	if (buf == NULL) {
+		buf = mem_alloc(size);
+		*allocp = size;
+	}
+	return buf;
+}
+
+/*
+ * Give a buffer back to the pool, or free it if the pool is full.
+ */
+static void
+pool_put(buf, alloc)
+	char *buf;
+	u_int alloc;
+{
+	mutex_lock(&xdrrec_pool_lock);
+	if (xdrrec_pool_count < XDRREC_POOL_MAX &&
+	    xdrrec_pool_bytes + alloc <= XDRREC_POOL_BYTES) {
+		xdrrec_pool[xdrrec_pool_count].buf = buf;
+		xdrrec_pool[xdrrec_pool_count].size = alloc;
+		xdrrec_pool_count++;
+		xdrrec_pool_bytes += alloc;
+		buf = NULL;
+	}
+	mutex_unlock(&xdrrec_pool_lock);
+
+	if (buf)
+		mem_free(buf, alloc);
+}
+
+/*
+ * Switch back to the stream's own output buffer once a record is sent.
+ */
+static void
+release_output(rstrm)
+	RECSTREAM *rstrm;
+{
+	if (rstrm->out_alloc == 0)
+		return;
+	pool_put(rstrm->out_base, rstrm->out_alloc);
+	rstrm->out_base = rstrm->out_own;
+	rstrm->out_alloc = 0;
+	rstrm->out_size = min(rstrm->sendsize, INITIAL_BUF_SIZE);
+	rstrm->out_boundry = rstrm->out_base + rstrm->out_size;
+	rstrm->frag_header = (u_int32_t *)(void *)rstrm->out_base;
+	rstrm->out_finger = rstrm->out_base + sizeof(u_int32_t);
+}
+
+/*
+ * Switch back to the stream's own input buffer, which is left empty.
+ */
+static void
+release_input(rstrm)
+	RECSTREAM *rstrm;
+{
+	if (rstrm->in_alloc == 0)
+		return;
+	pool_put(rstrm->in_base, rstrm->in_alloc);
+	rstrm->in_base = rstrm->in_own;
+	rstrm->in_alloc = 0;
+	rstrm->in_size = min(rstrm->recvsize, INITIAL_BUF_SIZE);
+	rstrm->in_finger = rstrm->in_boundry = rstrm->in_base;
+}
@@ -259,6 +259,7 @@ struct rpc_timers {
 #define CLSET_SVC_ADDR		16	/* get server's address (netbuf) */
 #define CLSET_PUSH_TIMOD	17	/* push timod if not already present */
 #define CLSET_POP_TIMOD		18	/* pop timod */
+#define CLSET_RECV_STEER	21	/* steer received data (struct clnt_steer) */
 /*
  * Connectionless only control operations
  */
@@ -267,6 +268,15 @@ struct rpc_timers {
 #define CLSET_ASYNC		19
 #define CLSET_CONNECT		20	/* Use connect() for UDP. (int) */
 
+/*
+ * argument to CLSET_RECV_STEER; see xdrrec_steer_t
+ */
+struct clnt_steer {
+	xdrrec_steer_t	cs_steer;	/* NULL to disable steering */
+	xdrrec_hold_t	cs_hold;	/* see xdrrec_hold_t */
+	void		*cs_arg;	/* passed to cs_steer and cs_hold */
+};
+
 /*
  * void
  * CLNT_DESTROY(rh);
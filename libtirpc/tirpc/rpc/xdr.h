@@ -362,6 +362,32 @@ extern void xdrrec_setlastfrag(XDR *);
 
 /* true if no more input */
 extern bool_t xdrrec_eof(XDR *);
+
+/* encode bytes by reference; a record stream sends them straight from
+ * the caller's buffer when the record is flushed, so they must remain
+ * valid until then.  other streams copy them as XDR_PUTBYTES does */
+extern bool_t xdrrec_putref(XDR *, const char *, u_int);
+
+/*
+ * Receive steering for record streams.  Once the start of a large record
+ * has been received, the steer function is called with the bytes so far.
+ * It may return a destination for a range of the record, given as an
+ * offset from the start of the record and a count, and those bytes are
+ * then received directly into the destination instead of the stream
+ * buffer.  Only records of a single fragment are steered.
+ */
+typedef bool_t (*xdrrec_steer_t)(void *, const char *, u_int,
+			    char **, u_int *, u_int *);
+
+/*
+ * The destination may be withdrawn while its record is still arriving.
+ * The hold function is called with TRUE before each receive into (or copy
+ * to) the destination, and with FALSE after it; between the two calls, it
+ * must keep the destination from being withdrawn.  If it returns FALSE
+ * from the TRUE call, the destination is gone, and the rest of the record
+ * goes to the stream buffer with no matching FALSE call.
+ */
+typedef bool_t (*xdrrec_hold_t)(void *, bool_t);
 extern u_int xdrrec_readbytes(XDR *, caddr_t, u_int);
 __END_DECLS
 
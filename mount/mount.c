@@ -61,8 +61,9 @@ static VOID PrintUsage(LPTSTR pProcess)
         TEXT("\t-o <comma-separated mount options>\n")
         TEXT("Mount options:\n")
         TEXT("\tro\tmount as read-only\n")
-        TEXT("\trsize=#\tread buffer size in bytes\n")
-        TEXT("\twsize=#\twrite buffer size in bytes\n")
+        TEXT("\trsize=#\tread buffer size in bytes (default 1M, up to 16M)\n")
+        TEXT("\twsize=#\twrite buffer size in bytes (default 1M, up to 16M)\n")
+        TEXT("\tnconnect=#\tnumber of tcp connections to the server, 1-16 (default 1)\n")
         TEXT("\tsec=krb5:krb5i:krb5p\tspecify gss security flavor\n")
         TEXT("\twritethru\tturns off rdbss caching for writes\n")
         TEXT("\tnocache\tturns off rdbss caching\n")
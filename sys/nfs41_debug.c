@@ -151,6 +151,18 @@ void print_fs_ioctl(int on, int op)
         case IOCTL_NFS41_WRITE:
             DbgP("IOCTL_NFS41_DOWNCALL\n");
             break;
+        case IOCTL_NFS41_READ_BATCH:
+            DbgP("IOCTL_NFS41_UPCALL_BATCH\n");
+            break;
+        case IOCTL_NFS41_WRITE_BATCH:
+            DbgP("IOCTL_NFS41_DOWNCALL_BATCH\n");
+            break;
+        case IOCTL_NFS41_RING_SETUP:
+            DbgP("IOCTL_NFS41_RING_SETUP\n");
+            break;
+        case IOCTL_NFS41_RING_ENTER:
+            DbgP("IOCTL_NFS41_RING_ENTER\n");
+            break;
         case IOCTL_NFS41_ADDCONN:
             DbgP("IOCTL_NFS41_ADDCONN\n");
             break;
@@ -610,6 +622,8 @@ const char *opcode2string(int opcode)
     case NFS41_VOLUME_QUERY: return "NFS41_VOLUME_QUERY";
     case NFS41_ACL_QUERY: return "NFS41_ACL_QUERY";
     case NFS41_ACL_SET: return "NFS41_ACL_SET";
+    case NFS41_FLUSH: return "NFS41_FLUSH";
+    case NFS41_CHANGE_QUERY: return "NFS41_CHANGE_QUERY";
     default: return "UNKNOWN";
     }
 }
@@ -29,6 +29,7 @@
 #include "nfs41_driver.h"
 #include "nfs41_np.h"
 #include "nfs41_debug.h"
+#include "nfs41_ring.h"
 
 #define USE_MOUNT_SEC_CONTEXT
 
@@ -53,6 +54,7 @@
 #define DEBUG_TIME_BASED_COHERENCY
 //#define DEBUG_MOUNT
 //#define DEBUG_VOLUME_QUERY
+//#define DEBUG_UPCALL_BATCH
 
 //#define ENABLE_TIMINGS
 //#define ENABLE_INDV_TIMINGS
@@ -83,12 +85,29 @@ PRDBSS_DEVICE_OBJECT nfs41_dev;
 #define NFS41_MM_POOLTAG_OPEN   ('open')
 #define NFS41_MM_POOLTAG_UP     ('upca')
 #define NFS41_MM_POOLTAG_DOWN   ('down')
+#define NFS41_MM_POOLTAG_RING   ('ring')
 
 KEVENT upcallEvent;
-FAST_MUTEX upcallLock, downcallLock, fcblistLock;
+FAST_MUTEX upcallLock;
 FAST_MUTEX xidLock;
 FAST_MUTEX openOwnerLock;
 
+/* shared-memory rings for upcalls, set up by the daemon with
+ * IOCTL_NFS41_RING_SETUP; see nfs41_ring.h */
+typedef struct _nfs41_upcall_ring {
+    nfs41_ring_pair         *rings;
+    PMDL                    mdl;
+    PVOID                   user_va; /* mapped in the daemon */
+    PEPROCESS               process; /* the daemon */
+    PFILE_OBJECT            file; /* torn down when this is cleaned up */
+    PKEVENT                 sq_doorbell;
+    EX_RUNDOWN_REF          rundown;
+    FAST_MUTEX              lock; /* for setup and teardown */
+    volatile BOOLEAN        active;
+} nfs41_upcall_ring;
+
+nfs41_upcall_ring upcall_ring;
+
 LONGLONG xid = 0;
 LONG open_owner_id = 1;
 
@@ -144,6 +163,14 @@ typedef enum _nfs41_updowncall_state {
     NFS41_NOT_WAITING
 } nfs41_updowncall_state;
 
+/* one file in an NFS41_CHANGE_QUERY upcall */
+typedef struct _nfs41_change_query {
+    HANDLE open_state;
+    ULONGLONG ChangeTime;
+    DWORD status;
+    BOOLEAN delegated;
+} nfs41_change_query;
+
 typedef struct _updowncall_entry {
     DWORD version;
     LONGLONG xid;
@@ -157,6 +184,7 @@ typedef struct _updowncall_entry {
     BOOLEAN async_op;
     SECURITY_CLIENT_CONTEXT sec_ctx;
     PSECURITY_CLIENT_CONTEXT psec_ctx;
+    LUID luid; /* logon session of psec_ctx, or zero if unknown */
     HANDLE open_state;
     HANDLE session;
     PUNICODE_STRING filename;
@@ -171,12 +199,14 @@ typedef struct _updowncall_entry {
             DWORD sec_flavor;
             DWORD rsize;
             DWORD wsize;
+            DWORD nconnect;
             DWORD lease_time;
         } Mount;
         struct {                       
             PMDL MdlAddress;
             ULONGLONG offset;
             PRX_CONTEXT rxcontext;
+            BOOLEAN write_thru;
         } ReadWrite;
         struct {
             LONGLONG offset;
@@ -244,6 +274,10 @@ typedef struct _updowncall_entry {
         struct {
             SECURITY_INFORMATION query;
         } Acl;
+        struct {
+            ULONG count;
+            nfs41_change_query *files;
+        } ChangeQuery;
     } u;
 
 } nfs41_updowncall_entry;
@@ -251,7 +285,24 @@ typedef struct _updowncall_entry {
 typedef struct _updowncall_list {
     LIST_ENTRY head;
 } nfs41_updowncall_list;
-nfs41_updowncall_list upcall, downcall;
+nfs41_updowncall_list upcall;
+
+/* upcalls waiting for a downcall are hashed by xid, so a downcall can
+ * find its entry without searching everything in flight.  xids are
+ * assigned in sequence, so the low bits spread them evenly.  each bucket
+ * has its own lock, so dispatching new upcalls doesn't contend with
+ * downcalls for other xids */
+#define DOWNCALL_TABLE_SIZE 256 /* must be a power of 2 */
+
+typedef struct _nfs41_downcall_bucket {
+    FAST_MUTEX lock;
+    LIST_ENTRY head;
+} nfs41_downcall_bucket;
+
+nfs41_downcall_bucket downcall_table[DOWNCALL_TABLE_SIZE];
+
+#define downcall_bucket(xid) \
+            (&downcall_table[(ULONG)(xid) & (DOWNCALL_TABLE_SIZE - 1)])
 
 typedef struct _nfs41_mount_entry {
     LIST_ENTRY next;
@@ -303,6 +354,57 @@ typedef struct _nfs41_mount_list {
                                   next)));                  \
             ExReleaseFastMutex(&lock);
 
+void downcall_table_init(void)
+{
+    int i;
+    for (i = 0; i < DOWNCALL_TABLE_SIZE; i++) {
+        ExInitializeFastMutex(&downcall_table[i].lock);
+        InitializeListHead(&downcall_table[i].head);
+    }
+}
+
+void downcall_insert(
+    IN nfs41_updowncall_entry *entry)
+{
+    nfs41_downcall_bucket *bucket = downcall_bucket(entry->xid);
+    ExAcquireFastMutex(&bucket->lock);
+    InsertTailList(&bucket->head, &entry->next);
+    ExReleaseFastMutex(&bucket->lock);
+}
+
+/* safe to call more than once, in case the entry was already removed by
+ * nfs41_FinalizeNetRoot() */
+void downcall_remove(
+    IN nfs41_updowncall_entry *entry)
+{
+    nfs41_downcall_bucket *bucket = downcall_bucket(entry->xid);
+    ExAcquireFastMutex(&bucket->lock);
+    RemoveEntryList(&entry->next);
+    InitializeListHead(&entry->next);
+    ExReleaseFastMutex(&bucket->lock);
+}
+
+nfs41_updowncall_entry *downcall_find(
+    IN LONGLONG xid)
+{
+    nfs41_downcall_bucket *bucket = downcall_bucket(xid);
+    nfs41_updowncall_entry *cur, *found = NULL;
+    PLIST_ENTRY pEntry;
+
+    ExAcquireFastMutex(&bucket->lock);
+    for (pEntry = bucket->head.Flink; pEntry != &bucket->head;
+            pEntry = pEntry->Flink) {
+        cur = (nfs41_updowncall_entry *)CONTAINING_RECORD(pEntry,
+                nfs41_updowncall_entry, next);
+        if (cur->xid == xid) {
+            found = cur;
+            break;
+        }
+    }
+    ExReleaseFastMutex(&bucket->lock);
+    return found;
+}
+
 /* In order to cooperate with other network providers,
  * we only claim paths of the format '\\server\nfs4\path' */
 DECLARE_CONST_UNICODE_STRING(NfsPrefix, L"\\nfs4");
@@ -316,13 +418,17 @@ DECLARE_CONST_UNICODE_STRING(EMPTY_STRING, L"");
 #define SERVER_NAME_BUFFER_SIZE         1024
 #define MOUNT_CONFIG_RW_SIZE_MIN        1024
 #define MOUNT_CONFIG_RW_SIZE_DEFAULT    1048576
-#define MOUNT_CONFIG_RW_SIZE_MAX        1048576
+#define MOUNT_CONFIG_RW_SIZE_MAX        16777216
+#define MOUNT_CONFIG_NCONNECT_MIN       1
+#define MOUNT_CONFIG_NCONNECT_DEFAULT   1
+#define MOUNT_CONFIG_NCONNECT_MAX       16
 #define MAX_SEC_FLAVOR_LEN              12
 #define UPCALL_TIMEOUT_DEFAULT          50  /* in seconds */
 
 typedef struct _NFS41_MOUNT_CONFIG {
     DWORD ReadSize;
     DWORD WriteSize;
+    DWORD nconnect; /* tcp connections per server */
     BOOLEAN ReadOnly;
     BOOLEAN write_thru;
     BOOLEAN nocache;
@@ -435,12 +541,99 @@ typedef struct _nfs41_fcb_list_entry {
     PNFS41_FOBX nfs41_fobx;
     ULONGLONG ChangeTime;
     BOOLEAN skip;
+    ULONGLONG next_poll; /* interrupt time of the next check */
+    ULONG interval; /* in seconds */
+    BOOLEAN busy; /* being checked by fcbopen_main() */
+    LUID luid; /* logon session of nfs41_fobx->sec_ctx, or zero */
 } nfs41_fcb_list_entry;
 
-typedef struct _nfs41_fcb_list {
+/* files opened without a delegation, hashed by fcb so the open, write
+ * and close paths only search their own bucket.  each bucket has its
+ * own lock.  fcbopen_main() doesn't hold any locks during its upcalls;
+ * instead it marks the entries it's checking as busy, and
+ * nfs41_remove_fcb_entry() waits on fcb_table_idle for them */
+#define FCB_TABLE_SIZE 1024 /* must be a power of 2 */
+
+typedef struct _nfs41_fcb_bucket {
+    FAST_MUTEX lock;
     LIST_ENTRY head;
-} nfs41_fcb_list;
-nfs41_fcb_list openlist;
+} nfs41_fcb_bucket;
+
+nfs41_fcb_bucket fcb_table[FCB_TABLE_SIZE];
+KEVENT fcb_table_idle; /* set while no entries are busy */
+
+#define fcb_bucket(fcb) (&fcb_table[(((ULONG_PTR)(fcb) >> 4) ^ \
+            ((ULONG_PTR)(fcb) >> 14)) & (FCB_TABLE_SIZE - 1)])
+
+/* time-based coherency: fcbopen_main() checks the change attribute of
+ * files opened without a delegation.  a file is checked after
+ * COHERENCY_INTERVAL_MIN seconds, and its interval doubles every time
+ * it's found unchanged, up to COHERENCY_INTERVAL_MAX.  a file that
+ * changes, locally or on the server, goes back to the minimum.  files
+ * that are due are checked together, with one NFS41_CHANGE_QUERY upcall
+ * for every NFS41_CHANGE_QUERY_MAX files of a user on a session */
+#define COHERENCY_INTERVAL_MIN  2   /* in seconds */
+#define COHERENCY_INTERVAL_MAX  60
+
+typedef struct _nfs41_coherency_stats {
+    ULONGLONG cycles;
+    ULONGLONG upcalls;
+    ULONGLONG checked;
+    ULONGLONG changed;
+    ULONGLONG delegated;
+    ULONGLONG errors;
+} nfs41_coherency_stats;
+
+/* totals since the driver was loaded */
+nfs41_coherency_stats coherency_stats;
+
+__inline void coherency_schedule(
+    IN nfs41_fcb_list_entry *entry,
+    IN ULONGLONG now,
+    IN ULONG interval)
+{
+    entry->interval = interval;
+    entry->next_poll = now + SECONDS(interval);
+}
+
+/* the logon session that a file's checks run as; must be called at
+ * PASSIVE_LEVEL */
+void coherency_luid(
+    IN PNFS41_FOBX nfs41_fobx,
+    OUT PLUID luid)
+{
+    if (SeQueryAuthenticationIdToken(nfs41_fobx->sec_ctx.ClientToken,
+            luid) != STATUS_SUCCESS)
+        RtlZeroMemory(luid, sizeof(LUID));
+}
+
+void fcb_table_init(void)
+{
+    int i;
+    for (i = 0; i < FCB_TABLE_SIZE; i++) {
+        ExInitializeFastMutex(&fcb_table[i].lock);
+        InitializeListHead(&fcb_table[i].head);
+    }
+    KeInitializeEvent(&fcb_table_idle, NotificationEvent, TRUE);
+}
+
+/* expects the caller to hold the bucket's lock */
+nfs41_fcb_list_entry *fcb_bucket_find(
+    IN nfs41_fcb_bucket *bucket,
+    IN PMRX_FCB fcb)
+{
+    PLIST_ENTRY pEntry;
+    nfs41_fcb_list_entry *cur;
+
+    for (pEntry = bucket->head.Flink; pEntry != &bucket->head;
+            pEntry = pEntry->Flink) {
+        cur = (nfs41_fcb_list_entry *)CONTAINING_RECORD(pEntry,
+                nfs41_fcb_list_entry, next);
+        if (cur->fcb == fcb)
+            return cur;
+    }
+    return NULL;
+}
 
 typedef enum _NULMRX_STORAGE_TYPE_CODES {
     NTC_NFS41_DEVICE_EXTENSION      =   (NODE_TYPE_CODE)0xFC00,    
@@ -615,7 +808,7 @@ NTSTATUS marshal_nfs41_mount(
         goto out;
     }
     header_len = *len + length_as_utf8(entry->u.Mount.srv_name) +
-        length_as_utf8(entry->u.Mount.root) + 3 * sizeof(DWORD);
+        length_as_utf8(entry->u.Mount.root) + 4 * sizeof(DWORD);
     if (header_len > buf_len) { 
         status = STATUS_INSUFFICIENT_RESOURCES;
         goto out;
@@ -629,14 +822,16 @@ NTSTATUS marshal_nfs41_mount(
     RtlCopyMemory(tmp, &entry->u.Mount.rsize, sizeof(DWORD));
     tmp += sizeof(DWORD);
     RtlCopyMemory(tmp, &entry->u.Mount.wsize, sizeof(DWORD));
+    tmp += sizeof(DWORD);
+    RtlCopyMemory(tmp, &entry->u.Mount.nconnect, sizeof(DWORD));
 
     *len = header_len;
 
 #ifdef DEBUG_MARSHAL_DETAIL
     DbgP("marshal_nfs41_mount: server name=%wZ mount point=%wZ sec_flavor=%s "
-         "rsize=%d wsize=%d\n", entry->u.Mount.srv_name, entry->u.Mount.root, 
-         secflavorop2name(entry->u.Mount.sec_flavor), entry->u.Mount.rsize,
-         entry->u.Mount.wsize);
+         "rsize=%d wsize=%d nconnect=%d\n", entry->u.Mount.srv_name,
+         entry->u.Mount.root, secflavorop2name(entry->u.Mount.sec_flavor),
+         entry->u.Mount.rsize, entry->u.Mount.wsize, entry->u.Mount.nconnect);
 #endif
 out:
     return status;
@@ -651,6 +846,52 @@ NTSTATUS marshal_nfs41_unmount(
     return marshal_nfs41_header(entry, buf, buf_len, len);
 }
 
+NTSTATUS marshal_nfs41_flush(
+    nfs41_updowncall_entry *entry,
+    unsigned char *buf,
+    ULONG buf_len,
+    ULONG *len) 
+{
+    return marshal_nfs41_header(entry, buf, buf_len, len);
+}
+
+NTSTATUS marshal_nfs41_changequery(
+    nfs41_updowncall_entry *entry,
+    unsigned char *buf,
+    ULONG buf_len,
+    ULONG *len)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG header_len = 0, i;
+    unsigned char *tmp = buf;
+
+    status = marshal_nfs41_header(entry, tmp, buf_len, len);
+    if (status) goto out;
+    else tmp += *len;
+
+    header_len = *len + sizeof(ULONG) +
+        entry->u.ChangeQuery.count * sizeof(HANDLE);
+    if (header_len > buf_len) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto out;
+    }
+    RtlCopyMemory(tmp, &entry->u.ChangeQuery.count, sizeof(ULONG));
+    tmp += sizeof(ULONG);
+    for (i = 0; i < entry->u.ChangeQuery.count; i++) {
+        RtlCopyMemory(tmp, &entry->u.ChangeQuery.files[i].open_state,
+            sizeof(HANDLE));
+        tmp += sizeof(HANDLE);
+    }
+    *len = header_len;
+
+#ifdef DEBUG_MARSHAL_DETAIL
+    DbgP("marshal_nfs41_changequery: count=%u\n",
+        entry->u.ChangeQuery.count);
+#endif
+out:
+    return status;
+}
+
 NTSTATUS marshal_nfs41_open(
     nfs41_updowncall_entry *entry,
     unsigned char *buf,
@@ -742,7 +983,8 @@ NTSTATUS marshal_nfs41_rw(
     else tmp += *len;
 
     header_len = *len + sizeof(entry->buf_len) +
-        sizeof(entry->u.ReadWrite.offset) + sizeof(HANDLE);
+        sizeof(entry->u.ReadWrite.offset) + sizeof(HANDLE) +
+        sizeof(entry->u.ReadWrite.write_thru);
     if (header_len > buf_len) { 
         status = STATUS_INSUFFICIENT_RESOURCES;
         goto out;
@@ -771,12 +1013,16 @@ NTSTATUS marshal_nfs41_rw(
         goto out;
     }
     RtlCopyMemory(tmp, &entry->buf, sizeof(HANDLE));
+    tmp += sizeof(HANDLE);
+    RtlCopyMemory(tmp, &entry->u.ReadWrite.write_thru,
+        sizeof(entry->u.ReadWrite.write_thru));
     *len = header_len;
 
 #ifdef DEBUG_MARSHAL_DETAIL
-    DbgP("marshal_nfs41_rw: len=%lu offset=%llu MdlAddress=%p Userspace=%p\n", 
-         entry->buf_len, entry->u.ReadWrite.offset, 
-         entry->u.ReadWrite.MdlAddress, entry->buf);
+    DbgP("marshal_nfs41_rw: len=%lu offset=%llu MdlAddress=%p Userspace=%p "
+         "write_thru=%d\n", entry->buf_len, entry->u.ReadWrite.offset, 
+         entry->u.ReadWrite.MdlAddress, entry->buf,
+         entry->u.ReadWrite.write_thru);
 #endif
 out:
     return status;
@@ -1291,19 +1537,20 @@ void nfs41_invalidate_cache (
 }
 
 NTSTATUS handle_upcall(
-    IN PRX_CONTEXT RxContext,
     IN nfs41_updowncall_entry *entry,
+    IN unsigned char *pbOut,
+    IN ULONG cbOut,
+    IN BOOLEAN impersonate,
     OUT ULONG *len)
 {
     NTSTATUS status = STATUS_SUCCESS;
-    PLOWIO_CONTEXT LowIoContext = &RxContext->LowIoContext;
-    ULONG cbOut = LowIoContext->ParamsFor.IoCtl.OutputBufferLength;
-    unsigned char *pbOut = LowIoContext->ParamsFor.IoCtl.pOutputBuffer;
 
-    status = SeImpersonateClientEx(entry->psec_ctx, NULL);
-    if (status != STATUS_SUCCESS) {
-        print_error("SeImpersonateClientEx failed %x\n", status);
-        goto out;
+    if (impersonate) {
+        status = SeImpersonateClientEx(entry->psec_ctx, NULL);
+        if (status != STATUS_SUCCESS) {
+            print_error("SeImpersonateClientEx failed %x\n", status);
+            goto out;
+        }
     }
 
     switch(entry->opcode) {
@@ -1362,6 +1609,12 @@ NTSTATUS handle_upcall(
     case NFS41_ACL_SET:
         status = marshal_nfs41_setacl(entry, pbOut, cbOut, len);
         break;
+    case NFS41_FLUSH:
+        status = marshal_nfs41_flush(entry, pbOut, cbOut, len);
+        break;
+    case NFS41_CHANGE_QUERY:
+        status = marshal_nfs41_changequery(entry, pbOut, cbOut, len);
+        break;
     default:
         status = STATUS_INVALID_PARAMETER;
         print_error("Unknown nfs41 ops %d\n", entry->opcode);
@@ -1426,22 +1679,37 @@ NTSTATUS nfs41_UpcallCreate(
         } else
             entry->psec_ctx = &entry->sec_ctx;
         SeReleaseSubjectContext(&sec_ctx);
+        if (status != STATUS_SUCCESS)
+            goto out;
     } else
         entry->psec_ctx = clnt_sec_ctx;
 
+    /* upcalls are batched and ringed by logon session, which maps to
+     * the daemon's uid/gid; leave it zero to opt out on failure */
+    if (SeQueryAuthenticationIdToken(entry->psec_ctx->ClientToken,
+            &entry->luid) != STATUS_SUCCESS) {
+        print_error("nfs41_UpcallCreate: SeQueryAuthenticationIdToken failed\n");
+        RtlZeroMemory(&entry->luid, sizeof(LUID));
+    }
+
     *entry_out = entry;
 out:
     return status;
 }
 
+BOOLEAN upcall_ring_submit(
+    IN nfs41_updowncall_entry *entry);
+
 NTSTATUS nfs41_UpcallWaitForReply(
     IN nfs41_updowncall_entry *entry,
     IN DWORD secs)
 {
     NTSTATUS status = STATUS_SUCCESS;
 
-    nfs41_AddEntry(upcallLock, upcall, entry);
-    KeSetEvent(&upcallEvent, 0, FALSE);
+    if (!upcall_ring_submit(entry)) {
+        nfs41_AddEntry(upcallLock, upcall, entry);
+        KeSetEvent(&upcallEvent, 0, FALSE);
+    }
     if (!entry->async_op) {
         LARGE_INTEGER timeout;
         timeout.QuadPart = RELATIVE(SECONDS(secs));
@@ -1488,6 +1756,9 @@ NTSTATUS nfs41_UpcallWaitForReply(
         ExAcquireFastMutex(&entry->lock);
         if (entry->state == NFS41_DONE_PROCESSING) {
             ExReleaseFastMutex(&entry->lock);
+            /* the downcall beat us, so the caller still owns the entry
+             * and has to see its results */
+            status = STATUS_SUCCESS;
             break;
         }
         DbgP("[upcall] abandoning %s entry=%p xid=%lld\n", 
@@ -1496,37 +1767,23 @@ NTSTATUS nfs41_UpcallWaitForReply(
         ExReleaseFastMutex(&entry->lock);
         goto out;
     }
-    nfs41_RemoveEntry(downcallLock, entry);
+    downcall_remove(entry);
 out:
     return status;
 }
 
-NTSTATUS nfs41_upcall(
-    IN PRX_CONTEXT RxContext)
+/* remove the first queued upcall, waiting for one if the queue is empty */
+NTSTATUS upcall_dequeue(
+    OUT nfs41_updowncall_entry **entry_out)
 {
     NTSTATUS status = STATUS_SUCCESS;
-    nfs41_updowncall_entry *entry = NULL;
-    ULONG len = 0;
     PLIST_ENTRY pEntry;
 
 process_upcall:
     nfs41_RemoveFirst(upcallLock, upcall, pEntry);
     if (pEntry) {
-        entry = (nfs41_updowncall_entry *)CONTAINING_RECORD(pEntry, 
+        *entry_out = (nfs41_updowncall_entry *)CONTAINING_RECORD(pEntry,
                     nfs41_updowncall_entry, next);
-        ExAcquireFastMutex(&entry->lock);
-        nfs41_AddEntry(downcallLock, downcall, entry);
-        status = handle_upcall(RxContext, entry, &len);
-        if (status == STATUS_SUCCESS && 
-                entry->state == NFS41_WAITING_FOR_UPCALL)
-            entry->state = NFS41_WAITING_FOR_DOWNCALL;
-        ExReleaseFastMutex(&entry->lock);
-        if (status) {
-            entry->status = status;
-            KeSetEvent(&entry->cond, 0, FALSE);
-            RxContext->InformationToReturn = 0;
-        } else 
-            RxContext->InformationToReturn = len;
     }
     else {
         status = KeWaitForSingleObject(&upcallEvent, Executive, UserMode, TRUE,
@@ -1543,6 +1800,133 @@ out:
     return status;
 }
 
+/* marshal the upcall into pbOut and move it to the downcall list; on
+ * failure, the waiter is woken with the error */
+NTSTATUS upcall_dispatch(
+    IN nfs41_updowncall_entry *entry,
+    IN unsigned char *pbOut,
+    IN ULONG cbOut,
+    IN BOOLEAN impersonate,
+    OUT ULONG *len)
+{
+    NTSTATUS status;
+
+    ExAcquireFastMutex(&entry->lock);
+    downcall_insert(entry);
+    status = handle_upcall(entry, pbOut, cbOut, impersonate, len);
+    if (status == STATUS_SUCCESS &&
+            entry->state == NFS41_WAITING_FOR_UPCALL)
+        entry->state = NFS41_WAITING_FOR_DOWNCALL;
+    ExReleaseFastMutex(&entry->lock);
+    if (status) {
+        entry->status = status;
+        KeSetEvent(&entry->cond, 0, FALSE);
+    }
+    return status;
+}
+
+NTSTATUS nfs41_upcall(
+    IN PRX_CONTEXT RxContext)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PLOWIO_CONTEXT LowIoContext = &RxContext->LowIoContext;
+    ULONG cbOut = LowIoContext->ParamsFor.IoCtl.OutputBufferLength;
+    unsigned char *pbOut = LowIoContext->ParamsFor.IoCtl.pOutputBuffer;
+    nfs41_updowncall_entry *entry = NULL;
+    ULONG len = 0;
+
+    RxContext->InformationToReturn = 0;
+
+    status = upcall_dequeue(&entry);
+    if (status) goto out;
+
+    status = upcall_dispatch(entry, pbOut, cbOut, TRUE, &len);
+    if (status == STATUS_SUCCESS)
+        RxContext->InformationToReturn = len;
+out:
+    return status;
+}
+
+/* remove the next queued upcall if it can join the batch; the daemon
+ * maps the whole batch to the uid/gid of its first upcall, so only
+ * upcalls from the same logon session are eligible */
+nfs41_updowncall_entry *upcall_dequeue_batch(
+    IN const LUID *luid)
+{
+    nfs41_updowncall_entry *entry = NULL;
+
+    ExAcquireFastMutex(&upcallLock);
+    if (!IsListEmpty(&upcall.head)) {
+        entry = (nfs41_updowncall_entry *)CONTAINING_RECORD(
+                    upcall.head.Flink, nfs41_updowncall_entry, next);
+        if (RtlEqualLuid(&entry->luid, luid) &&
+                entry->opcode != NFS41_MOUNT &&
+                entry->opcode != NFS41_SHUTDOWN)
+            RemoveEntryList(&entry->next);
+        else
+            entry = NULL;
+    }
+    ExReleaseFastMutex(&upcallLock);
+    return entry;
+}
+
+NTSTATUS nfs41_upcall_batch(
+    IN PRX_CONTEXT RxContext)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PLOWIO_CONTEXT LowIoContext = &RxContext->LowIoContext;
+    ULONG cbOut = LowIoContext->ParamsFor.IoCtl.OutputBufferLength;
+    unsigned char *pbOut = LowIoContext->ParamsFor.IoCtl.pOutputBuffer;
+    nfs41_updowncall_entry *entry = NULL;
+    LUID luid;
+    ULONG count = 0, dequeued = 0, offset = sizeof(ULONG), len;
+    BOOLEAN batch;
+
+    RxContext->InformationToReturn = 0;
+
+    if (cbOut < UPCALL_BATCH_MIN_SIZE) {
+        status = STATUS_BUFFER_TOO_SMALL;
+        goto out;
+    }
+
+    status = upcall_dequeue(&entry);
+    if (status) goto out;
+
+    /* a failed upcall may be freed by its waiter as soon as it's
+     * dispatched, so don't look at the first entry after that */
+    luid = entry->luid;
+    batch = entry->opcode != NFS41_MOUNT && entry->opcode != NFS41_SHUTDOWN &&
+        (luid.LowPart || luid.HighPart);
+
+    do {
+        dequeued++;
+        status = upcall_dispatch(entry, pbOut + offset + sizeof(ULONG),
+            cbOut - offset - sizeof(ULONG), TRUE, &len);
+        if (status == STATUS_SUCCESS) {
+            RtlCopyMemory(pbOut + offset, &len, sizeof(ULONG));
+            offset += sizeof(ULONG) + len;
+            count++;
+        }
+        /* stop when the next upcall might not fit */
+        if (!batch || dequeued == UPCALL_BATCH_MAX ||
+                cbOut - offset < sizeof(ULONG) + UPCALL_BATCH_ENTRY_SIZE)
+            break;
+        entry = upcall_dequeue_batch(&luid);
+    } while (entry);
+
+    if (count) {
+        RtlCopyMemory(pbOut, &count, sizeof(ULONG));
+        RxContext->InformationToReturn = offset;
+        status = STATUS_SUCCESS;
+    }
+#ifdef DEBUG_UPCALL_BATCH
+    DbgP("[upcall batch] returning %d of %d upcalls in %d bytes\n",
+        count, dequeued, offset);
+#endif
+out:
+    return status;
+}
+
 void unmarshal_nfs41_header(
     nfs41_updowncall_entry *tmp,
     unsigned char **buf)
@@ -1775,6 +2159,35 @@ out:
     return status;
 }
 
+NTSTATUS unmarshal_nfs41_changequery(
+    nfs41_updowncall_entry *cur,
+    unsigned char **buf)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    nfs41_change_query *file;
+    ULONG count, i;
+
+    RtlCopyMemory(&count, *buf, sizeof(ULONG));
+    *buf += sizeof(ULONG);
+    if (count != cur->u.ChangeQuery.count) {
+        print_error("unmarshal_nfs41_changequery: expected %u files, "
+            "got %u\n", cur->u.ChangeQuery.count, count);
+        cur->status = status = STATUS_INTERNAL_ERROR;
+        goto out;
+    }
+    for (i = 0; i < count; i++) {
+        file = &cur->u.ChangeQuery.files[i];
+        RtlCopyMemory(&file->status, *buf, sizeof(DWORD));
+        *buf += sizeof(DWORD);
+        RtlCopyMemory(&file->delegated, *buf, sizeof(BOOLEAN));
+        *buf += sizeof(BOOLEAN);
+        RtlCopyMemory(&file->ChangeTime, *buf, sizeof(ULONGLONG));
+        *buf += sizeof(ULONGLONG);
+    }
+out:
+    return status;
+}
+
 void unmarshal_nfs41_symlink(
     nfs41_updowncall_entry *cur,
     unsigned char **buf)
@@ -1793,16 +2206,12 @@ void unmarshal_nfs41_symlink(
     cur->u.Symlink.target->Length -= sizeof(UNICODE_NULL);
 }
 
-NTSTATUS nfs41_downcall(
-    IN PRX_CONTEXT RxContext)
+NTSTATUS handle_downcall(
+    IN unsigned char *buf,
+    IN ULONG in_len)
 {
     NTSTATUS status = STATUS_SUCCESS;
-    PLOWIO_CONTEXT LowIoContext = &RxContext->LowIoContext;
-    ULONG in_len = LowIoContext->ParamsFor.IoCtl.InputBufferLength;
-    unsigned char *buf = LowIoContext->ParamsFor.IoCtl.pInputBuffer;
-    PLIST_ENTRY pEntry;
-    nfs41_updowncall_entry *tmp, *cur= NULL;
-    BOOLEAN found = 0;
+    nfs41_updowncall_entry *tmp, *cur;
 
     print_hexbuf(0, (unsigned char *)"downcall buffer", buf, in_len);
 
@@ -1812,23 +2221,8 @@ NTSTATUS nfs41_downcall(
 
     unmarshal_nfs41_header(tmp, &buf);
 
-    ExAcquireFastMutex(&downcallLock); 
-    pEntry = &downcall.head;
-    pEntry = pEntry->Flink;
-    while (pEntry != NULL) {
-        cur = (nfs41_updowncall_entry *)CONTAINING_RECORD(pEntry, 
-                nfs41_updowncall_entry, next);
-        if (cur->xid == tmp->xid) {
-            found = 1;
-            break;
-        }
-        if (pEntry->Flink == &downcall.head)
-            break;
-        pEntry = pEntry->Flink;
-    }
-    ExReleaseFastMutex(&downcallLock);
-    SeStopImpersonatingClient();
-    if (!found) {
+    cur = downcall_find(tmp->xid);
+    if (cur == NULL) {
         print_error("Didn't find xid=%lld entry\n", tmp->xid);
         goto out_free;
     }
@@ -1853,9 +2247,12 @@ NTSTATUS nfs41_downcall(
                 IoFreeMdl(cur->u.Open.EaMdl);
             }
             break;
+        case NFS41_CHANGE_QUERY:
+            RxFreePool(cur->u.ChangeQuery.files);
+            break;
         }
         ExReleaseFastMutex(&cur->lock);
-        nfs41_RemoveEntry(downcallLock, cur);
+        downcall_remove(cur);
         RxFreePool(cur);
         status = STATUS_UNSUCCESSFUL;
         goto out_free;
@@ -1904,6 +2301,9 @@ NTSTATUS nfs41_downcall(
         case NFS41_ACL_SET:
             unmarshal_nfs41_setattr(cur, &cur->ChangeTime, &buf);
             break;
+        case NFS41_CHANGE_QUERY:
+            status = unmarshal_nfs41_changequery(cur, &buf);
+            break;
         }
     }
     ExReleaseFastMutex(&cur->lock);
@@ -1917,7 +2317,7 @@ NTSTATUS nfs41_downcall(
                 map_readwrite_errors(cur->status);
             cur->u.ReadWrite.rxcontext->InformationToReturn = 0;
         }
-        nfs41_RemoveEntry(downcallLock, cur);
+        downcall_remove(cur);
         RxLowIoCompletion(cur->u.ReadWrite.rxcontext);
         RxFreePool(cur);
     } else
@@ -1929,6 +2329,291 @@ out:
     return status;
 }
 
+NTSTATUS nfs41_downcall(
+    IN PRX_CONTEXT RxContext)
+{
+    PLOWIO_CONTEXT LowIoContext = &RxContext->LowIoContext;
+    ULONG in_len = LowIoContext->ParamsFor.IoCtl.InputBufferLength;
+    unsigned char *buf = LowIoContext->ParamsFor.IoCtl.pInputBuffer;
+    NTSTATUS status;
+
+    status = handle_downcall(buf, in_len);
+    SeStopImpersonatingClient();
+    return status;
+}
+
+NTSTATUS nfs41_downcall_batch(
+    IN PRX_CONTEXT RxContext)
+{
+    NTSTATUS status = STATUS_INVALID_PARAMETER;
+    PLOWIO_CONTEXT LowIoContext = &RxContext->LowIoContext;
+    ULONG in_len = LowIoContext->ParamsFor.IoCtl.InputBufferLength;
+    unsigned char *buf = LowIoContext->ParamsFor.IoCtl.pInputBuffer;
+    ULONG out_len = LowIoContext->ParamsFor.IoCtl.OutputBufferLength;
+    NTSTATUS results[UPCALL_BATCH_MAX];
+    ULONG count, i, len, offset = sizeof(ULONG);
+
+    RxContext->InformationToReturn = 0;
+
+    if (in_len < sizeof(ULONG))
+        goto out;
+    RtlCopyMemory(&count, buf, sizeof(ULONG));
+    if (count == 0 || count > UPCALL_BATCH_MAX)
+        goto out;
+
+    /* check the framing of the whole batch before completing anything;
+     * on failure, the daemon cancels every upcall in the batch, so none
+     * of them can have been completed */
+    for (i = 0; i < count; i++) {
+        if (in_len - offset < sizeof(ULONG))
+            break;
+        RtlCopyMemory(&len, buf + offset, sizeof(ULONG));
+        offset += sizeof(ULONG);
+        if (len > in_len - offset)
+            break;
+        offset += len;
+    }
+    if (i < count) {
+        print_error("downcall batch truncated after %d of %d entries\n",
+            i, count);
+        goto out;
+    }
+
+    offset = sizeof(ULONG);
+    for (i = 0; i < count; i++) {
+        RtlCopyMemory(&len, buf + offset, sizeof(ULONG));
+        offset += sizeof(ULONG);
+        /* a downcall that fails only affects its own upcall */
+        results[i] = handle_downcall(buf + offset, len);
+        offset += len;
+    }
+
+    /* report each result so the daemon can cancel the failed upcalls;
+     * the output shares the system buffer with the input we just read */
+    if (out_len >= count * sizeof(NTSTATUS)) {
+        RtlCopyMemory(LowIoContext->ParamsFor.IoCtl.pOutputBuffer, results,
+            count * sizeof(NTSTATUS));
+        RxContext->InformationToReturn = count * sizeof(NTSTATUS);
+    }
+    status = STATUS_SUCCESS;
+out:
+    SeStopImpersonatingClient();
+    return status;
+}
+
+/* try to submit the upcall through the shared ring; returns FALSE if the
+ * caller should queue it for IOCTL_NFS41_READ instead */
+BOOLEAN upcall_ring_submit(
+    IN nfs41_updowncall_entry *entry)
+{
+    nfs41_ring *sq;
+    nfs41_ring_entry *slot;
+    KAPC_STATE apc_state;
+    NTSTATUS status;
+    ULONG pos, len = 0;
+    BOOLEAN submitted = FALSE;
+
+    switch (entry->opcode) {
+    case NFS41_MOUNT:
+    case NFS41_SHUTDOWN:
+        /* the daemon has to impersonate the client */
+    case NFS41_OPEN:
+    case NFS41_LOCK:
+        /* the daemon has to cancel these if the downcall fails */
+        goto out;
+    }
+
+    if (!upcall_ring.active || !ExAcquireRundownProtection(&upcall_ring.rundown))
+        goto out;
+
+    /* the daemon maps the logon session to a uid/gid */
+    if (entry->luid.LowPart == 0 && entry->luid.HighPart == 0)
+        goto out_release;
+
+    sq = &upcall_ring.rings->sq;
+    slot = nfs41_ring_reserve(sq, &pos);
+    if (slot == NULL)
+        goto out_release;
+    slot->luid_low = entry->luid.LowPart;
+    slot->luid_high = entry->luid.HighPart;
+
+    /* marshalling maps user buffers into the current process, so it has
+     * to happen in the daemon's address space */
+    KeStackAttachProcess((PRKPROCESS)upcall_ring.process, &apc_state);
+    status = upcall_dispatch(entry, slot->data, NFS41_RING_DATA_SIZE,
+        FALSE, &len);
+    KeUnstackDetachProcess(&apc_state);
+
+    /* the slot is published either way; upcall_dispatch() has already
+     * completed a failed upcall */
+    slot->len = status ? 0 : len;
+    if (nfs41_ring_publish(sq, slot, pos))
+        KeSetEvent(upcall_ring.sq_doorbell, 0, FALSE);
+    submitted = TRUE;
+out_release:
+    ExReleaseRundownProtection(&upcall_ring.rundown);
+out:
+    return submitted;
+}
+
+/* the daemon makes this call when the completion ring goes from empty */
+NTSTATUS nfs41_ring_enter(
+    IN PRX_CONTEXT RxContext)
+{
+    NTSTATUS status = STATUS_INVALID_DEVICE_STATE;
+    nfs41_ring *cq;
+    nfs41_ring_entry *slot;
+    ULONG pos, len, count = 0;
+
+    if (!upcall_ring.active || !ExAcquireRundownProtection(&upcall_ring.rundown))
+        goto out;
+
+    cq = &upcall_ring.rings->cq;
+    while ((slot = nfs41_ring_consume(cq, &pos)) != NULL) {
+        len = slot->len;
+        if (len && len <= NFS41_RING_DATA_SIZE)
+            handle_downcall(slot->data, len);
+        nfs41_ring_release(slot, pos);
+        count++;
+    }
+    ExReleaseRundownProtection(&upcall_ring.rundown);
+#ifdef DEBUG_UPCALL_BATCH
+    DbgP("[ring] completed %d downcalls\n", count);
+#endif
+    status = STATUS_SUCCESS;
+out:
+    return status;
+}
+
+NTSTATUS nfs41_ring_setup(
+    IN PRX_CONTEXT RxContext)
+{
+    NTSTATUS status = STATUS_INVALID_PARAMETER;
+    PLOWIO_CONTEXT LowIoContext = &RxContext->LowIoContext;
+    ULONG in_len = LowIoContext->ParamsFor.IoCtl.InputBufferLength;
+    ULONG out_len = LowIoContext->ParamsFor.IoCtl.OutputBufferLength;
+    nfs41_ring_pair *rings = NULL;
+    PMDL mdl = NULL;
+    PVOID user_va = NULL;
+    PKEVENT doorbell = NULL;
+    HANDLE handle;
+
+    RxContext->InformationToReturn = 0;
+    if (in_len < sizeof(HANDLE) || out_len < sizeof(PVOID))
+        goto out;
+    RtlCopyMemory(&handle, LowIoContext->ParamsFor.IoCtl.pInputBuffer,
+        sizeof(HANDLE));
+
+    ExAcquireFastMutex(&upcall_ring.lock);
+    if (upcall_ring.rings) {
+        print_error("upcall rings are already set up\n");
+        status = STATUS_INVALID_DEVICE_STATE;
+        goto out_unlock;
+    }
+
+    status = ObReferenceObjectByHandle(handle, EVENT_MODIFY_STATE,
+        *ExEventObjectType, UserMode, (PVOID *)&doorbell, NULL);
+    if (status) {
+        print_error("ObReferenceObjectByHandle failed %x\n", status);
+        goto out_unlock;
+    }
+
+    /* allocations of a page or more are page-aligned, so nothing else
+     * shares the pages that get mapped into the daemon */
+    rings = RxAllocatePoolWithTag(NonPagedPool, sizeof(nfs41_ring_pair),
+                NFS41_MM_POOLTAG_RING);
+    if (rings == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto out_free;
+    }
+    RtlZeroMemory(rings, sizeof(nfs41_ring_pair));
+    nfs41_ring_init(&rings->sq);
+    nfs41_ring_init(&rings->cq);
+
+    mdl = IoAllocateMdl(rings, sizeof(nfs41_ring_pair), FALSE, FALSE, NULL);
+    if (mdl == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto out_free;
+    }
+    MmBuildMdlForNonPagedPool(mdl);
+
+    __try {
+        user_va = MmMapLockedPagesSpecifyCache(mdl, UserMode, MmCached,
+            NULL, FALSE, NormalPagePriority);
+    } __except(EXCEPTION_EXECUTE_HANDLER) {
+        NTSTATUS code;
+        code = GetExceptionCode();
+        print_error("Call to MmMapLocked failed due to exception 0x%x\n", code);
+        status = STATUS_ACCESS_DENIED;
+        goto out_free;
+    }
+    if (user_va == NULL) {
+        print_error("MmMapLockedPagesSpecifyCache failed to map rings\n");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto out_free;
+    }
+
+    upcall_ring.rings = rings;
+    upcall_ring.mdl = mdl;
+    upcall_ring.user_va = user_va;
+    upcall_ring.sq_doorbell = doorbell;
+    upcall_ring.process = PsGetCurrentProcess();
+    ObReferenceObject(upcall_ring.process);
+    upcall_ring.file = RxContext->CurrentIrpSp->FileObject;
+    ExReInitializeRundownProtection(&upcall_ring.rundown);
+    upcall_ring.active = TRUE;
+
+    RtlCopyMemory(LowIoContext->ParamsFor.IoCtl.pOutputBuffer, &user_va,
+        sizeof(PVOID));
+    RxContext->InformationToReturn = sizeof(PVOID);
+    DbgP("upcall rings mapped at %p in the daemon\n", user_va);
+out_unlock:
+    ExReleaseFastMutex(&upcall_ring.lock);
+out:
+    return status;
+
+out_free:
+    if (mdl) IoFreeMdl(mdl);
+    if (rings) RxFreePool(rings);
+    ObDereferenceObject(doorbell);
+    goto out_unlock;
+}
+
+/* called on IRP_MJ_CLEANUP of the daemon's handle, which happens in the
+ * daemon's context even if it exits without closing the handle */
+void nfs41_ring_teardown(
+    IN PFILE_OBJECT file)
+{
+    KAPC_STATE apc_state;
+
+    ExAcquireFastMutex(&upcall_ring.lock);
+    if (upcall_ring.rings == NULL || upcall_ring.file != file)
+        goto out;
+
+    /* stop new submissions and wait for the ones in progress; upcalls
+     * left in the submission ring will time out */
+    upcall_ring.active = FALSE;
+    ExWaitForRundownProtectionRelease(&upcall_ring.rundown);
+
+    KeStackAttachProcess((PRKPROCESS)upcall_ring.process, &apc_state);
+    MmUnmapLockedPages(upcall_ring.user_va, upcall_ring.mdl);
+    KeUnstackDetachProcess(&apc_state);
+
+    IoFreeMdl(upcall_ring.mdl);
+    RxFreePool(upcall_ring.rings);
+    ObDereferenceObject(upcall_ring.sq_doorbell);
+    ObDereferenceObject(upcall_ring.process);
+    upcall_ring.rings = NULL;
+    upcall_ring.mdl = NULL;
+    upcall_ring.user_va = NULL;
+    upcall_ring.sq_doorbell = NULL;
+    upcall_ring.process = NULL;
+    upcall_ring.file = NULL;
+    DbgP("upcall rings torn down\n");
+out:
+    ExReleaseFastMutex(&upcall_ring.lock);
+}
+
 NTSTATUS nfs41_shutdown_daemon(
     DWORD version)
 {
@@ -2324,6 +3009,18 @@ NTSTATUS nfs41_DevFcbXXXControlFile(
         case IOCTL_NFS41_WRITE:
             status = nfs41_downcall(RxContext);
             break;
+        case IOCTL_NFS41_READ_BATCH:
+            status = nfs41_upcall_batch(RxContext);
+            break;
+        case IOCTL_NFS41_WRITE_BATCH:
+            status = nfs41_downcall_batch(RxContext);
+            break;
+        case IOCTL_NFS41_RING_SETUP:
+            status = nfs41_ring_setup(RxContext);
+            break;
+        case IOCTL_NFS41_RING_ENTER:
+            status = nfs41_ring_enter(RxContext);
+            break;
         case IOCTL_NFS41_ADDCONN:
             status = nfs41_CreateConnection(RxContext, &RxContext->PostRequest);
             break;
@@ -2577,6 +3274,7 @@ NTSTATUS nfs41_mount(
     entry->u.Mount.root = &config->MntPt;
     entry->u.Mount.rsize = config->ReadSize;
     entry->u.Mount.wsize = config->WriteSize;
+    entry->u.Mount.nconnect = config->nconnect;
     entry->u.Mount.sec_flavor = sec_flavor;
     entry->u.Mount.FsAttrs = FsAttrs;
 
@@ -2608,6 +3306,7 @@ void nfs41_MountConfig_InitDefaults(
 
     Config->ReadSize = MOUNT_CONFIG_RW_SIZE_DEFAULT;
     Config->WriteSize = MOUNT_CONFIG_RW_SIZE_DEFAULT;
+    Config->nconnect = MOUNT_CONFIG_NCONNECT_DEFAULT;
     Config->ReadOnly = FALSE;
     Config->write_thru = FALSE;
     Config->nocache = FALSE;
@@ -2718,6 +3417,11 @@ NTSTATUS nfs41_MountConfig_ParseOptions(
                 &Config->WriteSize, MOUNT_CONFIG_RW_SIZE_MIN,
                 MOUNT_CONFIG_RW_SIZE_MAX);
         }
+        else if (wcsncmp(L"nconnect", Name, NameLen) == 0) {
+            status = nfs41_MountConfig_ParseDword(Option, &usValue,
+                &Config->nconnect, MOUNT_CONFIG_NCONNECT_MIN,
+                MOUNT_CONFIG_NCONNECT_MAX);
+        }
         else if (wcsncmp(L"srvname", Name, NameLen) == 0) {
             if (usValue.Length > Config->SrvName.MaximumLength)
                 status = STATUS_NAME_TOO_LONG;
@@ -3155,6 +3859,7 @@ NTSTATUS nfs41_FinalizeNetRoot(
         NFS41GetNetRootExtension((PMRX_NET_ROOT)pNetRoot);
     nfs41_updowncall_entry *tmp;
     nfs41_mount_entry *mount_tmp;
+    int i;
     
 #ifdef DEBUG_MOUNT
     DbgEn();
@@ -3231,16 +3936,19 @@ NTSTATUS nfs41_FinalizeNetRoot(
             break;
     } while (1);
 
-    do {
-        nfs41_GetFirstEntry(downcallLock, downcall, tmp);
-        if (tmp != NULL) {
-            DbgP("Removing entry from downcall list\n");
-            nfs41_RemoveEntry(downcallLock, tmp);
-            tmp->status = STATUS_INSUFFICIENT_RESOURCES;
-            KeSetEvent(&tmp->cond, 0, FALSE);
-        } else
-            break;
-    } while (1);
+    for (i = 0; i < DOWNCALL_TABLE_SIZE; i++) {
+        do {
+            nfs41_GetFirstEntry(downcall_table[i].lock,
+                downcall_table[i], tmp);
+            if (tmp != NULL) {
+                DbgP("Removing entry from downcall list\n");
+                downcall_remove(tmp);
+                tmp->status = STATUS_INSUFFICIENT_RESOURCES;
+                KeSetEvent(&tmp->cond, 0, FALSE);
+            } else
+                break;
+        } while (1);
+    }
 out:
 #ifdef DEBUG_MOUNT
     DbgEx();
@@ -3823,6 +4531,7 @@ retry_on_link:
             nfs41_fobx->nocache = TRUE;
         } else if (!entry->u.Open.deleg_type && !Fcb->OpenCount) {
             nfs41_fcb_list_entry *oentry;
+            nfs41_fcb_bucket *bucket;
 #ifdef DEBUG_OPEN
             DbgP("nfs41_Create: received no delegations: srv_open=%p "
                 "ctime=%llu\n", SrvOpen, entry->ChangeTime);
@@ -3836,9 +4545,14 @@ retry_on_link:
             oentry->fcb = RxContext->pFcb;
             oentry->nfs41_fobx = nfs41_fobx;
             oentry->session = pVNetRootContext->session;
+            coherency_luid(nfs41_fobx, &oentry->luid);
             oentry->ChangeTime = entry->ChangeTime;
             oentry->skip = FALSE;
-            nfs41_AddEntry(fcblistLock, openlist, oentry);
+            oentry->busy = FALSE;
+            coherency_schedule(oentry, KeQueryInterruptTime(),
+                COHERENCY_INTERVAL_MIN);
+            bucket = fcb_bucket(oentry->fcb);
+            nfs41_AddEntry(bucket->lock, *bucket, oentry);
         }
     }
 
@@ -3934,32 +4648,32 @@ ULONG nfs41_ExtendForCache(
 VOID nfs41_remove_fcb_entry(
     PMRX_FCB fcb)
 {
-    PLIST_ENTRY pEntry;
+    nfs41_fcb_bucket *bucket = fcb_bucket(fcb);
     nfs41_fcb_list_entry *cur;
-    ExAcquireFastMutex(&fcblistLock);
 
-    pEntry = openlist.head.Flink;
-    while (!IsListEmpty(&openlist.head)) {
-        cur = (nfs41_fcb_list_entry *)CONTAINING_RECORD(pEntry, 
-                nfs41_fcb_list_entry, next);
-        if (cur->fcb == fcb) {
+    ExAcquireFastMutex(&bucket->lock);
+    cur = fcb_bucket_find(bucket, fcb);
+    while (cur && cur->busy) {
+        /* wait for fcbopen_main() to finish checking it */
+        ExReleaseFastMutex(&bucket->lock);
+        KeWaitForSingleObject(&fcb_table_idle, Executive, KernelMode,
+            FALSE, NULL);
+        ExAcquireFastMutex(&bucket->lock);
+        cur = fcb_bucket_find(bucket, fcb);
+    }
+    if (cur) {
 #ifdef DEBUG_CLOSE
-            DbgP("nfs41_remove_srvopen_entry: Found match for fcb=%p\n", fcb);
+        DbgP("nfs41_remove_srvopen_entry: Found match for fcb=%p\n", fcb);
 #endif
-            RemoveEntryList(pEntry);
-            RxFreePool(cur);
-            break;
-        }
-        if (pEntry->Flink == &openlist.head) {
+        RemoveEntryList(&cur->next);
+        RxFreePool(cur);
+    }
 #ifdef DEBUG_CLOSE
-            DbgP("nfs41_remove_srvopen_entry: reached EOL looking for fcb "
-                "%p\n", fcb);
+    else
+        DbgP("nfs41_remove_srvopen_entry: reached EOL looking for fcb "
+            "%p\n", fcb);
 #endif
-            break;
-        }
-        pEntry = pEntry->Flink;
-    }
-    ExReleaseFastMutex(&fcblistLock);
+    ExReleaseFastMutex(&bucket->lock);
 }
 
 NTSTATUS map_close_errors(
@@ -4047,7 +4761,32 @@ out:
 NTSTATUS nfs41_Flush(
     IN OUT PRX_CONTEXT RxContext)
 {
-    return STATUS_SUCCESS;
+    NTSTATUS status = STATUS_SUCCESS;
+    nfs41_updowncall_entry *entry;
+    __notnull PMRX_SRV_OPEN SrvOpen = RxContext->pRelevantSrvOpen;
+    __notnull PNFS41_V_NET_ROOT_EXTENSION pVNetRootContext =
+        NFS41GetVNetRootExtension(SrvOpen->pVNetRoot);
+    __notnull PNFS41_NETROOT_EXTENSION pNetRootContext =
+        NFS41GetNetRootExtension(SrvOpen->pVNetRoot->pNetRoot);
+    __notnull PNFS41_FOBX nfs41_fobx = NFS41GetFobxExtension(RxContext->pFobx);
+
+    /* rdbss has already flushed the data cache with paging writes; ask
+     * the daemon to write back anything it cached under a delegation */
+    if (!(SrvOpen->DesiredAccess & (FILE_WRITE_DATA | FILE_APPEND_DATA)))
+        goto out;
+
+    status = nfs41_UpcallCreate(NFS41_FLUSH, &nfs41_fobx->sec_ctx,
+        pVNetRootContext->session, nfs41_fobx->nfs41_open_state,
+        pNetRootContext->nfs41d_version, SrvOpen->pAlreadyPrefixedName, &entry);
+    if (status) goto out;
+
+    status = nfs41_UpcallWaitForReply(entry, pVNetRootContext->timeout);
+    if (status) goto out;
+
+    status = map_readwrite_errors(entry->status);
+    RxFreePool(entry);
+out:
+    return status;
 }
 
 NTSTATUS nfs41_DeallocateForFcb(
@@ -4424,35 +5163,29 @@ VOID nfs41_update_fcb_list(
     PMRX_FCB fcb,
     ULONGLONG ChangeTime)
 {
-    PLIST_ENTRY pEntry;
+    nfs41_fcb_bucket *bucket = fcb_bucket(fcb);
     nfs41_fcb_list_entry *cur;
-    ExAcquireFastMutex(&fcblistLock); 
-    pEntry = openlist.head.Flink;
-    while (!IsListEmpty(&openlist.head)) {
-        cur = (nfs41_fcb_list_entry *)CONTAINING_RECORD(pEntry, 
-                nfs41_fcb_list_entry, next);
-        if (cur->fcb == fcb && 
-                cur->ChangeTime != ChangeTime) {
+
+    ExAcquireFastMutex(&bucket->lock);
+    cur = fcb_bucket_find(bucket, fcb);
+    if (cur && cur->ChangeTime != ChangeTime) {
 #if defined(DEBUG_FILE_SET) || defined(DEBUG_ACL_SET) || \
     defined(DEBUG_WRITE) || defined(DEBUG_EA_SET)
-            DbgP("nfs41_update_fcb_list: Found match for fcb %p: updating "
-                "%llu to %llu\n", fcb, cur->ChangeTime, ChangeTime);
+        DbgP("nfs41_update_fcb_list: Found match for fcb %p: updating "
+            "%llu to %llu\n", fcb, cur->ChangeTime, ChangeTime);
 #endif
-            cur->ChangeTime = ChangeTime;
-            break;
-        }
-        /* place an upcall for this srv_open */
-        if (pEntry->Flink == &openlist.head) {
+        cur->ChangeTime = ChangeTime;
+        /* check it sooner while it's in use */
+        coherency_schedule(cur, KeQueryInterruptTime(),
+            COHERENCY_INTERVAL_MIN);
+    }
 #if defined(DEBUG_FILE_SET) || defined(DEBUG_ACL_SET) || \
     defined(DEBUG_WRITE) || defined(DEBUG_EA_SET)
-            DbgP("nfs41_update_fcb_list: reached EOL loooking for "
-                "fcb=%p\n", fcb);
+    else if (cur == NULL)
+        DbgP("nfs41_update_fcb_list: reached EOL loooking for "
+            "fcb=%p\n", fcb);
 #endif
-            break;
-        }
-        pEntry = pEntry->Flink;
-    }
-    ExReleaseFastMutex(&fcblistLock);
+    ExReleaseFastMutex(&bucket->lock);
 }
 
 void print_nfs3_attrs(
@@ -5657,9 +6390,9 @@ void enable_caching(
     HANDLE session)
 {
     ULONG flag = 0;
-    PLIST_ENTRY pEntry;
+    nfs41_fcb_bucket *bucket = fcb_bucket(SrvOpen->pFcb);
     nfs41_fcb_list_entry *cur;
-    BOOLEAN found = FALSE;
+    LUID luid;
 
     if (SrvOpen->DesiredAccess & FILE_READ_DATA)
         flag = ENABLE_READ_CACHING;
@@ -5681,46 +6414,40 @@ void enable_caching(
 
     RxChangeBufferingState((PSRV_OPEN)SrvOpen, ULongToPtr(flag), 1);
 
-    ExAcquireFastMutex(&fcblistLock);
-    pEntry = openlist.head.Flink;
-    while (!IsListEmpty(&openlist.head)) {
-        cur = (nfs41_fcb_list_entry *)CONTAINING_RECORD(pEntry,
-                nfs41_fcb_list_entry, next);
-        if (cur->fcb == SrvOpen->pFcb) {
-#ifdef DEBUG_TIME_BASED_COHERENCY
-            DbgP("enable_caching: Looked&Found match for fcb=%p %wZ\n",
-                SrvOpen->pFcb, SrvOpen->pAlreadyPrefixedName);
-#endif
-            cur->skip = FALSE;
-            found = TRUE;
-            break;
-        }
-        if (pEntry->Flink == &openlist.head) {
+    /* can't query the token while holding the bucket's mutex */
+    if (nfs41_fobx->deleg_type)
+        coherency_luid(nfs41_fobx, &luid);
+
+    ExAcquireFastMutex(&bucket->lock);
+    cur = fcb_bucket_find(bucket, SrvOpen->pFcb);
+    if (cur) {
 #ifdef DEBUG_TIME_BASED_COHERENCY
-            DbgP("enable_caching: reached EOL looking for fcb=%p %wZ\n",
-                SrvOpen->pFcb, SrvOpen->pAlreadyPrefixedName);
+        DbgP("enable_caching: Looked&Found match for fcb=%p %wZ\n",
+            SrvOpen->pFcb, SrvOpen->pAlreadyPrefixedName);
 #endif
-            break;
-        }
-        pEntry = pEntry->Flink;
-    }
-    if (!found && nfs41_fobx->deleg_type) {
+        cur->skip = FALSE;
+    } else if (nfs41_fobx->deleg_type) {
         nfs41_fcb_list_entry *oentry;
 #ifdef DEBUG_TIME_BASED_COHERENCY
         DbgP("enable_caching: delegation recalled: srv_open=%p\n", SrvOpen);
 #endif
         oentry = RxAllocatePoolWithTag(NonPagedPool, 
             sizeof(nfs41_fcb_list_entry), NFS41_MM_POOLTAG_OPEN);
-        if (oentry == NULL) return;
+        if (oentry == NULL) goto out_unlock;
         oentry->fcb = SrvOpen->pFcb;
         oentry->session = session;
         oentry->nfs41_fobx = nfs41_fobx;
+        oentry->luid = luid;
         oentry->ChangeTime = ChangeTime;
         oentry->skip = FALSE;
-        InsertTailList(&openlist.head, &oentry->next);
+        oentry->busy = FALSE;
+        coherency_schedule(oentry, KeQueryInterruptTime(),
+            COHERENCY_INTERVAL_MIN);
+        InsertTailList(&bucket->head, &oentry->next);
         nfs41_fobx->deleg_type = 0;
     }
-    ExReleaseFastMutex(&fcblistLock);
+out_unlock:
+    ExReleaseFastMutex(&bucket->lock);
 }
 
 NTSTATUS map_readwrite_errors(
@@ -5902,6 +6629,10 @@ NTSTATUS nfs41_Write(
     entry->u.ReadWrite.MdlAddress = LowIoContext->ParamsFor.ReadWrite.Buffer;
     entry->buf_len = LowIoContext->ParamsFor.ReadWrite.ByteCount;
     entry->u.ReadWrite.offset = LowIoContext->ParamsFor.ReadWrite.ByteOffset;
+    /* write-through requests must not be cached by the daemon */
+    entry->u.ReadWrite.write_thru = nfs41_fobx->write_thru ||
+        pVNetRootContext->write_thru || FlagOn(
+            RxContext->CurrentIrpSp->FileObject->Flags, FO_WRITE_THROUGH);
 
     if (FlagOn(RxContext->CurrentIrpSp->FileObject->Flags, 
             FO_SYNCHRONOUS_IO) == FALSE) {
@@ -6525,9 +7256,7 @@ NTSTATUS nfs41_FsdDispatch (
     IN PDEVICE_OBJECT dev,
     IN PIRP Irp)
 {
-#ifdef DEBUG_FSDDISPATCH
     PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
-#endif
     NTSTATUS status;
 
 #ifdef DEBUG_FSDDISPATCH
@@ -6547,6 +7276,11 @@ NTSTATUS nfs41_FsdDispatch (
         goto out;
     }
 
+    /* unmap the upcall rings while we're still in the daemon's context */
+    if (IrpSp->MajorFunction == IRP_MJ_CLEANUP && upcall_ring.file &&
+            IrpSp->FileObject == upcall_ring.file)
+        nfs41_ring_teardown(IrpSp->FileObject);
+
     status = RxFsdDispatch((PRDBSS_DEVICE_OBJECT)dev,Irp);
     /* AGLO: 08/05/2009 - looks like RxFsdDispatch frees IrpSp */
 
@@ -6680,98 +7414,242 @@ NTSTATUS nfs41_init_ops()
     return(STATUS_SUCCESS);
 }
 
+/* collect files that are due for a check, up to NFS41_CHANGE_QUERY_MAX
+ * on the same session, and mark them busy so they can't be removed.  the
+ * upcall is made with the first file's credentials, so the rest have to
+ * come from the same logon session; a file whose logon session is
+ * unknown gets an upcall of its own */
+ULONG coherency_gather(
+    IN ULONGLONG now,
+    OUT nfs41_fcb_list_entry **batch,
+    OUT nfs41_change_query *files)
+{
+    nfs41_fcb_bucket *bucket;
+    PLIST_ENTRY pEntry;
+    nfs41_fcb_list_entry *cur;
+    HANDLE session = NULL;
+    LUID luid = { 0 };
+    ULONG count = 0, i;
+
+    for (i = 0; i < FCB_TABLE_SIZE && count < NFS41_CHANGE_QUERY_MAX; i++) {
+        bucket = &fcb_table[i];
+        ExAcquireFastMutex(&bucket->lock);
+        for (pEntry = bucket->head.Flink; pEntry != &bucket->head &&
+                count < NFS41_CHANGE_QUERY_MAX; pEntry = pEntry->Flink) {
+            cur = (nfs41_fcb_list_entry *)CONTAINING_RECORD(pEntry,
+                    nfs41_fcb_list_entry, next);
+            if (cur->skip || cur->next_poll > now)
+                continue;
+            if (count == 0) {
+                session = cur->session;
+                luid = cur->luid;
+            } else if (cur->session != session ||
+                    (luid.LowPart == 0 && luid.HighPart == 0) ||
+                    !RtlEqualLuid(&cur->luid, &luid))
+                continue;
+#ifdef DEBUG_TIME_BASED_COHERENCY
+            DbgP("fcbopen_main: Checking attributes for fcb=%p "
+                "change_time=%llu interval=%u\n", cur->fcb,
+                cur->ChangeTime, cur->interval);
+#endif
+            /* don't pick it up again until the next interval */
+            coherency_schedule(cur, now, cur->interval);
+            cur->busy = TRUE;
+            batch[count] = cur;
+            files[count].open_state = cur->nfs41_fobx->nfs41_open_state;
+            count++;
+        }
+        ExReleaseFastMutex(&bucket->lock);
+    }
+    return count;
+}
+
+void coherency_release(
+    IN nfs41_fcb_list_entry **batch,
+    IN ULONG count)
+{
+    nfs41_fcb_bucket *bucket;
+    ULONG i;
+
+    for (i = 0; i < count; i++) {
+        bucket = fcb_bucket(batch[i]->fcb);
+        ExAcquireFastMutex(&bucket->lock);
+        batch[i]->busy = FALSE;
+        ExReleaseFastMutex(&bucket->lock);
+    }
+    KeSetEvent(&fcb_table_idle, 0, FALSE);
+}
+
+void coherency_invalidate(
+    IN nfs41_fcb_list_entry *cur)
+{
+    ULONG flag = DISABLE_CACHING;
+    PMRX_SRV_OPEN srv_open;
+    PLIST_ENTRY psrvEntry;
+
+    psrvEntry = &cur->fcb->SrvOpenList;
+    psrvEntry = psrvEntry->Flink;
+    while (!IsListEmpty(&cur->fcb->SrvOpenList)) {
+        srv_open = (PMRX_SRV_OPEN)CONTAINING_RECORD(psrvEntry, 
+                MRX_SRV_OPEN, SrvOpenQLinks);
+        if (srv_open->DesiredAccess & 
+                (FILE_READ_DATA | FILE_WRITE_DATA | FILE_APPEND_DATA)) {
+#ifdef DEBUG_TIME_BASED_COHERENCY
+            DbgP("fcbopen_main: ************ Invalidate the cache %wZ"
+                 "************\n", srv_open->pAlreadyPrefixedName);
+#endif
+            RxIndicateChangeOfBufferingStateForSrvOpen(
+                cur->fcb->pNetRoot->pSrvCall, srv_open,
+                srv_open->Key, ULongToPtr(flag));
+        }
+        if (psrvEntry->Flink == &cur->fcb->SrvOpenList) {
+#ifdef DEBUG_TIME_BASED_COHERENCY
+            DbgP("fcbopen_main: reached end of srvopen for fcb %p\n",
+                cur->fcb);
+#endif
+            break;
+        }
+        psrvEntry = psrvEntry->Flink;
+    };
+}
+
+/* check the change attribute of a batch of busy files with a single
+ * upcall.  coherency_gather() only batches files from one logon session,
+ * so the first file's credentials speak for all of them */
+NTSTATUS coherency_query(
+    IN nfs41_fcb_list_entry **batch,
+    IN nfs41_change_query *files,
+    IN ULONG count,
+    IN OUT nfs41_coherency_stats *stats)
+{
+    NTSTATUS status;
+    PNFS41_NETROOT_EXTENSION pNetRootContext;
+    nfs41_updowncall_entry *entry;
+    nfs41_fcb_list_entry *cur;
+    nfs41_fcb_bucket *bucket;
+    PNFS41_FCB nfs41_fcb;
+    ULONGLONG now;
+    ULONG i;
+
+    pNetRootContext = NFS41GetNetRootExtension(batch[0]->fcb->pNetRoot);
+    status = nfs41_UpcallCreate(NFS41_CHANGE_QUERY,
+        &batch[0]->nfs41_fobx->sec_ctx, batch[0]->session,
+        INVALID_HANDLE_VALUE, pNetRootContext->nfs41d_version, NULL, &entry);
+    if (status) goto out_free;
+
+    entry->u.ChangeQuery.count = count;
+    entry->u.ChangeQuery.files = files;
+
+    stats->upcalls++;
+    stats->checked += count;
+
+    /* if we stop waiting, the downcall frees 'files' */
+    status = nfs41_UpcallWaitForReply(entry, UPCALL_TIMEOUT_DEFAULT);
+    if (status) goto out;
+
+    status = entry->status;
+    RxFreePool(entry);
+    if (status) goto out_free;
+
+    now = KeQueryInterruptTime();
+    for (i = 0; i < count; i++) {
+        cur = batch[i];
+        if (files[i].status) {
+            stats->errors++;
+            continue;
+        }
+        bucket = fcb_bucket(cur->fcb);
+        ExAcquireFastMutex(&bucket->lock);
+        if (files[i].delegated) {
+            /* it can't change until the delegation is recalled */
+            stats->delegated++;
+            coherency_schedule(cur, now, COHERENCY_INTERVAL_MAX);
+            ExReleaseFastMutex(&bucket->lock);
+            continue;
+        }
+        if (cur->ChangeTime != files[i].ChangeTime) {
+#ifdef DEBUG_TIME_BASED_COHERENCY
+            DbgP("fcbopen_main: old ctime=%llu new_ctime=%llu\n", 
+                cur->ChangeTime, files[i].ChangeTime);
+#endif
+            stats->changed++;
+            cur->ChangeTime = files[i].ChangeTime;
+            cur->skip = TRUE;
+            coherency_invalidate(cur);
+            coherency_schedule(cur, now, COHERENCY_INTERVAL_MIN);
+        } else
+            coherency_schedule(cur, now,
+                min(2 * cur->interval, COHERENCY_INTERVAL_MAX));
+
+        nfs41_fcb = (PNFS41_FCB)cur->fcb->Context;
+        nfs41_fcb->changeattr = files[i].ChangeTime;
+        ExReleaseFastMutex(&bucket->lock);
+    }
+out_free:
+    RxFreePool(files);
+out:
+    return status;
+}
+
 KSTART_ROUTINE fcbopen_main;
 VOID fcbopen_main(PVOID ctx)
 {
     NTSTATUS status;
     LARGE_INTEGER timeout;
+    nfs41_fcb_list_entry *batch[NFS41_CHANGE_QUERY_MAX];
 
     DbgEn();
-    timeout.QuadPart = RELATIVE(SECONDS(30));
+    timeout.QuadPart = RELATIVE(SECONDS(COHERENCY_INTERVAL_MIN));
     while(1) {
-        PLIST_ENTRY pEntry;
-        nfs41_fcb_list_entry *cur;
-        status = KeDelayExecutionThread(KernelMode, TRUE, &timeout);
-        ExAcquireFastMutex(&fcblistLock);
-        pEntry = openlist.head.Flink;
-        while (!IsListEmpty(&openlist.head)) {
-            PNFS41_NETROOT_EXTENSION pNetRootContext;
-            nfs41_updowncall_entry *entry;
-            FILE_BASIC_INFORMATION binfo;
-            PNFS41_FCB nfs41_fcb;
-            cur = (nfs41_fcb_list_entry *)CONTAINING_RECORD(pEntry, 
-                    nfs41_fcb_list_entry, next);
+        nfs41_coherency_stats cycle = { 0 };
+        nfs41_change_query *files;
+        ULONGLONG start;
+        ULONG count;
 
-#ifdef DEBUG_TIME_BASED_COHERENCY
-            DbgP("fcbopen_main: Checking attributes for fcb=%p "
-                "change_time=%llu skipping=%d\n", cur->fcb, 
-                cur->ChangeTime, cur->skip);
-#endif
-            if (cur->skip) goto out;
-            pNetRootContext = 
-                NFS41GetNetRootExtension(cur->fcb->pNetRoot);
-            /* place an upcall for this srv_open */
-            status = nfs41_UpcallCreate(NFS41_FILE_QUERY, 
-                &cur->nfs41_fobx->sec_ctx, cur->session, 
-                cur->nfs41_fobx->nfs41_open_state,
-                pNetRootContext->nfs41d_version, NULL, &entry);
-            if (status) goto out;
-
-            entry->u.QueryFile.InfoClass = FileBasicInformation;
-            entry->buf = &binfo;
-            entry->buf_len = sizeof(binfo);
-
-            status = nfs41_UpcallWaitForReply(entry, UPCALL_TIMEOUT_DEFAULT);
-            if (status) goto out;
-
-            if (cur->ChangeTime != entry->ChangeTime) {
-                ULONG flag = DISABLE_CACHING;
-                PMRX_SRV_OPEN srv_open;
-                PLIST_ENTRY psrvEntry;
-#ifdef DEBUG_TIME_BASED_COHERENCY
-                DbgP("fcbopen_main: old ctime=%llu new_ctime=%llu\n", 
-                    cur->ChangeTime, entry->ChangeTime);
-#endif
-                cur->ChangeTime = entry->ChangeTime;
-                cur->skip = TRUE;
-                psrvEntry = &cur->fcb->SrvOpenList;
-                psrvEntry = psrvEntry->Flink;
-                while (!IsListEmpty(&cur->fcb->SrvOpenList)) {
-                    srv_open = (PMRX_SRV_OPEN)CONTAINING_RECORD(psrvEntry, 
-                            MRX_SRV_OPEN, SrvOpenQLinks);
-                    if (srv_open->DesiredAccess & 
-                            (FILE_READ_DATA | FILE_WRITE_DATA | FILE_APPEND_DATA)) {
-#ifdef DEBUG_TIME_BASED_COHERENCY
-                        DbgP("fcbopen_main: ************ Invalidate the cache %wZ"
-                             "************\n", srv_open->pAlreadyPrefixedName);
-#endif
-                        RxIndicateChangeOfBufferingStateForSrvOpen(
-                            cur->fcb->pNetRoot->pSrvCall, srv_open,
-                            srv_open->Key, ULongToPtr(flag));
-                    }
-                    if (psrvEntry->Flink == &cur->fcb->SrvOpenList) {
-#ifdef DEBUG_TIME_BASED_COHERENCY
-                        DbgP("fcbopen_main: reached end of srvopen for fcb %p\n",
-                            cur->fcb);
-#endif
-                        break;
-                    }
-                    psrvEntry = psrvEntry->Flink;
-                };
+        status = KeDelayExecutionThread(KernelMode, TRUE, &timeout);
+        start = KeQueryInterruptTime();
+        do {
+            files = RxAllocatePoolWithTag(NonPagedPool,
+                NFS41_CHANGE_QUERY_MAX * sizeof(nfs41_change_query),
+                NFS41_MM_POOLTAG_OPEN);
+            if (files == NULL)
+                break;
+            /* every file we gather is rescheduled, so this ends */
+            KeClearEvent(&fcb_table_idle);
+            count = coherency_gather(start, batch, files);
+            if (count)
+                status = coherency_query(batch, files, count, &cycle);
+            coherency_release(batch, count);
+
+            if (count == 0) {
+                RxFreePool(files);
+                break;
             }
-            nfs41_fcb = (PNFS41_FCB)cur->fcb->Context;
-            nfs41_fcb->changeattr = entry->ChangeTime;
-            RxFreePool(entry);
-out:
-            if (pEntry->Flink == &openlist.head) {
-#ifdef DEBUG_TIME_BASED_COHERENCY
-                DbgP("fcbopen_main: reached end of the fcb list\n");
-#endif
+            if (status) {
+                /* try the rest on the next cycle */
+                print_error("fcbopen_main: NFS41_CHANGE_QUERY for %u files "
+                    "failed with %08lx\n", count, status);
+                cycle.errors += count;
                 break;
             }
-            pEntry = pEntry->Flink;
-        }
-        ExReleaseFastMutex(&fcblistLock);
+        } while (1);
+
+        if (cycle.upcalls == 0)
+            continue;
+
+        coherency_stats.cycles++;
+        coherency_stats.upcalls += cycle.upcalls;
+        coherency_stats.checked += cycle.checked;
+        coherency_stats.changed += cycle.changed;
+        coherency_stats.delegated += cycle.delegated;
+        coherency_stats.errors += cycle.errors;
+#ifdef DEBUG_TIME_BASED_COHERENCY
+        DbgP("fcbopen_main: cycle %llu checked %llu files with %llu upcalls "
+            "in %llu ms: %llu changed, %llu delegated, %llu errors\n",
+            coherency_stats.cycles, cycle.checked, cycle.upcalls,
+            (KeQueryInterruptTime() - start) / MILLISECONDS(1),
+            cycle.changed, cycle.delegated, cycle.errors);
+#endif
     }
     DbgEx();
 }
@@ -6833,13 +7711,12 @@ NTSTATUS DriverEntry(
 
     KeInitializeEvent(&upcallEvent, SynchronizationEvent, FALSE );
     ExInitializeFastMutex(&upcallLock);
-    ExInitializeFastMutex(&downcallLock);
     ExInitializeFastMutex(&xidLock);
     ExInitializeFastMutex(&openOwnerLock);
-    ExInitializeFastMutex(&fcblistLock);
+    ExInitializeFastMutex(&upcall_ring.lock);
     InitializeListHead(&upcall.head);
-    InitializeListHead(&downcall.head);
-    InitializeListHead(&openlist.head);
+    downcall_table_init();
+    fcb_table_init();
     InitializeObjectAttributes(&oattrs, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
     status = PsCreateSystemThread(&dev_exts->openlistHandle, mask, 
         &oattrs, NULL, NULL, &fcbopen_main, NULL);
@@ -48,6 +48,27 @@
 #define IOCTL_NFS41_READ        _RDR_CTL_CODE(6, METHOD_BUFFERED)
 #define IOCTL_NFS41_WRITE       _RDR_CTL_CODE(7, METHOD_BUFFERED)
 #define IOCTL_NFS41_INVALCACHE  _RDR_CTL_CODE(8, METHOD_BUFFERED)
+#define IOCTL_NFS41_READ_BATCH  _RDR_CTL_CODE(9, METHOD_BUFFERED)
+#define IOCTL_NFS41_WRITE_BATCH _RDR_CTL_CODE(10, METHOD_BUFFERED)
+#define IOCTL_NFS41_RING_SETUP  _RDR_CTL_CODE(11, METHOD_BUFFERED)
+#define IOCTL_NFS41_RING_ENTER  _RDR_CTL_CODE(12, METHOD_BUFFERED)
+
+/* IOCTL_NFS41_READ_BATCH and IOCTL_NFS41_WRITE_BATCH carry several upcalls
+ * or downcalls in one buffer: a ULONG count, then each entry as a ULONG
+ * length followed by the same encoding used by IOCTL_NFS41_READ/WRITE.
+ * a batch of upcalls must be answered with a single batch of downcalls,
+ * which returns an NTSTATUS for each downcall in the output buffer */
+#define UPCALL_BATCH_MAX        16
+/* room reserved for each upcall or downcall; matches UPCALL_BUF_SIZE */
+#define UPCALL_BATCH_ENTRY_SIZE 2048
+#define UPCALL_BATCH_MIN_SIZE   (2 * sizeof(ULONG) + UPCALL_BATCH_ENTRY_SIZE)
+#define UPCALL_BATCH_BUF_SIZE   (sizeof(ULONG) + UPCALL_BATCH_MAX * \
+                                (sizeof(ULONG) + UPCALL_BATCH_ENTRY_SIZE))
+
+/* IOCTL_NFS41_RING_SETUP takes the handle of an event for the submission
+ * doorbell, and returns the address where the nfs41_ring_pair is mapped
+ * in the caller.  the rings are torn down when that handle is cleaned up.
+ * IOCTL_NFS41_RING_ENTER completes everything in the completion ring */
 
 typedef enum _nfs41_opcodes {
     NFS41_MOUNT,
@@ -67,10 +88,15 @@ typedef enum _nfs41_opcodes {
     NFS41_VOLUME_QUERY,
     NFS41_ACL_QUERY,
     NFS41_ACL_SET,
+    NFS41_FLUSH,
+    NFS41_CHANGE_QUERY,
     NFS41_SHUTDOWN,
     INVALID_OPCODE
 } nfs41_opcodes;
 
+/* most files checked by a single NFS41_CHANGE_QUERY upcall */
+#define NFS41_CHANGE_QUERY_MAX  64
+
 enum rpcsec_flavors {
     RPCSEC_AUTH_SYS,
     RPCSEC_AUTHGSS_KRB5,
@@ -0,0 +1,183 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef _NFS41_RING_
+#define _NFS41_RING_
+
+/* shared-memory upcall transport
+ *
+ *   the driver allocates a pair of rings and maps them into the daemon.
+ * the submission ring carries upcalls from the driver to the daemon, and
+ * the completion ring carries downcalls back.  entries use the same
+ * encoding as IOCTL_NFS41_READ/WRITE.
+ *
+ *   each ring is a bounded queue that allows any number of producers and
+ * consumers.  every entry has a sequence number that says whose turn it
+ * is: seq == pos means the entry is free for the producer at pos, and
+ * seq == pos + 1 means it's ready for the consumer at pos.  a producer
+ * only needs to ring the doorbell when the ring was empty, which is when
+ * the consumers have caught up with the position it published.
+ *
+ *   this header doesn't depend on the kernel or win32, so the protocol
+ * can be built and exercised in user mode on any platform. */
+
+#if defined(_WDMDDK_)
+#define ring_cas(ptr, xchg, cmp) InterlockedCompareExchange(ptr, xchg, cmp)
+#define ring_barrier() KeMemoryBarrier()
+#elif defined(_WIN32)
+#define ring_cas(ptr, xchg, cmp) InterlockedCompareExchange(ptr, xchg, cmp)
+#define ring_barrier() MemoryBarrier()
+#else
+#include <stddef.h>
+#include <stdint.h>
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef unsigned char BOOLEAN;
+#define IN
+#define OUT
+#define ring_cas(ptr, xchg, cmp) __sync_val_compare_and_swap(ptr, cmp, xchg)
+#define ring_barrier() __sync_synchronize()
+#endif
+
+/* entries per ring; must be a power of two */
+#define NFS41_RING_ENTRIES      32
+#define NFS41_RING_MASK         (NFS41_RING_ENTRIES - 1)
+/* matches UPCALL_BATCH_ENTRY_SIZE */
+#define NFS41_RING_DATA_SIZE    2048
+#define NFS41_RING_ALIGN        64 /* keep head and tail on separate lines */
+
+typedef struct __nfs41_ring_entry {
+    volatile LONG   seq;
+    ULONG           len; /* 0 if the entry carries nothing */
+    /* submission: the client's logon session, since the daemon thread
+     * that consumes the upcall can't impersonate it */
+    ULONG           luid_low;
+    LONG            luid_high;
+    unsigned char   data[NFS41_RING_DATA_SIZE];
+} nfs41_ring_entry;
+
+typedef struct __nfs41_ring {
+    volatile LONG   head; /* next position to consume */
+    unsigned char   pad0[NFS41_RING_ALIGN - sizeof(LONG)];
+    volatile LONG   tail; /* next position to produce */
+    unsigned char   pad1[NFS41_RING_ALIGN - sizeof(LONG)];
+    nfs41_ring_entry entries[NFS41_RING_ENTRIES];
+} nfs41_ring;
+
+typedef struct __nfs41_ring_pair {
+    nfs41_ring      sq; /* upcalls, from the driver to the daemon */
+    nfs41_ring      cq; /* downcalls, from the daemon to the driver */
+} nfs41_ring_pair;
+
+
+static __inline void nfs41_ring_init(
+    IN nfs41_ring *ring)
+{
+    ULONG i;
+
+    ring->head = ring->tail = 0;
+    for (i = 0; i < NFS41_RING_ENTRIES; i++)
+        ring->entries[i].seq = (LONG)i;
+}
+
+/* claim the entry at the tail, or return NULL if the ring is full.  the
+ * entry must be published, even if there's nothing to put in it */
+static __inline nfs41_ring_entry* nfs41_ring_reserve(
+    IN nfs41_ring *ring,
+    OUT ULONG *pos_out)
+{
+    nfs41_ring_entry *entry;
+    ULONG pos;
+    LONG diff;
+
+    for (;;) {
+        pos = (ULONG)ring->tail;
+        entry = &ring->entries[pos & NFS41_RING_MASK];
+        diff = (LONG)((ULONG)entry->seq - pos);
+        if (diff == 0) {
+            if ((ULONG)ring_cas(&ring->tail, (LONG)(pos + 1), (LONG)pos) == pos)
+                break;
+        } else if (diff < 0)
+            return NULL;
+        /* otherwise another producer got here first */
+    }
+    *pos_out = pos;
+    return entry;
+}
+
+/* make a reserved entry visible to consumers.  returns TRUE if the ring
+ * was empty, in which case the caller has to ring the doorbell */
+static __inline BOOLEAN nfs41_ring_publish(
+    IN nfs41_ring *ring,
+    IN nfs41_ring_entry *entry,
+    IN ULONG pos)
+{
+    ring_barrier(); /* the contents before the sequence number */
+    entry->seq = (LONG)(pos + 1);
+    ring_barrier(); /* the sequence number before reading head */
+    return (ULONG)ring->head == pos;
+}
+
+/* claim the entry at the head, or return NULL if the ring is empty */
+static __inline nfs41_ring_entry* nfs41_ring_consume(
+    IN nfs41_ring *ring,
+    OUT ULONG *pos_out)
+{
+    nfs41_ring_entry *entry;
+    ULONG pos;
+    LONG diff;
+
+    for (;;) {
+        pos = (ULONG)ring->head;
+        entry = &ring->entries[pos & NFS41_RING_MASK];
+        diff = (LONG)((ULONG)entry->seq - (pos + 1));
+        if (diff == 0) {
+            if ((ULONG)ring_cas(&ring->head, (LONG)(pos + 1), (LONG)pos) == pos)
+                break;
+        } else if (diff < 0)
+            return NULL;
+        /* otherwise another consumer got here first */
+    }
+    ring_barrier(); /* the sequence number before the contents */
+    *pos_out = pos;
+    return entry;
+}
+
+/* hand a consumed entry back to the producers */
+static __inline void nfs41_ring_release(
+    IN nfs41_ring_entry *entry,
+    IN ULONG pos)
+{
+    ring_barrier(); /* finish with the contents first */
+    entry->seq = (LONG)(pos + NFS41_RING_ENTRIES);
+}
+
+/* returns TRUE if the entry at the head is ready to consume.  a consumer
+ * that's woken by the doorbell checks this after claiming its entry, and
+ * wakes another consumer for the rest */
+static __inline BOOLEAN nfs41_ring_ready(
+    IN nfs41_ring *ring)
+{
+    const ULONG pos = (ULONG)ring->head;
+    return (ULONG)ring->entries[pos & NFS41_RING_MASK].seq == pos + 1;
+}
+
+#endif /* !_NFS41_RING_ */
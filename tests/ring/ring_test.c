@@ -0,0 +1,277 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+/* exercises the upcall ring protocol in sys/nfs41_ring.h with fake
+ * producers standing in for the driver, and consumers that follow the
+ * doorbell rules of daemon/upcall_ring.c.  builds with gcc on linux */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "nfs41_ring.h"
+
+
+#define PRODUCERS       4
+#define CONSUMERS       4
+#define PER_PRODUCER    200000
+
+/* a consumer that waits this long with work in the ring missed a doorbell */
+#define DOORBELL_TIMEOUT 5 /* seconds */
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+            __FILE__, __LINE__, #cond); \
+        failures++; \
+    } } while (0)
+
+
+/* stands in for the auto-reset event that the driver sets */
+struct doorbell {
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    int                     set;
+};
+
+static void doorbell_ring(
+    IN struct doorbell *bell)
+{
+    pthread_mutex_lock(&bell->lock);
+    bell->set = 1;
+    pthread_cond_signal(&bell->cond);
+    pthread_mutex_unlock(&bell->lock);
+}
+
+/* returns 0 once rung, or ETIMEDOUT */
+static int doorbell_wait(
+    IN struct doorbell *bell)
+{
+    struct timespec due;
+    int status = 0;
+
+    clock_gettime(CLOCK_REALTIME, &due);
+    due.tv_sec += DOORBELL_TIMEOUT;
+
+    pthread_mutex_lock(&bell->lock);
+    while (!bell->set && status == 0)
+        status = pthread_cond_timedwait(&bell->cond, &bell->lock, &due);
+    if (bell->set) {
+        bell->set = 0; /* auto-reset */
+        status = 0;
+    }
+    pthread_mutex_unlock(&bell->lock);
+    return status;
+}
+
+
+/* single-threaded checks of the ring's bounds */
+static void test_bounds()
+{
+    static nfs41_ring ring;
+    nfs41_ring_entry *entry;
+    ULONG pos, i, lap;
+
+    nfs41_ring_init(&ring);
+    CHECK(nfs41_ring_consume(&ring, &pos) == NULL);
+    CHECK(!nfs41_ring_ready(&ring));
+
+    /* go around enough times to wrap the sequence numbers' low bits */
+    for (lap = 0; lap < 3; lap++) {
+        for (i = 0; i < NFS41_RING_ENTRIES; i++) {
+            entry = nfs41_ring_reserve(&ring, &pos);
+            CHECK(entry != NULL);
+            if (entry == NULL)
+                return;
+            CHECK(pos == lap * NFS41_RING_ENTRIES + i);
+            entry->len = pos;
+            /* only the first entry finds the ring empty */
+            CHECK(nfs41_ring_publish(&ring, entry, pos) == (i == 0));
+        }
+        CHECK(nfs41_ring_reserve(&ring, &pos) == NULL);
+
+        for (i = 0; i < NFS41_RING_ENTRIES; i++) {
+            CHECK(nfs41_ring_ready(&ring));
+            entry = nfs41_ring_consume(&ring, &pos);
+            CHECK(entry != NULL);
+            if (entry == NULL)
+                return;
+            CHECK(entry->len == pos);
+            nfs41_ring_release(entry, pos);
+        }
+        CHECK(nfs41_ring_consume(&ring, &pos) == NULL);
+    }
+
+    /* a reserved entry that isn't published yet holds up the consumers */
+    entry = nfs41_ring_reserve(&ring, &pos);
+    CHECK(entry != NULL);
+    CHECK(nfs41_ring_consume(&ring, &pos) == NULL);
+    if (entry) {
+        entry->len = 0;
+        nfs41_ring_publish(&ring, entry, pos);
+        CHECK(nfs41_ring_consume(&ring, &pos) == entry);
+        nfs41_ring_release(entry, pos);
+    }
+}
+
+
+/* fake producers and consumers on a shared ring */
+static nfs41_ring shared;
+static struct doorbell bell = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+static unsigned char seen[PRODUCERS][PER_PRODUCER];
+static volatile LONG consumed = 0;
+static volatile int done = 0;
+static volatile LONG lost_wakeups = 0;
+static volatile LONG doorbells = 0;
+
+struct payload {
+    uint32_t                producer;
+    uint32_t                index;
+};
+
+static void* producer_thread(void *args)
+{
+    const uint32_t id = (uint32_t)(size_t)args;
+    nfs41_ring_entry *entry;
+    struct payload payload;
+    ULONG pos;
+    uint32_t i;
+
+    for (i = 0; i < PER_PRODUCER; i++) {
+        while ((entry = nfs41_ring_reserve(&shared, &pos)) == NULL)
+            sched_yield(); /* the driver would fall back on READ_BATCH */
+
+        payload.producer = id;
+        payload.index = i;
+        memcpy(entry->data, &payload, sizeof(payload));
+        entry->len = sizeof(payload);
+        entry->luid_low = id;
+        entry->luid_high = (LONG)i;
+        if (nfs41_ring_publish(&shared, entry, pos)) {
+            __sync_fetch_and_add(&doorbells, 1);
+            doorbell_ring(&bell);
+        }
+    }
+    return NULL;
+}
+
+static void* consumer_thread(void *args)
+{
+    nfs41_ring_entry *entry;
+    struct payload payload;
+    ULONG pos, len;
+
+    (void)args;
+    while (!done) {
+        if (doorbell_wait(&bell) == ETIMEDOUT) {
+            if (nfs41_ring_ready(&shared)) {
+                fprintf(stderr, "consumer slept through a ready entry\n");
+                __sync_fetch_and_add(&lost_wakeups, 1);
+            } else
+                continue;
+        }
+        if (done) {
+            doorbell_ring(&bell); /* pass it on to the next thread */
+            break;
+        }
+
+        while ((entry = nfs41_ring_consume(&shared, &pos)) != NULL) {
+            len = entry->len;
+            memcpy(&payload, entry->data, sizeof(payload));
+            CHECK(len == sizeof(payload));
+            CHECK(entry->luid_low == payload.producer);
+            CHECK((uint32_t)entry->luid_high == payload.index);
+            nfs41_ring_release(entry, pos);
+
+            /* wake another consumer for the rest */
+            if (nfs41_ring_ready(&shared))
+                doorbell_ring(&bell);
+
+            if (payload.producer >= PRODUCERS ||
+                    payload.index >= PER_PRODUCER) {
+                CHECK(!"payload out of range");
+                continue;
+            }
+            /* every entry is consumed exactly once */
+            CHECK(__sync_fetch_and_add(
+                &seen[payload.producer][payload.index], 1) == 0);
+            if (__sync_add_and_fetch(&consumed, 1) ==
+                    PRODUCERS * PER_PRODUCER) {
+                done = 1;
+                doorbell_ring(&bell);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_fake_producers()
+{
+    pthread_t producers[PRODUCERS], consumers[CONSUMERS];
+    uint32_t i, j;
+
+    nfs41_ring_init(&shared);
+
+    for (i = 0; i < CONSUMERS; i++)
+        pthread_create(&consumers[i], NULL, consumer_thread, NULL);
+    for (i = 0; i < PRODUCERS; i++)
+        pthread_create(&producers[i], NULL, producer_thread,
+            (void*)(size_t)i);
+
+    for (i = 0; i < PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+    for (i = 0; i < CONSUMERS; i++)
+        pthread_join(consumers[i], NULL);
+
+    CHECK(consumed == PRODUCERS * PER_PRODUCER);
+    CHECK(lost_wakeups == 0);
+    CHECK(nfs41_ring_consume(&shared, (ULONG*)&j) == NULL);
+    for (i = 0; i < PRODUCERS; i++)
+        for (j = 0; j < PER_PRODUCER; j++)
+            if (seen[i][j] != 1) {
+                fprintf(stderr, "entry %u/%u consumed %u times\n",
+                    i, j, seen[i][j]);
+                failures++;
+                return;
+            }
+    printf("%u entries through %u slots with %d doorbells\n",
+        PRODUCERS * PER_PRODUCER, NFS41_RING_ENTRIES, doorbells);
+}
+
+int main()
+{
+    test_bounds();
+    test_fake_producers();
+
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("ring tests passed\n");
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+
+#ifndef __NFS41_TEST_XDR_BENCH_H__
+#define __NFS41_TEST_XDR_BENCH_H__
+
+#include <time.h>
+
+#include "xdr_corpus.h"
+
+
+/* timing for the benchmarks */
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* runs 'fn' in batches until 'duration' nanoseconds have passed, and
+ * returns the average time per call.  returns -1 if a call fails */
+typedef bool_t (*bench_fn)(void *context);
+
+static double measure(
+    IN bench_fn fn,
+    IN void *context,
+    IN double duration)
+{
+    const uint32_t batch = 256;
+    uint64_t calls = 0;
+    double start, elapsed;
+    uint32_t i;
+
+    /* warm up the caches and branch predictors */
+    for (i = 0; i < batch; i++)
+        if (!fn(context))
+            return -1;
+
+    start = now_ns();
+    do {
+        for (i = 0; i < batch; i++)
+            if (!fn(context))
+                return -1;
+        calls += batch;
+        elapsed = now_ns() - start;
+    } while (elapsed < duration);
+    return elapsed / calls;
+}
+
+#endif /* !__NFS41_TEST_XDR_BENCH_H__ */
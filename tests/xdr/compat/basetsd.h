@@ -0,0 +1 @@
+#include "win32.h"
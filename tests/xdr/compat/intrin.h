@@ -0,0 +1,16 @@
+#include "win32.h"
+
+#ifndef __NFS41_TEST_INTRIN_H__
+#define __NFS41_TEST_INTRIN_H__
+
+static inline unsigned char _BitScanForward(
+    unsigned long *index,
+    unsigned long mask)
+{
+    if (mask == 0)
+        return 0;
+    *index = (unsigned long)__builtin_ctzl(mask);
+    return 1;
+}
+
+#endif /* !__NFS41_TEST_INTRIN_H__ */
@@ -0,0 +1,50 @@
+/* replaces libtirpc/tirpc/rpc/types.h, which pulls in windows-only
+ * definitions that clash with glibc's */
+
+#ifndef __NFS41_TEST_RPC_TYPES_H__
+#define __NFS41_TEST_RPC_TYPES_H__
+
+#include "../win32.h"
+
+typedef int32_t bool_t;
+typedef int32_t enum_t;
+
+typedef u_int32_t rpcprog_t;
+typedef u_int32_t rpcvers_t;
+typedef u_int32_t rpcproc_t;
+typedef u_int32_t rpcprot_t;
+typedef u_int32_t rpcport_t;
+typedef int32_t rpc_inline_t;
+
+#define __dontcare__ -1
+#ifndef FALSE
+#define FALSE (0)
+#endif
+#ifndef TRUE
+#define TRUE (1)
+#endif
+
+#define mem_alloc(bsize) calloc(1, bsize)
+#define mem_free(ptr, bsize) free(ptr)
+
+#include <netconfig.h>
+
+struct netbuf {
+    unsigned int maxlen;
+    unsigned int len;
+    void *buf;
+};
+
+struct t_bind {
+    struct netbuf addr;
+    unsigned int qlen;
+};
+
+struct __rpc_sockinfo {
+    ADDRESS_FAMILY si_af;
+    int si_proto;
+    int si_socktype;
+    int si_alen;
+};
+
+#endif /* !__NFS41_TEST_RPC_TYPES_H__ */
@@ -0,0 +1,27 @@
+#include "win32.h"
+
+#ifndef __NFS41_TEST_STRSAFE_H__
+#define __NFS41_TEST_STRSAFE_H__
+
+typedef const char *STRSAFE_LPCSTR;
+typedef long HRESULT;
+
+#define S_OK ((HRESULT)0)
+#define STRSAFE_E_INSUFFICIENT_BUFFER ((HRESULT)0x8007007AL)
+
+static inline HRESULT StringCchCopyA(
+    char *dst,
+    size_t cch,
+    const char *src)
+{
+    size_t i;
+
+    if (cch == 0)
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    for (i = 0; i < cch - 1 && src[i]; i++)
+        dst[i] = src[i];
+    dst[i] = '\0';
+    return src[i] ? STRSAFE_E_INSUFFICIENT_BUFFER : S_OK;
+}
+
+#endif /* !__NFS41_TEST_STRSAFE_H__ */
@@ -0,0 +1,133 @@
+/* the parts of the windows headers that the xdr layer uses, for building
+ * it with gcc on linux.  every compat header includes this one */
+
+#ifndef __NFS41_TEST_WIN32_H__
+#define __NFS41_TEST_WIN32_H__
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* glibc's dprintf() takes a file descriptor; daemon_debug.h declares its
+ * own.  stdio.h is included above so its declaration isn't renamed */
+#define dprintf nfs41_dprintf
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define __inline inline
+#define WINAPI
+#define CALLBACK
+
+/* LLP64: long is 32 bits on windows */
+typedef uint32_t DWORD, ULONG, *PULONG, *LPDWORD, *PDWORD;
+typedef int32_t LONG, *PLONG;
+typedef int64_t LONGLONG, LONG64, INT64;
+typedef uint64_t ULONGLONG, ULONG64, DWORD64, UINT64;
+typedef int INT, BOOL, *PBOOL;
+typedef unsigned int UINT, UINT32;
+typedef int32_t INT32;
+typedef int16_t INT16;
+typedef uint16_t UINT16, USHORT, WORD, WCHAR, *PWCHAR;
+typedef unsigned char UCHAR, BYTE, BOOLEAN, *PBYTE, *PUCHAR;
+typedef char CHAR, CCHAR, *PCHAR, *LPSTR;
+typedef const char *LPCSTR, *PCSTR;
+typedef void VOID, *PVOID, *LPVOID, *HANDLE;
+typedef size_t SIZE_T, ULONG_PTR;
+typedef ssize_t SSIZE_T;
+typedef unsigned short ADDRESS_FAMILY;
+typedef int SOCKET;
+typedef DWORD ACCESS_MASK;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        LONG HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+/* never initialized by the xdr layer beyond InitializeSRWLock() */
+typedef struct { void *Ptr; } SRWLOCK, *PSRWLOCK;
+typedef struct { void *Ptr; } CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+typedef struct { void *Ptr[5]; } CRITICAL_SECTION;
+
+typedef struct _WSABUF {
+    ULONG len;
+    char *buf;
+} WSABUF, *LPWSABUF;
+
+typedef struct _FILE_BASIC_INFO {
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    DWORD FileAttributes;
+} FILE_BASIC_INFO, *PFILE_BASIC_INFO;
+
+typedef struct _FILE_STANDARD_INFO {
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    DWORD NumberOfLinks;
+    BOOLEAN DeletePending;
+    BOOLEAN Directory;
+} FILE_STANDARD_INFO, *PFILE_STANDARD_INFO;
+
+typedef struct _FILE_ID_BOTH_DIR_INFO {
+    DWORD NextEntryOffset;
+    DWORD FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    DWORD FileAttributes;
+    DWORD FileNameLength;
+    DWORD EaSize;
+    CCHAR ShortNameLength;
+    WCHAR ShortName[12];
+    LARGE_INTEGER FileId;
+    WCHAR FileName[1];
+} FILE_ID_BOTH_DIR_INFO, *PFILE_ID_BOTH_DIR_INFO;
+
+#define MAX_PATH 260
+#define NI_MAXHOST 1025
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+#define FIELD_OFFSET(type, field) offsetof(type, field)
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define ZeroMemory(dst, len) memset((dst), 0, (len))
+#define PtrToUlong(p) ((ULONG)(uintptr_t)(p))
+#define PtrToLong(p) ((LONG)(intptr_t)(p))
+#define InitializeSRWLock(lock) ((lock)->Ptr = NULL)
+
+/* the xdr layer doesn't lock; these are for inline functions in the
+ * daemon headers */
+#define AcquireSRWLockShared(lock) ((void)(lock))
+#define ReleaseSRWLockShared(lock) ((void)(lock))
+#define AcquireSRWLockExclusive(lock) ((void)(lock))
+#define ReleaseSRWLockExclusive(lock) ((void)(lock))
+#define EnterCriticalSection(lock) ((void)(lock))
+#define LeaveCriticalSection(lock) ((void)(lock))
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+/* msvc concatenates __FUNCTION__ with string literals */
+#define __FUNCTION__ __FILE__
+
+#endif /* !__NFS41_TEST_WIN32_H__ */
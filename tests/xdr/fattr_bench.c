@@ -0,0 +1,469 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+
+/* compares the time to decode the attributes in GETATTR and READDIR
+ * replies with the daemon's table-driven decoder, against the decoder
+ * that the table replaced: a test of each attribute bit in turn, reading
+ * from a nested xdrmem stream over a copy of attr_vals.  the replies hold
+ * only the GETATTR or READDIR result, so their fattr4s are most of the
+ * work.  usage: fattr_bench [milliseconds per measurement] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+#include "bench.h"
+
+
+#define MAX_MESSAGE 65536
+
+/* from nfs41_xdr.c */
+bool_t xdr_fattr4(XDR *xdr, fattr4 *fattr);
+
+/* the shapes that end in a result with attributes */
+static const enum corpus_shape shapes[] = {
+    CORPUS_GETATTR, CORPUS_LOOKUP, CORPUS_READDIR
+};
+#define SHAPE_COUNT (sizeof(shapes) / sizeof(shapes[0]))
+
+struct fattr_bench {
+    struct corpus_compound  c;
+    nfs_resop4              *resop; /* the result with the attributes */
+    char                    message[MAX_MESSAGE];
+    u_int                   length;
+};
+
+/* readies the results for another decode */
+static void reset(
+    IN OUT struct fattr_bench *b)
+{
+    nfs41_compound_res *res = &b->c.compound.res;
+
+    res->tag_len = NFS4_OPAQUE_LIMIT;
+    res->resarray = b->resop;
+    res->resarray_count = 1;
+    b->c.getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    b->c.readdir_res.reply.entries_len = CORPUS_DIR_SIZE;
+}
+
+static bool_t decode_table(void *context)
+{
+    struct fattr_bench *b = (struct fattr_bench*)context;
+    XDR xdr;
+
+    reset(b);
+    xdrmem_create(&xdr, b->message, b->length, XDR_DECODE);
+    return nfs_decode_compound(&xdr, (caddr_t*)&b->c.compound.res);
+}
+
+
+/* the stream decoder, as nfs41_xdr.c had it before the table.  the
+ * attributes that the corpus doesn't send fail instead of decoding */
+static bool_t stream_nfstime4(
+    XDR *xdr,
+    nfstime4 *nt)
+{
+    if (!xdr_hyper(xdr, &nt->seconds))
+        return FALSE;
+    return xdr_u_int32_t(xdr, &nt->nseconds);
+}
+
+static bool_t stream_string(
+    XDR *xdr,
+    char *str)
+{
+    uint32_t len;
+
+    if (!xdr_bytes(xdr, &str, &len, NFS4_OPAQUE_LIMIT))
+        return FALSE;
+    str[len] = '\0';
+    return TRUE;
+}
+
+static bool_t stream_file_attrs(
+    XDR *xdr,
+    fattr4 *attrs,
+    nfs41_file_info *info)
+{
+    if (attrs->attrmask.count >= 1) {
+        const uint32_t word = attrs->attrmask.arr[0];
+        if (word & FATTR4_WORD0_SUPPORTED_ATTRS)
+            return FALSE;
+        if (word & FATTR4_WORD0_TYPE) {
+            if (!xdr_u_int32_t(xdr, &info->type))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_CHANGE) {
+            if (!xdr_u_hyper(xdr, &info->change))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_SIZE) {
+            if (!xdr_u_hyper(xdr, &info->size))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_LINK_SUPPORT) {
+            if (!xdr_bool(xdr, &info->link_support))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_SYMLINK_SUPPORT) {
+            if (!xdr_bool(xdr, &info->symlink_support))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_FSID) {
+            if (!xdr_u_hyper(xdr, &info->fsid.major))
+                return FALSE;
+            if (!xdr_u_hyper(xdr, &info->fsid.minor))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_LEASE_TIME) {
+            if (!xdr_u_int32_t(xdr, &info->lease_time))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_RDATTR_ERROR) {
+            if (!xdr_u_int32_t(xdr, &info->rdattr_error))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_ACL)
+            return FALSE;
+        if (word & FATTR4_WORD0_ACLSUPPORT) {
+            if (!xdr_u_int32_t(xdr, &info->aclsupport))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_ARCHIVE) {
+            if (!xdr_bool(xdr, &info->archive))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_CANSETTIME) {
+            if (!xdr_bool(xdr, &info->cansettime))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_CASE_INSENSITIVE) {
+            if (!xdr_bool(xdr, &info->case_insensitive))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_CASE_PRESERVING) {
+            if (!xdr_bool(xdr, &info->case_preserving))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_FILEID) {
+            if (!xdr_u_hyper(xdr, &info->fileid))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_FS_LOCATIONS)
+            return FALSE;
+        if (word & FATTR4_WORD0_HIDDEN) {
+            if (!xdr_bool(xdr, &info->hidden))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_MAXREAD) {
+            if (!xdr_u_hyper(xdr, &info->maxread))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD0_MAXWRITE) {
+            if (!xdr_u_hyper(xdr, &info->maxwrite))
+                return FALSE;
+        }
+    }
+    if (attrs->attrmask.count >= 2) {
+        const uint32_t word = attrs->attrmask.arr[1];
+        if (word & FATTR4_WORD1_MODE) {
+            if (!xdr_u_int32_t(xdr, &info->mode))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_NUMLINKS) {
+            if (!xdr_u_int32_t(xdr, &info->numlinks))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_OWNER) {
+            if (!stream_string(xdr, info->owner))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_OWNER_GROUP) {
+            if (!stream_string(xdr, info->owner_group))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_SPACE_AVAIL) {
+            if (!xdr_u_hyper(xdr, &info->space_avail))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_SPACE_FREE) {
+            if (!xdr_u_hyper(xdr, &info->space_free))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_SPACE_TOTAL) {
+            if (!xdr_u_hyper(xdr, &info->space_total))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_SYSTEM) {
+            if (!xdr_bool(xdr, &info->system))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_TIME_ACCESS) {
+            if (!stream_nfstime4(xdr, &info->time_access))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_TIME_CREATE) {
+            if (!stream_nfstime4(xdr, &info->time_create))
+                return FALSE;
+        }
+        if (word & FATTR4_WORD1_TIME_DELTA)
+            return FALSE;
+        if (word & FATTR4_WORD1_TIME_MODIFY) {
+            if (!stream_nfstime4(xdr, &info->time_modify))
+                return FALSE;
+        }
+        if (word & (FATTR4_WORD1_DACL | FATTR4_WORD1_FS_LAYOUT_TYPE))
+            return FALSE;
+    }
+    if (attrs->attrmask.count >= 3) {
+        if (attrs->attrmask.arr[2] & (FATTR4_WORD2_MDSTHRESHOLD |
+                FATTR4_WORD2_SUPPATTR_EXCLCREAT))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static bool_t stream_fattr4(
+    XDR *xdr,
+    nfs41_file_info *info)
+{
+    fattr4 attrs;
+    XDR attr_xdr;
+
+    attrs.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    if (!xdr_fattr4(xdr, &attrs))
+        return FALSE;
+    xdrmem_create(&attr_xdr, (char*)attrs.attr_vals, attrs.attr_vals_len,
+        XDR_DECODE);
+    return stream_file_attrs(&attr_xdr, &attrs, info);
+}
+
+static bool_t stream_readdir_entry(
+    XDR *xdr,
+    nfs41_readdir_list *dirs,
+    uint32_t *offset,
+    bool_t *has_next)
+{
+    nfs41_readdir_entry *entry;
+    uint64_t cookie;
+    char name[NFS4_OPAQUE_LIMIT];
+    char *nameptr = name;
+    uint32_t name_len, entry_len;
+    fattr4 attrs;
+    XDR attr_xdr;
+
+    /* into temporaries until we know the entry fits */
+    memset(name, 0, sizeof(name));
+    entry_len = (uint32_t)FIELD_OFFSET(nfs41_readdir_entry, name);
+    attrs.attr_vals_len = NFS4_OPAQUE_LIMIT;
+
+    if (!xdr_u_hyper(xdr, &cookie))
+        return FALSE;
+    if (!xdr_bytes(xdr, &nameptr, &name_len, NFS4_OPAQUE_LIMIT))
+        return FALSE;
+    if (!xdr_fattr4(xdr, &attrs))
+        return FALSE;
+    if (!xdr_bool(xdr, has_next))
+        return FALSE;
+
+    name_len += 1;
+    if (*offset + entry_len + name_len > dirs->entries_len)
+        return FALSE; /* the corpus fits */
+
+    entry = (nfs41_readdir_entry*)(dirs->entries + *offset);
+    entry->cookie = cookie;
+    entry->name_len = name_len;
+    entry->next_entry_offset = *has_next ? entry_len + name_len : 0;
+
+    xdrmem_create(&attr_xdr, (char*)attrs.attr_vals, attrs.attr_vals_len,
+        XDR_DECODE);
+    if (!stream_file_attrs(&attr_xdr, &attrs, &entry->attr_info))
+        entry->attr_info.rdattr_error = NFS4ERR_BADXDR;
+    StringCchCopyA(entry->name, name_len, name);
+
+    *offset += entry_len + name_len;
+    return TRUE;
+}
+
+static bool_t stream_readdir(
+    XDR *xdr,
+    nfs41_readdir_res *res)
+{
+    nfs41_readdir_list *dirs = &res->reply;
+    uint32_t offset = 0;
+    bool_t has_next;
+
+    if (!xdr_opaque(xdr, (char*)res->cookieverf, NFS4_VERIFIER_SIZE))
+        return FALSE;
+    if (!xdr_bool(xdr, &dirs->has_entries))
+        return FALSE;
+    if (dirs->has_entries) {
+        do {
+            if (!stream_readdir_entry(xdr, dirs, &offset, &has_next))
+                return FALSE;
+        } while (has_next);
+    }
+    dirs->entries_len = offset;
+    return xdr_bool(xdr, &dirs->eof);
+}
+
+static bool_t decode_stream(void *context)
+{
+    struct fattr_bench *b = (struct fattr_bench*)context;
+    nfs41_compound_res *res = &b->c.compound.res;
+    unsigned char *tag = res->tag;
+    uint32_t count, op, status;
+    XDR xdr;
+
+    reset(b);
+    xdrmem_create(&xdr, b->message, b->length, XDR_DECODE);
+    if (!xdr_u_int32_t(&xdr, &res->status) ||
+        !xdr_bytes(&xdr, (char**)&tag, &res->tag_len, NFS4_OPAQUE_LIMIT) ||
+        !xdr_u_int32_t(&xdr, &count) || count != 1 ||
+        !xdr_u_int32_t(&xdr, &op) || op != b->resop->op ||
+        !xdr_u_int32_t(&xdr, &status) || status != NFS4_OK)
+        return FALSE;
+
+    if (op == OP_READDIR)
+        return stream_readdir(&xdr, &b->c.readdir_res);
+    return stream_fattr4(&xdr, &b->c.info);
+}
+
+
+/* both decoders have to agree on what they decoded */
+static bool_t same_info(
+    IN const nfs41_file_info *a,
+    IN const nfs41_file_info *b)
+{
+    return a->type == b->type && a->change == b->change &&
+        a->size == b->size && a->fileid == b->fileid &&
+        a->mode == b->mode && a->numlinks == b->numlinks &&
+        a->hidden == b->hidden && a->system == b->system &&
+        a->archive == b->archive && a->rdattr_error == b->rdattr_error &&
+        a->time_access.seconds == b->time_access.seconds &&
+        a->time_create.seconds == b->time_create.seconds &&
+        a->time_modify.seconds == b->time_modify.seconds &&
+        a->time_modify.nseconds == b->time_modify.nseconds;
+}
+
+static bool_t same_result(
+    IN struct fattr_bench *table,
+    IN struct fattr_bench *stream)
+{
+    const nfs41_readdir_list *x = &table->c.readdir_res.reply;
+    const nfs41_readdir_list *y = &stream->c.readdir_res.reply;
+    const nfs41_readdir_entry *e, *f;
+    uint32_t offset = 0;
+
+    if (table->resop->op != OP_READDIR)
+        return same_info(&table->c.info, &stream->c.info) &&
+            (table->c.info.owner == NULL ||
+                (strcmp(table->c.info.owner, stream->c.info.owner) == 0 &&
+                strcmp(table->c.info.owner_group,
+                    stream->c.info.owner_group) == 0));
+
+    if (x->entries_len != y->entries_len || x->eof != y->eof)
+        return FALSE;
+    do {
+        e = (const nfs41_readdir_entry*)(x->entries + offset);
+        f = (const nfs41_readdir_entry*)(y->entries + offset);
+        if (e->cookie != f->cookie || e->name_len != f->name_len ||
+            e->next_entry_offset != f->next_entry_offset ||
+            strcmp(e->name, f->name) != 0 ||
+            !same_info(&e->attr_info, &f->attr_info))
+            return FALSE;
+        offset += e->next_entry_offset;
+    } while (e->next_entry_offset);
+    return TRUE;
+}
+
+static void bench_init(
+    OUT struct fattr_bench *b,
+    IN enum corpus_shape shape)
+{
+    corpus_compound_init(&b->c, shape);
+    b->resop = &b->c.resops[b->c.compound.res.resarray_count - 1];
+    memset(b->c.entries, 0, sizeof(b->c.entries));
+}
+
+static uint32_t attr_count(
+    IN const bitmap4 *attrs)
+{
+    uint32_t i, count = 0;
+    for (i = 0; i < attrs->count; i++)
+        count += __builtin_popcount(attrs->arr[i]);
+    return count;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct fattr_bench *table, *stream;
+    double duration = 200e6, table_ns, stream_ns;
+    uint32_t i, fattrs, attrs;
+
+    if (argc > 1)
+        duration = strtod(argv[1], NULL) * 1e6;
+
+    table = malloc(sizeof(struct fattr_bench));
+    stream = malloc(sizeof(struct fattr_bench));
+    if (table == NULL || stream == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("%-10s %6s %6s %12s %12s %12s %8s\n", "reply", "fattr4",
+        "attrs", "stream ns", "table ns", "ns/attr", "speedup");
+    for (i = 0; i < SHAPE_COUNT; i++) {
+        bench_init(table, shapes[i]);
+        bench_init(stream, shapes[i]);
+        table->length = stream->length = corpus_last_reply(shapes[i],
+            table->message, MAX_MESSAGE);
+        memcpy(stream->message, table->message, table->length);
+
+        if (table->length == 0 || !decode_table(table) ||
+            !decode_stream(stream) || !same_result(table, stream)) {
+            fprintf(stderr, "%s: the decoders disagree\n",
+                corpus_name(shapes[i]));
+            return 1;
+        }
+
+        table_ns = measure(decode_table, table, duration);
+        stream_ns = measure(decode_stream, stream, duration);
+        if (table_ns < 0 || stream_ns < 0) {
+            fprintf(stderr, "%s: failed to decode\n",
+                corpus_name(shapes[i]));
+            return 1;
+        }
+
+        fattrs = shapes[i] == CORPUS_READDIR ? CORPUS_DIR_ENTRIES : 1;
+        attrs = attr_count(&table->c.attr_request);
+        printf("%-10s %6u %6u %12.1f %12.1f %12.2f %7.2fx\n",
+            corpus_name(shapes[i]), fattrs, attrs, stream_ns, table_ns,
+            table_ns / (fattrs * attrs), stream_ns / table_ns);
+    }
+
+    free(stream);
+    free(table);
+    return 0;
+}
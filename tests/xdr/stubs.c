@@ -0,0 +1,76 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+/* stands in for the parts of daemon_debug.c, util.c and libtirpc's
+ * mt_misc.c that the xdr layer uses, so it links without the rest of the
+ * daemon */
+
+#include <stdarg.h>
+#include <time.h>
+
+#include "nfs41_ops.h"
+#include "daemon_debug.h"
+#include "util.h"
+
+
+int xdr_test_verbose = 0;
+
+/* the compat EnterCriticalSection() is a no-op */
+CRITICAL_SECTION xdrrec_pool_lock;
+
+void dprintf(int level, LPCSTR format, ...)
+{
+    va_list args;
+
+    if (!xdr_test_verbose || level > xdr_test_verbose)
+        return;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void eprintf(LPCSTR format, ...)
+{
+    va_list args;
+
+    if (!xdr_test_verbose)
+        return;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+const char* nfs_opnum_to_string(int opnum)
+{
+    static char buffer[16];
+    snprintf(buffer, sizeof(buffer), "op %d", opnum);
+    return buffer;
+}
+
+void get_nfs_time(
+    OUT nfstime4 *nfs_time)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    nfs_time->seconds = now.tv_sec;
+    nfs_time->nseconds = (uint32_t)now.tv_nsec;
+}
@@ -0,0 +1,197 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+/* measures the time to encode each corpus compound and decode its reply
+ * with the daemon's xdr layer, and to decode the CB_COMPOUND requests.
+ * compounds are encoded twice: as the daemon does, and again with
+ * XDR_INLINE() turned off, which keeps nfs_encode_compound() off its
+ * fast path for SEQUENCE, PUTFH and READ, WRITE or GETATTR.
+ * usage: xdr_bench [milliseconds per measurement] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+
+#define MAX_MESSAGE 65536
+
+struct compound_bench {
+    struct corpus_compound  c;
+    enum corpus_shape       shape;
+    char                    message[MAX_MESSAGE];
+    u_int                   length;
+};
+
+static bool_t encode_compound(void *context)
+{
+    struct compound_bench *b = (struct compound_bench*)context;
+    XDR xdr;
+
+    xdrmem_create(&xdr, b->message, MAX_MESSAGE, XDR_ENCODE);
+    return nfs_encode_compound(&xdr, (caddr_t*)&b->c.compound.args);
+}
+
+/* the xdrmem operations without x_inline, set up in main() */
+static struct xdr_ops generic_ops;
+
+static int32_t* no_inline(
+    XDR *xdr,
+    u_int len)
+{
+    return NULL;
+}
+
+static bool_t encode_generic(void *context)
+{
+    struct compound_bench *b = (struct compound_bench*)context;
+    XDR xdr;
+
+    xdrmem_create(&xdr, b->message, MAX_MESSAGE, XDR_ENCODE);
+    xdr.x_ops = &generic_ops;
+    return nfs_encode_compound(&xdr, (caddr_t*)&b->c.compound.args);
+}
+
+/* the fast path has to encode the same bytes as the generic one */
+static bool_t same_encoding(
+    IN struct compound_bench *b)
+{
+    char *message;
+    u_int length;
+    bool_t result = FALSE;
+    XDR xdr;
+
+    message = malloc(MAX_MESSAGE);
+    if (message == NULL)
+        return FALSE;
+
+    xdrmem_create(&xdr, message, MAX_MESSAGE, XDR_ENCODE);
+    if (!nfs_encode_compound(&xdr, (caddr_t*)&b->c.compound.args))
+        goto out;
+    length = xdr_getpos(&xdr);
+
+    xdrmem_create(&xdr, b->message, MAX_MESSAGE, XDR_ENCODE);
+    xdr.x_ops = &generic_ops;
+    if (!nfs_encode_compound(&xdr, (caddr_t*)&b->c.compound.args))
+        goto out;
+    result = xdr_getpos(&xdr) == length &&
+        memcmp(message, b->message, length) == 0;
+out:
+    free(message);
+    return result;
+}
+
+static bool_t decode_compound(void *context)
+{
+    struct compound_bench *b = (struct compound_bench*)context;
+    bool_t result;
+    XDR xdr;
+
+    corpus_compound_init(&b->c, b->shape);
+    xdrmem_create(&xdr, b->message, b->length, XDR_DECODE);
+    result = nfs_decode_compound(&xdr, (caddr_t*)&b->c.compound.res);
+    corpus_compound_free(&b->c);
+    return result;
+}
+
+struct cb_bench {
+    char                    message[MAX_MESSAGE];
+    u_int                   length;
+};
+
+static bool_t decode_cb_compound(void *context)
+{
+    struct cb_bench *b = (struct cb_bench*)context;
+    struct cb_compound_args args;
+    bool_t result;
+    XDR xdr;
+
+    memset(&args, 0, sizeof(args));
+    xdrmem_create(&xdr, b->message, b->length, XDR_DECODE);
+    result = proc_cb_compound_args(&xdr, &args);
+    xdr.x_op = XDR_FREE;
+    proc_cb_compound_args(&xdr, &args);
+    return result;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct compound_bench *b;
+    struct cb_bench *cb;
+    double duration = 200e6, encode, generic, decode;
+    XDR xdr;
+    int shape;
+
+    if (argc > 1)
+        duration = strtod(argv[1], NULL) * 1e6;
+
+    b = malloc(sizeof(struct compound_bench));
+    cb = malloc(sizeof(struct cb_bench));
+    if (b == NULL || cb == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    xdrmem_create(&xdr, b->message, MAX_MESSAGE, XDR_ENCODE);
+    generic_ops = *xdr.x_ops;
+    generic_ops.x_inline = no_inline;
+
+    printf("%-16s %8s %12s %12s %12s\n", "compound", "bytes", "encode ns",
+        "generic ns", "decode ns");
+    for (shape = 0; shape < CORPUS_SHAPES; shape++) {
+        b->shape = shape;
+        corpus_compound_init(&b->c, shape);
+        if (!same_encoding(b)) {
+            fprintf(stderr, "%s: the encoders disagree\n",
+                corpus_name(shape));
+            return 1;
+        }
+        encode = measure(encode_compound, b, duration);
+        generic = measure(encode_generic, b, duration);
+
+        b->length = corpus_reply(shape, b->message, MAX_MESSAGE);
+        decode = b->length ? measure(decode_compound, b, duration) : -1;
+        if (encode < 0 || generic < 0 || decode < 0) {
+            fprintf(stderr, "%s: failed to encode or decode\n",
+                corpus_name(shape));
+            return 1;
+        }
+        printf("%-16s %8u %12.1f %12.1f %12.1f\n", corpus_name(shape),
+            b->length, encode, generic, decode);
+    }
+
+    for (shape = 0; shape < CORPUS_CB_SHAPES; shape++) {
+        cb->length = corpus_cb_args(shape, cb->message, MAX_MESSAGE);
+        decode = cb->length ? measure(decode_cb_compound, cb, duration) : -1;
+        if (decode < 0) {
+            fprintf(stderr, "%s: failed to decode\n", corpus_cb_name(shape));
+            return 1;
+        }
+        printf("%-16s %8u %12s %12s %12.1f\n", corpus_cb_name(shape),
+            cb->length, "-", "-", decode);
+    }
+
+    free(cb);
+    free(b);
+    return 0;
+}
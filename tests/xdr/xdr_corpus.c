@@ -0,0 +1,585 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdr_corpus.h"
+
+
+static const char *shape_names[] = {
+    "getattr", "read", "write", "readdir", "lookup", "fs_locations"
+};
+
+const char* corpus_name(
+    IN enum corpus_shape shape)
+{
+    return shape < CORPUS_SHAPES ? shape_names[shape] : "unknown";
+}
+
+/* the attributes of nfs41_superblock's default_getattr */
+static void default_getattr(
+    OUT bitmap4 *attrs)
+{
+    attrs->count = 2;
+    attrs->arr[0] = FATTR4_WORD0_TYPE | FATTR4_WORD0_CHANGE |
+        FATTR4_WORD0_SIZE | FATTR4_WORD0_FILEID | FATTR4_WORD0_HIDDEN |
+        FATTR4_WORD0_ARCHIVE;
+    attrs->arr[1] = FATTR4_WORD1_MODE | FATTR4_WORD1_NUMLINKS |
+        FATTR4_WORD1_SYSTEM | FATTR4_WORD1_TIME_ACCESS |
+        FATTR4_WORD1_TIME_CREATE | FATTR4_WORD1_TIME_MODIFY;
+    attrs->arr[2] = 0;
+}
+
+static void fill(
+    OUT unsigned char *buffer,
+    IN uint32_t length,
+    IN unsigned char seed)
+{
+    uint32_t i;
+    for (i = 0; i < length; i++)
+        buffer[i] = (unsigned char)(seed + i * 7);
+}
+
+static void add_op(
+    IN OUT struct corpus_compound *c,
+    IN uint32_t opnum,
+    IN void *arg,
+    IN void *res)
+{
+    /* as compound_add_op() does */
+    const uint32_t i = c->compound.args.argarray_count++;
+    const uint32_t j = c->compound.res.resarray_count++;
+    c->compound.args.argarray[i].op = opnum;
+    c->compound.args.argarray[i].arg = arg;
+    c->compound.res.resarray[j].op = opnum;
+    c->compound.res.resarray[j].res = res;
+}
+
+void corpus_compound_init(
+    OUT struct corpus_compound *c,
+    IN enum corpus_shape shape)
+{
+    static const char *tag = "corpus";
+    nfs41_compound *compound = &c->compound;
+
+    /* as compound_init() does */
+    compound->args.tag_len = (uint32_t)strlen(tag);
+    memcpy(compound->args.tag, tag, compound->args.tag_len);
+    compound->args.minorversion = 1;
+    compound->args.argarray_count = 0;
+    compound->args.argarray = c->argops;
+    compound->res.status = NFS4_OK;
+    compound->res.tag_len = NFS4_OPAQUE_LIMIT;
+    compound->res.resarray_count = 0;
+    compound->res.resarray = c->resops;
+
+    fill(c->sessionid, NFS4_SESSIONID_SIZE, 0x51);
+    add_op(c, OP_SEQUENCE, &c->sequence_args, &c->sequence_res);
+    c->sequence_args.sa_sessionid = c->sessionid;
+    c->sequence_args.sa_sequenceid = 1234;
+    c->sequence_args.sa_slotid = 3;
+    c->sequence_args.sa_highest_slotid = 63;
+    c->sequence_args.sa_cachethis = 0;
+
+    c->fh.len = 28;
+    fill(c->fh.fh, c->fh.len, 0xf4);
+    c->file.fh = c->fh;
+    add_op(c, OP_PUTFH, &c->putfh_args, &c->putfh_res);
+    c->putfh_args.file = &c->file;
+    c->putfh_args.in_recovery = 0;
+
+    c->stateid.stateid.seqid = 1;
+    fill(c->stateid.stateid.other, NFS4_STATEID_OTHER, 0x5d);
+
+    default_getattr(&c->attr_request);
+    memset(&c->info, 0, sizeof(c->info));
+    c->getattr_args.attr_request = &c->attr_request;
+    c->getattr_res.obj_attributes.attr_vals_len = NFS4_OPAQUE_LIMIT;
+    c->getattr_res.info = &c->info;
+
+    switch (shape) {
+    case CORPUS_GETATTR:
+        add_op(c, OP_GETATTR, &c->getattr_args, &c->getattr_res);
+        break;
+    case CORPUS_READ:
+        add_op(c, OP_READ, &c->read_args, &c->read_res);
+        c->read_args.stateid = &c->stateid;
+        c->read_args.offset = 65536;
+        c->read_args.count = CORPUS_IO_SIZE;
+        c->read_res.resok4.data_len = CORPUS_IO_SIZE;
+        c->read_res.resok4.data = c->data;
+        c->read_res.resok4.direct = 0;
+        break;
+    case CORPUS_WRITE:
+        add_op(c, OP_WRITE, &c->write_args, &c->write_res);
+        c->write_args.stateid = &c->stateid;
+        c->write_args.offset = 65536;
+        c->write_args.stable = UNSTABLE4;
+        c->write_args.data_len = CORPUS_IO_SIZE;
+        c->write_args.data = c->data;
+        c->write_res.resok4.verf = &c->verf;
+        break;
+    case CORPUS_READDIR:
+        add_op(c, OP_READDIR, &c->readdir_args, &c->readdir_res);
+        c->attr_request.arr[0] |= FATTR4_WORD0_RDATTR_ERROR;
+        c->readdir_args.cookie.cookie = 0;
+        memset(c->readdir_args.cookie.verf, 0, NFS4_VERIFIER_SIZE);
+        c->readdir_args.dircount = CORPUS_DIR_SIZE;
+        c->readdir_args.maxcount = CORPUS_DIR_SIZE +
+            sizeof(nfs41_readdir_res);
+        c->readdir_args.attr_request = &c->attr_request;
+        c->readdir_res.reply.entries_len = CORPUS_DIR_SIZE;
+        c->readdir_res.reply.entries = c->entries;
+        break;
+    case CORPUS_LOOKUP:
+        c->name.name = "component";
+        c->name.len = (unsigned short)strlen(c->name.name);
+        add_op(c, OP_LOOKUP, &c->lookup_args, &c->lookup_res);
+        c->lookup_args.name = &c->name;
+        add_op(c, OP_GETFH, NULL, &c->getfh_res);
+        c->getfh_res.fh = &c->fh;
+        add_op(c, OP_GETATTR, &c->getattr_args, &c->getattr_res);
+        c->attr_request.arr[1] |= FATTR4_WORD1_OWNER |
+            FATTR4_WORD1_OWNER_GROUP;
+        c->info.owner = c->owner;
+        c->info.owner_group = c->owner_group;
+        break;
+    case CORPUS_FS_LOCATIONS:
+        add_op(c, OP_GETATTR, &c->getattr_args, &c->getattr_res);
+        c->attr_request.count = 1;
+        c->attr_request.arr[0] = FATTR4_WORD0_FS_LOCATIONS;
+        c->attr_request.arr[1] = 0;
+        memset(&c->fs_locations, 0, sizeof(c->fs_locations));
+        c->info.fs_locations = &c->fs_locations;
+        break;
+    default:
+        break;
+    }
+}
+
+void corpus_compound_free(
+    IN struct corpus_compound *c)
+{
+    fs_locations4 *locations = c->info.fs_locations;
+    uint32_t i;
+
+    if (locations == NULL)
+        return;
+    for (i = 0; i < locations->location_count; i++)
+        free(locations->locations[i].servers);
+    free(locations->locations);
+    locations->locations = NULL;
+    locations->location_count = 0;
+}
+
+
+/* reply synthesis */
+struct writer {
+    XDR                     xdr;
+    bool_t                  ok;
+};
+
+static void put32(
+    IN OUT struct writer *w,
+    IN uint32_t value)
+{
+    if (w->ok && !xdr_u_int32_t(&w->xdr, &value))
+        w->ok = FALSE;
+}
+
+static void put64(
+    IN OUT struct writer *w,
+    IN uint64_t value)
+{
+    if (w->ok && !xdr_u_hyper(&w->xdr, &value))
+        w->ok = FALSE;
+}
+
+static void put_fixed(
+    IN OUT struct writer *w,
+    IN const void *data,
+    IN u_int length)
+{
+    if (w->ok && !xdr_opaque(&w->xdr, (char*)data, length))
+        w->ok = FALSE;
+}
+
+static void put_opaque(
+    IN OUT struct writer *w,
+    IN const void *data,
+    IN u_int length)
+{
+    put32(w, length);
+    put_fixed(w, data, length);
+}
+
+static void put_string(
+    IN OUT struct writer *w,
+    IN const char *str)
+{
+    put_opaque(w, str, (u_int)strlen(str));
+}
+
+static void put_bitmap(
+    IN OUT struct writer *w,
+    IN const bitmap4 *bitmap)
+{
+    uint32_t i;
+    put32(w, bitmap->count);
+    for (i = 0; i < bitmap->count; i++)
+        put32(w, bitmap->arr[i]);
+}
+
+static void put_time(
+    IN OUT struct writer *w,
+    IN uint64_t seconds)
+{
+    put64(w, seconds);
+    put32(w, 123456789);
+}
+
+/* pathname4 of the components in 'path', separated by '/' */
+static void put_pathname(
+    IN OUT struct writer *w,
+    IN const char *path)
+{
+    const char *pos, *next;
+    uint32_t count = 0;
+
+    for (pos = path; *pos; pos++)
+        if (*pos == '/')
+            count++;
+    put32(w, count + 1);
+    for (pos = path; ; pos = next + 1) {
+        next = strchr(pos, '/');
+        put_opaque(w, pos, (u_int)(next ? next - pos : strlen(pos)));
+        if (next == NULL)
+            break;
+    }
+}
+
+static void put_fs_locations(
+    IN OUT struct writer *w)
+{
+    put_pathname(w, "export/referral");
+    put32(w, 2); /* locations */
+    put32(w, 2); /* servers */
+    put_string(w, "server1.example.com");
+    put_string(w, "192.0.2.1");
+    put_pathname(w, "exports/home");
+    put32(w, 1);
+    put_string(w, "server2.example.com");
+    put_pathname(w, "exports/replica/home");
+}
+
+/* values for each attribute in the bitmap, in order.  'seed' varies them
+ * between readdir entries */
+static void put_attr_vals(
+    IN OUT struct writer *w,
+    IN const bitmap4 *attrs,
+    IN uint32_t seed)
+{
+    uint32_t i, bit, attr;
+
+    for (i = 0; i < attrs->count; i++) {
+        for (bit = 0; bit < 32; bit++) {
+            if ((attrs->arr[i] & (1u << bit)) == 0)
+                continue;
+            attr = i * 32 + bit;
+            switch (attr) {
+            case 1: /* type */
+                put32(w, seed % 5 ? NF4REG : NF4DIR);
+                break;
+            case 3: /* change */
+                put64(w, 0x5f0000000000ULL + seed);
+                break;
+            case 4: /* size */
+                put64(w, 4096ULL * seed + 17);
+                break;
+            case 8: /* fsid */
+                put64(w, 0x1234);
+                put64(w, 0x5678);
+                break;
+            case 11: /* rdattr_error */
+                put32(w, NFS4_OK);
+                break;
+            case 14: /* archive */
+            case 25: /* hidden */
+            case 46: /* system */
+                put32(w, seed & 1);
+                break;
+            case 20: /* fileid */
+                put64(w, 1000000ULL + seed);
+                break;
+            case 24: /* fs_locations */
+                put_fs_locations(w);
+                break;
+            case 33: /* mode */
+                put32(w, 0644);
+                break;
+            case 35: /* numlinks */
+                put32(w, 1);
+                break;
+            case 36: /* owner */
+                put_string(w, "user@example.com");
+                break;
+            case 37: /* owner_group */
+                put_string(w, "staff@example.com");
+                break;
+            case 47: /* time_access */
+            case 50: /* time_create */
+            case 53: /* time_modify */
+                put_time(w, 1300000000ULL + seed);
+                break;
+            default:
+                w->ok = FALSE; /* not in the corpus */
+                break;
+            }
+        }
+    }
+}
+
+static void put_fattr(
+    IN OUT struct writer *w,
+    IN const bitmap4 *attrs,
+    IN uint32_t seed)
+{
+    struct writer vals;
+    char buffer[NFS4_OPAQUE_LIMIT];
+
+    xdrmem_create(&vals.xdr, buffer, sizeof(buffer), XDR_ENCODE);
+    vals.ok = TRUE;
+    put_attr_vals(&vals, attrs, seed);
+    if (!vals.ok)
+        w->ok = FALSE;
+
+    put_bitmap(w, attrs);
+    put_opaque(w, buffer, xdr_getpos(&vals.xdr));
+}
+
+static void put_sequence(
+    IN OUT struct writer *w,
+    IN const struct corpus_compound *c)
+{
+    put32(w, OP_SEQUENCE);
+    put32(w, NFS4_OK);
+    put_fixed(w, c->sessionid, NFS4_SESSIONID_SIZE);
+    put32(w, c->sequence_args.sa_sequenceid);
+    put32(w, c->sequence_args.sa_slotid);
+    put32(w, c->sequence_args.sa_highest_slotid);
+    put32(w, c->sequence_args.sa_highest_slotid);
+    put32(w, 0); /* status flags */
+}
+
+static void put_readdir(
+    IN OUT struct writer *w,
+    IN const struct corpus_compound *c)
+{
+    unsigned char verf[NFS4_VERIFIER_SIZE];
+    char name[32];
+    uint32_t i;
+
+    fill(verf, NFS4_VERIFIER_SIZE, 0xc0);
+    put_fixed(w, verf, NFS4_VERIFIER_SIZE);
+    put32(w, TRUE); /* has entries */
+    for (i = 0; i < CORPUS_DIR_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "entry-%02u.dat", i);
+        put64(w, i + 3); /* cookie */
+        put_string(w, name);
+        put_fattr(w, &c->attr_request, i);
+        put32(w, i + 1 < CORPUS_DIR_ENTRIES); /* has next */
+    }
+    put32(w, TRUE); /* eof */
+}
+
+/* writes the results of all of the compound's operations, or only its last */
+static u_int write_reply(
+    IN enum corpus_shape shape,
+    IN bool_t last_only,
+    OUT char *buffer,
+    IN u_int length)
+{
+    struct corpus_compound *c;
+    struct writer w;
+    unsigned char verf[NFS4_VERIFIER_SIZE];
+    uint32_t i, first;
+
+    c = calloc(1, sizeof(struct corpus_compound));
+    if (c == NULL)
+        return 0;
+    corpus_compound_init(c, shape);
+
+    xdrmem_create(&w.xdr, buffer, length, XDR_ENCODE);
+    w.ok = TRUE;
+
+    first = last_only ? c->compound.args.argarray_count - 1 : 0;
+    put32(&w, NFS4_OK);
+    put_opaque(&w, c->compound.args.tag, c->compound.args.tag_len);
+    put32(&w, c->compound.args.argarray_count - first);
+
+    for (i = first; i < c->compound.args.argarray_count; i++) {
+        if (c->argops[i].op == OP_SEQUENCE) {
+            put_sequence(&w, c);
+            continue;
+        }
+        put32(&w, c->argops[i].op);
+        put32(&w, NFS4_OK);
+        switch (c->argops[i].op) {
+        case OP_PUTFH:
+        case OP_LOOKUP:
+            break;
+        case OP_GETFH:
+            put_opaque(&w, c->fh.fh, c->fh.len);
+            break;
+        case OP_GETATTR:
+            put_fattr(&w, &c->attr_request, 7);
+            break;
+        case OP_READ:
+            put32(&w, FALSE); /* eof */
+            fill(c->data, CORPUS_IO_SIZE, 0x0d);
+            put_opaque(&w, c->data, CORPUS_IO_SIZE);
+            break;
+        case OP_WRITE:
+            put32(&w, CORPUS_IO_SIZE);
+            put32(&w, UNSTABLE4);
+            fill(verf, NFS4_VERIFIER_SIZE, 0xee);
+            put_fixed(&w, verf, NFS4_VERIFIER_SIZE);
+            break;
+        case OP_READDIR:
+            put_readdir(&w, c);
+            break;
+        default:
+            w.ok = FALSE;
+            break;
+        }
+    }
+
+    free(c);
+    return w.ok ? xdr_getpos(&w.xdr) : 0;
+}
+
+u_int corpus_reply(
+    IN enum corpus_shape shape,
+    OUT char *buffer,
+    IN u_int length)
+{
+    return write_reply(shape, FALSE, buffer, length);
+}
+
+u_int corpus_last_reply(
+    IN enum corpus_shape shape,
+    OUT char *buffer,
+    IN u_int length)
+{
+    return write_reply(shape, TRUE, buffer, length);
+}
+
+
+/* CB_COMPOUND */
+static const char *cb_shape_names[] = {
+    "cb_recall", "cb_layoutrecall", "cb_getattr"
+};
+
+const char* corpus_cb_name(
+    IN enum corpus_cb_shape shape)
+{
+    return shape < CORPUS_CB_SHAPES ? cb_shape_names[shape] : "unknown";
+}
+
+u_int corpus_cb_args(
+    IN enum corpus_cb_shape shape,
+    OUT char *buffer,
+    IN u_int length)
+{
+    struct cb_compound_args args;
+    struct cb_argop argops[2];
+    struct cb_sequence_ref_list ref_list;
+    struct cb_sequence_ref refs[2];
+    nfs41_fh *fh;
+    XDR xdr;
+
+    memset(&args, 0, sizeof(args));
+    memset(argops, 0, sizeof(argops));
+    strcpy(args.tag.str, "cb corpus");
+    args.tag.len = (uint32_t)strlen(args.tag.str);
+    args.minorversion = 1;
+    args.argarray = argops;
+    args.argarray_count = 2;
+
+    /* CB_SEQUENCE with a referring call list */
+    argops[0].opnum = OP_CB_SEQUENCE;
+    fill((unsigned char*)argops[0].args.sequence.sessionid,
+        NFS4_SESSIONID_SIZE, 0x51);
+    argops[0].args.sequence.sequenceid = 77;
+    argops[0].args.sequence.slotid = 0;
+    argops[0].args.sequence.highest_slotid = 0;
+    argops[0].args.sequence.cachethis = FALSE;
+    fill((unsigned char*)ref_list.sessionid, NFS4_SESSIONID_SIZE, 0x51);
+    refs[0].sequenceid = 1234;
+    refs[0].slotid = 3;
+    refs[1].sequenceid = 99;
+    refs[1].slotid = 5;
+    ref_list.calls = refs;
+    ref_list.call_count = 2;
+    argops[0].args.sequence.ref_lists = &ref_list;
+    argops[0].args.sequence.ref_list_count = 1;
+
+    switch (shape) {
+    case CORPUS_CB_RECALL:
+        argops[1].opnum = OP_CB_RECALL;
+        argops[1].args.recall.stateid.seqid = 2;
+        fill(argops[1].args.recall.stateid.other, NFS4_STATEID_OTHER, 0x5d);
+        argops[1].args.recall.truncate = FALSE;
+        fh = &argops[1].args.recall.fh;
+        break;
+    case CORPUS_CB_LAYOUTRECALL:
+        argops[1].opnum = OP_CB_LAYOUTRECALL;
+        argops[1].args.layoutrecall.type = PNFS_LAYOUTTYPE_FILE;
+        argops[1].args.layoutrecall.iomode = PNFS_IOMODE_ANY;
+        argops[1].args.layoutrecall.changed = TRUE;
+        argops[1].args.layoutrecall.recall.type = PNFS_RETURN_FILE;
+        argops[1].args.layoutrecall.recall.args.file.offset = 0;
+        argops[1].args.layoutrecall.recall.args.file.length = ~0ULL;
+        argops[1].args.layoutrecall.recall.args.file.stateid.seqid = 3;
+        fill(argops[1].args.layoutrecall.recall.args.file.stateid.other,
+            NFS4_STATEID_OTHER, 0x1a);
+        fh = &argops[1].args.layoutrecall.recall.args.file.fh;
+        break;
+    case CORPUS_CB_GETATTR:
+        argops[1].opnum = OP_CB_GETATTR;
+        argops[1].args.getattr.attr_request.count = 1;
+        argops[1].args.getattr.attr_request.arr[0] =
+            FATTR4_WORD0_CHANGE | FATTR4_WORD0_SIZE;
+        fh = &argops[1].args.getattr.fh;
+        break;
+    default:
+        return 0;
+    }
+    fh->len = 28;
+    fill(fh->fh, fh->len, 0xf4);
+
+    xdrmem_create(&xdr, buffer, length, XDR_ENCODE);
+    if (!proc_cb_compound_args(&xdr, &args))
+        return 0;
+    return xdr_getpos(&xdr);
+}
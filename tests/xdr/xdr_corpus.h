@@ -0,0 +1,133 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+#ifndef __NFS41_TEST_XDR_CORPUS_H__
+#define __NFS41_TEST_XDR_CORPUS_H__
+
+#include "nfs41_compound.h"
+#include "nfs41_ops.h"
+#include "nfs41_xdr.h"
+#include "nfs41_callback.h"
+
+
+/* compounds in the shapes the daemon sends most, with replies
+ * synthesized from the protocol, for the benchmark and the fuzzer */
+enum corpus_shape {
+    CORPUS_GETATTR,         /* SEQUENCE, PUTFH, GETATTR */
+    CORPUS_READ,            /* SEQUENCE, PUTFH, READ */
+    CORPUS_WRITE,           /* SEQUENCE, PUTFH, WRITE */
+    CORPUS_READDIR,         /* SEQUENCE, PUTFH, READDIR */
+    CORPUS_LOOKUP,          /* SEQUENCE, PUTFH, LOOKUP, GETFH, GETATTR */
+    CORPUS_FS_LOCATIONS,    /* SEQUENCE, PUTFH, GETATTR(fs_locations) */
+    CORPUS_SHAPES
+};
+
+#define CORPUS_MAX_OPS      5
+#define CORPUS_IO_SIZE      4096    /* READ and WRITE payload */
+#define CORPUS_DIR_SIZE     16384   /* READDIR entry buffer */
+#define CORPUS_DIR_ENTRIES  24
+
+/* the arguments and results of one compound, set up the way the
+ * functions in nfs41_ops.c do it */
+struct corpus_compound {
+    nfs41_compound          compound;
+    nfs_argop4              argops[CORPUS_MAX_OPS];
+    nfs_resop4              resops[CORPUS_MAX_OPS];
+    nfs41_sequence_args     sequence_args;
+    nfs41_sequence_res      sequence_res;
+    nfs41_putfh_args        putfh_args;
+    nfs41_putfh_res         putfh_res;
+    nfs41_getattr_args      getattr_args;
+    nfs41_getattr_res       getattr_res;
+    nfs41_read_args         read_args;
+    nfs41_read_res          read_res;
+    nfs41_write_args        write_args;
+    nfs41_write_res         write_res;
+    nfs41_write_verf        verf;
+    nfs41_readdir_args      readdir_args;
+    nfs41_readdir_res       readdir_res;
+    nfs41_lookup_args       lookup_args;
+    nfs41_lookup_res        lookup_res;
+    nfs41_getfh_res         getfh_res;
+    nfs41_component         name;
+    nfs41_path_fh           file;
+    nfs41_fh                fh;
+    stateid_arg             stateid;
+    bitmap4                 attr_request;
+    nfs41_file_info         info;
+    fs_locations4           fs_locations;
+    char                    owner[NFS4_OPAQUE_LIMIT+1];
+    char                    owner_group[NFS4_OPAQUE_LIMIT+1];
+    unsigned char           sessionid[NFS4_SESSIONID_SIZE];
+    unsigned char           data[CORPUS_IO_SIZE];
+    unsigned char           entries[CORPUS_DIR_SIZE];
+};
+
+const char* corpus_name(
+    IN enum corpus_shape shape);
+
+/* fills in the arguments, and readies the results for decoding */
+void corpus_compound_init(
+    OUT struct corpus_compound *c,
+    IN enum corpus_shape shape);
+
+/* frees anything the decoder allocated */
+void corpus_compound_free(
+    IN struct corpus_compound *c);
+
+/* writes a successful COMPOUND4res for the shape into 'buffer'.
+ * returns its length, or 0 if it doesn't fit */
+u_int corpus_reply(
+    IN enum corpus_shape shape,
+    OUT char *buffer,
+    IN u_int length);
+
+/* writes a COMPOUND4res with only the result of the shape's last
+ * operation, to time its decoding on its own */
+u_int corpus_last_reply(
+    IN enum corpus_shape shape,
+    OUT char *buffer,
+    IN u_int length);
+
+
+/* CB_COMPOUND requests from the server, in the shapes we see */
+enum corpus_cb_shape {
+    CORPUS_CB_RECALL,       /* CB_SEQUENCE, CB_RECALL */
+    CORPUS_CB_LAYOUTRECALL, /* CB_SEQUENCE, CB_LAYOUTRECALL */
+    CORPUS_CB_GETATTR,      /* CB_SEQUENCE, CB_GETATTR */
+    CORPUS_CB_SHAPES
+};
+
+const char* corpus_cb_name(
+    IN enum corpus_cb_shape shape);
+
+/* writes the CB_COMPOUND4args for the shape into 'buffer'.
+ * returns its length, or 0 if it doesn't fit */
+u_int corpus_cb_args(
+    IN enum corpus_cb_shape shape,
+    OUT char *buffer,
+    IN u_int length);
+
+
+/* debug output from the xdr layer, off by default */
+extern int xdr_test_verbose;
+
+#endif /* !__NFS41_TEST_XDR_CORPUS_H__ */
@@ -0,0 +1,366 @@
+/* NFSv4.1 client for Windows
+ * Copyright  2012 The Regents of the University of Michigan
+ *
+ * Olga Kornievskaia <aglo@umich.edu>
+ * Casey Bodley <cbodley@umich.edu>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * without any warranty; without even the implied warranty of merchantability
+ * or fitness for a particular purpose.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ */
+
+/* feeds mutations of the corpus replies to nfs_decode_compound(), and of
+ * the CB_COMPOUND requests to proc_cb_compound_args().  each input is
+ * copied into a heap buffer of exactly its size, and the buffers that the
+ * decoders fill are allocated at exactly the size the daemon gives them,
+ * so under -fsanitize=address any access past the end aborts.
+ * usage: xdr_fuzz [iterations per shape] [seed]
+ * set XDR_VERBOSE to a debug level to see why the decoders fail */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdr_corpus.h"
+
+
+#define MAX_MESSAGE       65536
+#define MAX_GROWTH      256 /* bytes that mutate() may add */
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+            __FILE__, __LINE__, #cond); \
+        failures++; \
+    } } while (0)
+
+
+/* xorshift64* */
+static uint64_t rng_state;
+
+static uint32_t rng()
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* words that tend to find bounds bugs in length and count fields */
+static const uint32_t interesting[] = {
+    0, 1, 2, 3, 4, 7, 8, 16, 31, 32, 33, 63, 64, 65, 127, 128, 255, 256,
+    1023, 1024, 1025, 4095, 4096, 4097, 65535, 65536, 0x7ffffffe,
+    0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff,
+    NFS4_FHSIZE + 1, NFS4_OPAQUE_LIMIT + 1, NFS41_MAX_PATH_LEN,
+    NFS41_MAX_PATH_LEN + 1, NFS41_HOSTNAME_LEN + 1, CORPUS_IO_SIZE + 4
+};
+
+static void put_word(
+    IN unsigned char *pos,
+    IN uint32_t value)
+{
+    pos[0] = (unsigned char)(value >> 24);
+    pos[1] = (unsigned char)(value >> 16);
+    pos[2] = (unsigned char)(value >> 8);
+    pos[3] = (unsigned char)value;
+}
+
+static uint32_t get_word(
+    IN const unsigned char *pos)
+{
+    return ((uint32_t)pos[0] << 24) | ((uint32_t)pos[1] << 16) |
+        ((uint32_t)pos[2] << 8) | pos[3];
+}
+
+/* applies one to four random mutations in place, and returns the new
+ * length.  the buffer has room for MAX_GROWTH more bytes */
+static u_int mutate(
+    IN OUT unsigned char *buffer,
+    IN u_int length)
+{
+    const u_int limit = length + MAX_GROWTH;
+    uint32_t count = 1 + rng() % 4;
+    u_int words, pos, len, i;
+
+    while (count--) {
+        words = length / 4;
+        switch (rng() % 7) {
+        case 0: /* flip a bit */
+            if (length)
+                buffer[rng() % length] ^= (unsigned char)(1 << (rng() % 8));
+            break;
+        case 1: /* random byte */
+            if (length)
+                buffer[rng() % length] = (unsigned char)rng();
+            break;
+        case 2: /* an interesting word, most likely over a length or count */
+        case 3:
+            if (words)
+                put_word(buffer + 4 * (rng() % words),
+                    interesting[rng() % ARRAYSIZE(interesting)]);
+            break;
+        case 4: /* nudge a word */
+            if (words) {
+                pos = 4 * (rng() % words);
+                put_word(buffer + pos, get_word(buffer + pos) +
+                    rng() % 17 - 8);
+            }
+            break;
+        case 5: /* truncate */
+            if (length)
+                length = rng() % length;
+            break;
+        case 6: /* insert or remove words */
+            if (words == 0)
+                break;
+            pos = 4 * (rng() % words);
+            len = 4 * (1 + rng() % 8);
+            if (rng() & 1) {
+                if (length + len > limit)
+                    break;
+                memmove(buffer + pos + len, buffer + pos, length - pos);
+                for (i = 0; i < len; i += 4)
+                    put_word(buffer + pos + i, rng());
+                length += len;
+            } else if (pos + len <= length) {
+                memmove(buffer + pos, buffer + pos + len, length - pos - len);
+                length -= len;
+            }
+            break;
+        }
+    }
+    return length;
+}
+
+
+/* COMPOUND replies */
+static void check_readdir(
+    IN const nfs41_readdir_list *list,
+    IN bool_t expect_ok)
+{
+    const nfs41_readdir_entry *entry;
+    uint32_t offset = 0, count = 0;
+
+    CHECK(list->entries_len <= CORPUS_DIR_SIZE);
+    if (list->entries_len == 0 || list->entries_len > CORPUS_DIR_SIZE)
+        return;
+
+    for (;;) {
+        entry = (const nfs41_readdir_entry*)(list->entries + offset);
+        CHECK(offset + FIELD_OFFSET(nfs41_readdir_entry, name) +
+            entry->name_len <= list->entries_len);
+        count++;
+        if (entry->next_entry_offset == 0)
+            break;
+        offset += entry->next_entry_offset;
+        if (offset >= list->entries_len) {
+            CHECK(!"next_entry_offset past the end of the entries");
+            break;
+        }
+    }
+    if (expect_ok)
+        CHECK(count == CORPUS_DIR_ENTRIES);
+}
+
+static void check_path(
+    IN const nfs41_abs_path *path)
+{
+    CHECK(path->len <= NFS41_MAX_PATH_LEN);
+}
+
+static void decode_reply(
+    IN enum corpus_shape shape,
+    IN const unsigned char *input,
+    IN u_int length,
+    IN bool_t expect_ok)
+{
+    struct corpus_compound *c;
+    unsigned char *copy, *data, *entries;
+    char *owner, *owner_group;
+    fs_locations4 *locations;
+    uint32_t i;
+    bool_t ok;
+    XDR xdr;
+
+    c = malloc(sizeof(struct corpus_compound));
+    copy = malloc(length ? length : 1);
+    data = malloc(CORPUS_IO_SIZE);
+    entries = malloc(CORPUS_DIR_SIZE);
+    owner = malloc(NFS4_OPAQUE_LIMIT + 1);
+    owner_group = malloc(NFS4_OPAQUE_LIMIT + 1);
+    locations = calloc(1, sizeof(fs_locations4));
+    if (!c || !copy || !data || !entries || !owner || !owner_group ||
+            !locations) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(copy, input, length);
+
+    /* point the results at buffers of their own */
+    corpus_compound_init(c, shape);
+    c->read_res.resok4.data = data;
+    c->readdir_res.reply.entries = entries;
+    if (c->info.owner) {
+        c->info.owner = owner;
+        c->info.owner_group = owner_group;
+    }
+    if (c->info.fs_locations)
+        c->info.fs_locations = locations;
+
+    xdrmem_create(&xdr, (char*)copy, length, XDR_DECODE);
+    ok = nfs_decode_compound(&xdr, (caddr_t*)&c->compound.res);
+    CHECK(xdr_getpos(&xdr) <= length);
+    if (expect_ok)
+        CHECK(ok && c->compound.res.status == NFS4_OK);
+
+    if (ok && c->compound.res.status == NFS4_OK) {
+        CHECK(c->compound.res.tag_len <= NFS4_OPAQUE_LIMIT);
+        switch (shape) {
+        case CORPUS_READ:
+            if (c->read_res.status != NFS4_OK)
+                break;
+            CHECK(c->read_res.resok4.data_len <= CORPUS_IO_SIZE);
+            if (expect_ok)
+                CHECK(c->read_res.resok4.data_len == CORPUS_IO_SIZE);
+            break;
+        case CORPUS_READDIR:
+            if (c->readdir_res.status == NFS4_OK)
+                check_readdir(&c->readdir_res.reply, expect_ok);
+            break;
+        case CORPUS_LOOKUP:
+            if (c->getfh_res.status == NFS4_OK)
+                CHECK(c->fh.len <= NFS4_FHSIZE);
+            if (expect_ok)
+                CHECK(strcmp(owner, "user@example.com") == 0 &&
+                    strcmp(owner_group, "staff@example.com") == 0);
+            break;
+        case CORPUS_FS_LOCATIONS:
+            check_path(&locations->path);
+            for (i = 0; i < locations->location_count; i++)
+                check_path(&locations->locations[i].path);
+            if (expect_ok)
+                CHECK(locations->location_count == 2 &&
+                    locations->locations[1].server_count == 1 &&
+                    strcmp(locations->locations[1].servers[0].address,
+                        "server2.example.com") == 0);
+            break;
+        default:
+            break;
+        }
+    }
+
+    corpus_compound_free(c);
+    free(locations);
+    free(owner_group);
+    free(owner);
+    free(entries);
+    free(data);
+    free(copy);
+    free(c);
+}
+
+
+/* CB_COMPOUND requests */
+static void decode_cb(
+    IN const unsigned char *input,
+    IN u_int length,
+    IN bool_t expect_ok)
+{
+    struct cb_compound_args args;
+    unsigned char *copy;
+    bool_t ok;
+    XDR xdr;
+
+    copy = malloc(length ? length : 1);
+    if (copy == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(copy, input, length);
+
+    /* as handle_cb_compound() does */
+    memset(&args, 0, sizeof(args));
+    xdrmem_create(&xdr, (char*)copy, length, XDR_DECODE);
+    ok = proc_cb_compound_args(&xdr, &args);
+    CHECK(xdr_getpos(&xdr) <= length);
+    if (expect_ok)
+        CHECK(ok && args.argarray_count == 2);
+    if (ok)
+        CHECK(args.argarray_count <= CB_COMPOUND_MAX_OPERATIONS &&
+            args.tag.len <= CB_COMPOUND_MAX_TAG);
+
+    xdr.x_op = XDR_FREE;
+    proc_cb_compound_args(&xdr, &args);
+    free(copy);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static unsigned char seed[MAX_MESSAGE], input[MAX_MESSAGE + MAX_GROWTH];
+    uint32_t iterations = 20000, i;
+    u_int seed_len, length;
+    int shape;
+
+    if (argc > 1)
+        iterations = (uint32_t)strtoul(argv[1], NULL, 0);
+    rng_state = argc > 2 ? strtoull(argv[2], NULL, 0) : 0x4e465334;
+    if (rng_state == 0)
+        rng_state = 1;
+    if (getenv("XDR_VERBOSE"))
+        xdr_test_verbose = atoi(getenv("XDR_VERBOSE"));
+
+    for (shape = 0; shape < CORPUS_SHAPES; shape++) {
+        seed_len = corpus_reply(shape, (char*)seed, sizeof(seed));
+        CHECK(seed_len != 0);
+        if (seed_len == 0)
+            continue;
+
+        /* the unmodified reply has to decode, or we're not testing much */
+        decode_reply(shape, seed, seed_len, TRUE);
+
+        for (i = 0; i < iterations; i++) {
+            memcpy(input, seed, seed_len);
+            length = mutate(input, seed_len);
+            decode_reply(shape, input, length, FALSE);
+        }
+        printf("%-16s %6u bytes, %u mutations\n",
+            corpus_name(shape), seed_len, iterations);
+    }
+
+    for (shape = 0; shape < CORPUS_CB_SHAPES; shape++) {
+        seed_len = corpus_cb_args(shape, (char*)seed, sizeof(seed));
+        CHECK(seed_len != 0);
+        if (seed_len == 0)
+            continue;
+
+        decode_cb(seed, seed_len, TRUE);
+
+        for (i = 0; i < iterations; i++) {
+            memcpy(input, seed, seed_len);
+            length = mutate(input, seed_len);
+            decode_cb(input, length, FALSE);
+        }
+        printf("%-16s %6u bytes, %u mutations\n",
+            corpus_cb_name(shape), seed_len, iterations);
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("xdr fuzz passed\n");
+    return 0;
+}